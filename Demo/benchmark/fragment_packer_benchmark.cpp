@@ -0,0 +1,187 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+// Packs fragments of mixed sizes (like skin images and glyphs) into a TBBitmapFragmentMap
+// with each TB_FRAGMENT_PACKER, and prints the occupancy and the allocation time.
+//
+// Usage: TurboBadgerFragmentPackerBenchmark [map size] [alloc/free cycles]
+//
+// Each cycle frees a random half of the fragments and fills the map up again,
+// so the occupancy after many cycles shows how badly the packer fragments.
+// Finally the map is compacted and filled up again.
+
+#include "tb_bitmap_fragment.h"
+#include "tb_system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+using namespace tb;
+
+// There's no message loop, so there's no timer to reschedule.
+void TBSystem::RescheduleTimer(double /*fire_time*/) {}
+
+/** Give up filling the map after this many fragments in a row didn't fit. */
+static const int MAX_FAILS = 50;
+
+static uint32_t random_seed = 1;
+
+static int Random(int max)
+{
+	random_seed = random_seed * 1103515245 + 12345;
+	return (random_seed >> 8) % max;
+}
+
+/** Return a random fragment size. Mostly glyph sized, some icons, and a few large images. */
+static void RandomSize(int &w, int &h)
+{
+	const int type = Random(10);
+	if (type < 6)
+	{
+		w = 4 + Random(12);
+		h = 12 + Random(8);
+	}
+	else if (type < 9)
+	{
+		w = 8 + Random(40);
+		h = 8 + Random(40);
+	}
+	else
+	{
+		w = 32 + Random(96);
+		h = 32 + Random(96);
+	}
+}
+
+class PackerBenchmark
+{
+public:
+	PackerBenchmark(int map_size)
+		: m_map_size(map_size)
+		, m_data(new uint32_t[128 * 128]())
+		, m_alloc_time(std::chrono::duration<double, std::micro>::zero())
+		, m_num_allocs(0)
+	{
+	}
+	~PackerBenchmark()
+	{
+		for (int i = 0; i < m_frags.GetNumItems(); i++)
+			m_map.FreeFragmentSpace(m_frags[i]);
+		m_frags.DeleteAll();
+		delete [] m_data;
+	}
+	bool Init(TB_FRAGMENT_PACKER packer) { return m_map.Init(m_map_size, m_map_size, TB_BITMAP_FORMAT_RGBA32, packer); }
+
+	/** Create fragments until the map is full. */
+	void Fill()
+	{
+		int fails = 0;
+		while (fails < MAX_FAILS)
+		{
+			int w, h;
+			RandomSize(w, h);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			TBBitmapFragment *frag = m_map.CreateNewFragment(w, h, w, m_data, true);
+			m_alloc_time += std::chrono::steady_clock::now() - start;
+			m_num_allocs++;
+			if (frag && m_frags.Add(frag))
+				fails = 0;
+			else
+			{
+				if (frag)
+				{
+					m_map.FreeFragmentSpace(frag);
+					delete frag;
+				}
+				fails++;
+			}
+		}
+	}
+
+	/** Free a random half of the fragments. */
+	void FreeHalf()
+	{
+		for (int i = m_frags.GetNumItems() / 2; i > 0; i--)
+		{
+			const int index = Random(m_frags.GetNumItems());
+			TBBitmapFragment *frag = m_frags.Remove(index);
+			m_map.FreeFragmentSpace(frag);
+			delete frag;
+		}
+	}
+
+	double Compact()
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		m_map.Compact(m_frags);
+		std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+		return duration.count();
+	}
+
+	/** Return the percentage of the map covered by fragments. The allocated space
+		can be larger than the fragments, depending on the packer. */
+	int GetOccupancy() const
+	{
+		long long pixels = 0;
+		for (int i = 0; i < m_frags.GetNumItems(); i++)
+			pixels += m_frags[i]->Width() * m_frags[i]->Height();
+		return (int) (pixels * 100 / (m_map_size * m_map_size));
+	}
+
+	/** Return the average time per CreateNewFragment in microseconds, and reset it. */
+	double TakeAllocTime()
+	{
+		const double us = m_num_allocs ? m_alloc_time.count() / m_num_allocs : 0;
+		m_alloc_time = std::chrono::duration<double, std::micro>::zero();
+		m_num_allocs = 0;
+		return us;
+	}
+private:
+	int m_map_size;
+	uint32_t *m_data;
+	TBBitmapFragmentMap m_map;
+	TBListOf<TBBitmapFragment> m_frags;
+	std::chrono::duration<double, std::micro> m_alloc_time;
+	int m_num_allocs;
+};
+
+int main(int argc, char **argv)
+{
+	const int map_size = argc > 1 ? atoi(argv[1]) : 1024;
+	const int cycles = argc > 2 ? atoi(argv[2]) : 100;
+	const char *names[] = { "rows", "skyline" };
+
+	printf("%dx%d map, %d alloc/free cycles\n", map_size, map_size, cycles);
+	printf("packer    filled  us/alloc  churned  us/alloc  compacted  ms/compact\n");
+	for (int packer = TB_FRAGMENT_PACKER_ROWS; packer <= TB_FRAGMENT_PACKER_SKYLINE; packer++)
+	{
+		// Use the same sequence of sizes for each packer.
+		random_seed = 1;
+		PackerBenchmark benchmark(map_size);
+		if (!benchmark.Init((TB_FRAGMENT_PACKER) packer))
+			return 1;
+
+		benchmark.Fill();
+		const int filled = benchmark.GetOccupancy();
+		const double filled_us = benchmark.TakeAllocTime();
+
+		for (int i = 0; i < cycles; i++)
+		{
+			benchmark.FreeHalf();
+			benchmark.Fill();
+		}
+		const int churned = benchmark.GetOccupancy();
+		const double churned_us = benchmark.TakeAllocTime();
+
+		const double compact_ms = benchmark.Compact();
+		benchmark.Fill();
+		const int compacted = benchmark.GetOccupancy();
+
+		printf("%-8s  %5d%%  %8.2f  %6d%%  %8.2f  %8d%%  %10.2f\n", names[packer],
+			   filled, filled_us, churned, churned_us, compacted, compact_ms);
+	}
+	return 0;
+}
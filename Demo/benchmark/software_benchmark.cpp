@@ -0,0 +1,124 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+// Paints the demo01 test UI with TBRendererSoftwareTiled into memory, and prints
+// the frame time for different thread counts.
+//
+// Usage: TurboBadgerSoftwareBenchmark [ui resource file] [frames per thread count] [max threads]
+//
+// The thread count is doubled up to max threads, which defaults to the number of CPU cores.
+
+#include "tb_core.h"
+#include "tb_font_renderer.h"
+#include "tb_language.h"
+#include "tb_skin.h"
+#include "tb_system.h"
+#include "tb_widgets.h"
+#include "tb_widgets_reader.h"
+#include "tb_window.h"
+#include "renderers/tb_renderer_software_tiled.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+
+using namespace tb;
+
+// There's no message loop, so there's no timer to reschedule.
+void TBSystem::RescheduleTimer(double /*fire_time*/) {}
+
+static const int SCREEN_W = 1280;
+static const int SCREEN_H = 720;
+
+static bool InitResources()
+{
+	if (!g_tb_lng->Load("language/lng_en.tb.txt"))
+		return false;
+	if (!g_tb_skin->Load("default_skin/skin.tb.txt", "demo01/skin/skin.tb.txt"))
+		return false;
+#ifdef TB_FONT_RENDERER_TBBF
+	void register_tbbf_font_renderer();
+	register_tbbf_font_renderer();
+	g_font_manager->AddFontInfo("default_font/segoe_white_with_shadow.tb.txt", "Segoe");
+	TBFontDescription fd;
+	fd.SetID(TBIDC("Segoe"));
+	fd.SetSize(g_tb_skin->GetDimensionConverter()->DpToPx(14));
+	g_font_manager->SetDefaultFontDescription(fd);
+	g_font_manager->CreateFontFace(fd);
+#endif
+	return true;
+}
+
+/** Paint the given number of frames, and return the average time per frame in milliseconds. */
+static double PaintFrames(TBWidget *root, TBRendererSoftwareTiled *renderer, int frames)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++)
+	{
+		root->InvokeProcessStates();
+		root->InvokeProcess();
+		renderer->BeginPaint(SCREEN_W, SCREEN_H);
+		root->InvokePaint(TBWidget::PaintProps());
+		renderer->EndPaint();
+	}
+	std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+	return duration.count() / frames;
+}
+
+int main(int argc, char **argv)
+{
+	const char *ui_file = argc > 1 ? argv[1] : "demo01/ui_resources/test_ui.tb.txt";
+	const int frames = argc > 2 ? atoi(argv[2]) : 50;
+
+	uint32_t *framebuffer = new uint32_t[SCREEN_W * SCREEN_H];
+	TBRendererSoftwareTiled *renderer = new TBRendererSoftwareTiled;
+	renderer->SetFramebuffer(framebuffer, SCREEN_W, SCREEN_H, SCREEN_W);
+
+	tb_core_init(renderer);
+	if (!InitResources())
+	{
+		printf("Unable to load resources. Run from the directory with the staged resources.\n");
+		return 1;
+	}
+
+	{
+		TBWidget root;
+		root.SetRect(TBRect(0, 0, SCREEN_W, SCREEN_H));
+		root.SetSkinBg(TBIDC("background"));
+
+		TBWindow *window = new TBWindow;
+		root.AddChild(window);
+		if (!g_widgets_reader->LoadFile(window, ui_file))
+		{
+			printf("Unable to load %s\n", ui_file);
+			return 1;
+		}
+		window->SetRect(TBRect(40, 40, SCREEN_W - 80, SCREEN_H - 80));
+
+		printf("%dx%d, %d frames of %s\n", SCREEN_W, SCREEN_H, frames, ui_file);
+		printf("threads  ms/frame  speedup\n");
+
+		// Paint one frame first, so glyphs and skin bitmaps are created
+		// before measuring.
+		PaintFrames(&root, renderer, 1);
+
+		const int max_threads = argc > 3 ? atoi(argv[3]) : MAX((int) std::thread::hardware_concurrency(), 1);
+		double single_thread_ms = 0;
+		for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+		{
+			renderer->SetNumThreads(num_threads);
+			double ms = PaintFrames(&root, renderer, frames);
+			if (num_threads == 1)
+				single_thread_ms = ms;
+			printf("%7d  %8.2f  %6.2fx\n", num_threads, ms, single_thread_ms / ms);
+		}
+	}
+
+	tb_core_shutdown();
+	delete renderer;
+	delete [] framebuffer;
+	return 0;
+}
@@ -715,6 +715,7 @@ int fps = 0;
 uint32_t frame_counter_total = 0;
 uint32_t frame_counter = 0;
 double frame_counter_reset_time = 0;
+TBRect frame_counter_rect;
 
 const char *girl_names[] = {
 	"Maja", "Alice", "Julia", "Linnéa", "Wilma", "Ella", "Elsa", "Emma", "Alva", "Olivia", "Molly", "Ebba", "Klara", "Nellie", "Agnes",
@@ -800,15 +801,6 @@ void DemoApplication::RenderFrame()
 	// to inject code between BeginPaint/EndPaint.
 	// Application::RenderFrame();
 
-	// Render
-	g_renderer->BeginPaint(m_root.GetRect().w, m_root.GetRect().h);
-	m_root.InvokePaint(TBWidget::PaintProps());
-
-#if defined(TB_RUNTIME_DEBUG_INFO) && defined(TB_IMAGE)
-	// Enable to debug image manager fragments
-	//g_image_manager->Debug();
-#endif
-
 	frame_counter++;
 	frame_counter_total++;
 
@@ -821,7 +813,6 @@ void DemoApplication::RenderFrame()
 		frame_counter = 0;
 	}
 
-	// Draw FPS
 	TBWidgetValue *continuous_repaint_val = g_value_group.GetValue(TBIDC("continous-repaint"));
 	bool continuous_repaint = continuous_repaint_val ? !!continuous_repaint_val->GetInt() : 0;
 
@@ -830,12 +821,28 @@ void DemoApplication::RenderFrame()
 		str.SetFormatted("FPS: %d Frame %d", fps, frame_counter_total);
 	else
 		str.SetFormatted("Frame %d", frame_counter_total);
-	m_root.GetFont()->DrawString(5,
+
+	// The FPS text changes every frame, so make sure the area it has
+	// covered is repainted even if nothing else is.
+	TBFontFace *font = m_root.GetFont();
+	frame_counter_rect = frame_counter_rect.Union(TBRect(5,
 #ifdef TB_SYSTEM_IOS
-								 15+
+														 15+
 #endif
-								 5,
-								 TBColor(255, 255, 255), str.CStr());
+														 5,
+														 font->GetStringWidth(str.CStr()), font->GetHeight()));
+
+	// Render
+	g_renderer->BeginPaint(m_root.GetRect().w, m_root.GetRect().h);
+	PaintRoot(frame_counter_rect);
+
+#if defined(TB_RUNTIME_DEBUG_INFO) && defined(TB_IMAGE)
+	// Enable to debug image manager fragments
+	//g_image_manager->Debug();
+#endif
+
+	// Draw FPS
+	font->DrawString(frame_counter_rect.x, frame_counter_rect.y, TBColor(255, 255, 255), str.CStr());
 
 	g_renderer->EndPaint();
 
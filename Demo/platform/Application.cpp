@@ -36,7 +36,9 @@ bool AppRootWidget::OnEvent(const TBWidgetEvent & ev)
 App::App(int width, int height)
 	: m_backend(nullptr)
 	, m_root(this)
+	, m_frame(0)
 {
+	m_root.SetIsDamageRoot(true);
 	// Set initial size which suggest to the backend which size we want the window to be.
 	m_root.SetRect(TBRect(0, 0, width, height));
 }
@@ -79,10 +81,36 @@ void App::Process()
 void App::RenderFrame()
 {
 	g_renderer->BeginPaint(m_root.GetRect().w, m_root.GetRect().h);
-	m_root.InvokePaint(TBWidget::PaintProps());
+	PaintRoot();
 	g_renderer->EndPaint();
 
 	// If animations are running, reinvalidate immediately
 	if (TBAnimationManager::HasAnimationsRunning())
 		GetRoot()->Invalidate();
 }
+
+void App::PaintRoot(const TBRect &extra_damage)
+{
+	m_frame = (m_frame + 1) % MAX_BUFFER_AGE;
+	TBRegion &damage = m_frame_damage[m_frame];
+	m_root.TakeDamage(damage);
+	if (!extra_damage.IsEmpty())
+		damage.IncludeRect(extra_damage);
+
+	// The back buffer is missing the damage of all frames painted since it was
+	// painted, so include the damage of that many frames.
+	int buffer_age = m_backend ? m_backend->GetBufferAge() : 0;
+	if (buffer_age <= 0 || buffer_age > MAX_BUFFER_AGE)
+	{
+		m_root.InvokePaint(TBWidget::PaintProps());
+		return;
+	}
+	TBRegion paint_region;
+	for (int i = 0; i < buffer_age; i++)
+	{
+		const TBRegion &frame_damage = m_frame_damage[(m_frame + MAX_BUFFER_AGE - i) % MAX_BUFFER_AGE];
+		for (int j = 0; j < frame_damage.GetNumRects(); j++)
+			paint_region.IncludeRect(frame_damage.GetRect(j));
+	}
+	m_root.InvokePaint(TBWidget::PaintProps(), paint_region);
+}
@@ -39,6 +39,11 @@ public:
 	virtual ~AppBackend() {}
 	virtual void EventLoop() = 0;
 	virtual void OnAppEvent(const EVENT &ev) = 0;
+
+	/** Return how many frames old the content of the back buffer is, or 0 if
+		it's undefined. If it's known, App::PaintRoot only repaints what has
+		changed since then. */
+	virtual int GetBufferAge() { return 0; }
 };
 
 /** Application interface, for setting up the application using turbo badger. */
@@ -63,9 +68,24 @@ public:
 	virtual void ShutDown();
 	virtual void Process();
 	virtual void RenderFrame();
+
+	/** Paint the root widget. If the backend knows the age of the back buffer, only the
+		area invalidated since then is painted. extra_damage is repainted in this frame
+		too, f.ex for overlays painted on top of the root that change every frame. */
+	void PaintRoot(const tb::TBRect &extra_damage = tb::TBRect());
+
+	/** Get the area that changed in the last frame painted by PaintRoot. The backend
+		may present only this part of the frame. */
+	const tb::TBRegion &GetFrameDamage() const { return m_frame_damage[m_frame]; }
 protected:
+	/** The number of frames of damage to remember. Backends reporting an older
+		buffer age are always painted completely. */
+	enum { MAX_BUFFER_AGE = 3 };
+
 	AppBackend *m_backend;
 	AppRootWidget m_root;
+	tb::TBRegion m_frame_damage[MAX_BUFFER_AGE];
+	int m_frame;
 };
 
 /** Should return new instance of App. */
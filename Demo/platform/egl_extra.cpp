@@ -0,0 +1,91 @@
+#include "egl_extra.h"
+
+#ifdef TB_PRESENT_DAMAGE_EGL
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <string.h>
+
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+
+using namespace tb;
+
+typedef EGLBoolean (EGLAPIENTRYP SwapBuffersWithDamageProc)(EGLDisplay dpy, EGLSurface surface, const EGLint *rects, EGLint n_rects);
+
+static bool HasExtension(EGLDisplay display, const char *name)
+{
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	size_t len = strlen(name);
+	while (extensions && (extensions = strstr(extensions, name)))
+	{
+		if (extensions[len] == ' ' || extensions[len] == 0)
+			return true;
+		extensions += len;
+	}
+	return false;
+}
+
+int eglExtraGetBufferAge()
+{
+	EGLDisplay display = eglGetCurrentDisplay();
+	EGLSurface surface = eglGetCurrentSurface(EGL_DRAW);
+	if (display == EGL_NO_DISPLAY || surface == EGL_NO_SURFACE)
+		return 0;
+	static int has_buffer_age = -1;
+	if (has_buffer_age == -1)
+		has_buffer_age = HasExtension(display, "EGL_EXT_buffer_age");
+	EGLint age = 0;
+	if (!has_buffer_age || !eglQuerySurface(display, surface, EGL_BUFFER_AGE_EXT, &age))
+		return 0;
+	return age;
+}
+
+bool eglExtraSwapBuffersWithDamage(const TBRegion &damage, int surface_height)
+{
+	EGLDisplay display = eglGetCurrentDisplay();
+	EGLSurface surface = eglGetCurrentSurface(EGL_DRAW);
+	if (display == EGL_NO_DISPLAY || surface == EGL_NO_SURFACE)
+		return false;
+	static bool initialized = false;
+	static SwapBuffersWithDamageProc swap_buffers_with_damage = nullptr;
+	if (!initialized)
+	{
+		initialized = true;
+		if (HasExtension(display, "EGL_KHR_swap_buffers_with_damage"))
+			swap_buffers_with_damage = (SwapBuffersWithDamageProc) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+		else if (HasExtension(display, "EGL_EXT_swap_buffers_with_damage"))
+			swap_buffers_with_damage = (SwapBuffersWithDamageProc) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+	}
+	// No rects would mean the whole surface, so let the caller swap normally.
+	const int max_rects = 32;
+	if (!swap_buffers_with_damage || damage.IsEmpty() || damage.GetNumRects() > max_rects)
+		return false;
+
+	// EGL wants the rects with the origin at the bottom.
+	EGLint rects[max_rects * 4];
+	for (int i = 0; i < damage.GetNumRects(); i++)
+	{
+		const TBRect &rect = damage.GetRect(i);
+		rects[i * 4 + 0] = rect.x;
+		rects[i * 4 + 1] = surface_height - (rect.y + rect.h);
+		rects[i * 4 + 2] = rect.w;
+		rects[i * 4 + 3] = rect.h;
+	}
+	return swap_buffers_with_damage(display, surface, rects, damage.GetNumRects()) == EGL_TRUE;
+}
+
+#else // TB_PRESENT_DAMAGE_EGL
+
+int eglExtraGetBufferAge()
+{
+	return 0;
+}
+
+bool eglExtraSwapBuffersWithDamage(const tb::TBRegion & /*damage*/, int /*surface_height*/)
+{
+	return false;
+}
+
+#endif // TB_PRESENT_DAMAGE_EGL
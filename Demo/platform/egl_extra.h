@@ -0,0 +1,19 @@
+#ifndef EGL_EXTRA_H
+#define EGL_EXTRA_H
+
+#include "tb_geometry.h"
+
+// These use the EGL surface of the current context, if it was created through EGL
+// and the demo was built with TB_PRESENT_DAMAGE_EGL. Otherwise they do nothing.
+
+/** Return how many frames old the content of the back buffer is (See EGL_EXT_buffer_age),
+	or 0 if it's undefined or unknown. */
+int eglExtraGetBufferAge();
+
+/** Swap buffers, telling the compositor that only the rects in damage has changed since
+	the last frame (See EGL_KHR_swap_buffers_with_damage). damage is in window coordinates
+	with the origin at the top. Returns false if not supported, in which case the caller
+	must swap buffers the normal way. */
+bool eglExtraSwapBuffersWithDamage(const tb::TBRegion &damage, int surface_height);
+
+#endif // EGL_EXTRA_H
@@ -7,6 +7,7 @@
 #include <string.h>
 #include "tb_editfield.h"
 #include "tb_font_renderer.h"
+#include "egl_extra.h"
 
 #ifdef TB_SYSTEM_MACOSX
 #include <unistd.h>
@@ -331,7 +332,15 @@ static void window_refresh_callback(GLFWwindow *window)
 
 	backend->m_app->RenderFrame();
 
-	glfwSwapBuffers(window);
+	if (!eglExtraSwapBuffersWithDamage(backend->m_app->GetFrameDamage(), backend->GetHeight()))
+		glfwSwapBuffers(window);
+}
+
+static void window_expose_callback(GLFWwindow *window)
+{
+	// The window content was lost, so everything has to be repainted.
+	GetBackend(window)->GetRoot()->Invalidate();
+	window_refresh_callback(window);
 }
 
 static void window_size_callback(GLFWwindow *window, int w, int h)
@@ -384,7 +393,7 @@ bool AppBackendGLFW::Init(App *app)
 
 	// Set callback functions
 	glfwSetWindowSizeCallback(mainWindow, window_size_callback);
-	glfwSetWindowRefreshCallback(mainWindow, window_refresh_callback);
+	glfwSetWindowRefreshCallback(mainWindow, window_expose_callback);
 	glfwSetCursorPosCallback(mainWindow, cursor_position_callback);
     glfwSetMouseButtonCallback(mainWindow, mouse_button_callback);
     glfwSetScrollCallback(mainWindow, scroll_callback);
@@ -444,6 +453,11 @@ void AppBackendGLFW::EventLoop()
 #endif
 }
 
+int AppBackendGLFW::GetBufferAge()
+{
+	return eglExtraGetBufferAge();
+}
+
 void AppBackendGLFW::OnAppEvent(const EVENT &ev)
 {
 	switch (ev)
@@ -22,6 +22,7 @@ public:
 
 	virtual void EventLoop();
 	virtual void OnAppEvent(const EVENT &ev);
+	virtual int GetBufferAge();
 
 	TBWidget *GetRoot() const { return m_app->GetRoot(); }
 	int GetWidth() const { return m_app->GetWidth(); }
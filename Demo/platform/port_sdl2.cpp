@@ -18,6 +18,7 @@
 #include "renderers/tb_renderer_gl.h"
 #include "tb_font_renderer.h"
 #include "Application.h"
+#include "egl_extra.h"
 
 #ifdef TB_SYSTEM_MACOSX
 #include <unistd.h>
@@ -261,6 +262,11 @@ void AppBackendSDL2::EventLoop()
 
 #endif // __EMSCRIPTEN__
 
+int AppBackendSDL2::GetBufferAge()
+{
+	return eglExtraGetBufferAge();
+}
+
 void AppBackendSDL2::OnAppEvent(const EVENT &ev)
 {
 	switch (ev)
@@ -446,7 +452,9 @@ bool AppBackendSDL2::HandleSDLEvent(SDL_Event & event)
 			break;
 		case SDL_WINDOWEVENT_EXPOSED:
 			//SDL_Log("Window %d exposed", event.window.windowID);
-			OnAppEvent(EVENT_PAINT_REQUEST);
+			// The window content was lost, so everything has to be repainted.
+			if (m_app)
+				m_app->GetRoot()->Invalidate();
 			break;
 		case SDL_WINDOWEVENT_MOVED:
 			//SDL_Log("Window %d moved to %d,%d",
@@ -518,7 +526,8 @@ bool AppBackendSDL2::HandleSDLEvent(SDL_Event & event)
 			else
 			{
 				m_app->RenderFrame();
-				SDL_GL_SwapWindow(mainWindow);
+				if (!eglExtraSwapBuffersWithDamage(m_app->GetFrameDamage(), GetHeight()))
+					SDL_GL_SwapWindow(mainWindow);
 			}
 		}
 		break;
@@ -10,13 +10,16 @@
 #include "tb_system.h"
 #include "tb_tempbuffer.h"
 #include "tb_skin.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace tb {
 
 // == TBImageRep ========================================================================
 
 TBImageRep::TBImageRep(TBImageManager *image_manager, TBBitmapFragment *fragment, uint32_t hash_key)
-	: ref_count(0), hash_key(hash_key), image_manager(image_manager), fragment(fragment)
+	: ref_count(0), hash_key(hash_key), image_manager(image_manager), fragment(fragment), pending(false)
 {
 }
 
@@ -60,7 +63,12 @@ TBImage::~TBImage()
 
 bool TBImage::IsEmpty() const
 {
-	return m_image_rep && m_image_rep->fragment;
+	return !m_image_rep || !m_image_rep->fragment;
+}
+
+bool TBImage::IsPending() const
+{
+	return m_image_rep && m_image_rep->pending;
 }
 
 int TBImage::Width() const
@@ -96,17 +104,152 @@ void TBImage::SetImageRep(TBImageRep *image_rep)
 		m_image_rep->IncRef();
 }
 
+// == TBImageWorker =====================================================================
+
+/** The delay between checking for images loaded in the background. */
+#define IMAGE_WORKER_POLL_DELAY_MS 10
+
+/** TBImageJob is a image queued for loading in the background. */
+class TBImageJob : public TBLinkOf<TBImageJob>
+{
+public:
+	TBImageJob() : hash_key(0), dpi(0), loaded_index(-1), img(nullptr) {}
+	~TBImageJob() { delete img; }
+
+	/** Decode the first of the filenames that loads. */
+	void Load();
+
+	uint32_t hash_key;
+	TBStr filenames[2];		///< The destination DPI filename (if any) and the filename.
+	float dpi;
+	int loaded_index;		///< The index of the filename that was loaded, or -1.
+	TBImageLoader *img;
+};
+
+void TBImageJob::Load()
+{
+	for (int i = 0; i < 2 && !img; i++)
+	{
+		if (filenames[i].IsEmpty())
+			continue;
+		if ((img = TBImageLoader::CreateFromFile(filenames[i], dpi)))
+			loaded_index = i;
+	}
+}
+
+/** TBImageWorker is a thread decoding queued images for TBImageManager.
+	Only the decoding is done in the background (TBImageLoader::CreateFromFile
+	must be thread safe). The fragments are created by the manager. */
+class TBImageWorker
+{
+public:
+	TBImageWorker();
+	~TBImageWorker();
+
+	void Queue(TBImageJob *job);
+
+	/** Move the loaded jobs to the given list. If wait is true, wait until
+		all queued jobs are loaded first. */
+	void TakeLoaded(TBLinkListOf<TBImageJob> &jobs, bool wait);
+
+	/** Return true if there are jobs that are queued or loaded. */
+	bool HasJobs();
+private:
+	void WorkerMain();
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_queued_cond;
+	std::condition_variable m_loaded_cond;
+	TBLinkListAutoDeleteOf<TBImageJob> m_queued;
+	TBLinkListAutoDeleteOf<TBImageJob> m_loaded;
+	int m_num_loading;
+	bool m_quit;
+};
+
+TBImageWorker::TBImageWorker()
+	: m_num_loading(0)
+	, m_quit(false)
+{
+	m_thread = std::thread(&TBImageWorker::WorkerMain, this);
+}
+
+TBImageWorker::~TBImageWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_queued_cond.notify_one();
+	m_thread.join();
+}
+
+void TBImageWorker::Queue(TBImageJob *job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queued.AddLast(job);
+	}
+	m_queued_cond.notify_one();
+}
+
+void TBImageWorker::TakeLoaded(TBLinkListOf<TBImageJob> &jobs, bool wait)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (wait)
+		m_loaded_cond.wait(lock, [this] { return !m_queued.HasLinks() && !m_num_loading; });
+	while (TBImageJob *job = m_loaded.GetFirst())
+	{
+		m_loaded.Remove(job);
+		jobs.AddLast(job);
+	}
+}
+
+bool TBImageWorker::HasJobs()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_queued.HasLinks() || m_loaded.HasLinks() || m_num_loading;
+}
+
+void TBImageWorker::WorkerMain()
+{
+	while (true)
+	{
+		TBImageJob *job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_queued_cond.wait(lock, [this] { return m_quit || m_queued.HasLinks(); });
+			if (m_quit)
+				return;
+			job = m_queued.GetFirst();
+			m_queued.Remove(job);
+			m_num_loading++;
+		}
+
+		job->Load();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_loaded.AddLast(job);
+			m_num_loading--;
+		}
+		m_loaded_cond.notify_all();
+	}
+}
+
 // == TBImageManager ====================================================================
 
 TBImageManager *g_image_manager = nullptr;
 
 TBImageManager::TBImageManager()
+	: m_worker(nullptr)
 {
 	g_renderer->AddListener(this);
 }
 
 TBImageManager::~TBImageManager()
 {
+	// Stop loading before the reps are unset. Any loaded jobs are deleted with it.
+	delete m_worker;
 	g_renderer->RemoveListener(this);
 
 	// If there is TBImageRep objects live, we must unset the fragment pointer
@@ -116,39 +259,164 @@ TBImageManager::~TBImageManager()
 	{
 		image_rep->fragment = nullptr;
 		image_rep->image_manager = nullptr;
+		image_rep->pending = false;
 	}
 }
 
 TBImage TBImageManager::GetImage(const TBStr &filename)
 {
-	uint32_t hash_key = TBID(filename);
-	TBImageRep *image_rep = m_image_rep_hash.Get(hash_key);
-	if (!image_rep)
+	TBImage image;
+	GetImages(&filename, &image, 1);
+	return image;
+}
+
+void TBImageManager::GetImages(const TBStr *filenames, TBImage *images, int num_images)
+{
+	TBBitmapFragmentFile *files = new TBBitmapFragmentFile[num_images];
+	if (!files)
+		return;
+
+	// Load fragments for the images that aren't loaded already.
+	// Load a destination DPI bitmap if available.
+	const TBDimensionConverter *dim_conv = g_tb_skin->GetDimensionConverter();
+	const float dpi = (float) TBSystem::GetDPI();
+	TBTempBuffer filename_dst_DPI;
+	for (int i = 0; i < num_images; i++)
 	{
-		// Load a fragment. Load a destination DPI bitmap if available.
-		TBBitmapFragment *fragment = nullptr;
-		if (g_tb_skin->GetDimensionConverter()->NeedConversion())
+		files[i].dpi = dpi;
+		TBImageRep *image_rep = m_image_rep_hash.Get(TBID(filenames[i]));
+		if (image_rep && !image_rep->pending)
+			continue;
+		if (dim_conv->NeedConversion())
 		{
-			TBTempBuffer filename_dst_DPI;
-			g_tb_skin->GetDimensionConverter()->GetDstDPIFilename(filename, &filename_dst_DPI);
-			fragment = m_frag_manager.GetFragmentFromFile(filename_dst_DPI.GetData(), false, TBSystem::GetDPI());
+			dim_conv->GetDstDPIFilename(filenames[i], &filename_dst_DPI);
+			files[i].filename.Set(filename_dst_DPI.GetData());
 		}
-		if (!fragment)
-			fragment = m_frag_manager.GetFragmentFromFile(filename, false, TBSystem::GetDPI());
+		else
+			files[i].filename.Set(filenames[i]);
+	}
+	if (dim_conv->NeedConversion())
+	{
+		m_frag_manager.GetFragmentsFromFiles(files, num_images);
+		for (int i = 0; i < num_images; i++)
+			if (!files[i].fragment && !files[i].filename.IsEmpty())
+				files[i].filename.Set(filenames[i]);
+	}
+	m_frag_manager.GetFragmentsFromFiles(files, num_images);
 
-		image_rep = new TBImageRep(this, fragment, hash_key);
-		if (!image_rep || !fragment || !m_image_rep_hash.Add(hash_key, image_rep))
+	for (int i = 0; i < num_images; i++)
+	{
+		uint32_t hash_key = TBID(filenames[i]);
+		TBImageRep *image_rep = m_image_rep_hash.Get(hash_key);
+		if (image_rep && image_rep->pending)
 		{
-			delete image_rep;
-			m_frag_manager.FreeFragment(fragment);
-			image_rep = nullptr;
+			// It's no longer needed from the background, so it's ignored when it arrives.
+			image_rep->pending = false;
+			image_rep->fragment = files[i].fragment;
+			if (!image_rep->fragment)
+				TBDebugPrint("TBImageManager - Loading image failed: '%s'\n", (const char *)filenames[i]);
 		}
-		//TBDebugOut(image_rep ? "TBImageManager - Loaded new image.\n" : "TBImageManager - Loading image failed.\n");
-		if (!image_rep) {
-			TBDebugPrint("TBImageManager - Loading image failed: '%s'\n", (const char *)filename);
+		else if (!image_rep)
+		{
+			TBBitmapFragment *fragment = files[i].fragment;
+			image_rep = new TBImageRep(this, fragment, hash_key);
+			if (!image_rep || !fragment || !m_image_rep_hash.Add(hash_key, image_rep))
+			{
+				delete image_rep;
+				m_frag_manager.FreeFragment(fragment);
+				image_rep = nullptr;
+			}
+			//TBDebugOut(image_rep ? "TBImageManager - Loaded new image.\n" : "TBImageManager - Loading image failed.\n");
+			if (!image_rep) {
+				TBDebugPrint("TBImageManager - Loading image failed: '%s'\n", (const char *)filenames[i]);
+			}
 		}
+		images[i] = TBImage(image_rep);
+	}
+	delete [] files;
+}
+
+TBImage TBImageManager::GetImageAsync(const TBStr &filename)
+{
+#ifdef __EMSCRIPTEN__
+	// There are no threads to load on.
+	return GetImage(filename);
+#else
+	const uint32_t hash_key = TBID(filename);
+	if (TBImageRep *image_rep = m_image_rep_hash.Get(hash_key))
+		return TBImage(image_rep);
+
+	if (!m_worker && !(m_worker = new TBImageWorker))
+		return GetImage(filename);
+
+	TBImageJob *job = new TBImageJob;
+	TBImageRep *image_rep = job ? new TBImageRep(this, nullptr, hash_key) : nullptr;
+	if (!image_rep || !m_image_rep_hash.Add(hash_key, image_rep))
+	{
+		delete image_rep;
+		delete job;
+		return GetImage(filename);
+	}
+	image_rep->pending = true;
+
+	// Load a destination DPI bitmap if available.
+	const TBDimensionConverter *dim_conv = g_tb_skin->GetDimensionConverter();
+	if (dim_conv->NeedConversion())
+	{
+		TBTempBuffer filename_dst_DPI;
+		dim_conv->GetDstDPIFilename(filename, &filename_dst_DPI);
+		job->filenames[0].Set(filename_dst_DPI.GetData());
 	}
+	job->filenames[1].Set(filename);
+	job->hash_key = hash_key;
+	job->dpi = (float) TBSystem::GetDPI();
+	m_worker->Queue(job);
+	if (!GetMessageByID(TBIDC("images_loaded")))
+		PostMessageDelayed(TBIDC("images_loaded"), nullptr, IMAGE_WORKER_POLL_DELAY_MS);
 	return TBImage(image_rep);
+#endif // __EMSCRIPTEN__
+}
+
+void TBImageManager::ProcessLoadedImages(bool wait)
+{
+	if (!m_worker)
+		return;
+	TBLinkListAutoDeleteOf<TBImageJob> jobs;
+	m_worker->TakeLoaded(jobs, wait);
+	if (!jobs.HasLinks())
+		return;
+	for (TBImageJob *job = jobs.GetFirst(); job; job = job->GetNext())
+	{
+		// Skip it if the image was released, or loaded by GetImage meanwhile.
+		TBImageRep *image_rep = m_image_rep_hash.Get(job->hash_key);
+		if (!image_rep || !image_rep->pending)
+			continue;
+		image_rep->pending = false;
+		if (job->img)
+		{
+			const TBID id(job->filenames[job->loaded_index]);
+			image_rep->fragment = m_frag_manager.GetFragment(id);
+			if (!image_rep->fragment)
+				image_rep->fragment = m_frag_manager.CreateNewFragment(id, false, job->img->Width(), job->img->Height(),
+																	   job->img->Width(), job->img->Data());
+		}
+		if (!image_rep->fragment)
+			TBDebugPrint("TBImageManager - Loading image failed: '%s'\n", (const char *)job->filenames[1]);
+	}
+
+	TBLinkListOf<TBImageListener>::Iterator iter = m_listeners.IterateForward();
+	while (TBImageListener *listener = iter.GetAndStep())
+		listener->OnImagesLoaded();
+}
+
+void TBImageManager::OnMessageReceived(TBMessage *msg)
+{
+	if (msg->message == TBIDC("images_loaded"))
+	{
+		ProcessLoadedImages();
+		if (m_worker && m_worker->HasJobs())
+			PostMessageDelayed(TBIDC("images_loaded"), nullptr, IMAGE_WORKER_POLL_DELAY_MS);
+	}
 }
 
 void TBImageManager::RemoveImageRep(TBImageRep *image_rep)
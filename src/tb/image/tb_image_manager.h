@@ -14,10 +14,12 @@
 #include "tb_hashtable.h"
 #include "tb_bitmap_fragment.h"
 #include "tb_renderer.h"
+#include "tb_msg.h"
 
 namespace tb {
 
 class TBImageManager;
+class TBImageWorker;
 
 /** TBImageRep is the internal contents of a TBImage. Owned by reference counting from TBImage. */
 
@@ -35,6 +37,7 @@ class TBImageRep
 	uint32_t hash_key;
 	TBImageManager *image_manager;
 	TBBitmapFragment *fragment;
+	bool pending;		///< If it's being loaded in the background (See TBImageManager::GetImageAsync).
 };
 
 /** TBImage is a reference counting object representing a image loaded by TBImageManager.
@@ -54,6 +57,10 @@ public:
 	/** Return true if this image is empty. */
 	bool IsEmpty() const;
 
+	/** Return true if this image is being loaded in the background (See
+		TBImageManager::GetImageAsync). It's empty until it's loaded. */
+	bool IsPending() const;
+
 	/** Return the width of this image, or 0 if empty. */
 	int Width() const;
 
@@ -71,6 +78,17 @@ private:
 	TBImageRep *m_image_rep;
 };
 
+/** TBImageListener is notified when images that were loaded in the background are ready.
+	See TBImageManager::GetImageAsync. */
+class TBImageListener : public TBLinkOf<TBImageListener>
+{
+public:
+	virtual ~TBImageListener() {}
+
+	/** Called when images that were pending are loaded, or failed to load. */
+	virtual void OnImagesLoaded() = 0;
+};
+
 /** TBImageManager loads images returned as TBImage objects.
 
 	It internally use a TBBitmapFragmentManager that create fragment maps for loaded images,
@@ -79,7 +97,7 @@ private:
 	Images are forgotten when there are no longer any TBImage objects for a given file.
 */
 
-class TBImageManager : private TBRendererListener
+class TBImageManager : private TBRendererListener, private TBMessageHandler
 {
 public:
 	TBImageManager();
@@ -89,6 +107,26 @@ public:
 		If it fails, the returned TBImage object will be empty. */
 	TBImage GetImage(const TBStr &filename);
 
+	/** Get image objects for many files at once, like GetImage for each of them.
+		The files that aren't loaded yet are decoded in parallel, so this is faster
+		for preloading many images. images must have room for num_images. */
+	void GetImages(const TBStr *filenames, TBImage *images, int num_images);
+
+	/** Return a image object for the given filename without waiting for it to load.
+		If it's not loaded already, it's pending (See TBImage::IsPending) while it's
+		decoded on a background thread, and listeners are notified when it's ready
+		(from a message, so the message loop must run). If it fails, it's empty.
+		Calling GetImage for a pending image loads it right away. */
+	TBImage GetImageAsync(const TBStr &filename);
+
+	/** Create the images loaded in the background, and notify listeners if there were any.
+		This is done automatically when processing messages. If wait is true, wait until
+		all pending images are loaded first. */
+	void ProcessLoadedImages(bool wait = false);
+
+	void AddListener(TBImageListener *listener) { m_listeners.AddLast(listener); }
+	void RemoveListener(TBImageListener *listener) { m_listeners.Remove(listener); }
+
 #ifdef TB_RUNTIME_DEBUG_INFO
 	/** Render the skin bitmaps on screen, to analyze fragment positioning. */
 	void Debug() { m_frag_manager.Debug(); }
@@ -97,9 +135,14 @@ public:
 	// Implementing TBRendererListener
 	virtual void OnContextLost();
 	virtual void OnContextRestored();
+
+	// Implementing TBMessageHandler
+	virtual void OnMessageReceived(TBMessage *msg);
 private:
 	TBBitmapFragmentManager m_frag_manager;
 	TBHashTableOf<TBImageRep> m_image_rep_hash;
+	TBImageWorker *m_worker;	///< Created when the first image is loaded asynchronously.
+	TBLinkListOf<TBImageListener> m_listeners;
 
 	friend class TBImageRep;
 	void RemoveImageRep(TBImageRep *image_rep);
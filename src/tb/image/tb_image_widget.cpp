@@ -7,20 +7,92 @@
 #include "tb_widgets_reader.h"
 #include "tb_node_tree.h"
 #include "tb_system.h"
+#include "tb_skin.h"
+#include "tb_widget_skin_condition_context.h"
 
 #ifdef TB_IMAGE
 
 namespace tb {
 
+// == TBImageWidgetsWaiting =============================================================
+
+/** Image widgets with a image that is still pending. They are relayouted and
+	invalidated when their image is loaded. */
+class TBImageWidgetsWaiting : public TBImageListener
+{
+public:
+	void Add(TBImageWidget *widget)
+	{
+		if (m_widgets.Find(widget) != -1)
+			return;
+		if (!IsInList())
+			g_image_manager->AddListener(this);
+		m_widgets.Add(widget);
+	}
+	void Remove(TBImageWidget *widget)
+	{
+		int index = m_widgets.Find(widget);
+		if (index != -1)
+			m_widgets.RemoveFast(index);
+		if (!m_widgets.GetNumItems() && IsInList())
+			g_image_manager->RemoveListener(this);
+	}
+	virtual void OnImagesLoaded()
+	{
+		for (int i = m_widgets.GetNumItems() - 1; i >= 0; i--)
+		{
+			TBImageWidget *widget = m_widgets[i];
+			if (widget->GetImage().IsPending())
+				continue;
+			m_widgets.RemoveFast(i);
+			widget->InvalidateLayout(TBWidget::INVALIDATE_LAYOUT_RECURSIVE);
+			widget->Invalidate();
+		}
+		if (!m_widgets.GetNumItems())
+			g_image_manager->RemoveListener(this);
+	}
+private:
+	TBListOf<TBImageWidget> m_widgets;
+};
+
+static TBImageWidgetsWaiting image_widgets_waiting;
+
+// == TBImageWidget =====================================================================
+
+TBImageWidget::~TBImageWidget()
+{
+	image_widgets_waiting.Remove(this);
+}
+
+void TBImageWidget::SetImage(const TBImage &image)
+{
+	image_widgets_waiting.Remove(this);
+	m_image = image;
+	if (m_image.IsPending())
+		image_widgets_waiting.Add(this);
+	InvalidateLayout(INVALIDATE_LAYOUT_RECURSIVE);
+	Invalidate();
+}
+
 PreferredSize TBImageWidget::OnCalculatePreferredContentSize(const SizeConstraints & /*constraints*/)
 {
 	//TBDebugPrint("PCS: %d x %d\n", m_image.Width(), m_image.Height());
+	if (m_image.IsPending())
+	{
+		if (TBSkinElement *placeholder = g_tb_skin->GetSkinElement(TBIDC("TBImageWidget.placeholder")))
+			return PreferredSize(MAX(placeholder->GetIntrinsicWidth(), 0), MAX(placeholder->GetIntrinsicHeight(), 0));
+	}
 	return PreferredSize(m_image.Width(), m_image.Height());
 }
 
 void TBImageWidget::OnPaint(const PaintProps &paint_props)
 {
-	if (TBBitmapFragment *fragment = m_image.GetBitmap()) {
+	if (m_image.IsPending())
+	{
+		TBWidgetSkinConditionContext context(this);
+		g_tb_skin->PaintSkin(GetPaddingRect(), TBIDC("TBImageWidget.placeholder"), static_cast<SKIN_STATE>(GetAutoState()), context);
+	}
+	else if (TBBitmapFragment *fragment = m_image.GetBitmap()) {
 		if (m_adapt_text_color)
 			g_renderer->DrawBitmapColored(GetPaddingRect(),
 										  TBRect(0, 0, m_image.Width(), m_image.Height()),
@@ -16,7 +16,11 @@ namespace tb {
 
 /** TBImageWidget is a widget showing a image loaded by TBImageManager,
 	constrained in size to its skin.
-	If you need to show a image from the skin, you can use TBSkinImage. */
+	If you need to show a image from the skin, you can use TBSkinImage.
+
+	While the image is pending (See TBImageManager::GetImageAsync), the skin element
+	"TBImageWidget.placeholder" is painted instead, and the widget is invalidated when
+	the image is loaded. */
 
 class TBImageWidget : public TBWidget
 {
@@ -24,10 +28,15 @@ public:
 	// For safe typecasting
 	TBOBJECT_SUBCLASS(TBImageWidget, TBWidget);
 
-	TBImageWidget() {}
+	TBImageWidget() : m_adapt_text_color(false) {}
+	~TBImageWidget();
+
+	void SetImage(const TBImage &image);
+	void SetImage(const TBStr &filename) { SetImage(g_image_manager->GetImage(filename)); }
 
-	void SetImage(const TBImage &image) { m_image = image; }
-	void SetImage(const TBStr &filename) { m_image = g_image_manager->GetImage(filename); }
+	/** Set the image without waiting for it to load. See TBImageManager::GetImageAsync. */
+	void SetImageAsync(const TBStr &filename) { SetImage(g_image_manager->GetImageAsync(filename)); }
+	const TBImage &GetImage() const { return m_image; }
 
 	void SetAdaptTextColor(bool adapt) { m_adapt_text_color = adapt; }
 	virtual PreferredSize OnCalculatePreferredContentSize(const SizeConstraints &constraints);
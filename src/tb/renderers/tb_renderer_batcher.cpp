@@ -23,7 +23,7 @@ uint32_t dbg_frame_triangle_count = 0;
 
 void TBRendererBatcher::Batch::Flush(TBRendererBatcher *batch_renderer)
 {
-	if (!vertex_count || is_flushing)
+	if ((!vertex_count && !instance_count) || is_flushing)
 		return;
 
 	// Prevent re-entrancy. Calling fragment->GetBitmap may end up calling TBBitmap::SetData
@@ -44,51 +44,79 @@ void TBRendererBatcher::Batch::Flush(TBRendererBatcher *batch_renderer)
 #ifdef TB_RUNTIME_DEBUG_INFO
 	if (TB_DEBUG_SETTING(RENDER_BATCHES))
 	{
-		// This assumes we're drawing triangles. Need to modify this
+		// This assumes we're drawing indexed triangles. Need to modify this
 		// if we start using strips, fans or whatever.
-		dbg_frame_triangle_count += vertex_count / 3;
-
-		// Draw the triangles again using a random color based on the batch
-		// id. This indicates which triangles belong to the same batch.
-		uint32_t id = batch_id - dbg_begin_paint_batch_id;
-		uint32_t hash = id * (2166136261U ^ id);
-		uint32_t color = 0xAA000000 + (hash & 0x00FFFFFF);
-		for (int i = 0; i < vertex_count; i++)
-			vertex[i].col = color;
-		bitmap = nullptr;
-		batch_renderer->RenderBatch(this);
+		dbg_frame_triangle_count += GetIndexCount() / 3 + instance_count * 2;
 	}
 #endif // TB_RUNTIME_DEBUG_INFO
 
 	vertex_count = 0;
+	instance_count = 0;
 
 	batch_id++; // Will overflow eventually, but that doesn't really matter.
 
 	is_flushing = false;
 }
 
-TBRendererBatcher::Vertex *TBRendererBatcher::Batch::Reserve(TBRendererBatcher *batch_renderer, int count)
+// == TBRendererBatcher ===================================================================
+
+/** Clamp one axis of a quad (x0 to x1) to min - max and adjust its texture coordinates
+	to match. The quad may be flipped (x1 < x0). */
+static void ClampQuad(float &x0, float &x1, float &u0, float &u1, int min, int max)
 {
-	assert(count < VERTEX_BATCH_SIZE);
-	if (vertex_count + count > VERTEX_BATCH_SIZE)
-		Flush(batch_renderer);
-	Vertex *ret = &vertex[vertex_count];
-	vertex_count += count;
-	return ret;
+	float nx0 = Clamp<float>(x0, (float) min, (float) max);
+	float nx1 = Clamp<float>(x1, (float) min, (float) max);
+	float du = (u1 - u0) / (x1 - x0);
+	u1 = u0 + (nx1 - x0) * du;
+	u0 = u0 + (nx0 - x0) * du;
+	x0 = nx0;
+	x1 = nx1;
 }
 
-// == TBRendererBatcher ===================================================================
+/** The max number of batches to look back through for a batch that a new quad can join. */
+#define DRAW_LIST_LOOKBACK 64
 
 TBRendererBatcher::TBRendererBatcher()
 	: m_opacity(255), m_translation_x(0), m_translation_y(0)
 	, m_u(0), m_v(0), m_uu(0), m_vv(0)
+	, m_draw_list_id(0), m_is_flushing_draw_list(false), m_instanced_batches(false)
+	, m_num_render_targets(0), m_render_target(nullptr)
+	, m_num_recordings(0), m_recording(nullptr), m_display_list_epoch(0)
 {
+	ResetDrawList();
 }
 
 TBRendererBatcher::~TBRendererBatcher()
 {
 }
 
+int TBRendererBatcher::MapBatch(Batch *b, int quad_count)
+{
+	b->vertex = m_vertex_storage;
+	b->instance = m_instance_storage;
+	return MIN(quad_count, m_instanced_batches ? INSTANCE_BATCH_SIZE : VERTEX_BATCH_SIZE / 4);
+}
+
+const uint16_t *TBRendererBatcher::GetQuadIndices()
+{
+	static uint16_t indices[INDEX_BATCH_SIZE];
+	static bool initialized = false;
+	if (!initialized)
+	{
+		for (int i = 0, v = 0; i < INDEX_BATCH_SIZE; i += 6, v += 4)
+		{
+			indices[i + 0] = v + 0;
+			indices[i + 1] = v + 1;
+			indices[i + 2] = v + 2;
+			indices[i + 3] = v + 2;
+			indices[i + 4] = v + 1;
+			indices[i + 5] = v + 3;
+		}
+		initialized = true;
+	}
+	return indices;
+}
+
 void TBRendererBatcher::BeginPaint(int render_target_w, int render_target_h)
 {
 #ifdef TB_RUNTIME_DEBUG_INFO
@@ -98,10 +126,17 @@ void TBRendererBatcher::BeginPaint(int render_target_w, int render_target_h)
 
 	m_screen_rect.Set(0, 0, render_target_w, render_target_h);
 	m_clip_rect = m_screen_rect;
+	m_num_render_targets = 0;
+	m_render_target = nullptr;
+	m_num_recordings = 0;
+	m_recording = nullptr;
+	ResetDrawList();
 }
 
 void TBRendererBatcher::EndPaint()
 {
+	assert(m_num_render_targets == 0); // Missing call to EndRenderTarget!
+	assert(m_num_recordings == 0); // Missing call to EndRecording!
 	FlushAllInternal();
 
 #ifdef TB_RUNTIME_DEBUG_INFO
@@ -141,8 +176,8 @@ TBRect TBRendererBatcher::SetClipRect(const TBRect &rect, bool add_to_current)
 	if (add_to_current)
 		m_clip_rect = m_clip_rect.Clip(old_clip_rect);
 
-	FlushAllInternal();
-	SetClipRect(m_clip_rect);
+	// There's no need to flush anything, since quads are clamped to
+	// the clip rect when they are added.
 
 	old_clip_rect.x -= m_translation_x;
 	old_clip_rect.y -= m_translation_y;
@@ -203,83 +238,402 @@ void TBRendererBatcher::DrawBitmapTileColored(const TBRect &dst_rect, const TBCo
 					VER_COL(color.r, color.g, color.b, a), bitmap, nullptr);
 }
 
-void TBRendererBatcher::AddQuadInternal(const TBRect &dst_rect, const TBRect &src_rect, uint32_t color, TBBitmap *bitmap, TBBitmapFragment *fragment)
+bool TBRendererBatcher::BeginRenderTarget(TBBitmap *render_target)
+{
+	if (m_num_render_targets == RENDER_TARGET_STACK_SIZE)
+		return false;
+
+	// Everything so far has to be painted to the current render target.
+	FlushAllInternal();
+
+	RenderTargetState &state = m_render_targets[m_num_render_targets++];
+	state.render_target = m_render_target;
+	state.recording = m_recording;
+	state.screen_rect = m_screen_rect;
+	state.clip_rect = m_clip_rect;
+	state.translation_x = m_translation_x;
+	state.translation_y = m_translation_y;
+	state.opacity = m_opacity;
+
+	m_render_target = render_target;
+	m_recording = nullptr;
+	m_screen_rect.Set(0, 0, render_target->Width(), render_target->Height());
+	m_clip_rect = m_screen_rect;
+	m_translation_x = m_translation_y = 0;
+	m_opacity = 255;
+	SetRenderTarget(m_render_target, true);
+	return true;
+}
+
+void TBRendererBatcher::EndRenderTarget()
+{
+	assert(m_num_render_targets > 0); // Not matching a successful BeginRenderTarget!
+	FlushAllInternal();
+
+	const RenderTargetState &state = m_render_targets[--m_num_render_targets];
+	m_render_target = state.render_target;
+	m_recording = state.recording;
+	m_screen_rect = state.screen_rect;
+	m_clip_rect = state.clip_rect;
+	m_translation_x = state.translation_x;
+	m_translation_y = state.translation_y;
+	m_opacity = state.opacity;
+	SetRenderTarget(m_render_target, false);
+}
+
+void TBRendererBatcher::DrawRenderTarget(const TBRect &dst_rect, const TBRect &src_rect, TBBitmap *render_target)
+{
+	// The render target has premultiplied alpha, so the opacity applies to all channels.
+	const int bitmap_w = render_target->Width();
+	const int bitmap_h = render_target->Height();
+	AddQuadInternal(dst_rect.Offset(m_translation_x, m_translation_y),
+					(float) src_rect.x / bitmap_w, (float) src_rect.y / bitmap_h,
+					(float) (src_rect.x + src_rect.w) / bitmap_w, (float) (src_rect.y + src_rect.h) / bitmap_h,
+					VER_COL(m_opacity, m_opacity, m_opacity, m_opacity), render_target, nullptr, true);
+}
+
+TBDisplayList *TBRendererBatcher::CreateDisplayList()
 {
-	if (batch.bitmap != bitmap)
+	return new DisplayList;
+}
+
+bool TBRendererBatcher::BeginRecording(TBDisplayList *display_list, const TBRect &clip_rect)
+{
+	if (m_num_recordings == RECORDING_STACK_SIZE)
+		return false;
+
+	RecordingState &state = m_recordings[m_num_recordings++];
+	state.recording = m_recording;
+	state.clip_rect = m_clip_rect;
+	state.translation_x = m_translation_x;
+	state.translation_y = m_translation_y;
+	state.opacity = m_opacity;
+
+	m_recording = static_cast<DisplayList *>(display_list);
+	m_recording->quads.ResetAppendPos();
+	m_recording->epoch = m_display_list_epoch;
+	m_clip_rect = clip_rect;
+	m_translation_x = m_translation_y = 0;
+	m_opacity = 255;
+	return true;
+}
+
+void TBRendererBatcher::EndRecording()
+{
+	assert(m_num_recordings > 0); // Not matching a successful BeginRecording!
+
+	const RecordingState &state = m_recordings[--m_num_recordings];
+	m_recording = state.recording;
+	m_clip_rect = state.clip_rect;
+	m_translation_x = state.translation_x;
+	m_translation_y = state.translation_y;
+	m_opacity = state.opacity;
+}
+
+bool TBRendererBatcher::PaintDisplayList(TBDisplayList *display_list)
+{
+	DisplayList *dl = static_cast<DisplayList *>(display_list);
+	if (dl->epoch != m_display_list_epoch)
+		return false;
+
+	const RecordedQuad *quads = dl->GetQuads();
+	const int num_quads = dl->GetQuadCount();
+	for (int i = 0; i < num_quads; i++)
 	{
-		batch.Flush(this);
-		batch.bitmap = bitmap;
+		const RecordedQuad &rq = quads[i];
+		uint32_t color = rq.color;
+		if (m_opacity != 255)
+		{
+			uint32_t a = ((color >> 24) * m_opacity) / 255;
+			if (rq.premultiplied)
+			{
+				uint32_t r = ((color & 0xff) * m_opacity) / 255;
+				uint32_t g = (((color >> 8) & 0xff) * m_opacity) / 255;
+				uint32_t b = (((color >> 16) & 0xff) * m_opacity) / 255;
+				color = VER_COL(r, g, b, a);
+			}
+			else
+				color = (color & 0x00ffffff) + (a << 24);
+		}
+		AddQuadInternal(rq.dst_rect.Offset(m_translation_x, m_translation_y), rq.u, rq.v, rq.uu, rq.vv,
+						color, rq.bitmap, rq.fragment, rq.premultiplied);
 	}
-	batch.fragment = fragment;
+	return true;
+}
 
+void TBRendererBatcher::AddQuadInternal(const TBRect &dst_rect, const TBRect &src_rect, uint32_t color, TBBitmap *bitmap, TBBitmapFragment *fragment)
+{
 	const int bitmap_w = bitmap->Width();
 	const int bitmap_h = bitmap->Height();
-	m_u = (float) src_rect.x / bitmap_w;
-	m_v = (float) src_rect.y / bitmap_h;
-	m_uu = (float) (src_rect.x + src_rect.w) / bitmap_w;
-	m_vv = (float) (src_rect.y + src_rect.h) / bitmap_h;
+	AddQuadInternal(dst_rect, (float) src_rect.x / bitmap_w, (float) src_rect.y / bitmap_h,
+					(float) (src_rect.x + src_rect.w) / bitmap_w, (float) (src_rect.y + src_rect.h) / bitmap_h,
+					color, bitmap, fragment, false);
+}
+
+void TBRendererBatcher::AddQuadInternal(const TBRect &dst_rect, float u, float v, float uu, float vv, uint32_t color,
+										TBBitmap *bitmap, TBBitmapFragment *fragment, bool premultiplied)
+{
+	// Calculate the visible part of the quad. dst_rect may be flipped.
+	TBRect bounds = dst_rect;
+	if (bounds.w < 0)
+	{
+		bounds.x += bounds.w;
+		bounds.w = -bounds.w;
+	}
+	if (bounds.h < 0)
+	{
+		bounds.y += bounds.h;
+		bounds.h = -bounds.h;
+	}
+	TBRect visible_bounds = bounds.Clip(m_clip_rect);
+	if (visible_bounds.IsEmpty())
+		return;
+
+	m_u = u;
+	m_v = v;
+	m_uu = uu;
+	m_vv = vv;
+	TBRect clamped_dst_rect = dst_rect;
+	if (!visible_bounds.Equals(bounds))
+	{
+		// Clamp the quad to the clip rect on the CPU, so that the clip rect doesn't have
+		// to be applied when rendering (which would break the batch).
+		float x0 = (float) dst_rect.x, x1 = (float) (dst_rect.x + dst_rect.w);
+		float y0 = (float) dst_rect.y, y1 = (float) (dst_rect.y + dst_rect.h);
+		ClampQuad(x0, x1, m_u, m_uu, m_clip_rect.x, m_clip_rect.x + m_clip_rect.w);
+		ClampQuad(y0, y1, m_v, m_vv, m_clip_rect.y, m_clip_rect.y + m_clip_rect.h);
+		clamped_dst_rect.Set((int) x0, (int) y0, (int) (x1 - x0), (int) (y1 - y0));
+	}
+
+	if (m_recording)
+	{
+		RecordedQuad rq;
+		rq.dst_rect = clamped_dst_rect;
+		rq.u = m_u;
+		rq.v = m_v;
+		rq.uu = m_uu;
+		rq.vv = m_vv;
+		rq.color = color;
+		rq.bitmap = bitmap;
+		rq.fragment = fragment;
+		rq.premultiplied = premultiplied;
+		m_recording->quads.Append((const char *) &rq, sizeof(RecordedQuad));
+		return;
+	}
+
+	if (m_num_quads == DRAW_LIST_QUAD_COUNT)
+		FlushAllInternal();
+
+	int batch_index = FindDrawBatch(bitmap, visible_bounds);
+	if (batch_index < 0)
+	{
+		if (m_num_draw_batches == DRAW_LIST_BATCH_COUNT)
+			FlushAllInternal();
+		batch_index = m_num_draw_batches++;
+		DrawBatch &new_batch = m_draw_batches[batch_index];
+		new_batch.bitmap = bitmap;
+		new_batch.fragment = nullptr;
+		new_batch.bounds = visible_bounds;
+		new_batch.first_quad = -1;
+		new_batch.last_quad = -1;
+		new_batch.quad_count = 0;
+	}
+	else
+		m_draw_batches[batch_index].bounds = m_draw_batches[batch_index].bounds.Union(visible_bounds);
+
+	DrawBatch &draw_batch = m_draw_batches[batch_index];
+	if (fragment)
+		draw_batch.fragment = fragment;
+
+	int quad_index = m_num_quads++;
+	DrawQuad &quad = m_quads[quad_index];
+	quad.dst_rect = clamped_dst_rect;
+	quad.u = m_u;
+	quad.v = m_v;
+	quad.uu = m_uu;
+	quad.vv = m_vv;
+	quad.color = color;
+	quad.next = -1;
+	if (draw_batch.last_quad >= 0)
+		m_quads[draw_batch.last_quad].next = quad_index;
+	else
+		draw_batch.first_quad = quad_index;
+	draw_batch.last_quad = quad_index;
+	draw_batch.quad_count++;
 
-	Vertex *ver = batch.Reserve(this, 6);
+	// Update fragments batch id (See FlushBitmapFragment)
+	if (fragment)
+		fragment->m_batch_id = m_draw_list_id;
+}
+
+int TBRendererBatcher::FindDrawBatch(TBBitmap *bitmap, const TBRect &bounds) const
+{
+	// Search backwards for a batch with the same bitmap. The quad may only be
+	// moved back to it if it doesn't overlap anything painted in between.
+	int stop = MAX(m_num_draw_batches - DRAW_LIST_LOOKBACK, 0);
+	for (int i = m_num_draw_batches - 1; i >= stop; i--)
+	{
+		const DrawBatch &draw_batch = m_draw_batches[i];
+		if (draw_batch.bitmap == bitmap)
+			return i;
+		if (draw_batch.bounds.Intersects(bounds))
+			return -1;
+	}
+	return -1;
+}
+
+void TBRendererBatcher::ResetDrawList()
+{
+	m_num_quads = 0;
+	m_num_draw_batches = 0;
+}
+
+void TBRendererBatcher::WriteInstance(Instance *inst, const DrawQuad &quad, uint32_t color)
+{
+	// Quads are clamped to the clip rect, so the coordinates fit in 16 bits
+	// as long as the render target does.
+	const TBRect &dst_rect = quad.dst_rect;
+	inst->x = dst_rect.x;
+	inst->y = dst_rect.y;
+	inst->w = dst_rect.w;
+	inst->h = dst_rect.h;
+	inst->u = quad.u;
+	inst->v = quad.v;
+	inst->uu = quad.uu;
+	inst->vv = quad.vv;
+	inst->col = color;
+	inst->reserved = 0;
+}
+
+void TBRendererBatcher::WriteVertices(Vertex *ver, const DrawQuad &quad, uint32_t color)
+{
+	const TBRect &dst_rect = quad.dst_rect;
 	ver[0].x = (float) dst_rect.x;
 	ver[0].y = (float) (dst_rect.y + dst_rect.h);
-	ver[0].u = m_u;
-	ver[0].v = m_vv;
+	ver[0].u = quad.u;
+	ver[0].v = quad.vv;
 	ver[0].col = color;
 	ver[1].x = (float) (dst_rect.x + dst_rect.w);
 	ver[1].y = (float) (dst_rect.y + dst_rect.h);
-	ver[1].u = m_uu;
-	ver[1].v = m_vv;
+	ver[1].u = quad.uu;
+	ver[1].v = quad.vv;
 	ver[1].col = color;
 	ver[2].x = (float) dst_rect.x;
 	ver[2].y = (float) dst_rect.y;
-	ver[2].u = m_u;
-	ver[2].v = m_v;
+	ver[2].u = quad.u;
+	ver[2].v = quad.v;
 	ver[2].col = color;
-
-	ver[3].x = (float) dst_rect.x;
+	ver[3].x = (float) (dst_rect.x + dst_rect.w);
 	ver[3].y = (float) dst_rect.y;
-	ver[3].u = m_u;
-	ver[3].v = m_v;
+	ver[3].u = quad.uu;
+	ver[3].v = quad.v;
 	ver[3].col = color;
-	ver[4].x = (float) (dst_rect.x + dst_rect.w);
-	ver[4].y = (float) (dst_rect.y + dst_rect.h);
-	ver[4].u = m_uu;
-	ver[4].v = m_vv;
-	ver[4].col = color;
-	ver[5].x = (float) (dst_rect.x + dst_rect.w);
-	ver[5].y = (float) dst_rect.y;
-	ver[5].u = m_uu;
-	ver[5].v = m_v;
-	ver[5].col = color;
-	//for (int ii = 0; ii < 6; ii++)
-	//	fprintf(stderr, "x:%f y:%f u:%f v:%f col:0x%08x\n", ver[ii].x, ver[ii].y, ver[ii].u, ver[ii].v, ver[ii].col);
+}
 
-	// Update fragments batch id (See FlushBitmapFragment)
-	if (fragment)
-		fragment->m_batch_id = batch.batch_id;
+void TBRendererBatcher::RenderDrawBatch(const DrawBatch &draw_batch, TBBitmap *bitmap, uint32_t color_override)
+{
+	batch.bitmap = bitmap;
+	batch.fragment = bitmap ? draw_batch.fragment : nullptr;
+
+	int quads_left = draw_batch.quad_count;
+	int q = draw_batch.first_quad;
+	while (quads_left)
+	{
+		// Let the subclass decide where to write the quads. It may give us room for
+		// fewer quads than requested, in which case we render in several batches.
+		int count = MapBatch(&batch, quads_left);
+		for (int i = 0; i < count; i++, q = m_quads[q].next)
+		{
+			const DrawQuad &quad = m_quads[q];
+			uint32_t color = color_override ? color_override : quad.color;
+			if (m_instanced_batches)
+				WriteInstance(&batch.instance[i], quad, color);
+			else
+				WriteVertices(&batch.vertex[i * 4], quad, color);
+		}
+		if (m_instanced_batches)
+			batch.instance_count = count;
+		else
+			batch.vertex_count = count * 4;
+		batch.Flush(this);
+		quads_left -= count;
+	}
 }
 
 void TBRendererBatcher::FlushAllInternal()
 {
-	batch.Flush(this);
+	if (m_is_flushing_draw_list)
+		return;
+	if (!m_num_quads)
+	{
+		ResetDrawList();
+		return;
+	}
+
+	m_is_flushing_draw_list = true;
+
+	for (int i = 0; i < m_num_draw_batches; i++)
+	{
+		const DrawBatch &draw_batch = m_draw_batches[i];
+
+#ifdef TB_RUNTIME_DEBUG_INFO
+		uint32_t id = batch.batch_id - dbg_begin_paint_batch_id;
+#endif // TB_RUNTIME_DEBUG_INFO
+
+		RenderDrawBatch(draw_batch, draw_batch.bitmap, 0);
+
+#ifdef TB_RUNTIME_DEBUG_INFO
+		if (TB_DEBUG_SETTING(RENDER_BATCHES))
+		{
+			// Draw the triangles again using a random color based on the batch
+			// id. This indicates which triangles belong to the same batch.
+			uint32_t hash = id * (2166136261U ^ id);
+			uint32_t color = 0xAA000000 + (hash & 0x00FFFFFF);
+			RenderDrawBatch(draw_batch, nullptr, color);
+		}
+#endif // TB_RUNTIME_DEBUG_INFO
+	}
+
+	ResetDrawList();
+	m_draw_list_id++; // Will overflow eventually, but that doesn't really matter.
+
+	m_is_flushing_draw_list = false;
+}
+
+void TBRendererBatcher::FlushDeletedBitmap(TBBitmap *bitmap)
+{
+	// Display lists may refer to the bitmap, so they can't be used anymore.
+	m_display_list_epoch++;
+	FlushBitmap(bitmap);
 }
 
 void TBRendererBatcher::FlushBitmap(TBBitmap *bitmap)
 {
 	// Flush the batch if it's using this bitmap (that is about to change or be deleted)
-	if (batch.vertex_count && bitmap == batch.bitmap)
-		batch.Flush(this);
+	if (m_is_flushing_draw_list)
+	{
+		if ((batch.vertex_count || batch.instance_count) && bitmap == batch.bitmap)
+			batch.Flush(this);
+		return;
+	}
+	for (int i = 0; i < m_num_draw_batches; i++)
+		if (m_draw_batches[i].bitmap == bitmap)
+		{
+			FlushAllInternal();
+			return;
+		}
 }
 
 void TBRendererBatcher::FlushBitmapFragment(TBBitmapFragment *bitmap_fragment)
 {
-	// Flush the batch if it is using this fragment (that is about to change or be deleted)
-	// We know if it is in use in the current batch if its batch_id matches the current
-	// batch_id in our (one and only) batch.
-	// If we switch to a more advance batching system with multiple batches, we need to
-	// solve this a bit differently.
-	if (batch.vertex_count && bitmap_fragment->m_batch_id == batch.batch_id)
-		batch.Flush(this);
+	// Display lists may refer to the fragment, so they can't be used anymore.
+	m_display_list_epoch++;
+
+	// Flush the draw list if it is using this fragment (that is about to change or be deleted)
+	// We know if it is in use in the draw list if its batch_id matches the current draw list id.
+	// The draw list is flushed as a whole since the order of its batches matter.
+	if (m_num_quads && bitmap_fragment->m_batch_id == m_draw_list_id)
+		FlushAllInternal();
 }
 
 } // namespace tb
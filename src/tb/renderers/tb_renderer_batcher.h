@@ -7,16 +7,36 @@
 #define TB_RENDERER_BATCHER_H
 
 #include "tb_renderer.h"
+#include "tb_tempbuffer.h"
 
 #ifdef TB_RENDERER_BATCHER
 
 namespace tb {
 
-#define VERTEX_BATCH_SIZE 6 * 2048
+#define VERTEX_BATCH_SIZE 4 * 2048
+#define INDEX_BATCH_SIZE 6 * 2048
+#define INSTANCE_BATCH_SIZE 2048
+
+/** The number of quads and batches the frame draw list can hold before it has to be flushed. */
+#define DRAW_LIST_QUAD_COUNT 8192
+#define DRAW_LIST_BATCH_COUNT 512
+
+/** How deep calls to BeginRenderTarget can be nested. */
+#define RENDER_TARGET_STACK_SIZE 8
+
+/** How deep calls to BeginRecording can be nested. */
+#define RECORDING_STACK_SIZE 8
 
 /** TBRendererBatcher is a helper class that implements batching of draw operations for a TBRenderer.
 	If you do not want to do your own batching you can subclass this class instead of TBRenderer.
-	If overriding any function in this class, make sure to call the base class too. */
+	If overriding any function in this class, make sure to call the base class too.
+
+	Draw operations are recorded into a draw list that is flushed at EndPaint (or when a bitmap
+	in use is about to change). Quads that don't overlap are then reordered so that each bitmap
+	ends up in as few batches as possible, while overlapping quads are kept in painter's order.
+
+	Quads are clamped to the current clip rect when they are added, so clipping never breaks
+	a batch and subclasses don't need to implement any clipping (such as scissoring). */
 class TBRendererBatcher : public TBRenderer
 {
 public:
@@ -30,17 +50,37 @@ public:
 			uint32_t col;
 		};
 	};
-	/** A batch which should be rendered. */
+	/** Quad instance stored in a Batch, if the renderer uses instanced batches.
+		The quad is expanded to the same 4 corners as GetQuadIndices describes. */
+	struct Instance
+	{
+		int16_t x, y, w, h;		///< Destination rect in render target coordinates.
+		float u, v, uu, vv;		///< Texture coordinates of the top left and bottom right corner.
+		union {
+			struct { unsigned char r, g, b, a; };
+			uint32_t col;
+		};
+		uint32_t reserved;		///< Pads the instance to 32 bytes.
+	};
+	/** A batch which should be rendered. Each quad is stored as 4 vertices, that should be
+		drawn as triangles using the indices from GetQuadIndices, or as one Instance if
+		m_instanced_batches is set. The memory is provided by MapBatch. */
 	class Batch
 	{
 	public:
-		Batch() : vertex_count(0), bitmap(nullptr), fragment(nullptr), batch_id(0), is_flushing(false) {}
+		Batch() : vertex(nullptr), vertex_count(0), instance(nullptr), instance_count(0)
+				, bitmap(nullptr), fragment(nullptr), batch_id(0), is_flushing(false) {}
 		void Flush(TBRendererBatcher *batch_renderer);
-		Vertex *Reserve(TBRendererBatcher *batch_renderer, int count);
 
-		Vertex vertex[VERTEX_BATCH_SIZE];
+		/** Get the number of indices needed to draw all vertices in this batch. */
+		int GetIndexCount() const { return vertex_count / 4 * 6; }
+
+		Vertex *vertex;
 		int vertex_count;
 
+		Instance *instance;
+		int instance_count;
+
 		TBBitmap *bitmap;
 		TBBitmapFragment *fragment;
 
@@ -51,6 +91,12 @@ public:
 	TBRendererBatcher();
 	virtual ~TBRendererBatcher();
 
+	/** Get the index list (INDEX_BATCH_SIZE indices) that is shared by all batches.
+		Quad n uses vertex 4n to 4n+3 (bottom left, bottom right, top left, top right),
+		drawn as the triangles {0, 1, 2} and {2, 1, 3}. Since it never changes, backends
+		can upload it once to a static index buffer. */
+	static const uint16_t *GetQuadIndices();
+
 	virtual void BeginPaint(int render_target_w, int render_target_h);
 	virtual void EndPaint();
 
@@ -71,14 +117,102 @@ public:
 	virtual void FlushBitmap(TBBitmap *bitmap);
 	virtual void FlushBitmapFragment(TBBitmapFragment *bitmap_fragment);
 
+	virtual bool BeginRenderTarget(TBBitmap *render_target);
+	virtual void EndRenderTarget();
+	virtual void DrawRenderTarget(const TBRect &dst_rect, const TBRect &src_rect, TBBitmap *render_target);
+
+	virtual TBDisplayList *CreateDisplayList();
+	virtual bool BeginRecording(TBDisplayList *display_list, const TBRect &clip_rect);
+	virtual void EndRecording();
+	virtual bool PaintDisplayList(TBDisplayList *display_list);
+
 	virtual void BeginBatchHint(TBRenderer::BATCH_HINT /*hint*/) {}
 	virtual void EndBatchHint() {}
 
+	/** Should be called by bitmaps when they are deleted, instead of FlushBitmap.
+		It also makes display lists stale, since they may refer to the bitmap.
+		Changing the data of a bitmap only needs FlushBitmap. */
+	void FlushDeletedBitmap(TBBitmap *bitmap);
+
 	// == Methods that need implementation in subclasses ================================
 	virtual TBBitmap *CreateBitmap(int width, int height, uint32_t *data) = 0;
 	virtual void RenderBatch(Batch *batch) = 0;
-	virtual void SetClipRect(const TBRect &rect) = 0;
+	/** Called before up to quad_count quads are written to batch. Should point batch->vertex
+		(or batch->instance if m_instanced_batches is set) to memory with room for the quads,
+		and return how many quads fit (at least 1). The quads are then passed to RenderBatch.
+		The default implementation uses memory owned by the batcher, but a subclass may f.ex
+		return memory mapped from a GPU buffer. */
+	virtual int MapBatch(Batch *batch, int quad_count);
+	/** Called when painting should go to render_target, or to the target given to
+		BeginPaint if it's nullptr. m_screen_rect is set to the size of it. If clear
+		is true, the render target should be cleared to transparent.
+		Only needed by renderers that implement CreateRenderTarget. */
+	virtual void SetRenderTarget(TBBitmap * /*render_target*/, bool /*clear*/) {}
 protected:
+	/** A quad recorded in the draw list. */
+	struct DrawQuad
+	{
+		TBRect dst_rect;
+		float u, v, uu, vv;
+		uint32_t color;
+		int next;				///< Index of the next quad in the same DrawBatch, or -1.
+	};
+	/** A set of quads in the draw list that share bitmap. */
+	struct DrawBatch
+	{
+		TBBitmap *bitmap;
+		TBBitmapFragment *fragment;
+		TBRect bounds;			///< The union of all quads.
+		int first_quad;
+		int last_quad;
+		int quad_count;
+	};
+
+	/** A quad recorded in a display list. It's already clamped to the clip rect
+		that was used while recording, and relative to where the recording started. */
+	struct RecordedQuad
+	{
+		TBRect dst_rect;
+		float u, v, uu, vv;
+		uint32_t color;			///< Color with the opacity that was used while recording (255).
+		TBBitmap *bitmap;
+		TBBitmapFragment *fragment;
+		bool premultiplied;		///< The opacity applies to all channels (See DrawRenderTarget).
+	};
+	/** The TBDisplayList created by CreateDisplayList. */
+	class DisplayList : public TBDisplayList
+	{
+	public:
+		DisplayList() : epoch(0) {}
+		int GetQuadCount() const { return quads.GetAppendPos() / sizeof(RecordedQuad); }
+		const RecordedQuad *GetQuads() const { return (const RecordedQuad *) quads.GetData(); }
+
+		TBTempBuffer quads;
+		uint32_t epoch;			///< m_display_list_epoch when it was recorded.
+	};
+
+	/** The state saved by BeginRenderTarget and restored by EndRenderTarget. */
+	struct RenderTargetState
+	{
+		TBBitmap *render_target;
+		DisplayList *recording;
+		TBRect screen_rect;
+		TBRect clip_rect;
+		int translation_x;
+		int translation_y;
+		uint8_t opacity;
+	};
+
+	/** The state saved by BeginRecording and restored by EndRecording. */
+	struct RecordingState
+	{
+		DisplayList *recording;
+		TBRect clip_rect;
+		int translation_x;
+		int translation_y;
+		uint8_t opacity;
+	};
+
 	uint8_t m_opacity;
 	TBRect m_screen_rect;
 	TBRect m_clip_rect;
@@ -86,10 +220,37 @@ protected:
 	int m_translation_y;
 
 	float m_u, m_v, m_uu, m_vv; ///< Some temp variables
-	Batch batch; ///< The one and only batch. this should be improved.
+	Batch batch; ///< The batch used to submit the draw list to RenderBatch.
+	Vertex m_vertex_storage[VERTEX_BATCH_SIZE];
+	Instance m_instance_storage[INSTANCE_BATCH_SIZE];
+
+	DrawQuad m_quads[DRAW_LIST_QUAD_COUNT];
+	DrawBatch m_draw_batches[DRAW_LIST_BATCH_COUNT];
+	int m_num_quads;
+	int m_num_draw_batches;
+	uint32_t m_draw_list_id;	///< Increased each time the draw list has been flushed.
+	bool m_is_flushing_draw_list;
+	bool m_instanced_batches;	///< Set by subclasses that render Batch::instance instead of Batch::vertex.
+
+	RenderTargetState m_render_targets[RENDER_TARGET_STACK_SIZE];
+	int m_num_render_targets;	///< The number of nested BeginRenderTarget calls.
+	TBBitmap *m_render_target;	///< The render target being painted, or nullptr.
+
+	RecordingState m_recordings[RECORDING_STACK_SIZE];
+	int m_num_recordings;		///< The number of nested BeginRecording calls.
+	DisplayList *m_recording;	///< The display list being recorded, or nullptr.
+	uint32_t m_display_list_epoch;	///< Increased when a bitmap is deleted or a fragment is freed or moved, which makes all display lists stale.
 
 	void AddQuadInternal(const TBRect &dst_rect, const TBRect &src_rect, uint32_t color, TBBitmap *bitmap, TBBitmapFragment *fragment);
+	void AddQuadInternal(const TBRect &dst_rect, float u, float v, float uu, float vv, uint32_t color,
+						TBBitmap *bitmap, TBBitmapFragment *fragment, bool premultiplied);
 	void FlushAllInternal();
+private:
+	int FindDrawBatch(TBBitmap *bitmap, const TBRect &bounds) const;
+	void ResetDrawList();
+	void RenderDrawBatch(const DrawBatch &draw_batch, TBBitmap *bitmap, uint32_t color_override);
+	void WriteInstance(Instance *inst, const DrawQuad &quad, uint32_t color);
+	void WriteVertices(Vertex *ver, const DrawQuad &quad, uint32_t color);
 };
 
 } // namespace tb
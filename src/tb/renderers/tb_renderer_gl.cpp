@@ -9,8 +9,10 @@
 #include "tb_bitmap_fragment.h"
 #include "tb_system.h"
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 namespace tb {
 
@@ -67,6 +69,35 @@ static void MakeOrtho(float * ortho, float l, float r, float b, float t, float n
 }
 #endif
 
+/** Get the GL texture formats to use for bitmaps in the given format. */
+static void GetTextureFormat(TB_BITMAP_FORMAT format, GLint *internal_format, GLenum *pixel_format)
+{
+	if (format != TB_BITMAP_FORMAT_RGBA32)
+	{
+#if defined(TB_RENDERER_GL3)
+		// GL_ALPHA textures are gone in the core profile, so the alpha is read from red.
+		*internal_format = GL_R8;
+		*pixel_format = GL_RED;
+#else
+		*internal_format = GL_ALPHA;
+		*pixel_format = GL_ALPHA;
+#endif
+	}
+	else
+	{
+		*internal_format = GL_RGBA;
+		*pixel_format = GL_RGBA;
+	}
+}
+
+/** Rows of single channel data are not 4 byte aligned, so the unpack alignment
+	has to be 1 while uploading it. */
+static void SetUnpackAlignment(TB_BITMAP_FORMAT format, bool uploading)
+{
+	if (format != TB_BITMAP_FORMAT_RGBA32)
+		GLCALL(glPixelStorei(GL_UNPACK_ALIGNMENT, uploading ? 1 : 4));
+}
+
 #if defined(TB_RENDERER_GLES_2)
 static bool gl_supports_ext(const char * extname)
 {
@@ -114,7 +145,8 @@ void TBRendererGL::BindBitmap(TBBitmap *bitmap)
 // == TBBitmapGL ==================================================================================
 
 TBBitmapGL::TBBitmapGL(TBRendererGL *renderer)
-	: m_renderer(renderer), m_w(0), m_h(0), m_texture(0)
+	: m_renderer(renderer), m_w(0), m_h(0), m_format(TB_BITMAP_FORMAT_RGBA32)
+	, m_texture(0), m_fbo(0), m_pending_uploads(0)
 {
 }
 
@@ -122,15 +154,23 @@ TBBitmapGL::~TBBitmapGL()
 {
 	// Must flush and unbind before we delete the texture
 	if (m_renderer) {
-		m_renderer->FlushBitmap(this);
+		m_renderer->FlushDeletedBitmap(this);
 		if (m_texture == m_renderer->m_current_texture)
 			m_renderer->BindBitmap(nullptr);
+#if defined(TB_RENDERER_GL3)
+		if (m_pending_uploads)
+			m_renderer->CancelUploads(this);
+#endif
 	}
 
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	if (m_fbo)
+		GLCALL(glDeleteFramebuffers(1, &m_fbo));
+#endif
 	GLCALL(glDeleteTextures(1, &m_texture));
 }
 
-bool TBBitmapGL::Init(int width, int height, uint32_t *data)
+bool TBBitmapGL::Init(int width, int height, TB_BITMAP_FORMAT format, void *data)
 {
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
 #else
@@ -140,36 +180,132 @@ bool TBBitmapGL::Init(int width, int height, uint32_t *data)
 
 	m_w = width;
 	m_h = height;
+	m_format = format;
 
 	GLCALL(glGenTextures(1, &m_texture));
 	m_renderer->BindBitmap(this);
 	GLCALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
 	GLCALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
 
-	SetData(data);
+	if (format != TB_BITMAP_FORMAT_RGBA32)
+	{
+		// Allocate the storage, and set the data as a rect since SetData is RGBA only.
+		GLint internal_format;
+		GLenum pixel_format;
+		GetTextureFormat(format, &internal_format, &pixel_format);
+		GLCALL(glTexImage2D(GL_TEXTURE_2D, 0, internal_format, m_w, m_h, 0, pixel_format, GL_UNSIGNED_BYTE, nullptr));
+		if (data)
+			SetDataRect(TBRect(0, 0, m_w, m_h), data, m_w);
+		return true;
+	}
+
+#if defined(TB_RENDERER_GL3)
+	// Allocate the storage first, so the data can go through the upload queue.
+	GLCALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_w, m_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+	if (data)
+		SetData((uint32_t *) data);
+#else
+	SetData((uint32_t *) data);
+#endif
 
 	return true;
 }
 
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+bool TBBitmapGL::InitRenderTarget(int width, int height)
+{
+	if (!Init(width, height, TB_BITMAP_FORMAT_RGBA32, nullptr))
+		return false;
+
+	// Render targets don't have to be a power of two, which requires clamping on GLES 2.
+	GLCALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GLCALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+
+	GLint old_fbo = 0;
+	GLCALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo));
+	GLCALL(glGenFramebuffers(1, &m_fbo));
+	GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, m_fbo));
+	GLCALL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0));
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, old_fbo));
+	return complete;
+}
+#endif
+
 void TBBitmapGL::SetData(uint32_t *data)
 {
+	assert(m_format == TB_BITMAP_FORMAT_RGBA32);
 	m_renderer->FlushBitmap(this);
+#if defined(TB_RENDERER_GL3)
+	if (data && m_renderer->QueueUpload(this, TBRect(0, 0, m_w, m_h), data, m_w))
+		return;
+	// Staged data must not overwrite this later.
+	if (m_pending_uploads)
+		m_renderer->IssueUploads(this);
+	m_renderer->m_upload_stats.direct++;
+#endif
 	m_renderer->BindBitmap(this);
 	GLCALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_w, m_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data));
-	//GLCALL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_w, m_h, GL_RGBA, GL_UNSIGNED_BYTE, data));
 	TB_IF_DEBUG_SETTING(RENDER_BATCHES, dbg_bitmap_validations++);
 }
 
+bool TBBitmapGL::SetDataRect(const TBRect &rect, void *data, int data_stride)
+{
+	assert(rect.x >= 0 && rect.y >= 0 && rect.x + rect.w <= m_w && rect.y + rect.h <= m_h);
+	m_renderer->FlushBitmap(this);
+#if defined(TB_RENDERER_GL3)
+	if (m_renderer->QueueUpload(this, rect, data, data_stride))
+		return true;
+	// Staged data must not overwrite this later.
+	if (m_pending_uploads)
+		m_renderer->IssueUploads(this);
+	m_renderer->m_upload_stats.direct++;
+#endif
+	m_renderer->BindBitmap(this);
+	GLint internal_format;
+	GLenum pixel_format;
+	GetTextureFormat(m_format, &internal_format, &pixel_format);
+	SetUnpackAlignment(m_format, true);
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GLES_1)
+	// There's no GL_UNPACK_ROW_LENGTH, so rows that aren't tightly packed are uploaded one by one.
+	if (data_stride == rect.w)
+		GLCALL(glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, pixel_format, GL_UNSIGNED_BYTE, data));
+	else
+	{
+		const int row_size = data_stride * TBGetBytesPerPixel(m_format);
+		for (int i = 0; i < rect.h; i++)
+			GLCALL(glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y + i, rect.w, 1, pixel_format, GL_UNSIGNED_BYTE, (uint8_t *) data + i * row_size));
+	}
+#else
+	GLCALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, data_stride));
+	GLCALL(glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, pixel_format, GL_UNSIGNED_BYTE, data));
+	GLCALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+#endif
+	SetUnpackAlignment(m_format, false);
+	TB_IF_DEBUG_SETTING(RENDER_BATCHES, dbg_bitmap_validations++);
+	return true;
+}
+
 // == TBRendererGL ================================================================================
 
 TBRendererGL::TBRendererGL()
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-	: m_white(this),
+	: m_hasvao(false),
+	  m_white(this),
+	  m_screen_fbo(0),
+	  m_premultiplied_blend(false),
 	  m_current_texture(-1),
 	  m_current_batch(nullptr)
 #endif
 {
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	for (int i = 0; i < _NUM_FORMATS; i++)
+		m_programs[i] = 0;
+#if defined(TB_RENDERER_GL3)
+	for (int i = 0; i < _NUM_FORMATS; i++)
+		m_inst_programs[i] = 0;
+#endif
+
 	GLchar vertexShaderString[] =  
 #if defined(TB_RENDERER_GL3)
 		"#version 150                          \n"
@@ -205,6 +341,62 @@ TBRendererGL::TBRendererGL()
 		"{                                             \n"
 		"  gl_FragColor = color * texture2D(tex, uvo); \n"
 		"}                                             \n";
+	// TB_BITMAP_FORMAT_A8 bitmaps are painted as white with the alpha of the texture,
+	// which is in the red channel of GL_R8 textures.
+#if defined(TB_RENDERER_GL3)
+#define TB_GL_ALPHA_TEXEL "texture2D(tex, uvo).r"
+#else
+#define TB_GL_ALPHA_TEXEL "texture2D(tex, uvo).a"
+#endif
+	GLchar alphaFragmentShaderString[] =
+#if defined(TB_RENDERER_GL3)
+		"#version 150                                  \n"
+		"#define varying in                            \n"
+		"out vec4 fragData[1];                         \n"
+		"#define gl_FragColor fragData[0]              \n"
+		"#define texture2D texture                     \n"
+#endif
+		"precision mediump float;                      \n"
+		"uniform sampler2D tex;                        \n"
+		"varying vec2 uvo;                             \n"
+		"varying lowp vec4 color;                      \n"
+		"void main()                                   \n"
+		"{                                             \n"
+		"  float a = " TB_GL_ALPHA_TEXEL ";            \n"
+#ifdef TB_PREMULTIPLIED_ALPHA
+		"  gl_FragColor = color * vec4(a, a, a, a);    \n"
+#else
+		"  gl_FragColor = color * vec4(1.0, 1.0, 1.0, a); \n"
+#endif
+		"}                                             \n";
+	// TB_BITMAP_FORMAT_SDF8 bitmaps are distance fields with the edge at TB_SDF8_EDGE.
+	// The alpha ramps over one pixel around it, at any scale.
+	GLchar sdfFragmentShaderString[] =
+#if defined(TB_RENDERER_GL3)
+		"#version 150                                  \n"
+		"#define varying in                            \n"
+		"out vec4 fragData[1];                         \n"
+		"#define gl_FragColor fragData[0]              \n"
+		"#define texture2D texture                     \n"
+#else
+		"#extension GL_OES_standard_derivatives : enable \n"
+#endif
+		"precision mediump float;                      \n"
+		"uniform sampler2D tex;                        \n"
+		"varying vec2 uvo;                             \n"
+		"varying lowp vec4 color;                      \n"
+		"void main()                                   \n"
+		"{                                             \n"
+		"  float d = " TB_GL_ALPHA_TEXEL ";            \n"
+		"  float a = clamp((d - 128.0 / 255.0) / max(fwidth(d), 0.0001) + 0.5, 0.0, 1.0); \n"
+#ifdef TB_PREMULTIPLIED_ALPHA
+		"  gl_FragColor = color * vec4(a, a, a, a);    \n"
+#else
+		"  gl_FragColor = color * vec4(1.0, 1.0, 1.0, a); \n"
+#endif
+		"}                                             \n";
+#undef TB_GL_ALPHA_TEXEL
+	const GLchar *fragmentShaderStrings[_NUM_FORMATS] = { fragmentShaderString, alphaFragmentShaderString, sdfFragmentShaderString };
 
 #if defined(TB_SYSTEM_WINDOWS)
 	GLenum err = glewInit();
@@ -215,45 +407,18 @@ TBRendererGL::TBRendererGL()
 	}
 #endif
 
-	GLuint vertexShader;
-	GLuint fragmentShader;
-	GLint linked;
-
-	vertexShader = LoadShader(GL_VERTEX_SHADER, vertexShaderString);
-	fragmentShader = LoadShader(GL_FRAGMENT_SHADER, fragmentShaderString);
-
-	m_program = glCreateProgram();
-	if (m_program == 0)
-	{
-		TBDebugOut("glCreateProgram failed.\n");
-		return;
-	}
-
-	glAttachShader(m_program, vertexShader);
-	glAttachShader(m_program, fragmentShader);
-	GLCALL(glBindAttribLocation(m_program, 0, "xy"));
-	GLCALL(glBindAttribLocation(m_program, 1, "uv"));
-	GLCALL(glBindAttribLocation(m_program, 2, "color"));
-	glLinkProgram(m_program);
-	glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
-	if (!linked)
-	{
-		GLint infoLen = 0;
-		glGetProgramiv(m_program, GL_INFO_LOG_LENGTH, &infoLen);
-		if (infoLen > 1)
-		{
-			char * infoLog = (char *)malloc(sizeof(char) * infoLen);
-			glGetProgramInfoLog(m_program, infoLen, nullptr, infoLog);
-			TBDebugPrint("Error linking program:\n%s\n", infoLog);
-			free(infoLog);
-		}
-		glDeleteProgram(m_program);
-		TBDebugOut("glLinkProgram failed.\n");
+	const char *attributes[] = { "xy", "uv", "col" };
+	m_programs[TB_BITMAP_FORMAT_RGBA32] = LinkProgram(vertexShaderString, fragmentShaderString, attributes);
+	if (m_programs[TB_BITMAP_FORMAT_RGBA32] == 0)
 		return;
-	}
+	m_texLoc = glGetUniformLocation(m_programs[TB_BITMAP_FORMAT_RGBA32], "tex");
 
-	m_orthoLoc = glGetUniformLocation(m_program, "ortho");
-	m_texLoc = glGetUniformLocation(m_program, "tex");
+	// Without their programs, the other formats are simply not supported.
+	for (int i = TB_BITMAP_FORMAT_RGBA32 + 1; i < _NUM_FORMATS; i++)
+		m_programs[i] = LinkProgram(vertexShaderString, fragmentShaderStrings[i], attributes);
+	for (int i = 0; i < _NUM_FORMATS; i++)
+		if (m_programs[i])
+			m_orthoLocs[i] = glGetUniformLocation(m_programs[i], "ortho");
 
 #if defined(TB_RENDERER_GL3)
 	m_hasvao = true;
@@ -265,31 +430,56 @@ TBRendererGL::TBRendererGL()
 #endif
 
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-    if (m_hasvao) {
-		GLCALL(glGenVertexArrays(_NUM_VBOS, m_vao));
+	if (m_hasvao) {
+		GLCALL(glGenVertexArrays(1, &m_vao));
+		GLCALL(glBindVertexArray(m_vao));
 	}
 
-	// Generate & allocate GL_ARRAY_BUFFER buffers
-	_vboidx = 0;
-	GLCALL(glGenBuffers(_NUM_VBOS, m_vbo));
-	for (unsigned int ii = 0; ii < _NUM_VBOS; ii++) {
-		if (m_hasvao)
-			GLCALL(glBindVertexArray(m_vao[ii]));
-		GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo[ii]));
-		GLCALL(glBufferData(GL_ARRAY_BUFFER, sizeof(batch.vertex), nullptr, GL_STREAM_DRAW)); // or DYNAMIC?
+	// Generate the GL_ELEMENT_ARRAY_BUFFER shared by all batches
+	GLCALL(glGenBuffers(1, &m_ibo));
+	GLCALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo));
+	GLCALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, INDEX_BATCH_SIZE * sizeof(uint16_t), GetQuadIndices(), GL_STATIC_DRAW));
+
+	// Generate & allocate the GL_ARRAY_BUFFER all batches are streamed through
+	GLCALL(glGenBuffers(1, &m_vbo));
+	GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+	GLCALL(glBufferData(GL_ARRAY_BUFFER, _STREAM_BUFFER_SIZE, nullptr, GL_STREAM_DRAW));
+	if (m_hasvao) {
 		GLCALL(glEnableVertexAttribArray(0));
 		GLCALL(glEnableVertexAttribArray(1));
 		GLCALL(glEnableVertexAttribArray(2));
-		GLCALL(glVertexAttribPointer(0, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), &((Vertex *)nullptr)->x));
-		GLCALL(glVertexAttribPointer(1, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), &((Vertex *)nullptr)->u));
-		GLCALL(glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(Vertex), &((Vertex *)nullptr)->col));
 	}
+	m_stream_begin = 0;
+	m_stream_end = _STREAM_BUFFER_SIZE;
+	m_stream_offset = 0;
+#endif
+
+#if defined(TB_RENDERER_GL3)
+	for (int i = 0; i < _NUM_STREAM_FRAMES; i++)
+		m_stream_fences[i] = nullptr;
+	m_stream_frame = 0;
+	m_stream_end = _STREAM_BUFFER_SIZE / _NUM_STREAM_FRAMES;
+	m_batch_mapped = false;
+	m_batch_offset = 0;
+#endif
+
+#if defined(TB_RENDERER_GL3)
+	m_instanced_batches = InitInstancing(fragmentShaderStrings);
+
+	GLCALL(glGenBuffers(1, &m_upload_pbo));
+	GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo));
+	GLCALL(glBufferData(GL_PIXEL_UNPACK_BUFFER, _UPLOAD_BUFFER_SIZE, nullptr, GL_STREAM_DRAW));
+	GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+	m_upload_offset = 0;
+	m_upload_queue_start = 0;
+	m_upload_budget = 1024 * 1024;
+	ResetUploadStats();
 #endif
 
 	// Setup white 1-pixel "texture" as default
 	{
 		uint32_t whitepix = 0xffffffff;
-		m_white.Init(1, 1, &whitepix);
+		m_white.Init(1, 1, TB_BITMAP_FORMAT_RGBA32, &whitepix);
 	}
 #endif // defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
 }
@@ -297,7 +487,28 @@ TBRendererGL::TBRendererGL()
 TBRendererGL::~TBRendererGL()
 {
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-	GLCALL(glDeleteBuffers(_NUM_VBOS, m_vbo));
+	GLCALL(glDeleteBuffers(1, &m_vbo));
+	GLCALL(glDeleteBuffers(1, &m_ibo));
+	for (int i = 0; i < _NUM_FORMATS; i++)
+		if (m_programs[i])
+			GLCALL(glDeleteProgram(m_programs[i]));
+	if (m_hasvao)
+		GLCALL(glDeleteVertexArrays(1, &m_vao));
+#endif
+#if defined(TB_RENDERER_GL3)
+	for (int i = 0; i < _NUM_STREAM_FRAMES; i++)
+		if (m_stream_fences[i])
+			glDeleteSync(m_stream_fences[i]);
+	if (m_instanced_batches)
+	{
+		GLCALL(glDeleteVertexArrays(1, &m_inst_vao));
+		for (int i = 0; i < _NUM_FORMATS; i++)
+			if (m_inst_programs[i])
+				GLCALL(glDeleteProgram(m_inst_programs[i]));
+	}
+	// The queue is gone before m_white is deleted.
+	CancelUploads(&m_white);
+	GLCALL(glDeleteBuffers(1, &m_upload_pbo));
 #endif
 }
 
@@ -330,6 +541,355 @@ GLuint TBRendererGL::LoadShader(GLenum type, const GLchar *shaderSrc)
 	}
 	return shader;
 }
+
+GLuint TBRendererGL::LinkProgram(const GLchar *vertexShaderString, const GLchar *fragmentShaderString, const char *const *attributes)
+{
+	GLuint vertexShader;
+	GLuint fragmentShader;
+	GLint linked;
+
+	vertexShader = LoadShader(GL_VERTEX_SHADER, vertexShaderString);
+	fragmentShader = LoadShader(GL_FRAGMENT_SHADER, fragmentShaderString);
+
+	GLuint program = glCreateProgram();
+	if (program == 0)
+	{
+		TBDebugOut("glCreateProgram failed.\n");
+		return 0;
+	}
+
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	GLCALL(glBindAttribLocation(program, 0, attributes[0]));
+	GLCALL(glBindAttribLocation(program, 1, attributes[1]));
+	GLCALL(glBindAttribLocation(program, 2, attributes[2]));
+	glLinkProgram(program);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked)
+	{
+		GLint infoLen = 0;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
+		if (infoLen > 1)
+		{
+			char * infoLog = (char *)malloc(sizeof(char) * infoLen);
+			glGetProgramInfoLog(program, infoLen, nullptr, infoLog);
+			TBDebugPrint("Error linking program:\n%s\n", infoLog);
+			free(infoLog);
+		}
+		glDeleteProgram(program);
+		TBDebugOut("glLinkProgram failed.\n");
+		return 0;
+	}
+	return program;
+}
+
+void TBRendererGL::OrphanStreamBuffer()
+{
+	// Give the buffer new storage so we can start over without waiting for the
+	// GPU to finish with the data written so far.
+	GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+	GLCALL(glBufferData(GL_ARRAY_BUFFER, _STREAM_BUFFER_SIZE, nullptr, GL_STREAM_DRAW));
+	m_stream_offset = m_stream_begin;
+#if defined(TB_RENDERER_GL3)
+	// The fences guard the old storage, so they're no longer needed.
+	for (int i = 0; i < _NUM_STREAM_FRAMES; i++)
+		if (m_stream_fences[i])
+		{
+			glDeleteSync(m_stream_fences[i]);
+			m_stream_fences[i] = nullptr;
+		}
+#endif
+}
+
+GLintptr TBRendererGL::UploadBatch(Batch *batch)
+{
+#if defined(TB_RENDERER_GL3)
+	if (m_batch_mapped)
+	{
+		GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+		GLCALL(glUnmapBuffer(GL_ARRAY_BUFFER));
+		m_batch_mapped = false;
+		return m_batch_offset;
+	}
+#endif
+	// The batch is in memory owned by the batcher, so copy it to the stream buffer.
+	GLsizeiptr size = batch->instance_count ? batch->instance_count * sizeof(Instance) : batch->vertex_count * sizeof(Vertex);
+	const void *data = batch->instance_count ? (const void *) batch->instance : (const void *) batch->vertex;
+	if (m_stream_offset + size > m_stream_end)
+		OrphanStreamBuffer();
+	GLintptr offset = m_stream_offset;
+	GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+	GLCALL(glBufferSubData(GL_ARRAY_BUFFER, offset, size, data));
+	m_stream_offset += size;
+	return offset;
+}
+#endif
+
+#if defined(TB_RENDERER_GL3)
+bool TBRendererGL::InitInstancing(const GLchar *const *fragmentShaderStrings)
+{
+	// Instanced arrays (glVertexAttribDivisor) are core since GL 3.3
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major < 3 || (major == 3 && minor < 3))
+		return false;
+
+	// Expand each instance to the 4 corners of the quad, in the same order as
+	// TBRendererBatcher::GetQuadIndices, so it can be drawn as a triangle strip.
+	GLchar vertexShaderString[] =
+		"#version 150                                                \n"
+		"in vec4 dst;                                                \n"
+		"in vec4 uvr;                                                \n"
+		"in vec4 col;                                                \n"
+		"uniform mat4 ortho;                                         \n"
+		"out vec2 uvo;                                               \n"
+		"out lowp vec4 color;                                        \n"
+		"void main()                                                 \n"
+		"{                                                           \n"
+		"  vec2 c = vec2(gl_VertexID & 1, 1 - (gl_VertexID >> 1));   \n"
+		"  gl_Position = ortho * vec4(dst.xy + c * dst.zw, 0, 1);    \n"
+		"  uvo = mix(uvr.xy, uvr.zw, c);                             \n"
+		"  color = col;                                              \n"
+		"}                                                           \n";
+
+	// Link an instanced program for each format that is supported.
+	const char *attributes[] = { "dst", "uvr", "col" };
+	for (int i = 0; i < _NUM_FORMATS; i++)
+	{
+		if (!m_programs[i])
+			continue;
+		m_inst_programs[i] = LinkProgram(vertexShaderString, fragmentShaderStrings[i], attributes);
+		if (!m_inst_programs[i])
+		{
+			for (int j = 0; j < i; j++)
+			{
+				if (m_inst_programs[j])
+					GLCALL(glDeleteProgram(m_inst_programs[j]));
+				m_inst_programs[j] = 0;
+			}
+			return false;
+		}
+		m_inst_orthoLocs[i] = glGetUniformLocation(m_inst_programs[i], "ortho");
+	}
+
+	// The attribute pointers are set for each batch, since the offset in the stream
+	// buffer changes. The divisors are part of the VAO state though.
+	GLCALL(glGenVertexArrays(1, &m_inst_vao));
+	GLCALL(glBindVertexArray(m_inst_vao));
+	GLCALL(glEnableVertexAttribArray(0));
+	GLCALL(glEnableVertexAttribArray(1));
+	GLCALL(glEnableVertexAttribArray(2));
+	GLCALL(glVertexAttribDivisor(0, 1));
+	GLCALL(glVertexAttribDivisor(1, 1));
+	GLCALL(glVertexAttribDivisor(2, 1));
+	GLCALL(glBindVertexArray(0));
+	return true;
+}
+
+void TBRendererGL::RenderInstances(Batch *batch)
+{
+	GLintptr offset = UploadBatch(batch);
+
+	const TB_BITMAP_FORMAT format = batch->bitmap ? batch->bitmap->GetFormat() : TB_BITMAP_FORMAT_RGBA32;
+	GLCALL(glUseProgram(m_inst_programs[format]));
+	GLCALL(glUniformMatrix4fv(m_inst_orthoLocs[format], 1, GL_FALSE, m_ortho));
+	BindBitmap(batch->bitmap ? batch->bitmap : &m_white);
+
+	GLCALL(glBindVertexArray(m_inst_vao));
+	GLCALL(glVertexAttribPointer(0, 4, GL_SHORT,         GL_FALSE, sizeof(Instance), (void *)(offset + offsetof(Instance, x))));
+	GLCALL(glVertexAttribPointer(1, 4, GL_FLOAT,         GL_FALSE, sizeof(Instance), (void *)(offset + offsetof(Instance, u))));
+	GLCALL(glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(Instance), (void *)(offset + offsetof(Instance, col))));
+	GLCALL(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch->instance_count));
+}
+
+int TBRendererGL::MapBatch(Batch *batch, int quad_count)
+{
+	const GLsizeiptr quad_size = m_instanced_batches ? sizeof(Instance) : 4 * sizeof(Vertex);
+	if (m_stream_offset + quad_size > m_stream_end)
+		OrphanStreamBuffer();
+
+	// Write straight into the stream buffer. Nothing the GPU may still read is
+	// touched, since the segment was fenced, so no synchronization is needed.
+	int count = MIN(quad_count, (int) ((m_stream_end - m_stream_offset) / quad_size));
+	count = MIN(count, m_instanced_batches ? INSTANCE_BATCH_SIZE : VERTEX_BATCH_SIZE / 4);
+	GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo));
+	void *data = glMapBufferRange(GL_ARRAY_BUFFER, m_stream_offset, count * quad_size,
+								GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!data)
+		return TBRendererBatcher::MapBatch(batch, quad_count);
+
+	m_batch_mapped = true;
+	m_batch_offset = m_stream_offset;
+	m_stream_offset += count * quad_size;
+	batch->vertex = (Vertex *) data;
+	batch->instance = (Instance *) data;
+	return count;
+}
+#endif
+
+#if defined(TB_RENDERER_GL3)
+bool TBRendererGL::QueueUpload(TBBitmapGL *bitmap, const TBRect &rect, const void *data, int data_stride)
+{
+	const int bpp = TBGetBytesPerPixel(bitmap->m_format);
+	const GLsizeiptr size = rect.w * rect.h * bpp;
+	if (size > _UPLOAD_BUFFER_SIZE)
+		return false;
+	if (m_upload_offset + size > _UPLOAD_BUFFER_SIZE)
+	{
+		// Upload everything staged, and give the buffer new storage so we can
+		// start over without waiting for the GPU to finish copying from it.
+		IssueUploads(nullptr);
+		GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo));
+		GLCALL(glBufferData(GL_PIXEL_UNPACK_BUFFER, _UPLOAD_BUFFER_SIZE, nullptr, GL_STREAM_DRAW));
+		m_upload_offset = 0;
+	}
+	else
+		GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo));
+
+	// The staged part of the buffer is never written again until it's orphaned,
+	// so no synchronization is needed.
+	uint8_t *dst = (uint8_t *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, m_upload_offset, size,
+												GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	bool staged = false;
+	if (dst)
+	{
+		for (int i = 0; i < rect.h; i++)
+			memcpy(dst + i * rect.w * bpp, (const uint8_t *) data + i * data_stride * bpp, rect.w * bpp);
+		staged = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+	}
+	GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+
+	PendingUpload upload = { bitmap, rect, m_upload_offset };
+	if (!staged || !m_upload_queue.Append((const char *) &upload, sizeof(PendingUpload)))
+		return false;
+	// Keep the next upload 4 byte aligned, which single channel uploads may break.
+	m_upload_offset += (size + 3) & ~3;
+	bitmap->m_pending_uploads++;
+	m_upload_stats.queued++;
+	m_upload_stats.queued_bytes += size;
+	return true;
+}
+
+void TBRendererGL::IssueUpload(PendingUpload *upload)
+{
+	TBBitmapGL *bitmap = upload->bitmap;
+	const TBRect &rect = upload->rect;
+	GLint internal_format;
+	GLenum pixel_format;
+	GetTextureFormat(bitmap->m_format, &internal_format, &pixel_format);
+	BindBitmap(bitmap);
+	SetUnpackAlignment(bitmap->m_format, true);
+	GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_upload_pbo));
+	GLCALL(glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, pixel_format, GL_UNSIGNED_BYTE, (void *) upload->offset));
+	GLCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+	SetUnpackAlignment(bitmap->m_format, false);
+	TB_IF_DEBUG_SETTING(RENDER_BATCHES, dbg_bitmap_validations++);
+
+	m_upload_stats.frame_bytes += rect.w * rect.h * TBGetBytesPerPixel(bitmap->m_format);
+	bitmap->m_pending_uploads--;
+	upload->bitmap = nullptr;
+}
+
+void TBRendererGL::IssueUploads(TBBitmapGL *bitmap)
+{
+	PendingUpload *uploads = (PendingUpload *) m_upload_queue.GetData();
+	const int count = m_upload_queue.GetAppendPos() / sizeof(PendingUpload);
+	for (int i = m_upload_queue_start; i < count; i++)
+		if (uploads[i].bitmap && (!bitmap || uploads[i].bitmap == bitmap))
+		{
+			IssueUpload(&uploads[i]);
+			m_upload_stats.forced++;
+		}
+	CompactUploadQueue();
+}
+
+void TBRendererGL::CancelUploads(TBBitmapGL *bitmap)
+{
+	PendingUpload *uploads = (PendingUpload *) m_upload_queue.GetData();
+	const int count = m_upload_queue.GetAppendPos() / sizeof(PendingUpload);
+	for (int i = m_upload_queue_start; i < count; i++)
+		if (uploads[i].bitmap == bitmap)
+		{
+			uploads[i].bitmap = nullptr;
+			bitmap->m_pending_uploads--;
+		}
+	CompactUploadQueue();
+}
+
+void TBRendererGL::CompactUploadQueue()
+{
+	PendingUpload *uploads = (PendingUpload *) m_upload_queue.GetData();
+	const int count = m_upload_queue.GetAppendPos() / sizeof(PendingUpload);
+	while (m_upload_queue_start < count && !uploads[m_upload_queue_start].bitmap)
+		m_upload_queue_start++;
+	if (m_upload_queue_start == count)
+	{
+		m_upload_queue.ResetAppendPos();
+		m_upload_queue_start = 0;
+	}
+}
+
+void TBRendererGL::ResetUploadStats()
+{
+	memset(&m_upload_stats, 0, sizeof(UploadStats));
+}
+#endif
+
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+void TBRendererGL::SetViewport(int width, int height, bool flip)
+{
+	// Render targets are flipped, so that the first row painted ends up
+	// at texture coordinate v = 0 like in any other bitmap.
+	if (flip)
+		MakeOrtho(m_ortho, 0, (GLfloat)width, 0, (GLfloat)height, -1.0, 1.0);
+	else
+		MakeOrtho(m_ortho, 0, (GLfloat)width, (GLfloat)height, 0, -1.0, 1.0);
+	GLCALL(glViewport(0, 0, width, height));
+	GLCALL(glScissor(0, 0, width, height));
+}
+
+void TBRendererGL::SetBlendMode(bool premultiplied)
+{
+	if (premultiplied)
+		GLCALL(glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+	else if (m_render_target)
+	{
+		// Accumulate alpha correctly in the render target, which leaves
+		// it with premultiplied alpha.
+		GLCALL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA));
+	}
+	else
+		GLCALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+	m_premultiplied_blend = premultiplied;
+}
+
+void TBRendererGL::SetRenderTarget(TBBitmap *render_target, bool clear)
+{
+	GLuint fbo = render_target ? static_cast<TBBitmapGL*>(render_target)->m_fbo : m_screen_fbo;
+	GLCALL(glBindFramebuffer(GL_FRAMEBUFFER, fbo));
+	SetViewport(m_screen_rect.w, m_screen_rect.h, render_target != nullptr);
+	SetBlendMode(false);
+	if (clear)
+	{
+		GLfloat old_clear_color[4];
+		GLCALL(glGetFloatv(GL_COLOR_CLEAR_VALUE, old_clear_color));
+		GLCALL(glClearColor(0, 0, 0, 0));
+		GLCALL(glClear(GL_COLOR_BUFFER_BIT));
+		GLCALL(glClearColor(old_clear_color[0], old_clear_color[1], old_clear_color[2], old_clear_color[3]));
+	}
+}
+
+TBBitmap *TBRendererGL::CreateRenderTarget(int width, int height)
+{
+	TBBitmapGL *bitmap = new TBBitmapGL(this);
+	if (!bitmap || !bitmap->InitRenderTarget(width, height))
+	{
+		delete bitmap;
+		return nullptr;
+	}
+	return bitmap;
+}
 #endif
 
 void TBRendererGL::BeginPaint(int render_target_w, int render_target_h)
@@ -337,24 +897,57 @@ void TBRendererGL::BeginPaint(int render_target_w, int render_target_h)
 #ifdef TB_RUNTIME_DEBUG_INFO
 	dbg_bitmap_validations = 0;
 #endif
-	//TBDebugPrint("Frame start idx %d.\n", _vboidx);
 
 	TBRendererBatcher::BeginPaint(render_target_w, render_target_h);
 
 	m_current_texture = (GLuint)-1;
 	m_current_batch = nullptr;
 
+#if defined(TB_RENDERER_GL3)
+	// Move on to the next segment of the stream buffer. It was last written
+	// _NUM_STREAM_FRAMES frames ago, so the GPU should normally be done with it.
+	m_stream_frame = (m_stream_frame + 1) % _NUM_STREAM_FRAMES;
+	if (GLsync fence = m_stream_fences[m_stream_frame])
+	{
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fence);
+		m_stream_fences[m_stream_frame] = nullptr;
+	}
+	const GLsizeiptr segment_size = _STREAM_BUFFER_SIZE / _NUM_STREAM_FRAMES;
+	m_stream_begin = m_stream_frame * segment_size;
+	m_stream_end = m_stream_begin + segment_size;
+	m_stream_offset = m_stream_begin;
+
+	// Upload staged data ahead of the batches that need it, oldest first,
+	// as much as the budget allows.
+	m_upload_stats.frame_bytes = 0;
+	PendingUpload *uploads = (PendingUpload *) m_upload_queue.GetData();
+	const int upload_count = m_upload_queue.GetAppendPos() / sizeof(PendingUpload);
+	for (int i = m_upload_queue_start; i < upload_count; i++)
+	{
+		if (!uploads[i].bitmap)
+			continue;
+		const int size = uploads[i].rect.w * uploads[i].rect.h * TBGetBytesPerPixel(uploads[i].bitmap->m_format);
+		if (m_upload_stats.frame_bytes && m_upload_stats.frame_bytes + size > m_upload_budget)
+			break;
+		IssueUpload(&uploads[i]);
+		m_upload_stats.ahead++;
+	}
+	CompactUploadQueue();
+#endif
+
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-	MakeOrtho(m_ortho, 0, (GLfloat)render_target_w, (GLfloat)render_target_h, 0, -1.0, 1.0);
+	GLCALL(glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_screen_fbo));
+	SetViewport(render_target_w, render_target_h, false);
 #else
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	Ortho2D(0, (GLfloat)render_target_w, (GLfloat)render_target_h, 0);
 	glMatrixMode(GL_MODELVIEW);
-#endif
 
 	glViewport(0, 0, render_target_w, render_target_h);
 	glScissor(0, 0, render_target_w, render_target_h);
+#endif
 
 	GLCALL(glEnable(GL_BLEND));
 #if !defined(TB_RENDERER_GLES_2) && !defined(TB_RENDERER_GL3)
@@ -362,7 +955,11 @@ void TBRendererGL::BeginPaint(int render_target_w, int render_target_h)
 #endif
 	GLCALL(glDisable(GL_DEPTH_TEST));
 	GLCALL(glEnable(GL_SCISSOR_TEST));
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	SetBlendMode(false);
+#else
 	GLCALL(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+#endif
 	//GLCALL(glBlendFunc(GL_SRC_ALPHA, GL_DST_ALPHA));
 	//GLCALL(glAlphaFunc(GL_GREATER, 0.1));
 	//GLCALL(glEnable(GL_ALPHA_TEST));
@@ -381,6 +978,9 @@ void TBRendererGL::BeginPaint(int render_target_w, int render_target_h)
 void TBRendererGL::EndPaint()
 {
 	TBRendererBatcher::EndPaint();
+#if defined(TB_RENDERER_GL3)
+	m_stream_fences[m_stream_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+#endif
 	GLCALL(glDisable(GL_BLEND));
 	GLCALL(glDisable(GL_SCISSOR_TEST));
 	GLCALL(glFlush());
@@ -388,13 +988,19 @@ void TBRendererGL::EndPaint()
 	if (TB_DEBUG_SETTING(RENDER_BATCHES))
 		TBDebugPrint("Frame caused %d bitmap validations.\n", dbg_bitmap_validations);
 #endif // TB_RUNTIME_DEBUG_INFO
-	//TBDebugPrint("Frame end idx %d.\n", _vboidx);
 }
 
 TBBitmap *TBRendererGL::CreateBitmap(int width, int height, uint32_t *data)
 {
+	return CreateBitmapFormat(width, height, TB_BITMAP_FORMAT_RGBA32, data);
+}
+
+TBBitmap *TBRendererGL::CreateBitmapFormat(int width, int height, TB_BITMAP_FORMAT format, void *data)
+{
+	if (!IsBitmapFormatSupported(format))
+		return nullptr;
 	TBBitmapGL *bitmap = new TBBitmapGL(this);
-	if (!bitmap || !bitmap->Init(width, height, data))
+	if (!bitmap || !bitmap->Init(width, height, format, data))
 	{
 		delete bitmap;
 		return nullptr;
@@ -402,12 +1008,44 @@ TBBitmap *TBRendererGL::CreateBitmap(int width, int height, uint32_t *data)
 	return bitmap;
 }
 
+bool TBRendererGL::IsBitmapFormatSupported(TB_BITMAP_FORMAT format)
+{
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	return m_programs[format] != 0;
+#else
+	// The fixed function pipeline modulates the color with GL_ALPHA textures as is,
+	// which works for coverage but not distance fields.
+	return format != TB_BITMAP_FORMAT_SDF8;
+#endif
+}
+
 void TBRendererGL::RenderBatch(Batch *batch)
 {
+#if defined(TB_RENDERER_GL3)
+	// Upload any staged data for the bitmap before it's used.
+	TBBitmapGL *bitmap = static_cast<TBBitmapGL*>(batch->bitmap ? batch->bitmap : &m_white);
+	if (bitmap->m_pending_uploads)
+		IssueUploads(bitmap);
+#endif
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	// Render targets have premultiplied alpha.
+	bool premultiplied = batch->bitmap && static_cast<TBBitmapGL*>(batch->bitmap)->m_fbo;
+	if (premultiplied != m_premultiplied_blend)
+		SetBlendMode(premultiplied);
+#endif
+#if defined(TB_RENDERER_GL3)
+	if (batch->instance_count)
+	{
+		RenderInstances(batch);
+		return;
+	}
+#endif
+
 	// Bind texture and array pointers
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-	GLCALL(glUseProgram(m_program));
-	GLCALL(glUniformMatrix4fv(m_orthoLoc, 1, GL_FALSE, m_ortho));
+	const TB_BITMAP_FORMAT format = batch->bitmap ? batch->bitmap->GetFormat() : TB_BITMAP_FORMAT_RGBA32;
+	GLCALL(glUseProgram(m_programs[format]));
+	GLCALL(glUniformMatrix4fv(m_orthoLocs[format], 1, GL_FALSE, m_ortho));
 	BindBitmap(batch->bitmap ? batch->bitmap : &m_white);
 #else
 	BindBitmap(batch->bitmap);
@@ -425,32 +1063,26 @@ void TBRendererGL::RenderBatch(Batch *batch)
 
 	// Flush
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-	_vboidx = (_vboidx + 1) % _NUM_VBOS;
+	GLintptr offset = UploadBatch(batch);
 	if (m_hasvao) {
-		GLCALL(glBindVertexArray(m_vao[_vboidx]));
-		GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo[_vboidx]));
-		GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, batch->vertex_count * sizeof(Vertex), (void *)&batch->vertex[0]));
+		GLCALL(glBindVertexArray(m_vao));
 	}
 	else {
-		GLCALL(glBindBuffer(GL_ARRAY_BUFFER, m_vbo[_vboidx]));
-		GLCALL(glBufferSubData(GL_ARRAY_BUFFER, 0, batch->vertex_count * sizeof(Vertex), (void *)&batch->vertex[0]));
+		GLCALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo));
 		GLCALL(glEnableVertexAttribArray(0));
 		GLCALL(glEnableVertexAttribArray(1));
 		GLCALL(glEnableVertexAttribArray(2));
-		GLCALL(glVertexAttribPointer(0, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), &((Vertex *)nullptr)->x));
-		GLCALL(glVertexAttribPointer(1, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), &((Vertex *)nullptr)->u));
-		GLCALL(glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(Vertex), &((Vertex *)nullptr)->col));
 	}
+	GLCALL(glVertexAttribPointer(0, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), (void *)(offset + offsetof(Vertex, x))));
+	GLCALL(glVertexAttribPointer(1, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), (void *)(offset + offsetof(Vertex, u))));
+	GLCALL(glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(Vertex), (void *)(offset + offsetof(Vertex, col))));
+	GLCALL(glDrawElements(GL_TRIANGLES, batch->GetIndexCount(), GL_UNSIGNED_SHORT, nullptr));
+#else
+	GLCALL(glDrawElements(GL_TRIANGLES, batch->GetIndexCount(), GL_UNSIGNED_SHORT, GetQuadIndices()));
 #endif
-	GLCALL(glDrawArrays(GL_TRIANGLES, 0, batch->vertex_count));
 	//TBDebugPrint("Batch: %d\n", batch->vertex_count);
 }
 
-void TBRendererGL::SetClipRect(const TBRect & /*rect*/)
-{
-	GLCALL(glScissor(m_clip_rect.x, m_screen_rect.h - (m_clip_rect.y + m_clip_rect.h), m_clip_rect.w, m_clip_rect.h));
-}
-
 } // namespace tb
 
 #endif // TB_RENDERER_GL
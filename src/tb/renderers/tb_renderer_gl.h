@@ -89,6 +89,7 @@ extern PFNGLGENVERTEXARRAYSOESPROC glGenVertexArraysOESEXT;
 #endif
 
 #include "renderers/tb_renderer_batcher.h"
+#include "tb_tempbuffer.h"
 
 namespace tb {
 
@@ -99,14 +100,22 @@ class TBBitmapGL : public TBBitmap
 public:
 	TBBitmapGL(TBRendererGL *renderer);
 	~TBBitmapGL();
-	bool Init(int width, int height, uint32_t *data);
+	bool Init(int width, int height, TB_BITMAP_FORMAT format, void *data);
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	bool InitRenderTarget(int width, int height);
+#endif
 	virtual int Width() { return m_w; }
 	virtual int Height() { return m_h; }
+	virtual TB_BITMAP_FORMAT GetFormat() { return m_format; }
 	virtual void SetData(uint32_t *data);
+	virtual bool SetDataRect(const TBRect &rect, void *data, int data_stride);
 public:
 	TBRendererGL *m_renderer;
 	int m_w, m_h;
+	TB_BITMAP_FORMAT m_format;	///< Single channel formats are GL_R8 textures on GL3, and GL_ALPHA otherwise.
 	GLuint m_texture;
+	GLuint m_fbo;	///< The frame buffer object if this is a render target, or 0.
+	int m_pending_uploads;	///< The number of uploads of this bitmap queued in the renderer.
 };
 
 class TBRendererGL : public TBRendererBatcher
@@ -121,26 +130,112 @@ public:
 	virtual void EndPaint();
 
 	virtual TBBitmap *CreateBitmap(int width, int height, uint32_t *data);
+	virtual TBBitmap *CreateBitmapFormat(int width, int height, TB_BITMAP_FORMAT format, void *data);
+	virtual bool IsBitmapFormatSupported(TB_BITMAP_FORMAT format);
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	virtual TBBitmap *CreateRenderTarget(int width, int height);
+#endif
 
 	// == TBRendererBatcher ===============================================================
 
 	virtual void RenderBatch(Batch *batch);
-	virtual void SetClipRect(const TBRect &rect);
+#if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
+	virtual void SetRenderTarget(TBBitmap *render_target, bool clear);
+#endif
+
+#if defined(TB_RENDERER_GL3)
+	// == Upload queue ===================================================================
+	// Bitmap data is staged in a pixel buffer object, so the driver can copy it to the
+	// textures asynchronously. The staged data is uploaded in BeginPaint, as much as the
+	// upload budget allows, and the rest when a batch that uses the bitmap is rendered.
+
+	/** Counters for bitmap data uploaded through the upload queue. */
+	struct UploadStats
+	{
+		int queued;			///< Uploads staged in the upload buffer.
+		int queued_bytes;	///< Bytes staged in the upload buffer.
+		int ahead;			///< Uploads done in BeginPaint, before any batch needed them.
+		int forced;			///< Uploads done because a batch needed the bitmap.
+		int direct;			///< Uploads that didn't go through the upload buffer.
+		int frame_bytes;	///< Bytes uploaded since the last BeginPaint.
+	};
+
+	/** Set how many bytes of staged data may be uploaded in BeginPaint each frame
+		(at least one upload is always done). Data needed by a batch is always uploaded
+		before the batch is rendered, regardless of the budget. */
+	void SetUploadBudget(int bytes_per_frame) { m_upload_budget = bytes_per_frame; }
+	int GetUploadBudget() const { return m_upload_budget; }
+
+	const UploadStats &GetUploadStats() const { return m_upload_stats; }
+	void ResetUploadStats();
+#endif
 
 protected:
 	void BindBitmap(TBBitmap *bitmap);
 #if defined(TB_RENDERER_GLES_2) || defined(TB_RENDERER_GL3)
-	static const GLuint _NUM_VBOS = 256;
+	/** The size of the buffer that all vertex and instance data is streamed through. */
+	static const GLsizeiptr _STREAM_BUFFER_SIZE = 4 * 1024 * 1024;
 	GLuint LoadShader(GLenum type, const GLchar * shaderSrc);
-	GLuint m_program;
+	GLuint LinkProgram(const GLchar *vertexShaderString, const GLchar *fragmentShaderString, const char *const *attributes);
+	void OrphanStreamBuffer();
+	GLintptr UploadBatch(Batch *batch);
+	void SetViewport(int width, int height, bool flip);
+	void SetBlendMode(bool premultiplied);
+	static const int _NUM_FORMATS = TB_BITMAP_FORMAT_SDF8 + 1;
+	GLuint m_programs[_NUM_FORMATS];	///< Program for bitmaps of each TB_BITMAP_FORMAT, or 0 if unsupported.
+	GLint m_orthoLocs[_NUM_FORMATS];
 	bool m_hasvao;
-	GLuint m_vao[_NUM_VBOS];
-	GLuint m_vbo[_NUM_VBOS];
+	GLuint m_vao;
+	GLuint m_vbo;				///< The streaming ring buffer.
+	GLuint m_ibo;
+	GLintptr m_stream_begin;	///< Start of the part of m_vbo the current frame may write to.
+	GLintptr m_stream_end;		///< End of the part of m_vbo the current frame may write to.
+	GLintptr m_stream_offset;	///< Where the next batch will be written to m_vbo.
 	float m_ortho[16];
-	GLuint _vboidx;
-	GLint m_orthoLoc;
 	GLint m_texLoc;
 	TBBitmapGL m_white;
+	GLint m_screen_fbo;			///< The frame buffer that was bound when BeginPaint was called.
+	bool m_premultiplied_blend;	///< If blending is currently set up for a render target bitmap.
+#endif
+#if defined(TB_RENDERER_GL3)
+	/** The stream buffer is split in one segment per frame in flight. Each segment is
+		fenced when the frame ends, and waited for before it's written again. */
+	static const int _NUM_STREAM_FRAMES = 3;
+	virtual int MapBatch(Batch *batch, int quad_count);
+	bool InitInstancing(const GLchar *const *fragmentShaderStrings);
+	void RenderInstances(Batch *batch);
+	GLsync m_stream_fences[_NUM_STREAM_FRAMES];
+	int m_stream_frame;
+	bool m_batch_mapped;		///< If the current batch is written directly to m_vbo.
+	GLintptr m_batch_offset;	///< Where the current batch is mapped in m_vbo.
+	GLuint m_inst_programs[_NUM_FORMATS];
+	GLint m_inst_orthoLocs[_NUM_FORMATS];
+	GLuint m_inst_vao;
+
+	/** The size of the pixel buffer that bitmap data is staged in. */
+	static const GLsizeiptr _UPLOAD_BUFFER_SIZE = 4 * 1024 * 1024;
+	/** Bitmap data staged in m_upload_pbo, waiting to be uploaded. */
+	struct PendingUpload
+	{
+		TBBitmapGL *bitmap;		///< nullptr when uploaded or cancelled.
+		TBRect rect;
+		GLintptr offset;
+	};
+	/** Stage the data for rect in the bitmap. Returns false if it has to be uploaded directly. */
+	bool QueueUpload(TBBitmapGL *bitmap, const TBRect &rect, const void *data, int data_stride);
+	/** Upload all staged data for the bitmap, or for all bitmaps if it's nullptr. */
+	void IssueUploads(TBBitmapGL *bitmap);
+	void IssueUpload(PendingUpload *upload);
+	/** Forget the staged data for the bitmap, which is being deleted. */
+	void CancelUploads(TBBitmapGL *bitmap);
+	/** Remove uploaded and cancelled uploads from the start of the queue. */
+	void CompactUploadQueue();
+	GLuint m_upload_pbo;
+	GLintptr m_upload_offset;	///< Where the next upload will be staged in m_upload_pbo.
+	TBTempBuffer m_upload_queue;	///< PendingUpload structs.
+	int m_upload_queue_start;	///< The index of the first PendingUpload that may be pending.
+	int m_upload_budget;
+	UploadStats m_upload_stats;
 #endif
 	GLuint m_current_texture;
 	TBRendererBatcher::Batch *m_current_batch;
@@ -0,0 +1,367 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "renderers/tb_renderer_software.h"
+
+#ifdef TB_RENDERER_SOFTWARE
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TB_RENDERER_SOFTWARE_SSE2
+#endif
+
+namespace tb {
+
+/** The max number of pixels sampled before they are blended. */
+#define SPAN_SIZE 256
+
+// == Pixel operations ============================================================
+// Pixels are stored as 0xAABBGGRR (the same as TBBitmap data and batch colors).
+// The red and blue channels (and alpha and green) are processed in pairs
+// by masking out the other channels.
+
+/** Divide each 16bit lane in x (at most 255 * 255) by 255, rounding to nearest. */
+static inline uint32_t Div255Pair(uint32_t x)
+{
+	x += 0x00800080;
+	return ((x + ((x >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+/** Interpolate from a to b with the weight w (0-256). */
+static inline uint32_t LerpPixel(uint32_t a, uint32_t b, uint32_t w)
+{
+	uint32_t rb = ((a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w) >> 8;
+	uint32_t ag = (((a >> 8) & 0x00ff00ff) * (256 - w) + ((b >> 8) & 0x00ff00ff) * w) >> 8;
+	return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+/** Multiply each channel of the pixel with the same channel of color. */
+static inline uint32_t ModulatePixel(uint32_t p, uint32_t color)
+{
+	uint32_t r = ((p & 0xff) * ((color & 0xff) + 1)) >> 8;
+	uint32_t g = (((p >> 8) & 0xff) * (((color >> 8) & 0xff) + 1)) >> 8;
+	uint32_t b = (((p >> 16) & 0xff) * (((color >> 16) & 0xff) + 1)) >> 8;
+	uint32_t a = ((p >> 24) * ((color >> 24) + 1)) >> 8;
+	return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+/** Multiply the color channels of the pixel with its alpha. */
+static inline uint32_t PremultiplyPixel(uint32_t p)
+{
+	uint32_t a = p >> 24;
+	uint32_t rb = Div255Pair((p & 0x00ff00ff) * a);
+	uint32_t g = Div255Pair(((p >> 8) & 0xff) * a);
+	return (a << 24) | rb | (g << 8);
+}
+
+/** Blend the premultiplied pixel s over d. */
+static inline uint32_t BlendPixel(uint32_t s, uint32_t d)
+{
+	uint32_t inv = 255 - (s >> 24);
+	uint32_t rb = Div255Pair((d & 0x00ff00ff) * inv);
+	uint32_t ag = Div255Pair(((d >> 8) & 0x00ff00ff) * inv);
+	return s + (rb | (ag << 8));
+}
+
+#ifdef TB_RENDERER_SOFTWARE_SSE2
+/** Divide each 16bit lane in x (at most 255 * 255) by 255, rounding to nearest. */
+static inline __m128i Div255Epi16(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/** Multiply the 4 unpacked pixels in d with 255 - their alpha in s. */
+static inline __m128i ScaleByInvAlphaEpi16(__m128i d, __m128i s)
+{
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	return Div255Epi16(_mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a)));
+}
+#endif // TB_RENDERER_SOFTWARE_SSE2
+
+/** Blend count premultiplied pixels from src over dst. */
+static void BlendSpan(uint32_t *dst, const uint32_t *src, int count)
+{
+	int i = 0;
+#ifdef TB_RENDERER_SOFTWARE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+		__m128i d_lo = ScaleByInvAlphaEpi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+		__m128i d_hi = ScaleByInvAlphaEpi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_adds_epu8(s, _mm_packus_epi16(d_lo, d_hi)));
+	}
+#endif // TB_RENDERER_SOFTWARE_SSE2
+	for (; i < count; i++)
+		dst[i] = BlendPixel(src[i], dst[i]);
+}
+
+/** Return the texel index i wrapped into 0 - size, by repeating or clamping. */
+static inline int WrapTexel(int i, int size, bool clamp)
+{
+	if (clamp)
+		return i < 0 ? 0 : (i >= size ? size - 1 : i);
+	i %= size;
+	return i < 0 ? i + size : i;
+}
+
+// == TBBitmapSoftware ============================================================
+
+TBBitmapSoftware::TBBitmapSoftware(TBRendererSoftware *renderer)
+	: m_renderer(renderer), m_w(0), m_h(0), m_format(TB_BITMAP_FORMAT_RGBA32)
+	, m_data(nullptr), m_data8(nullptr), m_is_render_target(false)
+{
+}
+
+TBBitmapSoftware::~TBBitmapSoftware()
+{
+	m_renderer->FlushDeletedBitmap(this);
+	delete [] m_data;
+	delete [] m_data8;
+}
+
+bool TBBitmapSoftware::Init(int width, int height, TB_BITMAP_FORMAT format, void *data, bool is_render_target)
+{
+	m_w = width;
+	m_h = height;
+	m_format = format;
+	m_is_render_target = is_render_target;
+	if (format != TB_BITMAP_FORMAT_RGBA32)
+		m_data8 = new uint8_t[width * height];
+	else
+		m_data = new uint32_t[width * height];
+	if (!m_data && !m_data8)
+		return false;
+	if (data)
+		SetDataRect(TBRect(0, 0, width, height), data, width);
+	else
+		memset(m_data ? (void *) m_data : (void *) m_data8, 0, width * height * TBGetBytesPerPixel(format));
+	return true;
+}
+
+void TBBitmapSoftware::SetData(uint32_t *data)
+{
+	assert(m_format == TB_BITMAP_FORMAT_RGBA32);
+	m_renderer->FlushBitmap(this);
+	memcpy(m_data, data, m_w * m_h * sizeof(uint32_t));
+}
+
+bool TBBitmapSoftware::SetDataRect(const TBRect &rect, void *data, int data_stride)
+{
+	assert(rect.x >= 0 && rect.y >= 0 && rect.x + rect.w <= m_w && rect.y + rect.h <= m_h);
+	m_renderer->FlushBitmap(this);
+	const int bpp = TBGetBytesPerPixel(m_format);
+	uint8_t *dst = m_data ? (uint8_t *) m_data : m_data8;
+	for (int i = 0; i < rect.h; i++)
+		memcpy(dst + ((rect.y + i) * m_w + rect.x) * bpp, (uint8_t *) data + i * data_stride * bpp, rect.w * bpp);
+	return true;
+}
+
+// == TBRendererSoftware ==========================================================
+
+TBRendererSoftware::TBRendererSoftware()
+{
+	// Instances are simpler to rasterize than the triangles of each quad.
+	m_instanced_batches = true;
+	m_framebuffer.pixels = nullptr;
+	m_framebuffer.width = m_framebuffer.height = m_framebuffer.stride = 0;
+	m_target = m_framebuffer;
+}
+
+TBRendererSoftware::~TBRendererSoftware()
+{
+}
+
+void TBRendererSoftware::SetFramebuffer(uint32_t *pixels, int width, int height, int stride)
+{
+	m_framebuffer.pixels = pixels;
+	m_framebuffer.width = width;
+	m_framebuffer.height = height;
+	m_framebuffer.stride = stride;
+	m_target = m_framebuffer;
+}
+
+void TBRendererSoftware::BeginPaint(int render_target_w, int render_target_h)
+{
+	assert(render_target_w <= m_framebuffer.width && render_target_h <= m_framebuffer.height);
+	TBRendererBatcher::BeginPaint(render_target_w, render_target_h);
+	m_target = m_framebuffer;
+}
+
+TBBitmap *TBRendererSoftware::CreateBitmap(int width, int height, uint32_t *data)
+{
+	return CreateBitmapFormat(width, height, TB_BITMAP_FORMAT_RGBA32, data);
+}
+
+TBBitmap *TBRendererSoftware::CreateBitmapFormat(int width, int height, TB_BITMAP_FORMAT format, void *data)
+{
+	TBBitmapSoftware *bitmap = new TBBitmapSoftware(this);
+	if (!bitmap || !bitmap->Init(width, height, format, data, false))
+	{
+		delete bitmap;
+		return nullptr;
+	}
+	return bitmap;
+}
+
+TBBitmap *TBRendererSoftware::CreateRenderTarget(int width, int height)
+{
+	TBBitmapSoftware *bitmap = new TBBitmapSoftware(this);
+	if (!bitmap || !bitmap->Init(width, height, TB_BITMAP_FORMAT_RGBA32, nullptr, true))
+	{
+		delete bitmap;
+		return nullptr;
+	}
+	return bitmap;
+}
+
+void TBRendererSoftware::SetRenderTarget(TBBitmap *render_target, bool clear)
+{
+	if (TBBitmapSoftware *bitmap = static_cast<TBBitmapSoftware *>(render_target))
+	{
+		m_target.pixels = bitmap->m_data;
+		m_target.width = m_target.stride = bitmap->m_w;
+		m_target.height = bitmap->m_h;
+		if (clear)
+			memset(bitmap->m_data, 0, bitmap->m_w * bitmap->m_h * sizeof(uint32_t));
+	}
+	else
+		m_target = m_framebuffer;
+}
+
+void TBRendererSoftware::RenderBatch(Batch *batch)
+{
+	TBBitmapSoftware *bitmap = static_cast<TBBitmapSoftware *>(batch->bitmap);
+	TBRect scissor_rect(0, 0, m_target.width, m_target.height);
+	for (int i = 0; i < batch->instance_count; i++)
+		RasterizeInstance(m_target, scissor_rect, batch->instance[i], bitmap);
+}
+
+void TBRendererSoftware::RasterizeInstance(const TBSurfaceSoftware &surface, const TBRect &scissor_rect,
+											const Instance &instance, TBBitmapSoftware *bitmap)
+{
+	// Unflip the quad. Flipping is then only in the texture coordinates.
+	int x = instance.x, y = instance.y, w = instance.w, h = instance.h;
+	float u0 = instance.u, v0 = instance.v, u1 = instance.uu, v1 = instance.vv;
+	if (w < 0)
+	{
+		x += w;
+		w = -w;
+		float tmp = u0; u0 = u1; u1 = tmp;
+	}
+	if (h < 0)
+	{
+		y += h;
+		h = -h;
+		float tmp = v0; v0 = v1; v1 = tmp;
+	}
+	if (!w || !h)
+		return;
+
+	TBRect rect = TBRect(x, y, w, h).Clip(scissor_rect).Clip(TBRect(0, 0, surface.width, surface.height));
+	if (rect.IsEmpty())
+		return;
+
+	const uint32_t color = instance.col;
+	uint32_t span[SPAN_SIZE];
+
+	if (!bitmap)
+	{
+		// No bitmap is the same as a white bitmap.
+		for (int i = 0; i < rect.w && i < SPAN_SIZE; i++)
+			span[i] = PremultiplyPixel(color);
+		for (int py = rect.y; py < rect.y + rect.h; py++)
+			for (int px = rect.x; px < rect.x + rect.w; px += SPAN_SIZE)
+				BlendSpan(surface.pixels + py * surface.stride + px, span, MIN(rect.x + rect.w - px, SPAN_SIZE));
+		return;
+	}
+
+	// Sample at pixel centers, in 16.16 fixed point texel coordinates
+	// where texel centers are at whole numbers. The start is stepped from the
+	// quad origin, so a pixel gets the same sample however the quad is clipped.
+	const int tw = bitmap->m_w, th = bitmap->m_h;
+	const bool clamp = bitmap->m_is_render_target;
+	const bool premultiplied = bitmap->m_is_render_target;
+	const double step_x = (u1 - u0) * tw / w;
+	const double step_y = (v1 - v0) * th / h;
+	const int64_t fx_step = (int64_t) floor(step_x * 65536 + 0.5);
+	const int64_t fy_step = (int64_t) floor(step_y * 65536 + 0.5);
+	const int64_t fx_origin = (int64_t) floor((u0 * tw + 0.5 * step_x - 0.5) * 65536 + 0.5);
+	const int64_t fy_origin = (int64_t) floor((v0 * th + 0.5 * step_y - 0.5) * 65536 + 0.5);
+	const int64_t fx_start = fx_origin + (rect.x - x) * fx_step;
+	int64_t fy = fy_origin + (rect.y - y) * fy_step;
+
+	// If the texels map 1:1 to pixels, there's nothing to interpolate.
+	const bool nearest = fx_step == 65536 && fy_step == 65536 && !(fx_start & 0xffff) && !(fy & 0xffff);
+
+	// Alpha only bitmaps are painted as white with their alpha. The alpha of distance fields
+	// ramps from 0 to 255 over one pixel around the edge, so the multiplier for the distance
+	// from the edge (in 16.8 fixed point) depends on how many texels there are per pixel.
+	const uint8_t *data8 = bitmap->m_data8;
+	const bool sdf = bitmap->m_format == TB_BITMAP_FORMAT_SDF8;
+	const double texels_per_pixel = MAX(MAX(fabs(step_x), fabs(step_y)), 1.0 / 256);
+	const int sdf_mul = (int) (255 * 256 / (TB_SDF8_STEPS_PER_TEXEL * texels_per_pixel));
+
+	for (int py = rect.y; py < rect.y + rect.h; py++, fy += fy_step)
+	{
+		const int ty = (int) (fy >> 16);
+		const uint32_t wy = (uint32_t) ((fy >> 8) & 0xff);
+		const int row0 = WrapTexel(ty, th, clamp) * tw;
+		const int row1 = WrapTexel(ty + 1, th, clamp) * tw;
+		uint32_t *dst = surface.pixels + py * surface.stride;
+
+		int64_t fx = fx_start;
+		for (int px = rect.x; px < rect.x + rect.w; px += SPAN_SIZE)
+		{
+			const int count = MIN(rect.x + rect.w - px, SPAN_SIZE);
+			for (int i = 0; i < count; i++, fx += fx_step)
+			{
+				const int tx = (int) (fx >> 16);
+				uint32_t p;
+				if (data8)
+				{
+					uint32_t a;
+					if (nearest)
+						a = data8[row0 + WrapTexel(tx, tw, clamp)];
+					else
+					{
+						const uint32_t wx = (uint32_t) ((fx >> 8) & 0xff);
+						const int tx0 = WrapTexel(tx, tw, clamp);
+						const int tx1 = WrapTexel(tx + 1, tw, clamp);
+						const uint32_t a0 = (data8[row0 + tx0] * (256 - wx) + data8[row0 + tx1] * wx) >> 8;
+						const uint32_t a1 = (data8[row1 + tx0] * (256 - wx) + data8[row1 + tx1] * wx) >> 8;
+						a = (a0 * (256 - wy) + a1 * wy) >> 8;
+					}
+					if (sdf)
+						a = (uint32_t) CLAMP(((((int) a - TB_SDF8_EDGE) * sdf_mul) >> 8) + 128, 0, 255);
+					p = (a << 24) | 0x00ffffff;
+				}
+				else if (nearest)
+					p = bitmap->m_data[row0 + WrapTexel(tx, tw, clamp)];
+				else
+				{
+					const uint32_t *data = bitmap->m_data;
+					const uint32_t wx = (uint32_t) ((fx >> 8) & 0xff);
+					const int tx0 = WrapTexel(tx, tw, clamp);
+					const int tx1 = WrapTexel(tx + 1, tw, clamp);
+					p = LerpPixel(LerpPixel(data[row0 + tx0], data[row0 + tx1], wx),
+								  LerpPixel(data[row1 + tx0], data[row1 + tx1], wx), wy);
+				}
+				if (color != 0xffffffff)
+					p = ModulatePixel(p, color);
+				span[i] = premultiplied ? p : PremultiplyPixel(p);
+			}
+			BlendSpan(dst + px, span, count);
+		}
+	}
+}
+
+} // namespace tb
+
+#endif // TB_RENDERER_SOFTWARE
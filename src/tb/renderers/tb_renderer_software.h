@@ -0,0 +1,98 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#ifndef TB_RENDERER_SOFTWARE_H
+#define TB_RENDERER_SOFTWARE_H
+
+#include "tb_types.h"
+
+#ifdef TB_RENDERER_SOFTWARE
+
+#include "renderers/tb_renderer_batcher.h"
+
+namespace tb {
+
+class TBRendererSoftware;
+
+/** TBBitmapSoftware is a bitmap kept in memory, painted by TBRendererSoftware. */
+class TBBitmapSoftware : public TBBitmap
+{
+public:
+	TBBitmapSoftware(TBRendererSoftware *renderer);
+	~TBBitmapSoftware();
+	bool Init(int width, int height, TB_BITMAP_FORMAT format, void *data, bool is_render_target);
+	virtual int Width() { return m_w; }
+	virtual int Height() { return m_h; }
+	virtual TB_BITMAP_FORMAT GetFormat() { return m_format; }
+	virtual void SetData(uint32_t *data);
+	virtual bool SetDataRect(const TBRect &rect, void *data, int data_stride);
+public:
+	TBRendererSoftware *m_renderer;
+	int m_w, m_h;
+	TB_BITMAP_FORMAT m_format;
+	uint32_t *m_data;			///< The pixels if the format is TB_BITMAP_FORMAT_RGBA32, or nullptr.
+	uint8_t *m_data8;			///< The pixels if the format is single channel, or nullptr.
+	bool m_is_render_target;	///< It has premultiplied alpha and is clamped instead of repeated.
+};
+
+/** TBSurfaceSoftware is a buffer of pixels that TBRendererSoftware paints into. */
+struct TBSurfaceSoftware
+{
+	uint32_t *pixels;	///< Pixels in the same format as TBBitmap data.
+	int width;
+	int height;
+	int stride;			///< The number of pixels from the start of one row to the next.
+};
+
+/** TBRendererSoftware is a renderer that paints into a buffer in memory using the CPU,
+	so it works without a GPU or any graphics context. F.ex for headless testing, or for
+	painting thumbnails on a server.
+
+	Bitmaps are sampled bilinearly and repeated, and blended the same way as TBRendererGL
+	does. The result has straight alpha where the buffer was transparent before painting.
+	Render targets are supported. */
+class TBRendererSoftware : public TBRendererBatcher
+{
+public:
+	TBRendererSoftware();
+	virtual ~TBRendererSoftware();
+
+	/** Set the buffer to paint into. It must be at least as large as the size given
+		to BeginPaint. It's not owned by the renderer, and it's not cleared by BeginPaint.
+		stride is the number of pixels from the start of one row to the next. */
+	void SetFramebuffer(uint32_t *pixels, int width, int height, int stride);
+
+	/** Get the buffer set by SetFramebuffer. */
+	const TBSurfaceSoftware &GetFramebuffer() const { return m_framebuffer; }
+
+	/** Paint the instance into the surface, touching only the pixels inside scissor_rect.
+		bitmap may be nullptr, in which case the instance is painted with its color only.
+		This is what RenderBatch does for each instance, with the scissor rect set to the
+		whole surface. */
+	static void RasterizeInstance(const TBSurfaceSoftware &surface, const TBRect &scissor_rect,
+									const Instance &instance, TBBitmapSoftware *bitmap);
+
+	// == TBRenderer ====================================================================
+
+	virtual void BeginPaint(int render_target_w, int render_target_h);
+
+	virtual TBBitmap *CreateBitmap(int width, int height, uint32_t *data);
+	virtual TBBitmap *CreateBitmapFormat(int width, int height, TB_BITMAP_FORMAT format, void *data);
+	virtual bool IsBitmapFormatSupported(TB_BITMAP_FORMAT /*format*/) { return true; }
+	virtual TBBitmap *CreateRenderTarget(int width, int height);
+
+	// == TBRendererBatcher ===============================================================
+
+	virtual void RenderBatch(Batch *batch);
+	virtual void SetRenderTarget(TBBitmap *render_target, bool clear);
+protected:
+	TBSurfaceSoftware m_framebuffer;
+	TBSurfaceSoftware m_target;		///< The surface being painted (m_framebuffer or a render target).
+};
+
+} // namespace tb
+
+#endif // TB_RENDERER_SOFTWARE
+#endif // TB_RENDERER_SOFTWARE_H
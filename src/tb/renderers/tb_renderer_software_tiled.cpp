@@ -0,0 +1,281 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "renderers/tb_renderer_software_tiled.h"
+
+#ifdef TB_RENDERER_SOFTWARE
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace tb {
+
+/** The max number of threads painting tiles. */
+#define MAX_THREADS 64
+
+// == TBTileWorkers ===============================================================
+
+/** TBTileWorkers is a pool of threads that paint the used tiles of a
+	TBRendererSoftwareTiled together with the thread calling Run. */
+class TBTileWorkers
+{
+public:
+	TBTileWorkers(TBRendererSoftwareTiled *renderer, int num_workers);
+	~TBTileWorkers();
+
+	/** Paint all used tiles and return when they are done. */
+	void Run(int num_used_tiles);
+private:
+	void WorkerMain();
+
+	/** Paint tiles until there are no more left. */
+	void PaintTiles();
+
+	TBRendererSoftwareTiled *m_renderer;
+	std::thread *m_threads;
+	int m_num_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_start_cond;
+	std::condition_variable m_done_cond;
+	unsigned int m_generation;		///< Increased for each Run, to wake up the workers.
+	int m_num_running;				///< The number of workers not done with the current Run.
+	bool m_quit;
+	int m_num_used_tiles;
+	std::atomic<int> m_next_tile;
+};
+
+TBTileWorkers::TBTileWorkers(TBRendererSoftwareTiled *renderer, int num_workers)
+	: m_renderer(renderer)
+	, m_num_workers(num_workers)
+	, m_generation(0)
+	, m_num_running(0)
+	, m_quit(false)
+	, m_num_used_tiles(0)
+	, m_next_tile(0)
+{
+	m_threads = new std::thread[num_workers];
+	for (int i = 0; i < num_workers; i++)
+		m_threads[i] = std::thread(&TBTileWorkers::WorkerMain, this);
+}
+
+TBTileWorkers::~TBTileWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_start_cond.notify_all();
+	for (int i = 0; i < m_num_workers; i++)
+		m_threads[i].join();
+	delete [] m_threads;
+}
+
+void TBTileWorkers::Run(int num_used_tiles)
+{
+	m_num_used_tiles = num_used_tiles;
+	m_next_tile = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_generation++;
+		m_num_running = m_num_workers;
+	}
+	m_start_cond.notify_all();
+
+	PaintTiles();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cond.wait(lock, [this] { return m_num_running == 0; });
+}
+
+void TBTileWorkers::WorkerMain()
+{
+	unsigned int generation = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start_cond.wait(lock, [&] { return m_quit || m_generation != generation; });
+			if (m_quit)
+				return;
+			generation = m_generation;
+		}
+
+		PaintTiles();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_num_running == 0)
+			m_done_cond.notify_one();
+	}
+}
+
+void TBTileWorkers::PaintTiles()
+{
+	int index;
+	while ((index = m_next_tile++) < m_num_used_tiles)
+		m_renderer->PaintTile(index);
+}
+
+// == TBRendererSoftwareTiled =====================================================
+
+TBRendererSoftwareTiled::TBRendererSoftwareTiled()
+	: m_workers(nullptr)
+	, m_num_threads(1)
+	, m_tiles(nullptr)
+	, m_tiles_x(0), m_tiles_y(0)
+{
+	SetNumThreads(std::thread::hardware_concurrency());
+}
+
+TBRendererSoftwareTiled::~TBRendererSoftwareTiled()
+{
+	delete m_workers;
+	delete [] m_tiles;
+}
+
+void TBRendererSoftwareTiled::SetNumThreads(int num_threads)
+{
+	num_threads = CLAMP(num_threads, 1, MAX_THREADS);
+	if (num_threads == m_num_threads)
+		return;
+	Resolve();
+	delete m_workers;
+	m_workers = nullptr;
+	m_num_threads = num_threads;
+	if (num_threads > 1)
+		m_workers = new TBTileWorkers(this, num_threads - 1);
+}
+
+void TBRendererSoftwareTiled::SetupTiles()
+{
+	// The tiles only grow, so switching between the framebuffer and smaller
+	// render targets reuses them. A smaller target just uses the top left tiles.
+	const int tiles_x = (m_target.width + TILE_SIZE - 1) / TILE_SIZE;
+	const int tiles_y = (m_target.height + TILE_SIZE - 1) / TILE_SIZE;
+	if (m_tiles && tiles_x <= m_tiles_x && tiles_y <= m_tiles_y)
+		return;
+	delete [] m_tiles;
+	m_tiles_x = MAX(tiles_x, m_tiles_x);
+	m_tiles_y = MAX(tiles_y, m_tiles_y);
+	m_tiles = new Tile[m_tiles_x * m_tiles_y];
+	for (int y = 0; y < m_tiles_y; y++)
+		for (int x = 0; x < m_tiles_x; x++)
+			m_tiles[y * m_tiles_x + x].rect.Set(x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+}
+
+void TBRendererSoftwareTiled::RenderBatch(Batch *batch)
+{
+	if (m_num_threads == 1)
+	{
+		TBRendererSoftware::RenderBatch(batch);
+		return;
+	}
+	SetupTiles();
+	TBBitmapSoftware *bitmap = static_cast<TBBitmapSoftware *>(batch->bitmap);
+	if (m_binned_bitmaps.Find(bitmap) == -1 && !m_binned_bitmaps.Add(bitmap))
+	{
+		// It can't be tracked (See FlushBitmap), so paint it now, after what is binned.
+		Resolve();
+		TBRendererSoftware::RenderBatch(batch);
+		return;
+	}
+	for (int i = 0; i < batch->instance_count; i++)
+	{
+		const Instance &instance = batch->instance[i];
+
+		// Find the tiles touched by the unflipped quad.
+		int x = instance.x, y = instance.y, w = instance.w, h = instance.h;
+		if (w < 0)
+		{
+			x += w;
+			w = -w;
+		}
+		if (h < 0)
+		{
+			y += h;
+			h = -h;
+		}
+		TBRect rect = TBRect(x, y, w, h).Clip(TBRect(0, 0, m_target.width, m_target.height));
+		if (rect.IsEmpty())
+			continue;
+
+		const int index = m_instances.GetAppendPos() / sizeof(BinnedInstance);
+		BinnedInstance binned_instance = { instance, bitmap };
+		if (!m_instances.Append((const char *) &binned_instance, sizeof(BinnedInstance)))
+			continue;
+
+		const int tx1 = (rect.x + rect.w - 1) / TILE_SIZE;
+		const int ty1 = (rect.y + rect.h - 1) / TILE_SIZE;
+		for (int ty = rect.y / TILE_SIZE; ty <= ty1; ty++)
+			for (int tx = rect.x / TILE_SIZE; tx <= tx1; tx++)
+			{
+				const int tile_index = ty * m_tiles_x + tx;
+				Tile &tile = m_tiles[tile_index];
+				if (!tile.indices.GetAppendPos())
+					m_used_tiles.Append((const char *) &tile_index, sizeof(int));
+				tile.indices.Append((const char *) &index, sizeof(int));
+			}
+	}
+}
+
+void TBRendererSoftwareTiled::PaintTile(int used_tile_index)
+{
+	Tile &tile = m_tiles[((const int *) m_used_tiles.GetData())[used_tile_index]];
+	const BinnedInstance *instances = (const BinnedInstance *) m_instances.GetData();
+	const int *indices = (const int *) tile.indices.GetData();
+	const int count = tile.indices.GetAppendPos() / sizeof(int);
+	for (int i = 0; i < count; i++)
+	{
+		const BinnedInstance &binned_instance = instances[indices[i]];
+		RasterizeInstance(m_target, tile.rect, binned_instance.instance, binned_instance.bitmap);
+	}
+}
+
+void TBRendererSoftwareTiled::Resolve()
+{
+	const int num_used_tiles = m_used_tiles.GetAppendPos() / sizeof(int);
+	if (!num_used_tiles)
+		return;
+
+	if (m_workers)
+		m_workers->Run(num_used_tiles);
+	else
+		for (int i = 0; i < num_used_tiles; i++)
+			PaintTile(i);
+
+	const int *used_tiles = (const int *) m_used_tiles.GetData();
+	for (int i = 0; i < num_used_tiles; i++)
+		m_tiles[used_tiles[i]].indices.ResetAppendPos();
+	m_used_tiles.ResetAppendPos();
+	m_instances.ResetAppendPos();
+	m_binned_bitmaps.RemoveAll();
+}
+
+void TBRendererSoftwareTiled::EndPaint()
+{
+	TBRendererSoftware::EndPaint();
+	Resolve();
+}
+
+void TBRendererSoftwareTiled::FlushBitmap(TBBitmap *bitmap)
+{
+	// The bitmap is about to change or be deleted, so paint everything
+	// still using it. Other bitmaps (f.ex new glyphs) don't interrupt the frame.
+	TBRendererSoftware::FlushBitmap(bitmap);
+	if (m_binned_bitmaps.Find(static_cast<TBBitmapSoftware *>(bitmap)) != -1)
+		Resolve();
+}
+
+void TBRendererSoftwareTiled::SetRenderTarget(TBBitmap *render_target, bool clear)
+{
+	// Binned instances are painted into the current target.
+	Resolve();
+	TBRendererSoftware::SetRenderTarget(render_target, clear);
+}
+
+} // namespace tb
+
+#endif // TB_RENDERER_SOFTWARE
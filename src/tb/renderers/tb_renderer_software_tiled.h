@@ -0,0 +1,89 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#ifndef TB_RENDERER_SOFTWARE_TILED_H
+#define TB_RENDERER_SOFTWARE_TILED_H
+
+#include "renderers/tb_renderer_software.h"
+
+#ifdef TB_RENDERER_SOFTWARE
+
+#include "tb_tempbuffer.h"
+#include "tb_list.h"
+
+namespace tb {
+
+class TBTileWorkers;
+
+/** TBRendererSoftwareTiled is a TBRendererSoftware that paints using several threads.
+
+	Batches are not painted when they are rendered. Their quads are instead binned into the
+	tiles of the surface they touch, and the tiles are painted in parallel when the frame ends
+	(or before a bitmap is changed or the render target is switched). Each tile paints its
+	quads in the order they were added, so the result is exactly the same as painting with
+	TBRendererSoftware. */
+class TBRendererSoftwareTiled : public TBRendererSoftware
+{
+public:
+	/** The width and height in pixels of each tile. */
+	static const int TILE_SIZE = 64;
+
+	TBRendererSoftwareTiled();
+	virtual ~TBRendererSoftwareTiled();
+
+	/** Set the number of threads painting tiles, including the thread that ends the frame.
+		1 paints everything on the calling thread. The default is the number of CPU cores. */
+	void SetNumThreads(int num_threads);
+	int GetNumThreads() const { return m_num_threads; }
+
+	/** Paint all quads binned so far. This is done automatically by EndPaint, and before
+		a bitmap used by them is changed or the render target is switched. */
+	void Resolve();
+
+	// == TBRenderer ====================================================================
+
+	virtual void EndPaint();
+	virtual void FlushBitmap(TBBitmap *bitmap);
+
+	// == TBRendererBatcher ===============================================================
+
+	virtual void RenderBatch(Batch *batch);
+	virtual void SetRenderTarget(TBBitmap *render_target, bool clear);
+private:
+	friend class TBTileWorkers;
+
+	/** A quad waiting to be painted. */
+	struct BinnedInstance
+	{
+		Instance instance;
+		TBBitmapSoftware *bitmap;
+	};
+
+	/** A part of the surface, and the indices of the binned instances touching it. */
+	struct Tile
+	{
+		TBRect rect;
+		TBTempBuffer indices;
+	};
+
+	/** Set up the tiles for the current target surface, if it's larger than the tiles. */
+	void SetupTiles();
+
+	/** Paint all binned instances touching the tile at the given index in m_used_tiles. */
+	void PaintTile(int used_tile_index);
+
+	TBTileWorkers *m_workers;		///< The threads besides the calling thread, or nullptr.
+	int m_num_threads;
+	Tile *m_tiles;
+	int m_tiles_x, m_tiles_y;		///< The number of tiles, which covers the largest surface so far.
+	TBTempBuffer m_instances;		///< Binned instances (BinnedInstance).
+	TBTempBuffer m_used_tiles;		///< Indices (int) of the tiles that have any instances.
+	TBListOf<TBBitmapSoftware> m_binned_bitmaps;	///< The bitmaps used by the binned instances.
+};
+
+} // namespace tb
+
+#endif // TB_RENDERER_SOFTWARE
+#endif // TB_RENDERER_SOFTWARE_TILED_H
@@ -6,9 +6,20 @@
 #include "tb_bitmap_fragment.h"
 #include "tb_renderer.h"
 #include "tb_system.h"
+#include "tb_tempbuffer.h"
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
 
 namespace tb {
 
+/** The max number of dirty rectangles uploaded separately when a fragment map
+	is validated. If there are more, the whole bitmap is uploaded. */
+#define MAX_DIRTY_RECTS 16
+
+/** The max number of threads decoding image files. */
+#define MAX_DECODE_THREADS 64
+
 int TBGetNearestPowerOfTwo(int val)
 {
 	int i;
@@ -157,11 +168,298 @@ void TBSpaceAllocator::FreeSpace(Space *space)
 #endif // TB_RUNTIME_DEBUG_INFO
 }
 
+// == TBFragmentPacker ======================================================================================
+
+TBFragmentPacker *TBFragmentPacker::Create(TB_FRAGMENT_PACKER type, int width, int height)
+{
+	if (type == TB_FRAGMENT_PACKER_SKYLINE)
+	{
+		TBFragmentPackerSkyline *packer = new TBFragmentPackerSkyline(width, height);
+		if (packer && !packer->Init())
+		{
+			delete packer;
+			return nullptr;
+		}
+		return packer;
+	}
+	return new TBFragmentPackerRows(width, height);
+}
+
+// == TBFragmentPackerRows ==================================================================================
+
+bool TBFragmentPackerRows::AllocSpace(TBBitmapFragment *frag, int needed_w, int needed_h)
+{
+	// Finding available space works like this:
+	// The map size is sliced up horizontally in rows (initially just one row covering
+	// the entire map). When adding a new fragment, put it in the row with smallest height.
+	// If the smallest row is empty, it may slice the row to make a even smaller row.
+
+	if (!m_rows.GetNumItems())
+	{
+		// Create a row covering the entire bitmap.
+		TBFragmentSpaceAllocator *row;
+		if (!m_rows.GrowIfNeeded() || !(row = new TBFragmentSpaceAllocator(0, m_width, m_height)))
+			return false;
+		m_rows.Add(row);
+	}
+	// Get the smallest row where we fit
+	int best_row_index = -1;
+	TBFragmentSpaceAllocator *best_row = nullptr;
+	for (int i = 0; i < m_rows.GetNumItems(); i++)
+	{
+		TBFragmentSpaceAllocator *row = m_rows[i];
+		if (!best_row || row->height < best_row->height)
+		{
+			// This is the best row so far, if we fit
+			if (needed_h <= row->height && row->HasSpace(needed_w))
+			{
+				best_row = row;
+				best_row_index = i;
+				if (needed_h == row->height)
+					break; // We can't find a smaller line, so we're done
+			}
+		}
+	}
+	// Return if we're full
+	if (!best_row)
+		return false;
+	// If the row is unused, create a smaller row to only consume needed height for fragment
+	if (best_row->IsAllAvailable() && needed_h < best_row->height)
+	{
+		TBFragmentSpaceAllocator *row;
+		if (!m_rows.GrowIfNeeded() ||
+			!(row = new TBFragmentSpaceAllocator(best_row->y + needed_h, m_width, best_row->height - needed_h)))
+			return false;
+		// Keep the rows sorted from top to bottom
+		m_rows.Add(row, best_row_index + 1);
+		best_row->height = needed_h;
+	}
+	TBFragmentSpaceAllocator::Space *space = best_row->AllocSpace(needed_w);
+	if (!space)
+		return false;
+	frag->m_row = best_row;
+	frag->m_space = space;
+	frag->m_alloc_rect.Set(space->x, best_row->y, space->width, best_row->height);
+	return true;
+}
+
+void TBFragmentPackerRows::FreeSpace(TBBitmapFragment *frag)
+{
+	TBFragmentSpaceAllocator *freed_row = frag->m_row;
+	freed_row->FreeSpace(frag->m_space);
+	frag->m_row = nullptr;
+	frag->m_space = nullptr;
+
+	// If the row is now empty, merge empty rows so larger fragments
+	// have a chance of allocating the space.
+	if (freed_row->IsAllAvailable())
+	{
+		for (int i = 0; i < m_rows.GetNumItems() - 1; i++)
+		{
+			assert(i >= 0);
+			assert(i < m_rows.GetNumItems() - 1);
+			TBFragmentSpaceAllocator *row = m_rows.Get(i);
+			TBFragmentSpaceAllocator *next_row = m_rows.Get(i + 1);
+			if (row->IsAllAvailable() && next_row->IsAllAvailable())
+			{
+				row->height += next_row->height;
+				m_rows.Delete(i + 1);
+				i--;
+			}
+		}
+	}
+}
+
+// == TBFragmentPackerSkyline ===============================================================================
+
+TBFragmentPackerSkyline::TBFragmentPackerSkyline(int width, int height)
+	: m_nodes(nullptr)
+	, m_num_nodes(0)
+	, m_num_allocated(0)
+	, m_width(width)
+	, m_height(height)
+{
+}
+
+TBFragmentPackerSkyline::~TBFragmentPackerSkyline()
+{
+	delete [] m_nodes;
+}
+
+bool TBFragmentPackerSkyline::Init()
+{
+	// Nodes are at least 1px wide, so there can't be more nodes than pixels in width.
+	m_nodes = new Node[m_width];
+	if (!m_nodes)
+		return false;
+	m_nodes[0].x = 0;
+	m_nodes[0].y = 0;
+	m_nodes[0].w = m_width;
+	m_num_nodes = 1;
+	return true;
+}
+
+int TBFragmentPackerSkyline::GetFitY(int index, int needed_w, int needed_h) const
+{
+	const int x = m_nodes[index].x;
+	if (x + needed_w > m_width)
+		return -1;
+	int y = 0;
+	for (int i = index; i < m_num_nodes && m_nodes[i].x < x + needed_w; i++)
+		y = MAX(y, m_nodes[i].y);
+	return y + needed_h <= m_height ? y : -1;
+}
+
+void TBFragmentPackerSkyline::SplitAt(int x)
+{
+	for (int i = 0; i < m_num_nodes; i++)
+	{
+		Node &node = m_nodes[i];
+		if (x <= node.x)
+			return;
+		if (x < node.x + node.w)
+		{
+			memmove(&m_nodes[i + 2], &m_nodes[i + 1], sizeof(Node) * (m_num_nodes - i - 1));
+			m_nodes[i + 1].x = x;
+			m_nodes[i + 1].y = node.y;
+			m_nodes[i + 1].w = node.x + node.w - x;
+			node.w = x - node.x;
+			m_num_nodes++;
+			return;
+		}
+	}
+}
+
+void TBFragmentPackerSkyline::SetSkyline(int x, int w, int y, int waste_y)
+{
+	SplitAt(x);
+	SplitAt(x + w);
+	int first = 0;
+	while (m_nodes[first].x < x)
+		first++;
+	int end = first;
+	for (; end < m_num_nodes && m_nodes[end].x < x + w; end++)
+	{
+		// Remember the space between the old and the new skyline, so it can still
+		// be used by smaller fragments. If that fails, the space is just lost.
+		const Node &node = m_nodes[end];
+		if (node.y < waste_y)
+			m_waste.IncludeRect(TBRect(node.x, node.y, node.w, waste_y - node.y));
+	}
+
+	// Replace the nodes with one, and merge it with neighbours at the same height.
+	m_nodes[first].x = x;
+	m_nodes[first].y = y;
+	m_nodes[first].w = w;
+	memmove(&m_nodes[first + 1], &m_nodes[end], sizeof(Node) * (m_num_nodes - end));
+	m_num_nodes -= end - first - 1;
+	if (first + 1 < m_num_nodes && m_nodes[first + 1].y == y)
+	{
+		m_nodes[first].w += m_nodes[first + 1].w;
+		memmove(&m_nodes[first + 1], &m_nodes[first + 2], sizeof(Node) * (m_num_nodes - first - 2));
+		m_num_nodes--;
+	}
+	if (first > 0 && m_nodes[first - 1].y == y)
+	{
+		m_nodes[first - 1].w += m_nodes[first].w;
+		memmove(&m_nodes[first], &m_nodes[first + 1], sizeof(Node) * (m_num_nodes - first - 1));
+		m_num_nodes--;
+	}
+}
+
+bool TBFragmentPackerSkyline::LowerSkyline()
+{
+	for (int i = 0; i < m_waste.GetNumRects(); i++)
+	{
+		const TBRect rect = m_waste.GetRect(i);
+		for (int j = 0; j < m_num_nodes && m_nodes[j].x < rect.x + rect.w; j++)
+		{
+			const Node &node = m_nodes[j];
+			if (node.x + node.w <= rect.x || node.y != rect.y + rect.h)
+				continue;
+			const int x = MAX(node.x, rect.x);
+			const int w = MIN(node.x + node.w, rect.x + rect.w) - x;
+			if (!m_waste.ExcludeRect(TBRect(x, rect.y, w, rect.h)))
+				return false;
+			SetSkyline(x, w, rect.y, 0);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TBFragmentPackerSkyline::AllocSpace(TBBitmapFragment *frag, int needed_w, int needed_h)
+{
+	// Use the smallest wasted space the fragment fits in, if any.
+	int best_index = -1;
+	int best_area = 0;
+	for (int i = 0; i < m_waste.GetNumRects(); i++)
+	{
+		const TBRect &rect = m_waste.GetRect(i);
+		if (needed_w <= rect.w && needed_h <= rect.h && (best_index == -1 || rect.w * rect.h < best_area))
+		{
+			best_index = i;
+			best_area = rect.w * rect.h;
+		}
+	}
+	if (best_index != -1)
+	{
+		const TBRect &rect = m_waste.GetRect(best_index);
+		frag->m_alloc_rect.Set(rect.x, rect.y, needed_w, needed_h);
+		if (!m_waste.ExcludeRect(frag->m_alloc_rect))
+			return false;
+		m_num_allocated++;
+		return true;
+	}
+
+	// Otherwise put it on the skyline where its bottom ends up highest. If there are
+	// several such places, use the narrowest node to keep wide nodes for wide fragments.
+	int best_y = 0;
+	for (int i = 0; i < m_num_nodes; i++)
+	{
+		const int y = GetFitY(i, needed_w, needed_h);
+		if (y == -1)
+			continue;
+		if (best_index == -1 || y < best_y || (y == best_y && m_nodes[i].w < m_nodes[best_index].w))
+		{
+			best_index = i;
+			best_y = y;
+		}
+	}
+	if (best_index == -1)
+		return false;
+	frag->m_alloc_rect.Set(m_nodes[best_index].x, best_y, needed_w, needed_h);
+	SetSkyline(frag->m_alloc_rect.x, needed_w, best_y + needed_h, best_y);
+	m_num_allocated++;
+	return true;
+}
+
+void TBFragmentPackerSkyline::FreeSpace(TBBitmapFragment *frag)
+{
+	if (--m_num_allocated == 0)
+	{
+		m_nodes[0].x = 0;
+		m_nodes[0].y = 0;
+		m_nodes[0].w = m_width;
+		m_num_nodes = 1;
+		m_waste.RemoveAll(false);
+		return;
+	}
+	// Wasted space that ends up right on top of the skyline is given back to it.
+	m_waste.IncludeRect(frag->m_alloc_rect);
+	while (LowerSkyline())
+		;
+}
+
 // == TBBitmapFragmentMap ===================================================================================
 
 TBBitmapFragmentMap::TBBitmapFragmentMap()
-	: m_bitmap_w(0)
+	: m_packer(nullptr)
+	, m_bitmap_w(0)
 	, m_bitmap_h(0)
+	, m_format(TB_BITMAP_FORMAT_RGBA32)
+	, m_packer_type(TB_FRAGMENT_PACKER_ROWS)
+	, m_bytes_per_pixel(4)
 	, m_bitmap_data(nullptr)
 	, m_bitmap(nullptr)
 	, m_need_update(false)
@@ -169,14 +467,20 @@ TBBitmapFragmentMap::TBBitmapFragmentMap()
 {
 }
 
-bool TBBitmapFragmentMap::Init(int bitmap_w, int bitmap_h)
+bool TBBitmapFragmentMap::Init(int bitmap_w, int bitmap_h, TB_BITMAP_FORMAT format, TB_FRAGMENT_PACKER packer)
 {
-	m_bitmap_data = new uint32_t[bitmap_w * bitmap_h];
+	m_format = format;
+	m_packer_type = packer;
+	m_packer = TBFragmentPacker::Create(packer, bitmap_w, bitmap_h);
+	if (!m_packer)
+		return false;
+	m_bytes_per_pixel = TBGetBytesPerPixel(format);
+	m_bitmap_data = new uint8_t[bitmap_w * bitmap_h * m_bytes_per_pixel];
 	m_bitmap_w = bitmap_w;
 	m_bitmap_h = bitmap_h;
 #ifdef TB_RUNTIME_DEBUG_INFO
 	if (m_bitmap_data)
-		memset(m_bitmap_data, 0x88, bitmap_w * bitmap_h * sizeof(uint32_t));
+		memset(m_bitmap_data, 0x88, bitmap_w * bitmap_h * m_bytes_per_pixel);
 #endif
 	return m_bitmap_data ? true : false;
 }
@@ -185,18 +489,14 @@ TBBitmapFragmentMap::~TBBitmapFragmentMap()
 {
 	delete m_bitmap;
 	delete [] m_bitmap_data;
+	delete m_packer;
 }
 
 TBBitmapFragment *TBBitmapFragmentMap::CreateNewFragment(int frag_w, int frag_h,
 														 int data_stride,
-														 uint32_t *frag_data,
+														 void *frag_data,
 														 bool add_border)
 {
-	// Finding available space works like this:
-	// The map size is sliced up horizontally in rows (initially just one row covering
-	// the entire map). When adding a new fragment, put it in the row with smallest height.
-	// If the smallest row is empty, it may slice the row to make a even smaller row.
-
 	// When a image is stretched up to a larger size, the filtering will read
 	// pixels closest (but outside) of the src_rect. When we pack images together
 	// those pixels would be read from neighbour images, so we must add border space
@@ -224,66 +524,24 @@ TBBitmapFragment *TBBitmapFragmentMap::CreateNewFragment(int frag_w, int frag_h,
 	//needed_w = (needed_w + granularity - 1) / granularity * granularity;
 	//needed_h = (needed_h + granularity - 1) / granularity * granularity;
 
-	if (!m_rows.GetNumItems())
-	{
-		// Create a row covering the entire bitmap.
-		TBFragmentSpaceAllocator *row;
-		if (!m_rows.GrowIfNeeded() || !(row = new TBFragmentSpaceAllocator(0, m_bitmap_w, m_bitmap_h)))
-			return nullptr;
-		m_rows.Add(row);
-	}
-	// Get the smallest row where we fit
-	int best_row_index = -1;
-	TBFragmentSpaceAllocator *best_row = nullptr;
-	for (int i = 0; i < m_rows.GetNumItems(); i++)
-	{
-		TBFragmentSpaceAllocator *row = m_rows[i];
-		if (!best_row || row->height < best_row->height)
-		{
-			// This is the best row so far, if we fit
-			if (needed_h <= row->height && row->HasSpace(needed_w))
-			{
-				best_row = row;
-				best_row_index = i;
-				if (needed_h == row->height)
-					break; // We can't find a smaller line, so we're done
-			}
-		}
-	}
-	// Return if we're full
-	if (!best_row)
-		return nullptr;
-	// If the row is unused, create a smaller row to only consume needed height for fragment
-	if (best_row->IsAllAvailable() && needed_h < best_row->height)
-	{
-		TBFragmentSpaceAllocator *row;
-		if (!m_rows.GrowIfNeeded() ||
-			!(row = new TBFragmentSpaceAllocator(best_row->y + needed_h, m_bitmap_w, best_row->height - needed_h)))
-			return nullptr;
-		// Keep the rows sorted from top to bottom
-		m_rows.Add(row, best_row_index + 1);
-		best_row->height = needed_h;
-	}
 	// Allocate the fragment and copy the fragment data into the map data.
-	if (TBFragmentSpaceAllocator::Space *space = best_row->AllocSpace(needed_w))
+	TBBitmapFragment *frag = new TBBitmapFragment;
+	if (!frag)
+		return nullptr;
+	frag->m_map = this;
+	frag->m_row = nullptr;
+	frag->m_space = nullptr;
+	if (!m_packer->AllocSpace(frag, needed_w, needed_h))
 	{
-		if (TBBitmapFragment *frag = new TBBitmapFragment)
-		{
-			frag->m_map = this;
-			frag->m_row = best_row;
-			frag->m_space = space;
-			frag->m_rect.Set(space->x + border, best_row->y + border, frag_w, frag_h);
-			frag->m_row_height = best_row->height;
-			frag->m_batch_id = 0xffffffff;
-			CopyData(frag, data_stride, frag_data, border);
-			m_need_update = true;
-			m_allocated_pixels += frag->m_space->width * frag->m_row->height;
-			return frag;
-		}
-		else
-			best_row->FreeSpace(space);
+		delete frag;
+		return nullptr;
 	}
-	return nullptr;
+	frag->m_rect.Set(frag->m_alloc_rect.x + border, frag->m_alloc_rect.y + border, frag_w, frag_h);
+	frag->m_batch_id = 0xffffffff;
+	CopyData(frag, data_stride, frag_data, border);
+	m_need_update = true;
+	m_allocated_pixels += frag->m_alloc_rect.w * frag->m_alloc_rect.h;
+	return frag;
 }
 
 void TBBitmapFragmentMap::FreeFragmentSpace(TBBitmapFragment *frag)
@@ -292,78 +550,181 @@ void TBBitmapFragmentMap::FreeFragmentSpace(TBBitmapFragment *frag)
 		return;
 	assert(frag->m_map == this);
 
+	const TBRect alloc_rect = frag->m_alloc_rect;
 #ifdef TB_RUNTIME_DEBUG_INFO
 	// Debug code to clear the area in debug builds so it's easier to
 	// see & debug the allocation & deallocation of fragments in maps.
-	if (uint32_t *data32 = new uint32_t[frag->m_space->width * frag->m_row->height])
+	if (uint8_t *data = new uint8_t[alloc_rect.w * alloc_rect.h * m_bytes_per_pixel])
 	{
 		static int c = 0;
-		memset(data32, (c++) * 32, sizeof(uint32_t) * frag->m_space->width * frag->m_row->height);
-		CopyData(frag, frag->m_space->width, data32, false);
+		memset(data, (c++) * 32, alloc_rect.w * alloc_rect.h * m_bytes_per_pixel);
+		TBRect rect = frag->m_rect;
+		frag->m_rect = alloc_rect;
+		CopyData(frag, alloc_rect.w, data, false);
+		frag->m_rect = rect;
 		m_need_update = true;
-		delete [] data32;
+		delete [] data;
 	}
 #endif // TB_RUNTIME_DEBUG_INFO
 
-	m_allocated_pixels -= frag->m_space->width * frag->m_row->height;
-	frag->m_row->FreeSpace(frag->m_space);
-	frag->m_space = nullptr;
-	frag->m_row_height = 0;
+	m_allocated_pixels -= alloc_rect.w * alloc_rect.h;
+	m_packer->FreeSpace(frag);
+	frag->m_alloc_rect = TBRect();
+}
 
-	// If the row is now empty, merge empty rows so larger fragments
-	// have a chance of allocating the space.
-	if (frag->m_row->IsAllAvailable())
+/** A fragment being repacked by TBBitmapFragmentMap::Compact, and its old space. */
+struct TBCompactFragment
+{
+	TBBitmapFragment *frag;
+	TBRect alloc_rect;
+	TBFragmentSpaceAllocator *row;
+	TBFragmentSpaceAllocator::Space *space;
+};
+
+static int CompareCompactFragments(const void *a, const void *b)
+{
+	// Pack the tallest (and then widest) first, which packs tightest.
+	const TBRect &ra = ((const TBCompactFragment *) a)->alloc_rect;
+	const TBRect &rb = ((const TBCompactFragment *) b)->alloc_rect;
+	if (ra.h != rb.h)
+		return rb.h - ra.h;
+	return rb.w - ra.w;
+}
+
+bool TBBitmapFragmentMap::Compact(const TBListOf<TBBitmapFragment> &frags)
+{
+	// Pack everything with a new packer into new data, so nothing has changed if it fails.
+	const int num_frags = frags.GetNumItems();
+	TBFragmentPacker *packer = TBFragmentPacker::Create(m_packer_type, m_bitmap_w, m_bitmap_h);
+	uint8_t *data = packer ? new uint8_t[m_bitmap_w * m_bitmap_h * m_bytes_per_pixel] : nullptr;
+	TBCompactFragment *cfrags = data ? new TBCompactFragment[MAX(num_frags, 1)] : nullptr;
+	if (!cfrags)
 	{
-		for (int i = 0; i < m_rows.GetNumItems() - 1; i++)
+		delete [] data;
+		delete packer;
+		return false;
+	}
+	for (int i = 0; i < num_frags; i++)
+	{
+		TBBitmapFragment *frag = frags[i];
+		assert(frag->m_map == this);
+		cfrags[i].frag = frag;
+		cfrags[i].alloc_rect = frag->m_alloc_rect;
+		cfrags[i].row = frag->m_row;
+		cfrags[i].space = frag->m_space;
+	}
+	qsort(cfrags, num_frags, sizeof(TBCompactFragment), CompareCompactFragments);
+
+	int num_packed = 0;
+	for (; num_packed < num_frags; num_packed++)
+	{
+		const TBRect &rect = cfrags[num_packed].alloc_rect;
+		if (!packer->AllocSpace(cfrags[num_packed].frag, rect.w, rect.h))
+			break;
+	}
+	if (num_packed < num_frags)
+	{
+		for (int i = 0; i < num_frags; i++)
 		{
-			assert(i >= 0);
-			assert(i < m_rows.GetNumItems() - 1);
-			TBFragmentSpaceAllocator *row = m_rows.Get(i);
-			TBFragmentSpaceAllocator *next_row = m_rows.Get(i + 1);
-			if (row->IsAllAvailable() && next_row->IsAllAvailable())
-			{
-				row->height += next_row->height;
-				m_rows.Delete(i + 1);
-				i--;
-			}
+			cfrags[i].frag->m_alloc_rect = cfrags[i].alloc_rect;
+			cfrags[i].frag->m_row = cfrags[i].row;
+			cfrags[i].frag->m_space = cfrags[i].space;
 		}
+		delete [] cfrags;
+		delete [] data;
+		delete packer;
+		return false;
+	}
+
+#ifdef TB_RUNTIME_DEBUG_INFO
+	memset(data, 0x88, m_bitmap_w * m_bitmap_h * m_bytes_per_pixel);
+#endif
+	// Move the data of each fragment (including its border) to its new place.
+	const int bpp = m_bytes_per_pixel;
+	for (int i = 0; i < num_frags; i++)
+	{
+		TBBitmapFragment *frag = cfrags[i].frag;
+		const TBRect &src_rect = cfrags[i].alloc_rect;
+		const TBRect &dst_rect = frag->m_alloc_rect;
+		for (int y = 0; y < src_rect.h; y++)
+			memcpy(data + (dst_rect.x + (dst_rect.y + y) * m_bitmap_w) * bpp,
+				   m_bitmap_data + (src_rect.x + (src_rect.y + y) * m_bitmap_w) * bpp, src_rect.w * bpp);
+		frag->m_rect.x += dst_rect.x - src_rect.x;
+		frag->m_rect.y += dst_rect.y - src_rect.y;
 	}
+	delete [] cfrags;
+	delete [] m_bitmap_data;
+	delete m_packer;
+	m_bitmap_data = data;
+	m_packer = packer;
+	m_dirty_region.Set(TBRect(0, 0, m_bitmap_w, m_bitmap_h));
+	m_need_update = true;
+	return true;
 }
 
-void TBBitmapFragmentMap::CopyData(TBBitmapFragment *frag, int data_stride, uint32_t *frag_data, int border)
+void TBBitmapFragmentMap::CopyData(TBBitmapFragment *frag, int data_stride, void *frag_data, int border)
 {
+	// Remember the changed area, so only that has to be uploaded to the bitmap.
+	// If we're out of memory, fall back to uploading everything.
+	if (!m_dirty_region.IncludeRect(frag->m_rect.Expand(border, border)))
+		m_dirty_region.Set(TBRect(0, 0, m_bitmap_w, m_bitmap_h));
+
 	// Copy the bitmap data
-	uint32_t *dst = m_bitmap_data + frag->m_rect.x + frag->m_rect.y * m_bitmap_w;
-	uint32_t *src = frag_data;
+	const int bpp = m_bytes_per_pixel;
+	uint8_t *dst = m_bitmap_data + (frag->m_rect.x + frag->m_rect.y * m_bitmap_w) * bpp;
+	uint8_t *src = (uint8_t *) frag_data;
 	for (int i = 0; i < frag->m_rect.h; i++)
 	{
-		memcpy(dst, src, frag->m_rect.w * sizeof(uint32_t));
-		dst += m_bitmap_w;
-		src += data_stride;
+		memcpy(dst, src, frag->m_rect.w * bpp);
+		dst += m_bitmap_w * bpp;
+		src += data_stride * bpp;
 	}
 	// Copy the bitmap data to the border around the fragment
 	if (border)
 	{
 		TBRect rect = frag->m_rect.Expand(border, border);
+		if (m_format != TB_BITMAP_FORMAT_RGBA32)
+		{
+			// No color, so the border is simply left transparent.
+			for (int y = rect.y; y < rect.y + rect.h; y++)
+			{
+				uint8_t *row = m_bitmap_data + rect.x + y * m_bitmap_w;
+				if (y == rect.y || y == rect.y + rect.h - 1)
+					memset(row, 0, rect.w);
+				else
+					row[0] = row[rect.w - 1] = 0;
+			}
+			return;
+		}
+		uint32_t *bitmap_data32 = (uint32_t *) m_bitmap_data;
+		uint32_t *frag_data32 = (uint32_t *) frag_data;
 		// Copy vertical edges
-		dst = m_bitmap_data + rect.x + (rect.y + 1) * m_bitmap_w;
-		src = frag_data;
+		uint32_t *dst32 = bitmap_data32 + rect.x + (rect.y + 1) * m_bitmap_w;
+		uint32_t *src32 = frag_data32;
 		for (int i = 0; i < frag->m_rect.h; i++)
 		{
-			dst[0] = src[0] & 0x00ffffff;
-			dst[rect.w - 1] = src[frag->m_rect.w - 1] & 0x00ffffff;
-			dst += m_bitmap_w;
-			src += data_stride;
+			dst32[0] = src32[0] & 0x00ffffff;
+			dst32[rect.w - 1] = src32[frag->m_rect.w - 1] & 0x00ffffff;
+			dst32 += m_bitmap_w;
+			src32 += data_stride;
 		}
 		// Copy horizontal edges
-		dst = m_bitmap_data + rect.x + 1 + rect.y * m_bitmap_w;
-		src = frag_data;
+		dst32 = bitmap_data32 + rect.x + 1 + rect.y * m_bitmap_w;
+		src32 = frag_data32;
 		for (int i = 0; i < frag->m_rect.w; i++)
-			dst[i] = src[i] & 0x00ffffff;
-		dst = m_bitmap_data + rect.x + 1 + (rect.y + rect.h - 1) * m_bitmap_w;
-		src = frag_data + (frag->m_rect.h - 1) * data_stride;
+			dst32[i] = src32[i] & 0x00ffffff;
+		dst32 = bitmap_data32 + rect.x + 1 + (rect.y + rect.h - 1) * m_bitmap_w;
+		src32 = frag_data32 + (frag->m_rect.h - 1) * data_stride;
 		for (int i = 0; i < frag->m_rect.w; i++)
-			dst[i] = src[i] & 0x00ffffff;
+			dst32[i] = src32[i] & 0x00ffffff;
+		// Copy corners, so filtering never reads whatever was left in the map.
+		const int last_x = frag->m_rect.w - 1, last_y = (frag->m_rect.h - 1) * data_stride;
+		dst32 = bitmap_data32 + rect.x + rect.y * m_bitmap_w;
+		dst32[0] = frag_data32[0] & 0x00ffffff;
+		dst32[rect.w - 1] = frag_data32[last_x] & 0x00ffffff;
+		dst32 += (rect.h - 1) * m_bitmap_w;
+		dst32[0] = frag_data32[last_y] & 0x00ffffff;
+		dst32[rect.w - 1] = frag_data32[last_y + last_x] & 0x00ffffff;
 	}
 }
 
@@ -380,9 +741,10 @@ bool TBBitmapFragmentMap::ValidateBitmap()
 	if (m_need_update)
 	{
 		if (m_bitmap)
-			m_bitmap->SetData(m_bitmap_data);
+			UpdateBitmap();
 		else
-			m_bitmap = g_renderer->CreateBitmap(m_bitmap_w, m_bitmap_h, m_bitmap_data);
+			m_bitmap = g_renderer->CreateBitmapFormat(m_bitmap_w, m_bitmap_h, m_format, m_bitmap_data);
+		m_dirty_region.RemoveAll(false);
 		m_need_update = false;
 	}
 	if (!m_bitmap) {
@@ -391,6 +753,29 @@ bool TBBitmapFragmentMap::ValidateBitmap()
 	return m_bitmap ? true : false;
 }
 
+void TBBitmapFragmentMap::UpdateBitmap()
+{
+	// Upload only the changed parts (f.ex a few new glyphs), unless
+	// there are so many that uploading everything is cheaper.
+	const int num_rects = m_dirty_region.GetNumRects();
+	if (num_rects && num_rects <= MAX_DIRTY_RECTS)
+	{
+		int i = 0;
+		for (; i < num_rects; i++)
+		{
+			const TBRect &rect = m_dirty_region.GetRect(i);
+			if (!m_bitmap->SetDataRect(rect, m_bitmap_data + (rect.x + rect.y * m_bitmap_w) * m_bytes_per_pixel, m_bitmap_w))
+				break;
+		}
+		if (i == num_rects)
+			return;
+	}
+	if (m_format == TB_BITMAP_FORMAT_RGBA32)
+		m_bitmap->SetData((uint32_t *) m_bitmap_data);
+	else
+		m_bitmap->SetDataRect(TBRect(0, 0, m_bitmap_w, m_bitmap_h), m_bitmap_data, m_bitmap_w);
+}
+
 void TBBitmapFragmentMap::DeleteBitmap()
 {
 	delete m_bitmap;
@@ -398,13 +783,30 @@ void TBBitmapFragmentMap::DeleteBitmap()
 	m_need_update = true;
 }
 
+// == TBBitmapFragment ======================================================================================
+
+void TBBitmapFragment::CopyData(void *dst) const
+{
+	const int bpp = m_map->m_bytes_per_pixel;
+	const uint8_t *src = m_map->m_bitmap_data + (m_rect.x + m_rect.y * m_map->m_bitmap_w) * bpp;
+	for (int i = 0; i < m_rect.h; i++)
+		memcpy((uint8_t *) dst + i * m_rect.w * bpp, src + i * m_map->m_bitmap_w * bpp, m_rect.w * bpp);
+}
+
 // == TBBitmapFragmentManager =============================================================================
 
 TBBitmapFragmentManager::TBBitmapFragmentManager()
 	: m_num_maps_limit(0)
 	, m_add_border(false)
+	, m_format(TB_BITMAP_FORMAT_RGBA32)
+	, m_packer(TB_FRAGMENT_PACKER_ROWS)
 	, m_default_map_w(512)
 	, m_default_map_h(512)
+#ifdef __EMSCRIPTEN__
+	, m_num_decode_threads(1)
+#else
+	, m_num_decode_threads(CLAMP((int) std::thread::hardware_concurrency(), 1, MAX_DECODE_THREADS))
+#endif
 {
 }
 
@@ -424,6 +826,7 @@ TBBitmapFragment *TBBitmapFragmentManager::GetFragmentFromFile(const TBStr & fil
 		return frag;
 
 	// Load the file
+	assert(m_format == TB_BITMAP_FORMAT_RGBA32);
 	TBImageLoader *img = TBImageLoader::CreateFromFile(filename, dpi);
 	if (!img)
 		return nullptr;
@@ -433,9 +836,93 @@ TBBitmapFragment *TBBitmapFragmentManager::GetFragmentFromFile(const TBStr & fil
 	return frag;
 }
 
+/** A file decoded by DecodeImageFiles. */
+struct TBImageDecodeJob
+{
+	const TBBitmapFragmentFile *file;
+	TBImageLoader *img;
+};
+
+static void DecodeImageJobs(TBImageDecodeJob *jobs, int num_jobs, std::atomic<int> *next_job)
+{
+	int index;
+	while ((index = (*next_job)++) < num_jobs)
+		jobs[index].img = TBImageLoader::CreateFromFile(jobs[index].file->filename, jobs[index].file->dpi);
+}
+
+/** Decode the file of each job with TBImageLoader, on up to num_threads threads
+	including the calling thread. Returns when all are done. */
+static void DecodeImageFiles(TBImageDecodeJob *jobs, int num_jobs, int num_threads)
+{
+	std::atomic<int> next_job(0);
+	const int num_workers = MIN(num_threads, num_jobs) - 1;
+	std::thread *threads = num_workers > 0 ? new std::thread[num_workers] : nullptr;
+	for (int i = 0; threads && i < num_workers; i++)
+		threads[i] = std::thread(DecodeImageJobs, jobs, num_jobs, &next_job);
+
+	DecodeImageJobs(jobs, num_jobs, &next_job);
+
+	for (int i = 0; threads && i < num_workers; i++)
+		threads[i].join();
+	delete [] threads;
+}
+
+bool TBBitmapFragmentManager::GetFragmentsFromFiles(TBBitmapFragmentFile *files, int num_files)
+{
+	assert(m_format == TB_BITMAP_FORMAT_RGBA32);
+	TBImageDecodeJob *jobs = new TBImageDecodeJob[num_files];
+	if (!jobs)
+		return false;
+
+	// Find the files that must be decoded, each only once even if given several times.
+	TBHashTableOf<TBImageDecodeJob> job_hash;
+	int num_jobs = 0;
+	for (int i = 0; i < num_files; i++)
+	{
+		files[i].fragment = nullptr;
+		const TBID id(files[i].filename);
+		if (files[i].filename.IsEmpty() || (files[i].fragment = m_fragments.Get(id)) || job_hash.Get(id))
+			continue;
+		TBImageDecodeJob *job = &jobs[num_jobs];
+		job->file = &files[i];
+		job->img = nullptr;
+		if (job_hash.Add(id, job))
+			num_jobs++;
+	}
+
+	DecodeImageFiles(jobs, num_jobs, m_num_decode_threads);
+
+	// Create the fragments on this thread, in the given order so the result
+	// doesn't depend on which decode finished first.
+	bool success = true;
+	for (int i = 0; i < num_files; i++)
+	{
+		if (files[i].filename.IsEmpty())
+			continue;
+		const TBID id(files[i].filename);
+		if (!files[i].fragment && !(files[i].fragment = m_fragments.Get(id)))
+		{
+			TBImageDecodeJob *job = job_hash.Get(id);
+			if (TBImageLoader *img = job ? job->img : nullptr)
+				files[i].fragment = CreateNewFragment(id, files[i].dedicated_map,
+													  img->Width(), img->Height(), img->Width(), img->Data());
+		}
+		success &= files[i].fragment != nullptr;
+	}
+	for (int i = 0; i < num_jobs; i++)
+		delete jobs[i].img;
+	delete [] jobs;
+	return success;
+}
+
+void TBBitmapFragmentManager::SetNumDecodeThreads(int num_threads)
+{
+	m_num_decode_threads = CLAMP(num_threads, 1, MAX_DECODE_THREADS);
+}
+
 TBBitmapFragment *TBBitmapFragmentManager::CreateNewFragment(const TBID &id, bool dedicated_map,
 															 int data_w, int data_h, int data_stride,
-															 uint32_t *data)
+															 void *data)
 {
 	assert(!GetFragment(id));
 
@@ -464,7 +951,7 @@ TBBitmapFragment *TBBitmapFragmentManager::CreateNewFragment(const TBID &id, boo
 			po2h = TBGetNearestPowerOfTwo(data_h);
 		}
 		TBBitmapFragmentMap *fm = new TBBitmapFragmentMap();
-		if (fm && fm->Init(po2w, po2h))
+		if (fm && fm->Init(po2w, po2h, m_format, m_packer))
 		{
 			m_fragment_maps.Add(fm);
 			frag = fm->CreateNewFragment(data_w, data_h, data_stride, data, m_add_border);
@@ -505,10 +992,187 @@ TBBitmapFragment *TBBitmapFragmentManager::GetFragment(const TBID &id) const
 
 void TBBitmapFragmentManager::Clear()
 {
+	// The renderer must be done with the fragments, like in FreeFragment.
+	TBHashTableIteratorOf<TBBitmapFragment> it(&m_fragments);
+	while (TBBitmapFragment *frag = it.GetNextContent())
+		g_renderer->FlushBitmapFragment(frag);
 	m_fragment_maps.DeleteAll();
 	m_fragments.DeleteAll();
 }
 
+bool TBBitmapFragmentManager::Compact()
+{
+	bool success = true;
+	for (int i = 0; i < m_fragment_maps.GetNumItems(); i++)
+	{
+		TBBitmapFragmentMap *map = m_fragment_maps[i];
+		TBListOf<TBBitmapFragment> frags;
+		TBHashTableIteratorOf<TBBitmapFragment> it(&m_fragments);
+		while (TBBitmapFragment *frag = it.GetNextContent())
+			if (frag->m_map == map && !frags.Add(frag))
+				return false;
+
+		// The fragments will move, so the renderer must be done with them.
+		for (int j = 0; j < frags.GetNumItems(); j++)
+			g_renderer->FlushBitmapFragment(frags[j]);
+
+		if (!map->Compact(frags))
+			success = false;
+	}
+	return success;
+}
+
+/** The first value in files saved by TBBitmapFragmentManager::SaveMaps. It also tells if the byte order is the same. */
+#define SAVED_MAPS_MAGIC 0x4d464254 // "TBFM"
+
+/** Increase if the format of saved maps changes. */
+#define SAVED_MAPS_VERSION 1
+
+/** The header of files saved by TBBitmapFragmentManager::SaveMaps.
+	It's followed by the maps and then the fragments. */
+struct SavedMapsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t key;
+	uint8_t format;		///< TB_BITMAP_FORMAT
+	uint8_t add_border;
+	uint16_t num_maps;
+	uint32_t num_fragments;
+};
+
+/** A map in a file saved by SaveMaps. It's followed by its data (w * h pixels), padded to 4 bytes. */
+struct SavedMap
+{
+	uint16_t w, h;
+};
+
+/** A fragment in a file saved by SaveMaps. */
+struct SavedFragment
+{
+	uint32_t id;
+	uint32_t map_index;
+	TBRect rect;
+	TBRect alloc_rect;
+};
+
+/** Return the size of the data following the saved map, including padding. */
+static int GetSavedMapDataSize(int w, int h, TB_BITMAP_FORMAT format)
+{
+	return (w * h * TBGetBytesPerPixel(format) + 3) & ~3;
+}
+
+bool TBBitmapFragmentManager::SaveMaps(const TBStr &filename, uint32_t key)
+{
+	TBTempBuffer buffer;
+	SavedMapsHeader header = { SAVED_MAPS_MAGIC, SAVED_MAPS_VERSION, key, (uint8_t) m_format,
+								(uint8_t) m_add_border, (uint16_t) GetNumMaps(), 0 };
+	if (!buffer.Append((const char *) &header, sizeof(SavedMapsHeader)))
+		return false;
+	for (int i = 0; i < m_fragment_maps.GetNumItems(); i++)
+	{
+		const TBBitmapFragmentMap *fm = m_fragment_maps[i];
+		const SavedMap saved_map = { (uint16_t) fm->m_bitmap_w, (uint16_t) fm->m_bitmap_h };
+		const int size = fm->m_bitmap_w * fm->m_bitmap_h * fm->m_bytes_per_pixel;
+		const int data_size = GetSavedMapDataSize(fm->m_bitmap_w, fm->m_bitmap_h, m_format);
+		if (!buffer.Append((const char *) &saved_map, sizeof(SavedMap)) ||
+			!buffer.Append((const char *) fm->m_bitmap_data, size) ||
+			!buffer.AppendSpace(data_size - size))
+			return false;
+	}
+	TBHashTableIteratorOf<TBBitmapFragment> it(&m_fragments);
+	while (TBBitmapFragment *frag = it.GetNextContent())
+	{
+		SavedFragment saved_frag;
+		saved_frag.id = frag->m_id;
+		saved_frag.map_index = m_fragment_maps.Find(frag->m_map);
+		saved_frag.rect = frag->m_rect;
+		saved_frag.alloc_rect = frag->m_alloc_rect;
+		if (!buffer.Append((const char *) &saved_frag, sizeof(SavedFragment)))
+			return false;
+		header.num_fragments++;
+	}
+	memcpy(buffer.GetData(), &header, sizeof(SavedMapsHeader));
+
+	TBFile *file = TBFile::Open(filename, TBFile::MODE_WRITETRUNC);
+	if (!file)
+		return false;
+	const bool success = file->Write(buffer.GetData(), 1, buffer.GetAppendPos()) == (size_t) buffer.GetAppendPos();
+	delete file;
+	return success;
+}
+
+bool TBBitmapFragmentManager::LoadSavedMaps(const TBStr &filename, uint32_t key)
+{
+	Clear();
+	TBTempBuffer buffer;
+	if (!buffer.AppendFile(filename))
+		return false;
+	if (LoadSavedMapsInternal(buffer.GetData(), buffer.GetAppendPos(), key))
+		return true;
+	Clear();
+	return false;
+}
+
+bool TBBitmapFragmentManager::LoadSavedMapsInternal(const char *data, int size, uint32_t key)
+{
+	const SavedMapsHeader *header = (const SavedMapsHeader *) data;
+	if (size < (int) sizeof(SavedMapsHeader) || header->magic != SAVED_MAPS_MAGIC ||
+		header->version != SAVED_MAPS_VERSION || header->key != key ||
+		header->format != m_format || header->add_border != (uint8_t) m_add_border)
+		return false;
+
+	int pos = sizeof(SavedMapsHeader);
+	for (int i = 0; i < header->num_maps; i++)
+	{
+		const SavedMap *saved_map = (const SavedMap *) (data + pos);
+		if (pos + (int) sizeof(SavedMap) > size)
+			return false;
+		pos += sizeof(SavedMap) + GetSavedMapDataSize(saved_map->w, saved_map->h, m_format);
+		if (pos > size || !m_fragment_maps.GrowIfNeeded())
+			return false;
+		TBBitmapFragmentMap *fm = new TBBitmapFragmentMap();
+		if (!fm || !fm->Init(saved_map->w, saved_map->h, m_format, m_packer))
+		{
+			delete fm;
+			return false;
+		}
+		m_fragment_maps.Add(fm);
+		memcpy(fm->m_bitmap_data, saved_map + 1, saved_map->w * saved_map->h * fm->m_bytes_per_pixel);
+	}
+	for (uint32_t i = 0; i < header->num_fragments; i++)
+	{
+		const SavedFragment *saved_frag = (const SavedFragment *) (data + pos);
+		pos += sizeof(SavedFragment);
+		if (pos > size || saved_frag->map_index >= (uint32_t) m_fragment_maps.GetNumItems() || GetFragment(saved_frag->id))
+			return false;
+		TBBitmapFragmentMap *fm = m_fragment_maps[saved_frag->map_index];
+		const TBRect &alloc_rect = saved_frag->alloc_rect;
+		if (alloc_rect.IsEmpty() || alloc_rect.x < 0 || alloc_rect.y < 0 ||
+			alloc_rect.x + alloc_rect.w > fm->m_bitmap_w || alloc_rect.y + alloc_rect.h > fm->m_bitmap_h)
+			return false;
+		TBBitmapFragment *frag = new TBBitmapFragment;
+		if (!frag)
+			return false;
+		frag->m_map = fm;
+		frag->m_rect = saved_frag->rect;
+		frag->m_alloc_rect = alloc_rect;
+		frag->m_row = nullptr;
+		frag->m_space = nullptr;
+		frag->m_id = saved_frag->id;
+		frag->m_batch_id = 0xffffffff;
+		if (!m_fragments.Add(frag->m_id, frag))
+		{
+			delete frag;
+			return false;
+		}
+		fm->m_allocated_pixels += alloc_rect.w * alloc_rect.h;
+	}
+	// Nothing is allocated by the packers of the new maps yet. Compacting
+	// allocates the space of all fragments, and moves them there.
+	return Compact();
+}
+
 bool TBBitmapFragmentManager::ValidateBitmaps()
 {
 	bool success = true;
@@ -12,6 +12,7 @@
 #include "tb_list.h"
 #include "tb_id.h"
 #include "tb_linklist.h"
+#include "tb_renderer.h"
 
 namespace tb {
 
@@ -77,7 +78,7 @@ private:
 	TBLinkListAutoDeleteOf<Space> m_used_space_list;
 };
 
-/** Allocates space for TBBitmapFragment in a row (used in TBBitmapFragmentMap). */
+/** Allocates space for TBBitmapFragment in a row (used in TBFragmentPackerRows). */
 class TBFragmentSpaceAllocator : public TBSpaceAllocator
 {
 public:
@@ -87,6 +88,89 @@ public:
 	int y, height;
 };
 
+/** The strategy used to pack fragments in a TBBitmapFragmentMap. */
+enum TB_FRAGMENT_PACKER {
+
+	/** Slice the map into rows, and pack fragments from left to right in the
+		row with the smallest height they fit in. Good for fragments of the same
+		height (f.ex glyphs), but wastes space with mixed heights. */
+	TB_FRAGMENT_PACKER_ROWS,
+
+	/** Keep the skyline of the packed fragments, and put new fragments where
+		they end up closest to the top. Space left under the skyline is reused
+		for smaller fragments. Packs mixed sizes (f.ex skin images) tighter. */
+	TB_FRAGMENT_PACKER_SKYLINE
+};
+
+/** TBFragmentPacker allocates the space of fragments in a TBBitmapFragmentMap. */
+class TBFragmentPacker
+{
+public:
+	/** Create a packer of the given type for a map of the given size.
+		Returns nullptr on fail. */
+	static TBFragmentPacker *Create(TB_FRAGMENT_PACKER type, int width, int height);
+
+	virtual ~TBFragmentPacker() {}
+
+	/** Allocate space of the given size for frag, and set frag->m_alloc_rect.
+		Returns false if there is not enough room. */
+	virtual bool AllocSpace(TBBitmapFragment *frag, int needed_w, int needed_h) = 0;
+
+	/** Free the space allocated for frag, so it is available for new allocations. */
+	virtual void FreeSpace(TBBitmapFragment *frag) = 0;
+};
+
+/** TBFragmentPackerRows implements TB_FRAGMENT_PACKER_ROWS. */
+class TBFragmentPackerRows : public TBFragmentPacker
+{
+public:
+	TBFragmentPackerRows(int width, int height) : m_width(width), m_height(height) {}
+
+	virtual bool AllocSpace(TBBitmapFragment *frag, int needed_w, int needed_h);
+	virtual void FreeSpace(TBBitmapFragment *frag);
+private:
+	TBListAutoDeleteOf<TBFragmentSpaceAllocator> m_rows;
+	int m_width, m_height;
+};
+
+/** TBFragmentPackerSkyline implements TB_FRAGMENT_PACKER_SKYLINE. */
+class TBFragmentPackerSkyline : public TBFragmentPacker
+{
+public:
+	TBFragmentPackerSkyline(int width, int height);
+	~TBFragmentPackerSkyline();
+
+	/** Must be called (and succeed) before allocating. Returns false on fail. */
+	bool Init();
+
+	virtual bool AllocSpace(TBBitmapFragment *frag, int needed_w, int needed_h);
+	virtual void FreeSpace(TBBitmapFragment *frag);
+private:
+	/** A horizontal segment of the skyline. Everything above y is used or wasted. */
+	struct Node { int x, y, w; };
+
+	/** Return the y the given size would be placed at if placed at node index,
+		or -1 if it doesn't fit there. */
+	int GetFitY(int index, int needed_w, int needed_h) const;
+
+	/** Set the skyline between x and x + w to y. Any space between the old
+		skyline and waste_y is added to the waste. */
+	void SetSkyline(int x, int w, int y, int waste_y);
+
+	/** Split the node containing x so a node starts at x. */
+	void SplitAt(int x);
+
+	/** Move the first wasted space found right on top of the skyline to the skyline.
+		Returns false if there was none. */
+	bool LowerSkyline();
+
+	Node *m_nodes;
+	int m_num_nodes;
+	int m_num_allocated;
+	int m_width, m_height;
+	TBRegion m_waste;	///< Free space below the skyline.
+};
+
 /** Specify when the bitmap should be validated when calling TBBitmapFragmentMap::GetBitmap. */
 enum TB_VALIDATE_TYPE {
 
@@ -107,30 +191,49 @@ public:
 	TBBitmapFragmentMap();
 	~TBBitmapFragmentMap();
 
-	/** Initialize the map with the given size. The size should be a power of two since
-		it will be used to create a TBBitmap (texture memory). */
-	bool Init(int bitmap_w, int bitmap_h);
+	/** Initialize the map with the given size, format and packing strategy. The size should be
+		a power of two since it will be used to create a TBBitmap (texture memory). */
+	bool Init(int bitmap_w, int bitmap_h, TB_BITMAP_FORMAT format = TB_BITMAP_FORMAT_RGBA32,
+			  TB_FRAGMENT_PACKER packer = TB_FRAGMENT_PACKER_ROWS);
 
-	/** Create a new fragment with the given size and data in this map.
+	/** Create a new fragment with the given size and data (in the format of the map).
 		Returns nullptr if there is not enough room in this map or on any other fail. */
-	TBBitmapFragment *CreateNewFragment(int frag_w, int frag_h, int data_stride, uint32_t *frag_data, bool add_border);
+	TBBitmapFragment *CreateNewFragment(int frag_w, int frag_h, int data_stride, void *frag_data, bool add_border);
 
 	/** Free up the space used by the given fragment, so that other fragments can take its place. */
 	void FreeFragmentSpace(TBBitmapFragment *frag);
 
+	/** Repack the given fragments (which must be all live fragments in this map) so
+		the free space is gathered, and update their m_rect. The fragments must not be
+		in use by the renderer (See TBRenderer::FlushBitmapFragment).
+		Returns false if out of memory or if they didn't fit, and then nothing is changed. */
+	bool Compact(const TBListOf<TBBitmapFragment> &frags);
+
+	/** Return the number of pixels allocated by the fragments in this map. */
+	int GetAllocatedPixels() const { return m_allocated_pixels; }
+
 	/** Return the bitmap for this map.
 		By default, the bitmap is validated if needed before returning (See TB_VALIDATE_TYPE) */
 	TBBitmap *GetBitmap(TB_VALIDATE_TYPE validate_type = TB_VALIDATE_ALWAYS);
+
+	/** Return the format of the bitmap. */
+	TB_BITMAP_FORMAT GetFormat() const { return m_format; }
 private:
 	friend class TBBitmapFragmentManager;
+	friend class TBBitmapFragment;
 	bool ValidateBitmap();
+	void UpdateBitmap();
 	void DeleteBitmap();
-	void CopyData(TBBitmapFragment *frag, int data_stride, uint32_t *frag_data, int border);
-	TBListAutoDeleteOf<TBFragmentSpaceAllocator> m_rows;
+	void CopyData(TBBitmapFragment *frag, int data_stride, void *frag_data, int border);
+	TBFragmentPacker *m_packer;
 	int m_bitmap_w, m_bitmap_h;
-	uint32_t *m_bitmap_data;
+	TB_BITMAP_FORMAT m_format;
+	TB_FRAGMENT_PACKER m_packer_type;
+	int m_bytes_per_pixel;
+	uint8_t *m_bitmap_data;
 	TBBitmap *m_bitmap;
 	bool m_need_update;
+	TBRegion m_dirty_region;	///< The parts of m_bitmap_data changed since m_bitmap was updated.
 	int m_allocated_pixels;
 };
 
@@ -154,20 +257,39 @@ public:
 
 	/** Return the height allocated to this fragment. This may be larger than Height() depending
 		of the internal allocation of fragments in a map. It should rarely be used. */
-	int GetAllocatedHeight() const { return m_row_height; }
+	int GetAllocatedHeight() const { return m_alloc_rect.h; }
+
+	/** Return the format of the bitmap. */
+	TB_BITMAP_FORMAT GetFormat() const { return m_map->GetFormat(); }
+
+	/** Copy the data of this fragment from the software buffer of its map to dst.
+		It's in the format of the map, with rows of Width() pixels. */
+	void CopyData(void *dst) const;
 public:
 	TBBitmapFragmentMap *m_map;
 	TBRect m_rect;
-	TBFragmentSpaceAllocator *m_row;
-	TBFragmentSpaceAllocator::Space *m_space;
+	TBRect m_alloc_rect;							///< The space allocated in the map, including any border.
+	TBFragmentSpaceAllocator *m_row;				///< The row, if packed by TBFragmentPackerRows.
+	TBFragmentSpaceAllocator::Space *m_space;		///< The space, if packed by TBFragmentPackerRows.
 	TBID m_id;
-	int m_row_height;
 
 	/** This uint32_t is reserved for batching renderer backends. It's not used
 		internally, but always initialized to 0xffffffff for all new fragments. */
 	uint32_t m_batch_id;
 };
 
+/** An image file to get a fragment for with TBBitmapFragmentManager::GetFragmentsFromFiles. */
+class TBBitmapFragmentFile
+{
+public:
+	TBBitmapFragmentFile() : dedicated_map(false), dpi(0), fragment(nullptr) {}
+
+	TBStr filename;
+	bool dedicated_map;
+	float dpi;
+	TBBitmapFragment *fragment;		///< Set by GetFragmentsFromFiles, nullptr if it failed.
+};
+
 /** TBBitmapFragmentManager manages loading bitmaps of arbitrary size,
 	pack as many of them into as few TBBitmap as possible.
 
@@ -185,11 +307,33 @@ public:
 	void SetAddBorder(bool add_border) { m_add_border = add_border; }
 	bool GetAddBorder() const { return m_add_border; }
 
+	/** Set the format of the maps, and the data given to CreateNewFragment.
+		This must be set before any fragment is created. Default is TB_BITMAP_FORMAT_RGBA32.
+		Fragments loaded from files (GetFragmentFromFile) need TB_BITMAP_FORMAT_RGBA32. */
+	void SetFormat(TB_BITMAP_FORMAT format) { assert(!GetNumMaps()); m_format = format; }
+	TB_BITMAP_FORMAT GetFormat() const { return m_format; }
+
+	/** Set the strategy used to pack fragments in new maps. Default is TB_FRAGMENT_PACKER_ROWS. */
+	void SetPacker(TB_FRAGMENT_PACKER packer) { m_packer = packer; }
+	TB_FRAGMENT_PACKER GetPacker() const { return m_packer; }
+
 	/** Get the fragment with the given image filename. If it's not already loaded,
 		it will be loaded into a new fragment with the filename as id.
 		returns nullptr on fail. */
 	TBBitmapFragment *GetFragmentFromFile(const TBStr & filename, bool dedicated_map, float dpi);
 
+	/** Get the fragments for many image files, like GetFragmentFromFile for each of them.
+		The files that aren't loaded yet are decoded in parallel (see SetNumDecodeThreads),
+		and then added to the maps in the given order on the calling thread. Files with
+		an empty filename are skipped. Returns true if all other files got a fragment. */
+	bool GetFragmentsFromFiles(TBBitmapFragmentFile *files, int num_files);
+
+	/** Set the max number of threads decoding files in GetFragmentsFromFiles, including the
+		calling thread. 1 decodes all files on the calling thread. More requires that
+		TBImageLoader::CreateFromFile is thread safe. The default is the number of CPU cores. */
+	void SetNumDecodeThreads(int num_threads);
+	int GetNumDecodeThreads() const { return m_num_decode_threads; }
+
 	/** Get the fragment with the given id, or nullptr if it doesn't exist. */
 	TBBitmapFragment *GetFragment(const TBID &id) const;
 
@@ -199,10 +343,10 @@ public:
 		@param data_w the width of the data.
 		@param data_h the height of the data.
 		@param data_stride the number of pixels in a row of the input data.
-		@param data pointer to the data in BGRA32 format. */
+		@param data pointer to the data in the format of this manager (See SetFormat). */
 	TBBitmapFragment *CreateNewFragment(const TBID &id, bool dedicated_map,
 										int data_w, int data_h, int data_stride,
-										uint32_t *data);
+										void *data);
 
 	/** Delete the given fragment and free the space it used in its map,
 		so that other fragments can take its place. */
@@ -213,6 +357,22 @@ public:
 		by this fragment manager. */
 	void Clear();
 
+	/** Repack the fragments in each map so the free space is gathered after many
+		fragments have been created and freed. This moves fragments (their m_rect
+		change) but all pointers stay valid. Returns false if any map failed. */
+	bool Compact();
+
+	/** Save all maps with their data and fragments to a file, so they can be created
+		with LoadSavedMaps without creating each fragment again. The key is saved too,
+		and should identify everything the fragments were created from.
+		Returns false on fail. */
+	bool SaveMaps(const TBStr &filename, uint32_t key);
+
+	/** Clear and create the maps and fragments saved with SaveMaps. Returns false (and
+		leaves this manager cleared) if the file can't be read, was saved with another key,
+		or with another format or border setting. */
+	bool LoadSavedMaps(const TBStr &filename, uint32_t key);
+
 	/** Validate bitmaps on fragment maps that has changed. */
 	bool ValidateBitmaps();
 
@@ -241,12 +401,16 @@ public:
 	void Debug();
 #endif
 private:
+	bool LoadSavedMapsInternal(const char *data, int size, uint32_t key);
 	TBListOf<TBBitmapFragmentMap> m_fragment_maps;
 	TBHashTableOf<TBBitmapFragment> m_fragments;
 	int m_num_maps_limit;
 	bool m_add_border;
+	TB_BITMAP_FORMAT m_format;
+	TB_FRAGMENT_PACKER m_packer;
 	int m_default_map_w;
 	int m_default_map_h;
+	int m_num_decode_threads;
 };
 
 } // namespace tb
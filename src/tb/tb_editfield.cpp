@@ -399,7 +399,7 @@ PreferredSize TBEditField::OnCalculatePreferredContentSize(const SizeConstraints
 			if (constraints.available_w != SizeConstraints::NO_RESTRICTION)
 			{
 				layout_width = constraints.available_w;
-				if (TBSkinElement *bg_skin = GetSkinBgElement())
+				if (TBSkinElement *bg_skin = GetSkinBgElement(false))
 					layout_width -= bg_skin->padding_left + bg_skin->padding_right;
 			}
 
@@ -474,9 +474,11 @@ bool TBEditField::OnEnter()
 	return false;
 }
 
-void TBEditField::Invalidate(const TBRect & /*rect*/)
+void TBEditField::Invalidate(const TBRect &rect)
 {
-	TBWidget::Invalidate();
+	// The rect is relative to the visible rect, where the content is painted.
+	TBRect visible_rect = GetVisibleRect();
+	TBWidget::Invalidate(rect.Offset(visible_rect.x, visible_rect.y));
 }
 
 void TBEditField::DrawString(int32_t x, int32_t y, TBFontFace *font, const TBColor &color, const char *str, int32_t len)
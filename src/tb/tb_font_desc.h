@@ -54,6 +54,12 @@ public:
 	void SetOutline(bool outline)										{ m_packed.outline = outline; }
 	bool GetOutline() const												{ return m_packed.outline; }
 
+	/** Ask for glyphs rendered as signed distance fields. They are rendered once at
+		TB_FONT_SDF_SIZE and shared by all sizes of the font, which stay sharp when
+		scaled. It's ignored by font renderers or renderers that don't support it. */
+	void SetSDF(bool sdf)												{ m_packed.sdf = sdf; }
+	bool GetSDF() const													{ return m_packed.sdf; }
+
 	TBFontDescription() : m_packed_init(0) {}
 	TBFontDescription(const TBFontDescription &src)						{ m_packed_init = src.m_packed_init; m_id = src.m_id; }
 	const TBFontDescription& operator = (const TBFontDescription &src)	{ m_packed_init = src.m_packed_init; m_id = src.m_id; return *this; }
@@ -67,6 +73,7 @@ private:
 			uint32_t italic : 1;
 			uint32_t bold : 1;
 			uint32_t outline : 1;
+			uint32_t sdf : 1;
 		} m_packed;
 		uint32_t m_packed_init;
 	};
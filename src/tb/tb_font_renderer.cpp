@@ -8,38 +8,80 @@
 #include "tb_system.h"
 #include "tb_skin.h"
 #include <math.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TB_FONT_EFFECT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TB_FONT_EFFECT_NEON
+#endif
 
 namespace tb {
 
 // ================================================================================================
 
-static void blurGlyph(unsigned char* src, int srcw, int srch, int srcStride, unsigned char* dst, int dstw, int dsth, int dstStride, float* temp, float* kernel, int kernelRadius)
+/** Convolve count values: dst[x] is the sum of src[x + k * step] * kernel[k] for all taps. */
+static void ConvolveRow(const float *src, int step, const float *kernel, int taps, float *dst, int count)
+{
+	int x = 0;
+#if defined(TB_FONT_EFFECT_SSE2)
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128 acc = _mm_setzero_ps();
+		for (int k = 0; k < taps; k++)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + x + k * step), _mm_set1_ps(kernel[k])));
+		_mm_storeu_ps(dst + x, acc);
+	}
+#elif defined(TB_FONT_EFFECT_NEON)
+	for (; x + 4 <= count; x += 4)
+	{
+		float32x4_t acc = vdupq_n_f32(0);
+		for (int k = 0; k < taps; k++)
+			acc = vaddq_f32(acc, vmulq_n_f32(vld1q_f32(src + x + k * step), kernel[k]));
+		vst1q_f32(dst + x, acc);
+	}
+#endif
+	for (; x < count; x++)
+	{
+		float val = 0;
+		for (int k = 0; k < taps; k++)
+			val += src[x + k * step] * kernel[k];
+		dst[x] = val;
+	}
+}
+
+/** Blur src into dst, which is larger by kernelRadius on each side. temp must fit
+	srch * dstw + (dstw + kernelRadius * 2) * 2 floats. The glyph is zero padded so the
+	inner loops have no bounds checks, and they are vectorized if possible. */
+static void blurGlyph(const unsigned char* src, int srcw, int srch, int srcStride, unsigned char* dst, int dstw, int dsth, int dstStride, float* temp, const float* kernel, int kernelRadius)
 {
+	const int taps = kernelRadius * 2 + 1;
+	float *rows = temp;							// The horizontally blurred rows, dstw wide.
+	float *padded = rows + srch * dstw;			// A source row with zeroes around it.
+	float *out = padded + dstw + kernelRadius * 2;	// A vertically blurred row.
+
+	// Horizontal pass. Output x reads source x - 2 * kernelRadius to x.
+	memset(padded, 0, (dstw + kernelRadius * 2) * sizeof(float));
 	for (int y = 0; y < srch; y++)
 	{
-		for (int x = 0; x < dstw; x++)
-		{
-			float val = 0;
-			for (int k_ofs = -kernelRadius; k_ofs <= kernelRadius; k_ofs++)
-			{
-				if (x - kernelRadius + k_ofs >= 0 && x - kernelRadius + k_ofs < srcw)
-					val += src[y * srcStride + x - kernelRadius + k_ofs] * kernel[k_ofs + kernelRadius];
-			}
-			temp[y * dstw + x] = val;
-		}
+		for (int x = 0; x < srcw; x++)
+			padded[kernelRadius * 2 + x] = src[y * srcStride + x];
+		ConvolveRow(padded, 1, kernel, taps, rows + y * dstw, dstw);
 	}
+
+	// Vertical pass. Output y reads rows y - 2 * kernelRadius to y, of which the
+	// ones outside the source are zero and skipped.
 	for (int y = 0; y < dsth; y++)
 	{
+		const int k0 = MAX(kernelRadius * 2 - y, 0);
+		const int k1 = MIN(kernelRadius * 2 + srch - y, taps);
+		ConvolveRow(rows + (y - kernelRadius * 2 + k0) * dstw, dstw, kernel + k0, k1 - k0, out, dstw);
 		for (int x = 0; x < dstw; x++)
-		{
-			float val = 0;
-			for (int k_ofs = -kernelRadius; k_ofs <= kernelRadius; k_ofs++)
-			{
-				if (y - kernelRadius + k_ofs >= 0 && y - kernelRadius + k_ofs < srch)
-					val += temp[(y - kernelRadius + k_ofs) * dstw + x] * kernel[k_ofs + kernelRadius];
-			}
-			dst[y * dstStride + x] = (unsigned char)(val + 0.5f);
-		}
+			dst[y * dstStride + x] = (unsigned char)(out[x] + 0.5f);
 	}
 }
 
@@ -90,7 +132,7 @@ TBFontGlyphData *TBFontEffect::Render(TBGlyphMetrics *metrics, const TBFontGlyph
 
 		// Reserve memory needed for blurring.
 		if (!m_data_dst.Reserve(effect_glyph_data->w * effect_glyph_data->h) ||
-			!m_blur_temp.Reserve(effect_glyph_data->w * effect_glyph_data->h * sizeof(float)))
+			!m_blur_temp.Reserve((src->h * effect_glyph_data->w + (effect_glyph_data->w + m_blur_radius * 2) * 2) * sizeof(float)))
 		{
 			delete effect_glyph_data;
 			return nullptr;
@@ -109,6 +151,13 @@ TBFontGlyphData *TBFontEffect::Render(TBGlyphMetrics *metrics, const TBFontGlyph
 	return effect_glyph_data;
 }
 
+// == TBFontRenderer ==============================================================================
+
+bool TBFontRenderer::ShouldRenderSDF(const TBFontDescription &font_desc)
+{
+	return font_desc.GetSDF() && g_renderer->IsBitmapFormatSupported(TB_BITMAP_FORMAT_SDF8);
+}
+
 // == TBFontGlyph =================================================================================
 
 TBFontGlyph::TBFontGlyph(const TBID &hash_id, UCS4 cp)
@@ -116,41 +165,350 @@ TBFontGlyph::TBFontGlyph(const TBID &hash_id, UCS4 cp)
 	, cp(cp)
 	, frag(nullptr)
 	, has_rgb(false)
+	, queued(false)
+	, metrics_pending(false)
+	, no_bitmap(false)
+	, last_used(0)
+	, saved_key(0)
+{
+}
+
+// == TBFontGlyphWorker ===========================================================================
+
+/** The delay between checking for glyphs rendered in the background. */
+#define GLYPH_WORKER_POLL_DELAY_MS 10
+
+/** TBFontGlyphJob is a glyph queued for rendering in the background. */
+class TBFontGlyphJob : public TBLinkOf<TBFontGlyphJob>
+{
+public:
+	TBFontGlyphJob(TBFontFace *face, TBFontRenderer *renderer, TBFontGlyph *glyph, int blur_radius)
+		: face(face), renderer(renderer), glyph(glyph), cp(glyph->cp), blur_radius(blur_radius), rendered(false) {}
+
+	/** Render the glyph and its metrics, and copy the glyph data to buffer. */
+	void Render();
+
+	TBFontFace *face;
+	TBFontRenderer *renderer;
+	TBFontGlyph *glyph;		///< Only touched by the thread queueing it.
+	UCS4 cp;
+	int blur_radius;		///< The blur radius of the face when queued.
+	bool rendered;			///< If the renderer had a bitmap for the glyph.
+	TBGlyphMetrics metrics;
+	TBFontGlyphData data;	///< The rendered glyph, pointing into buffer.
+	TBTempBuffer buffer;
+};
+
+void TBFontGlyphJob::Render()
 {
+	// Glyphs without a bitmap (f.ex space) still need their metrics.
+	renderer->GetGlyphMetrics(&metrics, cp);
+	TBFontGlyphData src;
+	if (!renderer->RenderGlyph(&src, cp))
+		return;
+
+	// The renderer owns the data, and may reuse it for the next glyph.
+	const int bpp = src.data32 ? sizeof(uint32_t) : sizeof(uint8_t);
+	const uint8_t *src_data = src.data32 ? (const uint8_t *) src.data32 : src.data8;
+	if (!src_data || !buffer.Reserve(src.w * src.h * bpp))
+		return;
+	for (int y = 0; y < src.h; y++)
+		memcpy(buffer.GetData() + y * src.w * bpp, src_data + y * src.stride * bpp, src.w * bpp);
+	data.data8 = src.data32 ? nullptr : (uint8_t *) buffer.GetData();
+	data.data32 = src.data32 ? (uint32_t *) buffer.GetData() : nullptr;
+	data.w = data.stride = src.w;
+	data.h = src.h;
+	data.rgb = src.rgb;
+	rendered = true;
+}
+
+/** TBFontGlyphWorker is a thread rendering queued glyphs for TBFontGlyphCache.
+
+	Font renderers may share state (f.ex the FreeType library), so all calls to any of
+	them must be done with renderer_mutex locked while the worker exists. */
+class TBFontGlyphWorker
+{
+public:
+	TBFontGlyphWorker();
+	~TBFontGlyphWorker();
+
+	void Queue(TBFontGlyphJob *job);
+
+	/** Move the rendered jobs to the given list. If wait is true, wait until
+		all queued jobs are rendered first. */
+	void TakeRendered(TBLinkListOf<TBFontGlyphJob> &jobs, bool wait);
+
+	/** Delete all jobs of the given face, queued or rendered. Must be called with
+		renderer_mutex locked, so none of them is being rendered. */
+	void DeleteJobs(TBFontFace *face);
+
+	/** Return true if there are jobs that are queued or rendered. */
+	bool HasJobs();
+
+	std::mutex renderer_mutex;
+private:
+	void WorkerMain();
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_queued_cond;
+	std::condition_variable m_rendered_cond;
+	TBLinkListAutoDeleteOf<TBFontGlyphJob> m_queued;
+	TBLinkListAutoDeleteOf<TBFontGlyphJob> m_rendered;
+	int m_num_rendering;
+	bool m_quit;
+};
+
+TBFontGlyphWorker::TBFontGlyphWorker()
+	: m_num_rendering(0)
+	, m_quit(false)
+{
+	m_thread = std::thread(&TBFontGlyphWorker::WorkerMain, this);
+}
+
+TBFontGlyphWorker::~TBFontGlyphWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_queued_cond.notify_one();
+	m_thread.join();
+}
+
+void TBFontGlyphWorker::Queue(TBFontGlyphJob *job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queued.AddLast(job);
+	}
+	m_queued_cond.notify_one();
+}
+
+void TBFontGlyphWorker::TakeRendered(TBLinkListOf<TBFontGlyphJob> &jobs, bool wait)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (wait)
+		m_rendered_cond.wait(lock, [this] { return !m_queued.HasLinks() && !m_num_rendering; });
+	while (TBFontGlyphJob *job = m_rendered.GetFirst())
+	{
+		m_rendered.Remove(job);
+		jobs.AddLast(job);
+	}
+}
+
+void TBFontGlyphWorker::DeleteJobs(TBFontFace *face)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	TBLinkListAutoDeleteOf<TBFontGlyphJob> *lists[2] = { &m_queued, &m_rendered };
+	for (int i = 0; i < 2; i++)
+	{
+		TBFontGlyphJob *job = lists[i]->GetFirst();
+		while (job)
+		{
+			TBFontGlyphJob *next_job = job->GetNext();
+			if (job->face == face)
+			{
+				job->glyph->queued = false;
+				lists[i]->Delete(job);
+			}
+			job = next_job;
+		}
+	}
+}
+
+bool TBFontGlyphWorker::HasJobs()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_queued.HasLinks() || m_rendered.HasLinks() || m_num_rendering;
+}
+
+void TBFontGlyphWorker::WorkerMain()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_queued_cond.wait(lock, [this] { return m_quit || m_queued.HasLinks(); });
+			if (m_quit)
+				return;
+		}
+
+		std::lock_guard<std::mutex> renderer_lock(renderer_mutex);
+		TBFontGlyphJob *job;
+		{
+			// Take the job with the renderers locked, so DeleteJobs can't delete it while rendering.
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (!(job = m_queued.GetFirst()))
+				continue;
+			m_queued.Remove(job);
+			m_num_rendering++;
+		}
+
+		job->Render();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_rendered.AddLast(job);
+			m_num_rendering--;
+		}
+		m_rendered_cond.notify_all();
+	}
 }
 
+/** TBFontRendererLock locks the font renderers while the glyph cache renders glyphs in the background. */
+class TBFontRendererLock
+{
+public:
+	TBFontRendererLock(TBFontGlyphWorker *worker) : m_worker(worker) { if (m_worker) m_worker->renderer_mutex.lock(); }
+	~TBFontRendererLock() { if (m_worker) m_worker->renderer_mutex.unlock(); }
+private:
+	TBFontGlyphWorker *m_worker;
+};
+
 // == TBFontGlyphCache ============================================================================
 
 TBFontGlyphCache::TBFontGlyphCache()
+	: m_memory_budget(TB_GLYPH_CACHE_MEMORY_BUDGET)
+	, m_max_pages(0)
+	, m_generation(0)
+	, m_use_counter(0)
+	, m_worker(nullptr)
+	, m_num_skipped_glyphs(0)
 {
-	// Only use one map for the font face. The glyph cache will start forgetting
-	// glyphs that haven't been used for a while if the map gets full.
-	m_frag_manager.SetNumMapsLimit(1);
-	m_frag_manager.SetDefaultMapSize(TB_GLYPH_CACHE_WIDTH, TB_GLYPH_CACHE_HEIGHT);
+	for (int i = 0; i < NUM_FORMATS; i++)
+	{
+		m_frag_managers[i].SetFormat((TB_BITMAP_FORMAT) i);
+		m_frag_managers[i].SetDefaultMapSize(TB_GLYPH_CACHE_WIDTH, TB_GLYPH_CACHE_HEIGHT);
+	}
+	// SDF glyphs are drawn scaled, so they need a border for filtering.
+	m_frag_managers[TB_BITMAP_FORMAT_SDF8].SetAddBorder(true);
+	ResetStats();
 
 	g_renderer->AddListener(this);
 }
 
 TBFontGlyphCache::~TBFontGlyphCache()
 {
+	// The font faces are deleted before, so there are no jobs left.
+	delete m_worker;
 	g_renderer->RemoveListener(this);
 }
 
-TBFontGlyph *TBFontGlyphCache::GetGlyph(const TBID &hash_id, UCS4 /*cp*/)
+void TBFontGlyphCache::SetRenderInBackground(bool render_in_background)
 {
-	if (TBFontGlyph *glyph = m_glyphs.Get(hash_id))
+	if (render_in_background == GetRenderInBackground())
+		return;
+	if (render_in_background)
 	{
-		// Move the glyph to the end of m_all_rendered_glyphs so we maintain LRU (oldest first)
-		if (m_all_rendered_glyphs.ContainsLink(glyph))
+#ifndef __EMSCRIPTEN__
+		m_worker = new TBFontGlyphWorker;
+#endif
+	}
+	else
+	{
+		ProcessRenderedGlyphs(true);
+		delete m_worker;
+		m_worker = nullptr;
+	}
+}
+
+void TBFontGlyphCache::QueueGlyph(TBFontFace *face, TBFontRenderer *renderer, TBFontGlyph *glyph)
+{
+	assert(m_worker && !glyph->queued);
+	TBFontGlyphJob *job = new TBFontGlyphJob(face, renderer, glyph, face->GetEffect()->GetBlurRadius());
+	if (!job)
+		return;
+	glyph->queued = true;
+	m_worker->Queue(job);
+	if (!GetMessageByID(TBIDC("glyphs_rendered")))
+		PostMessageDelayed(TBIDC("glyphs_rendered"), nullptr, GLYPH_WORKER_POLL_DELAY_MS);
+}
+
+void TBFontGlyphCache::ProcessRenderedGlyphs(bool wait)
+{
+	if (!m_worker)
+		return;
+	TBLinkListAutoDeleteOf<TBFontGlyphJob> jobs;
+	m_worker->TakeRendered(jobs, wait);
+	if (!jobs.HasLinks())
+		return;
+	for (TBFontGlyphJob *job = jobs.GetFirst(); job; job = job->GetNext())
+	{
+		TBFontGlyph *glyph = job->glyph;
+		glyph->queued = false;
+		if (glyph->metrics_pending)
+		{
+			// Text measured with the glyph was measured without its advance.
+			glyph->metrics = job->metrics;
+			glyph->metrics_pending = false;
+			m_generation++;
+		}
+		if (!job->rendered)
+			glyph->no_bitmap = true;
+		// If the effect changed since it was queued, it's queued again next time it's needed.
+		else if (!glyph->frag && job->blur_radius == job->face->GetEffect()->GetBlurRadius())
 		{
-			m_all_rendered_glyphs.Remove(glyph);
-			m_all_rendered_glyphs.AddLast(glyph);
+			glyph->metrics = job->metrics;
+			job->face->CreateGlyphFragment(glyph, &job->data);
 		}
+	}
+
+	TBLinkListOf<TBFontGlyphListener>::Iterator iter = m_listeners.IterateForward();
+	while (TBFontGlyphListener *listener = iter.GetAndStep())
+		listener->OnGlyphsRendered();
+}
+
+void TBFontGlyphCache::OnMessageReceived(TBMessage *msg)
+{
+	if (msg->message == TBIDC("glyphs_rendered"))
+	{
+		ProcessRenderedGlyphs();
+		if (m_worker && m_worker->HasJobs())
+			PostMessageDelayed(TBIDC("glyphs_rendered"), nullptr, GLYPH_WORKER_POLL_DELAY_MS);
+	}
+}
+
+int TBFontGlyphCache::GetNumPages() const
+{
+	int num_pages = 0;
+	for (int i = 0; i < NUM_FORMATS; i++)
+		num_pages += m_frag_managers[i].GetNumMaps();
+	return num_pages;
+}
+
+int TBFontGlyphCache::GetMemoryUsage() const
+{
+	int bytes = 0;
+	for (int i = 0; i < NUM_FORMATS; i++)
+		bytes += m_frag_managers[i].GetNumMaps() * TB_GLYPH_CACHE_WIDTH * TB_GLYPH_CACHE_HEIGHT * TBGetBytesPerPixel((TB_BITMAP_FORMAT) i);
+	return bytes;
+}
+
+void TBFontGlyphCache::ResetStats()
+{
+	memset(&m_stats, 0, sizeof(Stats));
+}
+
+TBFontGlyph *TBFontGlyphCache::GetGlyph(const TBID &hash_id, UCS4 /*cp*/)
+{
+	if (TBFontGlyph *glyph = m_glyphs.Get(hash_id))
+	{
+		MarkGlyphUsed(glyph);
 		return glyph;
 	}
 	return nullptr;
 }
 
+void TBFontGlyphCache::MarkGlyphUsed(TBFontGlyph *glyph)
+{
+	// Stamp the glyph, so DropLeastRecentlyUsedPage knows when its page was last used.
+	if (glyph->frag)
+	{
+		glyph->last_used = ++m_use_counter;
+		m_stats.hits++;
+	}
+}
+
 TBFontGlyph *TBFontGlyphCache::CreateAndCacheGlyph(const TBID &hash_id, UCS4 cp)
 {
 	assert(!GetGlyph(hash_id, cp));
@@ -161,72 +519,114 @@ TBFontGlyph *TBFontGlyphCache::CreateAndCacheGlyph(const TBID &hash_id, UCS4 cp)
 	return nullptr;
 }
 
-TBBitmapFragment *TBFontGlyphCache::CreateFragment(TBFontGlyph *glyph, int w, int h, int stride, uint32_t *data)
+bool TBFontGlyphCache::CanAddPage(TB_BITMAP_FORMAT format) const
+{
+	const int num_pages = GetNumPages();
+	if (!num_pages)
+		return true;
+	if (m_max_pages && num_pages >= m_max_pages)
+		return false;
+	const int page_bytes = TB_GLYPH_CACHE_WIDTH * TB_GLYPH_CACHE_HEIGHT * TBGetBytesPerPixel(format);
+	return GetMemoryUsage() + page_bytes <= m_memory_budget;
+}
+
+TBBitmapFragment *TBFontGlyphCache::CreateFragment(TBFontGlyph *glyph, int w, int h, int stride,
+													TB_BITMAP_FORMAT format, void *data)
 {
-	assert(GetGlyph(glyph->hash_id, glyph->cp));
+	assert(m_glyphs.Get(glyph->hash_id));
 	// Don't bother if the requested glyph is too large.
 	if (w > TB_GLYPH_CACHE_WIDTH || h > TB_GLYPH_CACHE_HEIGHT)
 		return nullptr;
 
-	bool try_drop_largest = true;
-	bool dropped_large_enough_glyph = false;
+	m_stats.misses++;
+	TBBitmapFragmentManager &frag_manager = m_frag_managers[format];
 	do
 	{
-		// Attempt creating a fragment for the rendered glyph data
-		if (TBBitmapFragment *frag = m_frag_manager.CreateNewFragment(glyph->hash_id, false, w, h, stride, data))
+		// Attempt creating a fragment for the rendered glyph data in the pages we have,
+		// or in a new page if the budget allows it.
+		const int num_maps = frag_manager.GetNumMaps();
+		const bool can_add_page = CanAddPage(format);
+		if (num_maps || can_add_page)
 		{
-			glyph->frag = frag;
-			m_all_rendered_glyphs.AddLast(glyph);
-			return frag;
-		}
-		// Drop the oldest glyph that's large enough to free up the space we need.
-		if (try_drop_largest)
-		{
-			const int check_limit = 20;
-			int check_count = 0;
-			for (TBFontGlyph *oldest = m_all_rendered_glyphs.GetFirst(); oldest && check_count < check_limit; oldest = oldest->GetNext())
+			frag_manager.SetNumMapsLimit(can_add_page ? num_maps + 1 : num_maps);
+			if (TBBitmapFragment *frag = frag_manager.CreateNewFragment(glyph->hash_id, false, w, h, stride, data))
 			{
-				if (oldest->frag->Width() >= w && oldest->frag->GetAllocatedHeight() >= h)
-				{
-					DropGlyphFragment(oldest);
-					dropped_large_enough_glyph = true;
-					break;
-				}
-				check_count++;
+				glyph->frag = frag;
+				glyph->last_used = ++m_use_counter;
+				m_rendered_glyphs.AddLast(glyph);
+				return frag;
 			}
-			try_drop_largest = false;
 		}
-		// We had no large enough glyph so just drop the oldest one. We will likely
-		// spin around the loop, fail and drop again a few times before we succeed.
-		if (!dropped_large_enough_glyph)
+		// Make room by dropping a whole page, so we don't have to spin around
+		// dropping one glyph at a time until there happens to be a large enough space.
+	} while (DropLeastRecentlyUsedPage());
+	return nullptr;
+}
+
+bool TBFontGlyphCache::DropLeastRecentlyUsedPage()
+{
+	// Find how long ago each page was last used. The ages are relative to
+	// m_use_counter, so they are right even if it has wrapped around.
+	TBListOf<TBBitmapFragmentMap> pages;
+	TBTempBuffer page_ages;
+	for (TBFontGlyph *glyph = m_rendered_glyphs.GetFirst(); glyph; glyph = glyph->GetNext())
+	{
+		const uint32_t age = m_use_counter - glyph->last_used;
+		int index = pages.Find(glyph->frag->m_map);
+		if (index == -1)
 		{
-			if (TBFontGlyph *oldest = m_all_rendered_glyphs.GetFirst())
-				DropGlyphFragment(oldest);
-			else
-				break;
+			index = pages.GetNumItems();
+			if (!pages.Add(glyph->frag->m_map) || !page_ages.Append((const char *) &age, sizeof(uint32_t)))
+				return false;
 		}
-	} while (true);
-	return nullptr;
+		uint32_t *ages = (uint32_t *) page_ages.GetData();
+		ages[index] = MIN(ages[index], age);
+	}
+	if (!pages.GetNumItems())
+		return false;
+	const uint32_t *ages = (const uint32_t *) page_ages.GetData();
+	int oldest = 0;
+	for (int i = 1; i < pages.GetNumItems(); i++)
+		if (ages[i] > ages[oldest])
+			oldest = i;
+	TBBitmapFragmentMap *page = pages[oldest];
+
+	TBFontGlyph *glyph = m_rendered_glyphs.GetFirst();
+	while (glyph)
+	{
+		TBFontGlyph *next_glyph = glyph->GetNext();
+		if (glyph->frag->m_map == page)
+		{
+			DropGlyphFragment(glyph);
+			m_stats.evicted_glyphs++;
+		}
+		glyph = next_glyph;
+	}
+	m_stats.evicted_pages++;
+	return true;
 }
 
 void TBFontGlyphCache::DropGlyphFragment(TBFontGlyph *glyph)
 {
 	assert(glyph->frag);
-	m_frag_manager.FreeFragment(glyph->frag);
+	m_frag_managers[glyph->frag->GetFormat()].FreeFragment(glyph->frag);
 	glyph->frag = nullptr;
-	m_all_rendered_glyphs.Remove(glyph);
+	m_rendered_glyphs.Remove(glyph);
+	m_generation++;
 }
 
 #ifdef TB_RUNTIME_DEBUG_INFO
 void TBFontGlyphCache::Debug()
 {
-	m_frag_manager.Debug();
+	for (int i = 0; i < NUM_FORMATS; i++)
+		m_frag_managers[i].Debug();
 }
 #endif // TB_RUNTIME_DEBUG_INFO
 
 void TBFontGlyphCache::OnContextLost()
 {
-	m_frag_manager.DeleteBitmaps();
+	for (int i = 0; i < NUM_FORMATS; i++)
+		m_frag_managers[i].DeleteBitmaps();
 }
 
 void TBFontGlyphCache::OnContextRestored()
@@ -234,13 +634,192 @@ void TBFontGlyphCache::OnContextRestored()
 	// No need to do anything. The bitmaps will be created when drawing.
 }
 
+/** The first value in files saved by TBFontGlyphCache::SaveGlyphs. It also tells if the byte order is the same. */
+#define SAVED_GLYPHS_MAGIC 0x43474254 // "TBGC"
+
+/** Increase if the glyph data changes for the same font renderer output. */
+#define SAVED_GLYPHS_VERSION 1
+
+/** The header of files saved by TBFontGlyphCache::SaveGlyphs. */
+struct SavedGlyphsHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t build;			///< The build options that change glyph data (See GetSavedGlyphsBuild).
+	uint32_t num_glyphs;
+};
+
+static uint32_t GetSavedGlyphsBuild()
+{
+	uint32_t build = TB_FONT_SDF_SIZE << 1;
+#ifdef TB_PREMULTIPLIED_ALPHA
+	build |= 1;
+#endif
+	return build;
+}
+
+/** Return the size of the bitmap data following the saved glyph, including padding. */
+static int GetSavedGlyphDataSize(int w, int h, TB_BITMAP_FORMAT format)
+{
+	return (w * h * TBGetBytesPerPixel(format) + 3) & ~3;
+}
+
+bool TBFontGlyphCache::SaveGlyphs(const TBStr &filename)
+{
+	TBTempBuffer buffer;
+	SavedGlyphsHeader header = { SAVED_GLYPHS_MAGIC, SAVED_GLYPHS_VERSION, GetSavedGlyphsBuild(), 0 };
+	if (!buffer.Append((const char *) &header, sizeof(SavedGlyphsHeader)))
+		return false;
+
+	// The glyphs we have, and then those that were loaded but not used.
+	TBHashTableOf<TBFontGlyph> saved_glyphs;
+	TBHashTableIteratorOf<TBFontGlyph> it(&m_glyphs);
+	while (TBFontGlyph *glyph = it.GetNextContent())
+	{
+		if (!glyph->saved_key || (!glyph->frag && !glyph->no_bitmap) || saved_glyphs.Get(glyph->saved_key))
+			continue;
+		SavedGlyph saved_glyph;
+		saved_glyph.key = glyph->saved_key;
+		saved_glyph.cp = glyph->cp;
+		saved_glyph.metrics = glyph->metrics;
+		saved_glyph.format = (uint8_t) (glyph->frag ? glyph->frag->GetFormat() : TB_BITMAP_FORMAT_RGBA32);
+		saved_glyph.has_rgb = glyph->has_rgb;
+		saved_glyph.w = (uint16_t) (glyph->frag ? glyph->frag->Width() : 0);
+		saved_glyph.h = (uint16_t) (glyph->frag ? glyph->frag->Height() : 0);
+		const int pos = buffer.GetAppendPos();
+		const int data_size = GetSavedGlyphDataSize(saved_glyph.w, saved_glyph.h, (TB_BITMAP_FORMAT) saved_glyph.format);
+		if (!buffer.AppendSpace(sizeof(SavedGlyph) + data_size))
+			return false;
+		memcpy(buffer.GetData() + pos, &saved_glyph, sizeof(SavedGlyph));
+		memset(buffer.GetData() + pos + sizeof(SavedGlyph), 0, data_size);
+		if (glyph->frag)
+			glyph->frag->CopyData(buffer.GetData() + pos + sizeof(SavedGlyph));
+		if (!saved_glyphs.Add(glyph->saved_key, glyph))
+			return false;
+		header.num_glyphs++;
+	}
+	TBHashTableIteratorOf<SavedGlyph> saved_it(&m_saved_glyphs);
+	while (SavedGlyph *saved_glyph = saved_it.GetNextContent())
+	{
+		if (saved_glyphs.Get(saved_glyph->key))
+			continue;
+		const int data_size = GetSavedGlyphDataSize(saved_glyph->w, saved_glyph->h, (TB_BITMAP_FORMAT) saved_glyph->format);
+		if (!buffer.Append((const char *) saved_glyph, sizeof(SavedGlyph) + data_size))
+			return false;
+		header.num_glyphs++;
+	}
+	memcpy(buffer.GetData(), &header, sizeof(SavedGlyphsHeader));
+
+	TBFile *file = TBFile::Open(filename, TBFile::MODE_WRITETRUNC);
+	if (!file)
+		return false;
+	const bool success = file->Write(buffer.GetData(), 1, buffer.GetAppendPos()) == (size_t) buffer.GetAppendPos();
+	delete file;
+	return success;
+}
+
+bool TBFontGlyphCache::LoadSavedGlyphs(const TBStr &filename)
+{
+	m_saved_glyphs.RemoveAll();
+	m_saved_glyphs_data.SetAppendPos(0);
+	if (!m_saved_glyphs_data.AppendFile(filename))
+		return false;
+
+	const char *data = m_saved_glyphs_data.GetData();
+	const int size = m_saved_glyphs_data.GetAppendPos();
+	const SavedGlyphsHeader *header = (const SavedGlyphsHeader *) data;
+	if (size < (int) sizeof(SavedGlyphsHeader) || header->magic != SAVED_GLYPHS_MAGIC ||
+		header->version != SAVED_GLYPHS_VERSION || header->build != GetSavedGlyphsBuild())
+		return false;
+
+	int pos = sizeof(SavedGlyphsHeader);
+	for (uint32_t i = 0; i < header->num_glyphs; i++)
+	{
+		SavedGlyph *saved_glyph = (SavedGlyph *) (data + pos);
+		if (pos + (int) sizeof(SavedGlyph) > size || saved_glyph->format > TB_BITMAP_FORMAT_SDF8)
+			break;
+		pos += sizeof(SavedGlyph) + GetSavedGlyphDataSize(saved_glyph->w, saved_glyph->h, (TB_BITMAP_FORMAT) saved_glyph->format);
+		if (pos > size)
+			break;
+		if (!m_saved_glyphs.Get(saved_glyph->key) && !m_saved_glyphs.Add(saved_glyph->key, saved_glyph))
+			break;
+	}
+	return true;
+}
+
+const TBFontGlyphCache::SavedGlyph *TBFontGlyphCache::GetSavedGlyph(const TBFontGlyph *glyph) const
+{
+	if (!glyph->saved_key)
+		return nullptr;
+	const SavedGlyph *saved_glyph = m_saved_glyphs.Get(glyph->saved_key);
+	return saved_glyph && saved_glyph->cp == glyph->cp ? saved_glyph : nullptr;
+}
+
+bool TBFontGlyphCache::SetSavedGlyphMetrics(TBFontGlyph *glyph) const
+{
+	const SavedGlyph *saved_glyph = GetSavedGlyph(glyph);
+	if (!saved_glyph)
+		return false;
+	glyph->metrics = saved_glyph->metrics;
+	return true;
+}
+
+bool TBFontGlyphCache::CreateSavedGlyphFragment(TBFontGlyph *glyph)
+{
+	const SavedGlyph *saved_glyph = GetSavedGlyph(glyph);
+	if (!saved_glyph)
+		return false;
+	const TB_BITMAP_FORMAT format = (TB_BITMAP_FORMAT) saved_glyph->format;
+	if (format != TB_BITMAP_FORMAT_RGBA32 && !g_renderer->IsBitmapFormatSupported(format))
+		return false;
+	glyph->metrics = saved_glyph->metrics;
+	if (!saved_glyph->w || !saved_glyph->h)
+	{
+		glyph->no_bitmap = true;
+		return true;
+	}
+	glyph->has_rgb = saved_glyph->has_rgb ? true : false;
+	return CreateFragment(glyph, saved_glyph->w, saved_glyph->h, saved_glyph->w, format, (void *) (saved_glyph + 1)) ? true : false;
+}
+
 // ================================================================================================
 
+/** The number of texels around SDF glyphs, for the distance field to fade out in. */
+#define SDF_PADDING 4
+
+/** The max number of glyph runs cached by each font face. */
+#define MAX_GLYPH_RUNS 256
+
+/** The max length in bytes of strings to cache glyph runs for. */
+#define MAX_GLYPH_RUN_LENGTH 256
+
+/** Get the coverage of the glyph at x, y, which is 0 outside it. */
+static inline int GetGlyphCoverage(const TBFontGlyphData *src, int x, int y)
+{
+	if (x < 0 || y < 0 || x >= src->w || y >= src->h)
+		return 0;
+	return src->data8[x + y * src->stride];
+}
+
 TBFontFace::TBFontFace(TBFontGlyphCache *glyph_cache, TBFontRenderer *renderer, const TBFontDescription &font_desc)
-	: m_glyph_cache(glyph_cache), m_font_renderer(renderer), m_font_desc(font_desc), m_bgFont(nullptr), m_bgX(0), m_bgY(0)
+	: m_glyph_cache(glyph_cache), m_font_renderer(renderer), m_font_desc(font_desc)
+	, m_sdf(renderer && renderer->IsSDF()), m_sdf_scale(1), m_glyph_table(nullptr), m_glyph_table_size(0)
+	, m_glyphs_blur_radius(0)
+	, m_file_hash(0)
+	, m_bgFont(nullptr), m_bgX(0), m_bgY(0)
 {
 	if (m_font_renderer)
+	{
 		m_metrics = m_font_renderer->GetMetrics();
+		if (m_sdf)
+		{
+			// The renderer measures at TB_FONT_SDF_SIZE.
+			m_sdf_scale = m_font_desc.GetSize() / (float) TB_FONT_SDF_SIZE;
+			m_metrics.ascent = (int16_t) (m_metrics.ascent * m_sdf_scale + 0.5f);
+			m_metrics.descent = (int16_t) (m_metrics.descent * m_sdf_scale + 0.5f);
+			m_metrics.height = (int16_t) (m_metrics.height * m_sdf_scale + 0.5f);
+		}
+	}
 	else
 	{
 		// Invent some metrics for the test font
@@ -256,7 +835,11 @@ TBFontFace::~TBFontFace()
 	// It would be nice to drop all glyphs we have live for this font face.
 	// Now they only die when they get old and kicked out of the cache.
 	// We currently don't drop any font faces either though (except on shutdown)
+	TBFontRendererLock lock(m_glyph_cache->m_worker);
+	if (m_glyph_cache->m_worker)
+		m_glyph_cache->m_worker->DeleteJobs(this);
 	delete m_font_renderer;
+	delete [] m_glyph_table;
 }
 
 void TBFontFace::SetBackgroundFont(TBFontFace *font, const TBColor &col, int xofs, int yofs)
@@ -275,6 +858,7 @@ bool TBFontFace::RenderGlyphs(const char *glyph_str, int glyph_str_len)
 	if (glyph_str_len == TB_ALL_TO_TERMINATION)
 		glyph_str_len = (int)strlen(glyph_str);
 
+	ValidateEffect();
 	bool has_all_glyphs = true;
 	int i = 0;
 	while (glyph_str[i] && i < glyph_str_len)
@@ -293,51 +877,111 @@ TBFontGlyph *TBFontFace::CreateAndCacheGlyph(UCS4 cp)
 
 	// Create the new glyph
 	TBFontGlyph *glyph = m_glyph_cache->CreateAndCacheGlyph(GetHashId(cp), cp);
-	if (glyph)
-		m_font_renderer->GetGlyphMetrics(&glyph->metrics, cp);
+	if (!glyph)
+		return nullptr;
+	// Glyphs that were saved don't need the font renderer.
+	glyph->saved_key = GetSavedGlyphKey(cp);
+	if (!m_glyph_cache->SetSavedGlyphMetrics(glyph))
+		GetGlyphMetrics(glyph);
 	return glyph;
 }
 
+void TBFontFace::GetGlyphMetrics(TBFontGlyph *glyph)
+{
+	// The renderer may have to rasterize the glyph to get its metrics, so leave it to the worker.
+	if (m_glyph_cache->GetRenderInBackground())
+	{
+		glyph->metrics_pending = true;
+		if (!glyph->queued)
+			m_glyph_cache->QueueGlyph(this, m_font_renderer, glyph);
+		return;
+	}
+	m_font_renderer->GetGlyphMetrics(&glyph->metrics, glyph->cp);
+	glyph->metrics_pending = false;
+}
+
 void TBFontFace::RenderGlyph(TBFontGlyph *glyph)
 {
 	assert(!glyph->frag);
+	if (m_glyph_cache->CreateSavedGlyphFragment(glyph))
+		return;
+	if (m_glyph_cache->GetRenderInBackground())
+	{
+		if (!glyph->queued)
+			m_glyph_cache->QueueGlyph(this, m_font_renderer, glyph);
+		return;
+	}
 	TBFontGlyphData glyph_data;
-	if (m_font_renderer->RenderGlyph(&glyph_data, glyph->cp))
+	if (!m_font_renderer->RenderGlyph(&glyph_data, glyph->cp))
 	{
-		TBFontGlyphData *effect_glyph_data = m_effect.Render(&glyph->metrics, &glyph_data);
-		TBFontGlyphData *result_glyph_data = effect_glyph_data ? effect_glyph_data : &glyph_data;
+		glyph->no_bitmap = true;
+		return;
+	}
+	// Effects adjust the metrics, so start over from the renderer metrics in case this glyph
+	// was rendered before and dropped from the cache.
+	if (!m_sdf && m_effect.GetBlurRadius())
+		m_font_renderer->GetGlyphMetrics(&glyph->metrics, glyph->cp);
+	CreateGlyphFragment(glyph, &glyph_data);
+}
 
-		// The glyph data may be in uint8_t format, which we have to convert since we always
-		// create fragments (and TBBitmap) in 32bit format.
-		uint32_t *glyph_dsta_src = result_glyph_data->data32;
-		if (!glyph_dsta_src && result_glyph_data->data8)
+void TBFontFace::CreateGlyphFragment(TBFontGlyph *glyph, const TBFontGlyphData *glyph_data)
+{
+	// Effects are for the size they are rendered at, so SDF glyphs that are scaled have none.
+	TBFontGlyphData *effect_glyph_data = nullptr;
+	if (!m_sdf && m_effect.GetBlurRadius())
+		effect_glyph_data = m_effect.Render(&glyph->metrics, glyph_data);
+	const TBFontGlyphData *result_glyph_data = effect_glyph_data ? effect_glyph_data : glyph_data;
+
+	// The glyph data may be in uint8_t format. Keep it as alpha only if the renderer
+	// supports it, or convert it to the 32bit format. SDF fonts convert it to a distance field.
+	void *glyph_data_src = result_glyph_data->data32;
+	int glyph_data_stride = result_glyph_data->stride;
+	TB_BITMAP_FORMAT glyph_data_format = TB_BITMAP_FORMAT_RGBA32;
+	TBFontGlyphData sdf_glyph_data;
+	if (!glyph_data_src && result_glyph_data->data8 && m_sdf)
+	{
+		if (RenderSDF(result_glyph_data, &sdf_glyph_data))
 		{
-			if (m_temp_buffer.Reserve(result_glyph_data->w * result_glyph_data->h * sizeof(uint32_t)))
-			{
-				glyph_dsta_src = (uint32_t *) m_temp_buffer.GetData();
-				for (int y = 0; y < result_glyph_data->h; y++)
-					for (int x = 0; x < result_glyph_data->w; x++)
-					{
+			result_glyph_data = &sdf_glyph_data;
+			glyph_data_src = sdf_glyph_data.data8;
+			glyph_data_stride = sdf_glyph_data.stride;
+			glyph_data_format = TB_BITMAP_FORMAT_SDF8;
+		}
+	}
+	else if (!glyph_data_src && result_glyph_data->data8 && g_renderer->IsBitmapFormatSupported(TB_BITMAP_FORMAT_A8))
+	{
+		glyph_data_src = result_glyph_data->data8;
+		glyph_data_format = TB_BITMAP_FORMAT_A8;
+	}
+	else if (!glyph_data_src && result_glyph_data->data8)
+	{
+		if (m_temp_buffer.Reserve(result_glyph_data->w * result_glyph_data->h * sizeof(uint32_t)))
+		{
+			uint32_t *glyph_dsta_src = (uint32_t *) m_temp_buffer.GetData();
+			for (int y = 0; y < result_glyph_data->h; y++)
+				for (int x = 0; x < result_glyph_data->w; x++)
+				{
 #ifdef TB_PREMULTIPLIED_ALPHA
-						uint8_t opacity = result_glyph_data->data8[x + y * result_glyph_data->stride];
-						glyph_dsta_src[x + y * result_glyph_data->w] = TBColor(opacity, opacity, opacity, opacity);
+					uint8_t opacity = result_glyph_data->data8[x + y * result_glyph_data->stride];
+					glyph_dsta_src[x + y * result_glyph_data->w] = TBColor(opacity, opacity, opacity, opacity);
 #else
-						glyph_dsta_src[x + y * result_glyph_data->w] = TBColor(255, 255, 255, result_glyph_data->data8[x + y * result_glyph_data->stride]);
+					glyph_dsta_src[x + y * result_glyph_data->w] = TBColor(255, 255, 255, result_glyph_data->data8[x + y * result_glyph_data->stride]);
 #endif
-					}
-			}
-		}
-
-		// Finally, the glyph data is ready and we can create a bitmap fragment.
-		if (glyph_dsta_src)
-		{
-			glyph->has_rgb = result_glyph_data->rgb;
-			m_glyph_cache->CreateFragment(glyph, result_glyph_data->w, result_glyph_data->h,
-										result_glyph_data->stride, glyph_dsta_src);
+				}
+			glyph_data_src = glyph_dsta_src;
+			glyph_data_stride = result_glyph_data->w;
 		}
+	}
 
-		delete effect_glyph_data;
+	// Finally, the glyph data is ready and we can create a bitmap fragment.
+	if (glyph_data_src)
+	{
+		glyph->has_rgb = result_glyph_data->rgb;
+		m_glyph_cache->CreateFragment(glyph, result_glyph_data->w, result_glyph_data->h,
+									glyph_data_stride, glyph_data_format, glyph_data_src);
 	}
+
+	delete effect_glyph_data;
 #ifdef TB_RUNTIME_DEBUG_INFO
 	//char glyph_str[9];
 	//int len = utf8::encode(cp, glyph_str);
@@ -348,62 +992,300 @@ void TBFontFace::RenderGlyph(TBFontGlyph *glyph)
 #endif
 }
 
+bool TBFontFace::RenderSDF(const TBFontGlyphData *src, TBFontGlyphData *dst)
+{
+	dst->w = src->w + SDF_PADDING * 2;
+	dst->h = src->h + SDF_PADDING * 2;
+	dst->stride = dst->w;
+	if (!m_temp_buffer.Reserve(dst->w * dst->h))
+		return false;
+	dst->data8 = (uint8_t *) m_temp_buffer.GetData();
+
+	for (int y = 0; y < dst->h; y++)
+		for (int x = 0; x < dst->w; x++)
+		{
+			// Find the nearest texel on the other side of the edge. Texels
+			// further away than the padding are all at the max distance.
+			const int coverage = GetGlyphCoverage(src, x - SDF_PADDING, y - SDF_PADDING);
+			const bool inside = coverage >= 128;
+			int min_dist_sq = (SDF_PADDING + 1) * (SDF_PADDING + 1);
+			for (int dy = -SDF_PADDING; dy <= SDF_PADDING; dy++)
+				for (int dx = -SDF_PADDING; dx <= SDF_PADDING; dx++)
+				{
+					const int dist_sq = dx * dx + dy * dy;
+					if (dist_sq < min_dist_sq &&
+						(GetGlyphCoverage(src, x + dx - SDF_PADDING, y + dy - SDF_PADDING) >= 128) != inside)
+						min_dist_sq = dist_sq;
+				}
+
+			// The edge is halfway to the nearest texel on the other side, or where
+			// the coverage says if that is a direct neighbour.
+			float dist;
+			if (min_dist_sq == 1)
+				dist = coverage / 255.f - 0.5f;
+			else
+				dist = inside ? sqrtf((float) min_dist_sq) - 0.5f : 0.5f - sqrtf((float) min_dist_sq);
+			const float value = TB_SDF8_EDGE + dist * TB_SDF8_STEPS_PER_TEXEL + 0.5f;
+			dst->data8[x + y * dst->stride] = (uint8_t) CLAMP(value, 0.f, 255.f);
+		}
+	dst->rgb = false;
+	return true;
+}
+
+TBRect TBFontFace::GetSDFGlyphRect(const TBFontGlyph *glyph, float x, int y) const
+{
+	const int padding = glyph->frag->GetFormat() == TB_BITMAP_FORMAT_SDF8 ? SDF_PADDING : 0;
+	const float x0 = x + (glyph->metrics.x - padding) * m_sdf_scale;
+	const float y0 = y + GetAscent() + (glyph->metrics.y - padding) * m_sdf_scale;
+	const int left = (int) floorf(x0 + 0.5f);
+	const int top = (int) floorf(y0 + 0.5f);
+	return TBRect(left, top,
+				(int) floorf(x0 + glyph->frag->Width() * m_sdf_scale + 0.5f) - left,
+				(int) floorf(y0 + glyph->frag->Height() * m_sdf_scale + 0.5f) - top);
+}
+
 TBID TBFontFace::GetHashId(UCS4 cp) const
 {
-	return cp * 3111 + m_font_desc.GetFontFaceID();
+	if (m_sdf)
+	{
+		// All sizes of a SDF font share the same glyphs.
+		TBFontDescription font_desc(m_font_desc);
+		font_desc.SetSize(0);
+		return cp * 3111 + font_desc.GetFontFaceID();
+	}
+	// Glyphs with effects are cached separately from the plain ones.
+	return cp * 3111 + m_font_desc.GetFontFaceID() + m_effect.GetBlurRadius() * 0x9e3779b9u;
+}
+
+uint32_t TBFontFace::GetSavedGlyphKey(UCS4 cp) const
+{
+	if (!m_file_hash)
+		return 0;
+	// Like GetHashId, SDF glyphs are the same for all sizes and have no effect.
+	const uint32_t values[4] = { m_sdf ? 0 : m_font_desc.GetSize(), m_sdf ? 1u : 0u,
+								m_sdf ? 0 : (uint32_t) m_effect.GetBlurRadius(), cp };
+	uint32_t hash = m_file_hash;
+	for (int i = 0; i < 4; i++)
+		hash = (hash ^ values[i]) * prime;
+	return hash ? hash : 1;
 }
 
 TBFontGlyph *TBFontFace::GetGlyph(UCS4 cp, bool render_if_needed)
 {
-	TBFontGlyph *glyph = m_glyph_cache->GetGlyph(GetHashId(cp), cp);
-	if (!glyph)
-		glyph = CreateAndCacheGlyph(cp);
-	if (glyph && !glyph->frag && render_if_needed)
+	// Glyphs are never deleted from the glyph cache (only their fragments),
+	// so the table doesn't need to know when they are dropped.
+	TBFontGlyph *glyph = cp < m_glyph_table_size ? m_glyph_table[cp] : nullptr;
+	if (glyph)
+		m_glyph_cache->MarkGlyphUsed(glyph);
+	else
+	{
+		glyph = m_glyph_cache->GetGlyph(GetHashId(cp), cp);
+		if (!glyph)
+			glyph = CreateAndCacheGlyph(cp);
+		if (glyph && cp < TB_FONT_GLYPH_TABLE_SIZE)
+			AddToGlyphTable(glyph);
+	}
+	// The metrics may still be pending if the face that queued the glyph was deleted.
+	if (glyph && glyph->metrics_pending && !glyph->queued)
+		GetGlyphMetrics(glyph);
+	if (glyph && !glyph->frag && !glyph->no_bitmap && render_if_needed)
 		RenderGlyph(glyph);
 	return glyph;
 }
 
-void TBFontFace::DrawString(int x, int y, const TBColor &color, const char *str, int len)
+void TBFontFace::ValidateEffect()
 {
-	if (m_bgFont)
-		m_bgFont->DrawString(x+m_bgX, y+m_bgY, m_bgColor, str, len);
+	if (m_glyphs_blur_radius == m_effect.GetBlurRadius() || m_sdf)
+		return;
+	m_glyphs_blur_radius = m_effect.GetBlurRadius();
+	if (m_glyph_table_size)
+		memset(m_glyph_table, 0, m_glyph_table_size * sizeof(TBFontGlyph *));
+	m_glyph_runs.RemoveAll();
+	m_glyph_runs_lru.DeleteAll();
+}
 
-	if (m_font_renderer)
-		g_renderer->BeginBatchHint(TBRenderer::BATCH_HINT_DRAW_BITMAP_FRAGMENT);
+void TBFontFace::AddToGlyphTable(TBFontGlyph *glyph)
+{
+	if (glyph->cp >= m_glyph_table_size)
+	{
+		// Grow to the next power of two, so text in one script only needs the table up to it.
+		UCS4 new_size = MAX(m_glyph_table_size, (UCS4) 128);
+		while (new_size <= glyph->cp)
+			new_size *= 2;
+		new_size = MIN(new_size, (UCS4) TB_FONT_GLYPH_TABLE_SIZE);
+		TBFontGlyph **new_table = new TBFontGlyph *[new_size];
+		if (!new_table)
+			return;
+		if (m_glyph_table_size)
+			memcpy(new_table, m_glyph_table, m_glyph_table_size * sizeof(TBFontGlyph *));
+		memset(new_table + m_glyph_table_size, 0, (new_size - m_glyph_table_size) * sizeof(TBFontGlyph *));
+		delete [] m_glyph_table;
+		m_glyph_table = new_table;
+		m_glyph_table_size = new_size;
+	}
+	m_glyph_table[glyph->cp] = glyph;
+}
+
+TBFontGlyphRun *TBFontFace::GetGlyphRun(const char *str, int len, bool render_if_needed)
+{
+	// Hash the string (FNV-1a, like TBGetHash), and give up on strings too long to be worth caching.
+	uint32_t hash = basis;
+	int str_len = 0;
+	for (; str_len < len && str[str_len]; str_len++)
+	{
+		if (str_len == MAX_GLYPH_RUN_LENGTH)
+			return nullptr;
+		hash = (hash ^ str[str_len]) * prime;
+	}
+
+	if (TBFontGlyphRun *run = m_glyph_runs.Get(hash))
+	{
+		if (run->str_len == str_len && memcmp(run->str, str, str_len) == 0 &&
+			run->generation == m_glyph_cache->GetGeneration() &&
+			(run->rendered || !render_if_needed))
+		{
+			m_glyph_runs_lru.Remove(run);
+			m_glyph_runs_lru.AddLast(run);
+			// It's about to be drawn, so mark its glyphs as used like creating it did.
+			if (render_if_needed)
+				for (int i = 0; i < run->num_glyphs; i++)
+					m_glyph_cache->MarkGlyphUsed(run->glyphs[i]);
+			return run;
+		}
+		// It's stale, or another string with the same hash.
+		DeleteGlyphRun(run);
+	}
+
+	if (m_glyph_runs_lru.CountLinks() >= MAX_GLYPH_RUNS)
+		DeleteGlyphRun(m_glyph_runs_lru.GetFirst());
+	return CreateGlyphRun(hash, str, str_len, render_if_needed);
+}
+
+TBFontGlyphRun *TBFontFace::CreateGlyphRun(uint32_t hash, const char *str, int str_len, bool render_if_needed)
+{
+	int num_glyphs = 0;
+	for (int i = 0; i < str_len; num_glyphs++)
+		utf8::decode_next(str, &i, str_len);
+
+	TBFontGlyphRun *run = new TBFontGlyphRun;
+	if (!run)
+		return nullptr;
+	run->hash = hash;
+	run->str = new char[str_len];
+	run->glyphs = new TBFontGlyph *[num_glyphs];
+	run->x = new float[num_glyphs];
+	if (!run->str || !run->glyphs || !run->x || !m_glyph_runs.Add(hash, run))
+	{
+		delete run;
+		return nullptr;
+	}
+	m_glyph_runs_lru.AddLast(run);
+	memcpy(run->str, str, str_len);
+	run->str_len = str_len;
+	// Rendering glyphs may drop others, also in this run. Remember the generation
+	// from before, so the run is created again next time if that happens.
+	run->generation = m_glyph_cache->GetGeneration();
+	run->rendered = render_if_needed;
 
 	int i = 0;
-	while (str[i] && i < len)
+	while (i < str_len)
 	{
-		UCS4 cp = utf8::decode_next(str, &i, len);
+		UCS4 cp = utf8::decode_next(str, &i, str_len);
 		if (cp == 0xFFFF)
 			continue;
-		if (TBFontGlyph *glyph = GetGlyph(cp, true))
+		if (TBFontGlyph *glyph = GetGlyph(cp, render_if_needed))
 		{
-			if (glyph->frag)
-			{
-				TBRect dst_rect(x + glyph->metrics.x, y + glyph->metrics.y + GetAscent(), glyph->frag->Width(), glyph->frag->Height());
-				TBRect src_rect(0, 0, glyph->frag->Width(), glyph->frag->Height());
-				if (glyph->has_rgb)
-					g_renderer->DrawBitmap(dst_rect, src_rect, glyph->frag);
-				else
-					g_renderer->DrawBitmapColored(dst_rect, src_rect, color, glyph->frag);
-			}
-			x += glyph->metrics.advance;
+			run->glyphs[run->num_glyphs] = glyph;
+			run->x[run->num_glyphs] = run->width;
+			run->num_glyphs++;
+			// Keep the fractions of scaled advances of SDF fonts, so text has the same width as measured.
+			run->width += glyph->metrics.advance * m_sdf_scale;
 		}
-		else if (!m_font_renderer) // This is the test font. Use same glyph width as height and draw square.
+	}
+	return run;
+}
+
+void TBFontFace::DeleteGlyphRun(TBFontGlyphRun *run)
+{
+	m_glyph_runs.Remove(run->hash);
+	m_glyph_runs_lru.Delete(run);
+}
+
+void TBFontFace::DrawGlyph(const TBFontGlyph *glyph, float x, int y, const TBColor &color)
+{
+	if (!glyph->frag)
+	{
+		if (glyph->queued)
+			m_glyph_cache->m_num_skipped_glyphs++;
+		return;
+	}
+	TBRect dst_rect;
+	if (m_sdf)
+		dst_rect = GetSDFGlyphRect(glyph, x, y);
+	else
+		dst_rect.Set((int) x + glyph->metrics.x, y + glyph->metrics.y + GetAscent(), glyph->frag->Width(), glyph->frag->Height());
+	TBRect src_rect(0, 0, glyph->frag->Width(), glyph->frag->Height());
+	if (glyph->has_rgb)
+		g_renderer->DrawBitmap(dst_rect, src_rect, glyph->frag);
+	else
+		g_renderer->DrawBitmapColored(dst_rect, src_rect, color, glyph->frag);
+}
+
+void TBFontFace::DrawString(int x, int y, const TBColor &color, const char *str, int len)
+{
+	if (m_bgFont)
+		m_bgFont->DrawString(x+m_bgX, y+m_bgY, m_bgColor, str, len);
+
+	if (!m_font_renderer)
+	{
+		// This is the test font. Use same glyph width as height and draw square.
+		int i = 0;
+		while (str[i] && i < len)
 		{
+			UCS4 cp = utf8::decode_next(str, &i, len);
+			if (cp == 0xFFFF)
+				continue;
 			g_tb_skin->PaintRect(TBRect(x, y, m_metrics.height / 3, m_metrics.height), color, 1);
 			x += m_metrics.height / 3 + 1;
 		}
+		return;
 	}
 
-	if (m_font_renderer)
-		g_renderer->EndBatchHint();
+	ValidateEffect();
+	g_renderer->BeginBatchHint(TBRenderer::BATCH_HINT_DRAW_BITMAP_FRAGMENT);
+	if (TBFontGlyphRun *run = GetGlyphRun(str, len, true))
+	{
+		for (int i = 0; i < run->num_glyphs; i++)
+			DrawGlyph(run->glyphs[i], x + run->x[i], y, color);
+	}
+	else
+	{
+		float pen_x = (float) x;
+		int i = 0;
+		while (str[i] && i < len)
+		{
+			UCS4 cp = utf8::decode_next(str, &i, len);
+			if (cp == 0xFFFF)
+				continue;
+			if (TBFontGlyph *glyph = GetGlyph(cp, true))
+			{
+				DrawGlyph(glyph, pen_x, y, color);
+				pen_x += glyph->metrics.advance * m_sdf_scale;
+			}
+		}
+	}
+	g_renderer->EndBatchHint();
 }
 
 int TBFontFace::GetStringWidth(const char *str, int len)
 {
-	int width = 0;
+	if (m_font_renderer)
+	{
+		ValidateEffect();
+		if (TBFontGlyphRun *run = GetGlyphRun(str, len, false))
+			return (int) (run->width + 0.5f);
+	}
+	float width = 0;
 	int i = 0;
 	while (str[i] && i < len)
 	{
@@ -413,9 +1295,9 @@ int TBFontFace::GetStringWidth(const char *str, int len)
 		if (!m_font_renderer) // This is the test font. Use same glyph width as height.
 			width += m_metrics.height / 3 + 1;
 		else if (TBFontGlyph *glyph = GetGlyph(cp, false))
-			width += glyph->metrics.advance;
+			width += glyph->metrics.advance * m_sdf_scale;
 	}
-	return width;
+	return (int) (width + 0.5f);
 }
 
 #ifdef TB_RUNTIME_DEBUG_INFO
@@ -428,6 +1310,7 @@ void TBFontFace::Debug()
 // == TBFontManager ===============================================================================
 
 TBFontManager::TBFontManager()
+	: m_save_glyphs(false)
 {
 	// Add the test dummy font with empty name (Equals to ID 0)
 	AddFontInfo("-test-font-dummy-", "");
@@ -440,6 +1323,8 @@ TBFontManager::TBFontManager()
 
 TBFontManager::~TBFontManager()
 {
+	// The font faces use the glyph cache, so delete them first.
+	m_fonts.DeleteAll();
 }
 
 TBFontInfo *TBFontManager::AddFontInfo(const char *filename, const char *name)
@@ -494,8 +1379,15 @@ TBFontFace *TBFontManager::CreateFontFace(const TBFontDescription &font_desc)
 	// Iterate through font renderers until we find one capable of creating a font for this file.
 	for (TBFontRenderer *fr = m_font_renderers.GetFirst(); fr; fr = fr->GetNext())
 	{
-		if (TBFontFace *font = fr->Create(this, fi->GetFilename(), font_desc))
+		TBFontFace *font;
+		{
+			TBFontRendererLock lock(m_glyph_cache.m_worker);
+			font = fr->Create(this, fi->GetFilename(), font_desc);
+		}
+		if (font)
 		{
+			if (m_save_glyphs)
+				font->m_file_hash = GetFontFileHash(fi);
 			if (m_fonts.Add(font_desc.GetFontFaceID(), font))
 				return font;
 			delete font;
@@ -504,4 +1396,30 @@ TBFontFace *TBFontManager::CreateFontFace(const TBFontDescription &font_desc)
 	return nullptr;
 }
 
+uint32_t TBFontManager::GetFontFileHash(TBFontInfo *font_info)
+{
+	if (!font_info->m_file_hash)
+	{
+		TBTempBuffer file;
+		if (!file.AppendFile(font_info->GetFilename()))
+			return 0;
+		uint32_t hash = basis;
+		for (int i = 0; i < file.GetAppendPos(); i++)
+			hash = (hash ^ (uint8_t) file.GetData()[i]) * prime;
+		font_info->m_file_hash = hash ? hash : 1;
+	}
+	return font_info->m_file_hash;
+}
+
+bool TBFontManager::LoadGlyphCache(const TBStr &filename)
+{
+	m_save_glyphs = true;
+	return m_glyph_cache.LoadSavedGlyphs(filename);
+}
+
+bool TBFontManager::SaveGlyphCache(const TBStr &filename)
+{
+	return m_glyph_cache.SaveGlyphs(filename);
+}
+
 } // namespace tb
@@ -12,12 +12,14 @@
 #include "tb_tempbuffer.h"
 #include "tb_linklist.h"
 #include "tb_font_desc.h"
+#include "tb_msg.h"
 #include "utf8/utf8.h"
 
 namespace tb {
 
 class TBBitmap;
 class TBFontFace;
+class TBFontGlyphWorker;
 
 /** TBFontGlyphData is rendering info used during glyph rendering by TBFontRenderer.
 	It does not own the data pointers. */
@@ -66,6 +68,14 @@ public:
 	virtual void GetGlyphMetrics(TBGlyphMetrics *metrics, UCS4 cp) = 0;
 	virtual TBFontMetrics GetMetrics() = 0;
 	//virtual int GetKernAdvance(UCS4 cp1, UCS4 cp2) = 0;
+
+	/** Return true if this renderer renders glyphs and metrics at TB_FONT_SDF_SIZE, for TBFontFace
+		to convert to signed distance fields and scale to the size of the font description. */
+	virtual bool IsSDF() const { return false; }
+
+	/** Return true if a renderer able to render at TB_FONT_SDF_SIZE should do so for the given
+		font description. That is if it asks for SDF glyphs, and g_renderer supports them. */
+	static bool ShouldRenderSDF(const TBFontDescription &font_desc);
 };
 
 /** TBFontGlyph holds glyph metrics and bitmap fragment.
@@ -80,25 +90,121 @@ public:
 	TBGlyphMetrics metrics;		///< The glyph metrics.
 	TBBitmapFragment *frag;		///< The bitmap fragment, or nullptr if missing.
 	bool has_rgb;				///< if true, drawing should ignore text color.
+	bool queued;				///< If it's waiting to be rendered in the background.
+	bool metrics_pending;		///< If its metrics are rendered in the background with it, so it has no advance yet.
+	bool no_bitmap;				///< If the renderer had no bitmap for it (f.ex space), so it's not rendered again.
+	uint32_t last_used;			///< TBFontGlyphCache use counter when it was last used (See MarkGlyphUsed).
+	uint32_t saved_key;			///< Identifies the glyph across runs (See TBFontManager::SaveGlyphCache), or 0.
+};
+
+/** TBFontGlyphListener is notified when glyphs that were rendered in the background are ready.
+	See TBFontGlyphCache::SetRenderInBackground. */
+class TBFontGlyphListener : public TBLinkOf<TBFontGlyphListener>
+{
+public:
+	virtual ~TBFontGlyphListener() {}
+
+	/** Called when glyphs that were skipped when drawing text may be drawn. */
+	virtual void OnGlyphsRendered() = 0;
 };
 
 /** TBFontGlyphCache caches glyphs for font faces.
-	Rendered glyphs use bitmap fragments from its fragment manager. */
-class TBFontGlyphCache : private TBRendererListener
+	Rendered glyphs use bitmap fragments from its fragment managers. There is one for each
+	bitmap format, so glyphs that are only coverage (alpha) use a fourth of the memory of
+	color glyphs if the renderer supports TB_BITMAP_FORMAT_A8. Glyphs of signed distance
+	field fonts are TB_BITMAP_FORMAT_SDF8, with a border since they are drawn scaled.
+
+	Each map (page) is TB_GLYPH_CACHE_WIDTH x TB_GLYPH_CACHE_HEIGHT. New pages are added
+	while the memory budget allows it. When it doesn't, the least recently used page is
+	dropped with all its glyphs, which are rendered again when they are needed.
+
+	Glyphs may also be rendered by a worker thread (See SetRenderInBackground). */
+class TBFontGlyphCache : private TBRendererListener, private TBMessageHandler
 {
 public:
 	TBFontGlyphCache();
 	~TBFontGlyphCache();
 
+	/** Counters for tuning the size of the cache. */
+	struct Stats
+	{
+		int hits;			///< Lookups of glyphs that were already rendered.
+		int misses;			///< Glyphs that had to be rendered into a page.
+		int evicted_pages;	///< Pages dropped to make room for new glyphs.
+		int evicted_glyphs;	///< Rendered glyphs dropped with those pages.
+	};
+
+	/** Set the max number of bytes the pages may use together. At least one page is always
+		allowed. Default is TB_GLYPH_CACHE_MEMORY_BUDGET. Pages already created are not
+		dropped until more room is needed. */
+	void SetMemoryBudget(int bytes) { m_memory_budget = bytes; }
+	int GetMemoryBudget() const { return m_memory_budget; }
+
+	/** Set the max number of pages, regardless of the memory budget. 0 means no limit (default). */
+	void SetMaxPages(int max_pages) { m_max_pages = max_pages; }
+	int GetMaxPages() const { return m_max_pages; }
+
+	/** Return the number of pages, and the bytes they use. */
+	int GetNumPages() const;
+	int GetMemoryUsage() const;
+
+	const Stats &GetStats() const { return m_stats; }
+	void ResetStats();
+
+	/** Set if glyphs should be rendered by a worker thread, so drawing text never waits for
+		the font renderer. Glyphs that aren't rendered yet are skipped when drawing, and the
+		listeners are notified when they are ready so the text can be painted again.
+		Only the font renderer runs on the worker, also for the metrics of new glyphs, which
+		have no advance until they arrive. Effects, signed distance fields and bitmap
+		fragments are done on the calling thread, when the rendered glyphs are picked up.
+		Default is false. Under Emscripten there are no threads, so this does nothing and
+		glyphs are always rendered when they are needed. */
+	void SetRenderInBackground(bool render_in_background);
+	bool GetRenderInBackground() const { return m_worker ? true : false; }
+
+	/** Pick up the glyphs rendered in the background, and notify the listeners if there were
+		any. This is done automatically by a message while there are glyphs waiting.
+		If wait is true, wait for all queued glyphs to be rendered first. */
+	void ProcessRenderedGlyphs(bool wait = false);
+
+	/** Return the number of times a glyph was skipped when drawing text, because it was still
+		being rendered in the background. It only increases, so if it changed while painting
+		something, it should be painted again when OnGlyphsRendered is called. */
+	int GetNumSkippedGlyphs() const { return m_num_skipped_glyphs; }
+
+	/** Save the glyphs that are rendered and have a saved_key to a file, with their metrics
+		and bitmap data. Saved glyphs that were loaded but not used are saved again.
+		Returns false on fail. */
+	bool SaveGlyphs(const TBStr &filename);
+
+	/** Load glyphs saved with SaveGlyphs. Glyphs with the same saved_key get their metrics
+		and bitmap from them, instead of from the font renderer. Returns false if the file
+		can't be read, or was saved by a build with different glyph formats. */
+	bool LoadSavedGlyphs(const TBStr &filename);
+
+	void AddListener(TBFontGlyphListener *listener) { m_listeners.AddLast(listener); }
+	void RemoveListener(TBFontGlyphListener *listener) { m_listeners.Remove(listener); }
+
+	/** Return a number that changes whenever glyph fragments are dropped, or metrics
+		rendered in the background arrive, so anything holding on to glyphs knows when
+		they may need to be rendered or measured again. */
+	int GetGeneration() const { return m_generation; }
+
 	/** Get the glyph or nullptr if it is not in the cache. */
 	TBFontGlyph *GetGlyph(const TBID &hash_id, UCS4 cp);
 
+	/** Mark the glyph as used, like GetGlyph does. For glyphs found without GetGlyph.
+		It only stamps the glyph, so it's cheap enough to call for each glyph drawn. */
+	void MarkGlyphUsed(TBFontGlyph *glyph);
+
 	/** Create the glyph and put it in the cache. Returns the glyph, or nullptr on fail. */
 	TBFontGlyph *CreateAndCacheGlyph(const TBID &hash_id, UCS4 cp);
 
-	/** Create a bitmap fragment for the given glyph and render data. This may drop other
-		rendered glyphs from the fragment map. Returns the fragment, or nullptr on fail. */
-	TBBitmapFragment *CreateFragment(TBFontGlyph *glyph, int w, int h, int stride, uint32_t *data);
+	/** Create a bitmap fragment for the given glyph and render data in the given format.
+		This may drop other rendered glyphs from the fragment map of the same format.
+		Returns the fragment, or nullptr on fail. */
+	TBBitmapFragment *CreateFragment(TBFontGlyph *glyph, int w, int h, int stride,
+									TB_BITMAP_FORMAT format, void *data);
 
 #ifdef TB_RUNTIME_DEBUG_INFO
 	/** Render the glyph bitmaps on screen, to analyze fragment positioning. */
@@ -108,11 +214,79 @@ public:
 	// Implementing TBRendererListener
 	virtual void OnContextLost();
 	virtual void OnContextRestored();
+
+	// Implementing TBMessageHandler
+	virtual void OnMessageReceived(TBMessage *msg);
 private:
+	friend class TBFontFace;
+	friend class TBFontManager;
+
+	/** A glyph in a file saved by SaveGlyphs. It's followed by its bitmap data
+		(w * h pixels), padded to 4 bytes. */
+	struct SavedGlyph
+	{
+		uint32_t key;
+		UCS4 cp;
+		TBGlyphMetrics metrics;
+		uint8_t format;		///< TB_BITMAP_FORMAT
+		uint8_t has_rgb;
+		uint16_t w, h;		///< 0 if there's no bitmap (See TBFontGlyph::no_bitmap).
+	};
+	/** Get the saved glyph with the key of the glyph, or nullptr. */
+	const SavedGlyph *GetSavedGlyph(const TBFontGlyph *glyph) const;
+	/** Set the metrics of the glyph from its saved glyph. Returns false if it wasn't saved. */
+	bool SetSavedGlyphMetrics(TBFontGlyph *glyph) const;
+	/** Set the metrics and create the fragment of the glyph from its saved glyph.
+		Returns false if it wasn't saved, or the fragment couldn't be created. */
+	bool CreateSavedGlyphFragment(TBFontGlyph *glyph);
+	/** Queue the glyph to be rendered in the background by the renderer of the face. */
+	void QueueGlyph(TBFontFace *face, TBFontRenderer *renderer, TBFontGlyph *glyph);
 	void DropGlyphFragment(TBFontGlyph *glyph);
-	TBBitmapFragmentManager m_frag_manager;
+	/** Return true if a new page in the given format fits in the budget. */
+	bool CanAddPage(TB_BITMAP_FORMAT format) const;
+	/** Drop the page that was least recently used, and all glyphs in it. A page was last
+		used when the most recently used glyph in it was. Returns false if there was no page to drop. */
+	bool DropLeastRecentlyUsedPage();
+	static const int NUM_FORMATS = TB_BITMAP_FORMAT_SDF8 + 1;
+	TBBitmapFragmentManager m_frag_managers[NUM_FORMATS];	///< Indexed by TB_BITMAP_FORMAT.
 	TBHashTableAutoDeleteOf<TBFontGlyph> m_glyphs;
-	TBLinkListOf<TBFontGlyph> m_all_rendered_glyphs;
+	TBLinkListOf<TBFontGlyph> m_rendered_glyphs;	///< The glyphs that have a fragment.
+	int m_memory_budget;
+	int m_max_pages;
+	int m_generation;
+	uint32_t m_use_counter;		///< Increased for each glyph marked as used. May wrap around.
+	Stats m_stats;
+	TBFontGlyphWorker *m_worker;	///< Renders glyphs in the background, or nullptr.
+	int m_num_skipped_glyphs;
+	TBLinkListOf<TBFontGlyphListener> m_listeners;
+	TBTempBuffer m_saved_glyphs_data;			///< The loaded file.
+	TBHashTableOf<SavedGlyph> m_saved_glyphs;	///< Glyphs in m_saved_glyphs_data, by key.
+};
+
+/** TBFontGlyphRun is a string decoded to glyphs and their positions. TBFontFace caches
+	them, so strings that are drawn or measured repeatedly skip UTF-8 decoding and glyph
+	lookup. It holds on to the glyphs, which are never deleted by TBFontGlyphCache, but
+	is invalidated when the glyph cache generation changes since their fragments may
+	have been dropped.
+
+	Glyphs drawn from a cached run are still marked as used in the glyph cache, so the
+	pages holding text that is on screen are not the ones dropped when it's full. */
+class TBFontGlyphRun : public TBLinkOf<TBFontGlyphRun>
+{
+public:
+	TBFontGlyphRun() : hash(0), str(nullptr), str_len(0), generation(0), rendered(false),
+						num_glyphs(0), glyphs(nullptr), x(nullptr), width(0) {}
+	~TBFontGlyphRun() { delete [] str; delete [] glyphs; delete [] x; }
+
+	uint32_t hash;
+	char *str;				///< A copy of the string (not null terminated).
+	int str_len;
+	int generation;			///< TBFontGlyphCache::GetGeneration when created.
+	bool rendered;			///< If the glyphs were rendered when created, so it can be drawn.
+	int num_glyphs;
+	TBFontGlyph **glyphs;
+	float *x;				///< The pen position of each glyph, relative to the string.
+	float width;			///< The sum of all advances.
 };
 
 /** TBFontEffect applies an effect on each glyph that is rendered in a TBFontFace. */
@@ -124,6 +298,7 @@ public:
 
 	/** Set blur radius. 0 means no blur. */
 	void SetBlurRadius(int blur_radius);
+	int GetBlurRadius() const { return m_blur_radius; }
 
 	/** Returns true if the result is in RGB and should not be painted using the color parameter
 		given to DrawString. In other words: It's a color glyph. */
@@ -138,7 +313,14 @@ private:
 	TBTempBuffer m_data_dst;
 };
 
-/** TBFontFace represents a loaded font that can measure and render strings. */
+/** TBFontFace represents a loaded font that can measure and render strings.
+
+	If the font renderer renders SDF glyphs (See TBFontRenderer::IsSDF), they are shared
+	with all other sizes of the same font, and scaled when drawn.
+
+	The glyphs of strings that are drawn or measured are cached as TBFontGlyphRun, for
+	strings up to 256 bytes. Glyphs of code points below TB_FONT_GLYPH_TABLE_SIZE are
+	also kept in a table indexed by code point, so they are found without hashing. */
 class TBFontFace
 {
 public:
@@ -159,11 +341,15 @@ public:
 	/** Get height of the font in pixels. */
 	int GetHeight() const { return m_metrics.height; }
 
+	/** Return true if the glyphs are signed distance fields. */
+	bool IsSDF() const { return m_sdf; }
+
 	/** Get the font description that was used to create this font. */
 	TBFontDescription GetFontDescription() const { return m_font_desc; }
 
 	/** Get the effect object, so the effect can be changed.
-		Note: No glyphs are re-rendered. Only new glyphs are affected. */
+		Glyphs are cached separately for each effect, so changing it back
+		and forth only renders glyphs the first time they are needed. */
 	TBFontEffect *GetEffect() { return &m_effect; }
 
 	/** Draw string at position x, y (marks the upper left corner of the text). */
@@ -182,16 +368,49 @@ public:
 	    when calling DrawString. Very usefull to add a shadow effect to a font. */
 	void SetBackgroundFont(TBFontFace *font, const TBColor &col, int xofs, int yofs);
 private:
+	friend class TBFontGlyphCache;
+	friend class TBFontManager;
 	TBID GetHashId(UCS4 cp) const;
+	/** Get the key of the glyph of the code point that is the same across runs,
+		or 0 if the hash of the font file isn't known. */
+	uint32_t GetSavedGlyphKey(UCS4 cp) const;
 	TBFontGlyph *GetGlyph(UCS4 cp, bool render_if_needed);
+	/** Add the glyph to m_glyph_table, growing it if needed. */
+	void AddToGlyphTable(TBFontGlyph *glyph);
+	/** Clear m_glyph_table and the glyph runs if the effect changed since they were filled. */
+	void ValidateEffect();
+	/** Get the cached glyph run for the string, or create it. Returns nullptr if the string
+		is too long to cache, or on fail. */
+	TBFontGlyphRun *GetGlyphRun(const char *str, int len, bool render_if_needed);
+	TBFontGlyphRun *CreateGlyphRun(uint32_t hash, const char *str, int str_len, bool render_if_needed);
+	void DeleteGlyphRun(TBFontGlyphRun *run);
+	void DrawGlyph(const TBFontGlyph *glyph, float x, int y, const TBColor &color);
 	TBFontGlyph *CreateAndCacheGlyph(UCS4 cp);
+	/** Get the metrics of the glyph from the font renderer, or queue it so the worker
+		does it if the glyph cache renders in the background. */
+	void GetGlyphMetrics(TBFontGlyph *glyph);
 	void RenderGlyph(TBFontGlyph *glyph);
+	/** Apply the effect to the rendered glyph data, and create the bitmap fragment of the glyph. */
+	void CreateGlyphFragment(TBFontGlyph *glyph, const TBFontGlyphData *glyph_data);
+	/** Convert the coverage of src to a signed distance field in m_temp_buffer, with
+		TB_BITMAP_FORMAT_SDF8 values. Returns false on fail. */
+	bool RenderSDF(const TBFontGlyphData *src, TBFontGlyphData *dst);
+	/** Get the rect to draw the fragment of the glyph of a SDF font at. */
+	TBRect GetSDFGlyphRect(const TBFontGlyph *glyph, float x, int y) const;
 	TBFontGlyphCache *m_glyph_cache;
 	TBFontRenderer *m_font_renderer;
 	TBFontDescription m_font_desc;
 	TBFontMetrics m_metrics;
 	TBFontEffect m_effect;
 	TBTempBuffer m_temp_buffer;
+	bool m_sdf;
+	float m_sdf_scale;	///< The size of this face relative to TB_FONT_SDF_SIZE.
+	TBHashTableOf<TBFontGlyphRun> m_glyph_runs;
+	TBLinkListAutoDeleteOf<TBFontGlyphRun> m_glyph_runs_lru;	///< Owns the runs (oldest first).
+	TBFontGlyph **m_glyph_table;	///< Glyphs indexed by code point, or nullptr if not looked up yet.
+	UCS4 m_glyph_table_size;
+	int m_glyphs_blur_radius;		///< The blur radius of the glyphs in the table and runs.
+	uint32_t m_file_hash;			///< The hash of the font file, or 0 if glyphs aren't saved.
 
 	TBFontFace *m_bgFont;
 	int m_bgX;
@@ -215,10 +434,11 @@ public:
 
 private:
 	friend class TBFontManager;
-	TBFontInfo(const TBStr & filename, const TBStr & name) : m_filename(filename), m_name(name), m_id(name) {}
+	TBFontInfo(const TBStr & filename, const TBStr & name) : m_filename(filename), m_name(name), m_id(name), m_file_hash(0) {}
 	TBStr m_filename;
 	TBStr m_name;
 	TBID m_id;
+	uint32_t m_file_hash;	///< The hash of the file content, or 0 if not read yet.
 };
 
 /** TBFontManager creates and owns font faces (TBFontFace) which are looked up from
@@ -271,13 +491,29 @@ public:
 
 	/** Return the glyph cache used for fonts created by this font manager. */
 	TBFontGlyphCache *GetGlyphCache() { return &m_glyph_cache; }
+
+	/** Load glyphs saved with SaveGlyphCache, so font faces created after this use them
+		instead of calling the font renderer. Glyphs are identified by the hash of the font
+		file, the size, the effect and the code point.
+
+		This also makes font faces created after this hash their font file, so their glyphs
+		can be saved. So call it before creating fonts, also if the file doesn't exist yet.
+		Returns false if the file couldn't be loaded. */
+	bool LoadGlyphCache(const TBStr &filename);
+
+	/** Save the glyphs rendered by font faces created after LoadGlyphCache.
+		Returns false on fail. */
+	bool SaveGlyphCache(const TBStr &filename);
 private:
+	/** Return the hash of the file of the font info, or 0 if it can't be read. */
+	uint32_t GetFontFileHash(TBFontInfo *font_info);
 	TBHashTableAutoDeleteOf<TBFontInfo> m_font_info;
 	TBHashTableAutoDeleteOf<TBFontFace> m_fonts;
 	TBLinkListAutoDeleteOf<TBFontRenderer> m_font_renderers;
 	TBFontGlyphCache m_glyph_cache;
 	TBFontDescription m_default_font_desc;
 	TBFontDescription m_test_font_desc;
+	bool m_save_glyphs;		///< If font files are hashed, so glyphs can be saved (See LoadGlyphCache).
 };
 
 } // namespace tb
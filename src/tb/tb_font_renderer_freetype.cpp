@@ -62,12 +62,14 @@ public:
 	virtual TBFontMetrics GetMetrics();
 	virtual bool RenderGlyph(TBFontGlyphData *dst_bitmap, UCS4 cp);
 	virtual void GetGlyphMetrics(TBGlyphMetrics *metrics, UCS4 cp);
+	virtual bool IsSDF() const { return m_sdf; }
 private:
 	bool Load(FreetypeFace *face, const TBFontDescription &font_desc);
 	bool Load(const TBStr & filename, const TBFontDescription &font_desc);
 
 	FT_Size m_size;
 	FreetypeFace *m_face;
+	bool m_sdf;
 	//bool m_outline;
 	//TBColor m_data[1024]; // 32x32
 	//static const int maxcw = 32;
@@ -76,6 +78,7 @@ private:
 FreetypeFontRenderer::FreetypeFontRenderer()
 	: m_size(nullptr)
 	, m_face(nullptr)
+	, m_sdf(false)
 {
 	num_fonts++;
 }
@@ -219,7 +222,8 @@ void FreetypeFontRenderer::GetGlyphMetrics(TBGlyphMetrics *metrics, UCS4 cp)
 
 bool FreetypeFontRenderer::Load(FreetypeFace *face, const TBFontDescription &font_desc)
 {
-	int size = font_desc.GetSize();
+	m_sdf = ShouldRenderSDF(font_desc);
+	int size = m_sdf ? TB_FONT_SDF_SIZE : font_desc.GetSize();
 	// Should not be possible to have a face if freetype is not initialized
 	assert(ft_initialized);
 	m_face = face;
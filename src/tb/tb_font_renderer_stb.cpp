@@ -29,6 +29,7 @@ public:
 	virtual TBFontMetrics GetMetrics();
 	virtual bool RenderGlyph(TBFontGlyphData *dst_bitmap, UCS4 cp);
 	virtual void GetGlyphMetrics(TBGlyphMetrics *metrics, UCS4 cp);
+	virtual bool IsSDF() const { return sdf; }
 private:
 	bool Load(const TBStr & filename, int size);
 
@@ -37,10 +38,12 @@ private:
 	unsigned char *render_data;
 	int font_size;
 	float scale;
+	bool sdf;
 };
 
 STBFontRenderer::STBFontRenderer()
 	: render_data(nullptr)
+	, sdf(false)
 {
 }
 
@@ -98,7 +101,8 @@ TBFontFace *STBFontRenderer::Create(TBFontManager *font_manager, const TBStr &fi
 {
 	if (STBFontRenderer *fr = new STBFontRenderer())
 	{
-		if (fr->Load(filename, (int) font_desc.GetSize()))
+		fr->sdf = ShouldRenderSDF(font_desc);
+		if (fr->Load(filename, fr->sdf ? TB_FONT_SDF_SIZE : (int) font_desc.GetSize()))
 			if (TBFontFace *font = new TBFontFace(font_manager->GetGlyphCache(), fr, font_desc))
 				return font;
 		delete fr;
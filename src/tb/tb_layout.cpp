@@ -211,7 +211,7 @@ int TBLayout::CalculateSpacing()
 	int spacing = m_spacing;
 	if (spacing == SPACING_FROM_SKIN)
 	{
-		if (TBSkinElement *e = GetSkinBgElement())
+		if (TBSkinElement *e = GetSkinBgElement(false))
 			spacing = e->spacing;
 
 		assert(SPACING_FROM_SKIN == SKIN_VALUE_NOT_SPECIFIED);
@@ -31,22 +31,62 @@ public:
 	virtual void OnContextRestored() = 0;
 };
 
+/** The format of the pixels in a TBBitmap. */
+enum TB_BITMAP_FORMAT
+{
+	TB_BITMAP_FORMAT_RGBA32,	///< 32bit color and alpha (BGRA32 format, the same as TBColor).
+	TB_BITMAP_FORMAT_A8,		///< 8bit alpha only. It's painted as white with this alpha.
+	TB_BITMAP_FORMAT_SDF8		///< 8bit signed distance field. It's painted as white inside the edge
+								///< and transparent outside, antialiased at any scale. See TB_SDF8_EDGE.
+};
+
+/** The value of TB_BITMAP_FORMAT_SDF8 pixels at the edge. Each TB_SDF8_STEPS_PER_TEXEL
+	further in is one texel of distance inside the edge, and each step lower is outside. */
+#define TB_SDF8_EDGE 128
+#define TB_SDF8_STEPS_PER_TEXEL 16
+
+/** Return the size in bytes of one pixel in the given format. */
+inline int TBGetBytesPerPixel(TB_BITMAP_FORMAT format) { return format == TB_BITMAP_FORMAT_RGBA32 ? 4 : 1; }
+
 /** TBBitmap is a minimal interface for bitmap to be painted by TBRenderer. */
 
 class TBBitmap
 {
 public:
-	/** Note: Implementations for batched renderers should call TBRenderer::FlushBitmap
+	/** Note: Implementations for batched renderers should call TBRendererBatcher::FlushDeletedBitmap
 		to make sure any active batch is being flushed before the bitmap is deleted. */
 	virtual ~TBBitmap() {}
 
 	virtual int Width() = 0;
 	virtual int Height() = 0;
 
-	/** Update the bitmap with the given data (in BGRA32 format).
+	/** Return the format of the pixels. See TBRenderer::CreateBitmapFormat. */
+	virtual TB_BITMAP_FORMAT GetFormat() { return TB_BITMAP_FORMAT_RGBA32; }
+
+	/** Update the bitmap with the given data (in BGRA32 format). Only for bitmaps
+		in TB_BITMAP_FORMAT_RGBA32.
 		Note: Implementations for batched renderers should call TBRenderer::FlushBitmap
 		to make sure any active batch is being flushed before the bitmap is changed. */
 	virtual void SetData(uint32_t *data) = 0;
+
+	/** Update the part rect of the bitmap with the given data (in the format of the
+		bitmap). data points to the first pixel of rect, and data_stride is the number of
+		pixels from the start of one row to the next. This is cheaper than SetData when
+		only a small part has changed.
+		Returns false if not supported, in which case SetData has to be used instead.
+		Bitmaps in other formats than TB_BITMAP_FORMAT_RGBA32 must support it.
+		Note: Implementations for batched renderers should call TBRenderer::FlushBitmap
+		to make sure any active batch is being flushed before the bitmap is changed. */
+	virtual bool SetDataRect(const TBRect & /*rect*/, void * /*data*/, int /*data_stride*/) { return false; }
+};
+
+/** TBDisplayList is a recording of painting that can be painted again by the
+	TBRenderer that created it. See TBRenderer::BeginRecording. */
+
+class TBDisplayList
+{
+public:
+	virtual ~TBDisplayList() {}
 };
 
 /** TBRenderer is a minimal interface for painting strings and bitmaps. */
@@ -113,6 +153,62 @@ public:
 		Return nullptr if fail. */
 	virtual TBBitmap *CreateBitmap(int width, int height, uint32_t *data) = 0;
 
+	/** Create a new TBBitmap in the given format, from data in that format.
+		Width and height must be a power of two.
+		Return nullptr if fail or if the renderer doesn't support the format. */
+	virtual TBBitmap *CreateBitmapFormat(int width, int height, TB_BITMAP_FORMAT format, void *data)
+	{
+		return format == TB_BITMAP_FORMAT_RGBA32 ? CreateBitmap(width, height, (uint32_t *) data) : nullptr;
+	}
+
+	/** Return true if CreateBitmapFormat can create bitmaps in the given format. */
+	virtual bool IsBitmapFormatSupported(TB_BITMAP_FORMAT format) { return format == TB_BITMAP_FORMAT_RGBA32; }
+
+	/** Create a new TBBitmap that can be painted into (See BeginRenderTarget).
+		Its content is undefined until painted, and it has premultiplied alpha
+		so it should only be drawn using DrawRenderTarget.
+		Return nullptr if fail or if the renderer doesn't support render targets. */
+	virtual TBBitmap *CreateRenderTarget(int /*width*/, int /*height*/) { return nullptr; }
+
+	/** Make all painting go to the given render target (created by CreateRenderTarget)
+		until EndRenderTarget is called. The render target is cleared to transparent.
+		Translation, clip rect and opacity are reset to paint the whole render target,
+		and restored by EndRenderTarget. Calls may be nested.
+		Return false if fail, in which case EndRenderTarget should not be called. */
+	virtual bool BeginRenderTarget(TBBitmap * /*render_target*/) { return false; }
+
+	/** End painting to the render target set by BeginRenderTarget. */
+	virtual void EndRenderTarget() {}
+
+	/** Draw the src_rect part of the render target stretched to dst_rect,
+		using the current opacity. */
+	virtual void DrawRenderTarget(const TBRect & /*dst_rect*/, const TBRect & /*src_rect*/, TBBitmap * /*render_target*/) {}
+
+	/** Create a new empty TBDisplayList (See BeginRecording).
+		Return nullptr if fail or if the renderer doesn't support display lists. */
+	virtual TBDisplayList *CreateDisplayList() { return nullptr; }
+
+	/** Record all painting into the given display list (created by CreateDisplayList)
+		instead of painting it, until EndRecording is called. Anything previously recorded
+		in the list is discarded.
+		Translation and opacity are reset, and the clip rect is set to clip_rect (relative
+		to the current translation), so that the list can be painted at any translation
+		and opacity. They are restored by EndRecording. Calls may be nested.
+		Return false if fail, in which case EndRecording should not be called. */
+	virtual bool BeginRecording(TBDisplayList * /*display_list*/, const TBRect & /*clip_rect*/) { return false; }
+
+	/** End recording into the display list given to BeginRecording. */
+	virtual void EndRecording() {}
+
+	/** Paint what was recorded in the display list, using the current translation,
+		opacity and clip rect.
+		Return false without painting anything if the list can't be used anymore
+		(f.ex because a bitmap fragment it uses was changed or deleted), in which case
+		it has to be recorded again.
+		Note: Bitmaps painted directly (not fragments) must not be deleted while a display
+		list that uses them is still painted. */
+	virtual bool PaintDisplayList(TBDisplayList * /*display_list*/) { return false; }
+
 	/** Add a listener to this renderer. Does not take ownership. */
 	void AddListener(TBRendererListener *listener) { m_listeners.AddLast(listener); }
 
@@ -145,11 +145,15 @@ TBSkin::TBSkin()
 	, m_default_disabled_opacity(0.3f)
 	, m_default_placeholder_opacity(0.2f)
 	, m_default_spacing(0)
+	, m_lazy_bitmap_loading(false)
 {
 	g_renderer->AddListener(this);
 
 	// Avoid filtering artifacts at edges when we draw fragments stretched.
 	m_frag_manager.SetAddBorder(true);
+
+	// Skin images have mixed sizes, which pack much tighter on a skyline than in rows.
+	m_frag_manager.SetPacker(TB_FRAGMENT_PACKER_SKYLINE);
 }
 
 bool TBSkin::Load(const TBStr & skin_file, const TBStr & override_skin_file)
@@ -235,7 +239,7 @@ bool TBSkin::LoadInternal(const TBStr & skin_file)
 			// If the skin element already exist, we will call Load on it again.
 			// This will patch the element with any new data from the node.
 			TBID element_id(n->GetName());
-			TBSkinElement *e = GetSkinElement(element_id);
+			TBSkinElement *e = m_elements.Get(element_id);
 			if (!e)
 			{
 				e = new TBSkinElement;
@@ -251,6 +255,7 @@ bool TBSkin::LoadInternal(const TBStr & skin_file)
 			n = n->GetNext();
 		}
 	}
+	UpdatePaintExpand();
 	return true;
 }
 
@@ -274,7 +279,10 @@ void TBSkin::UnloadBitmaps()
 	// Unset all bitmap pointers.
 	TBHashTableIteratorOf<TBSkinElement> it(&m_elements);
 	while (TBSkinElement *element = it.GetNextContent())
+	{
 		element->bitmap = nullptr;
+		element->is_bitmap_loaded = false;
+	}
 
 	// Clear all fragments and bitmaps.
 	m_frag_manager.Clear();
@@ -284,7 +292,20 @@ void TBSkin::UnloadBitmaps()
 bool TBSkin::ReloadBitmaps()
 {
 	UnloadBitmaps();
+
+	// If the bitmap cache is up to date, it has fragments for all images
+	// so ReloadBitmapsInternal won't have to load any.
+	uint32_t cache_key = 0;
+	bool cached = false;
+	if (!m_bitmap_cache_file.IsEmpty() && !m_lazy_bitmap_loading)
+	{
+		cache_key = GetBitmapCacheKey();
+		cached = m_frag_manager.LoadSavedMaps(m_bitmap_cache_file, cache_key);
+	}
+
 	bool success = ReloadBitmapsInternal();
+	if (success && cache_key && !cached)
+		m_frag_manager.SaveMaps(m_bitmap_cache_file, cache_key);
 	// Create all bitmaps for the bitmap fragment maps
 	if (success)
 		success = m_frag_manager.ValidateBitmaps();
@@ -301,43 +322,21 @@ bool TBSkin::ReloadBitmaps()
 
 bool TBSkin::ReloadBitmapsInternal()
 {
-	// Load all bitmap files into new bitmap fragments.
-	TBTempBuffer filename_dst_DPI;
-	bool success = true;
-	TBHashTableIteratorOf<TBSkinElement> it(&m_elements);
-	while (TBSkinElement *element = it.GetNextContent())
+	// Load the bitmaps of all elements, unless they're loaded when first used.
+	TBListOf<TBSkinElement> elements;
+	if (!m_lazy_bitmap_loading)
 	{
-		if (!element->bitmap_file.IsEmpty())
-		{
-			assert(!element->bitmap);
-
-			// FIX: dedicated_map is not needed for all backends (only deprecated fixed function GL)
-			bool dedicated_map = element->type == SKIN_ELEMENT_TYPE_TILE;
-
-			// Try to load bitmap fragment in the destination DPI (F.ex "foo.png" becomes "foo@192.png")
-			int bitmap_dpi = m_dim_conv.GetSrcDPI();
-			if (m_dim_conv.NeedConversion())
-			{
-				m_dim_conv.GetDstDPIFilename(element->bitmap_file.CStr(), &filename_dst_DPI);
-				element->bitmap = m_frag_manager.GetFragmentFromFile(filename_dst_DPI.GetData(),
-																	 dedicated_map,
-																	 m_dim_conv.GetDstDPI());
-				if (element->bitmap)
-					bitmap_dpi = m_dim_conv.GetDstDPI();
-			}
-			element->SetBitmapDPI(m_dim_conv, bitmap_dpi);
+		TBHashTableIteratorOf<TBSkinElement> it(&m_elements);
+		while (TBSkinElement *element = it.GetNextContent())
+			if (!elements.Add(element))
+				return false;
+	}
+	bool success = LoadElementBitmaps(elements);
 
-			// If we still have no bitmap fragment, load from default file.
-			if (!element->bitmap)
-				element->bitmap = m_frag_manager.GetFragmentFromFile(element->bitmap_file.CStr(),
-																	 dedicated_map, bitmap_dpi);
+	// The fragment used for color fills may be loaded from the bitmap cache already.
+	if ((m_color_frag = m_frag_manager.GetFragment(TBID((uint32_t)0))))
+		return success;
 
-			if (!element->bitmap) {
-				TBDebugPrint("Bitmap %s: '%s' load failed\n", element->name.CStr(), element->bitmap_file.CStr());
-				success = false;
-			}
-		}
-	}
 	// Create fragment used for color fills. Use 2x2px and inset source rect to center 0x0
 	// to avoid filtering artifacts.
 	uint32_t data[4] = { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
@@ -349,22 +348,201 @@ bool TBSkin::ReloadBitmapsInternal()
 	return false;
 }
 
+bool TBSkin::LoadElementBitmaps(TBListOf<TBSkinElement> &elements)
+{
+	// Skip the elements without bitmap files, or that are loaded already.
+	for (int i = elements.GetNumItems() - 1; i >= 0; i--)
+	{
+		if (elements[i]->bitmap_file.IsEmpty() || elements[i]->is_bitmap_loaded)
+			elements.Remove(i);
+		else
+			assert(!elements[i]->bitmap);
+	}
+	const int num_elements = elements.GetNumItems();
+	if (!num_elements)
+		return true;
+	TBBitmapFragmentFile *files = new TBBitmapFragmentFile[num_elements];
+	if (!files)
+		return false;
+
+	// Load all bitmap files into new bitmap fragments. The files are decoded in parallel
+	// by the fragment manager, first the ones in the destination DPI (F.ex "foo.png"
+	// becomes "foo@192.png") and then the default file for those that didn't exist.
+	TBTempBuffer filename_dst_DPI;
+	for (int i = 0; i < num_elements; i++)
+	{
+		TBSkinElement *element = elements[i];
+		// FIX: dedicated_map is not needed for all backends (only deprecated fixed function GL)
+		files[i].dedicated_map = element->type == SKIN_ELEMENT_TYPE_TILE;
+		if (m_dim_conv.NeedConversion())
+		{
+			m_dim_conv.GetDstDPIFilename(element->bitmap_file.CStr(), &filename_dst_DPI);
+			files[i].filename.Set(filename_dst_DPI.GetData());
+			files[i].dpi = (float) m_dim_conv.GetDstDPI();
+		}
+	}
+	if (m_dim_conv.NeedConversion())
+		m_frag_manager.GetFragmentsFromFiles(files, num_elements);
+
+	for (int i = 0; i < num_elements; i++)
+	{
+		TBSkinElement *element = elements[i];
+		element->bitmap = files[i].fragment;
+		element->SetBitmapDPI(m_dim_conv, element->bitmap ? m_dim_conv.GetDstDPI() : m_dim_conv.GetSrcDPI());
+		if (!element->bitmap)
+		{
+			files[i].filename.Set(element->bitmap_file);
+			files[i].dpi = (float) m_dim_conv.GetSrcDPI();
+		}
+	}
+	m_frag_manager.GetFragmentsFromFiles(files, num_elements);
+
+	bool success = true;
+	for (int i = 0; i < num_elements; i++)
+	{
+		TBSkinElement *element = elements[i];
+		if (!element->bitmap)
+			element->bitmap = files[i].fragment;
+		element->is_bitmap_loaded = true;
+		if (!element->bitmap) {
+			TBDebugPrint("Bitmap %s: '%s' load failed\n", element->name.CStr(), element->bitmap_file.CStr());
+			success = false;
+		}
+	}
+	delete [] files;
+	return success;
+}
+
+bool TBSkin::AddPrefetchElement(TBListOf<TBSkinElement> &elements, const TBID &skin_id)
+{
+	TBSkinElement *element = m_elements.Get(skin_id);
+	if (!element || elements.Find(element) != -1)
+		return true;
+	if (!elements.Add(element))
+		return false;
+
+	// Add the elements it refers to.
+	TBSkinElementStateList *lists[4] = { &element->m_override_elements, &element->m_strong_override_elements,
+										 &element->m_child_elements, &element->m_overlay_elements };
+	for (int i = 0; i < 4; i++)
+		for (const TBSkinElementState *state = lists[i]->GetFirstElement(); state; state = state->GetNext())
+			if (!AddPrefetchElement(elements, state->element_id))
+				return false;
+	return true;
+}
+
+int TBSkin::CalculatePaintExpand(TBSkinElement *element)
+{
+	// Avoid eternal recursion when elements refer to elements referring back.
+	if (element->is_getting)
+		return 0;
+	element->is_getting = true;
+
+	// The expand is scaled when a destination DPI bitmap is loaded (See SetBitmapDPI),
+	// so until the bitmap is loaded, use the largest it may get.
+	int paint_expand = element->expand;
+	if (!element->bitmap_dpi && !element->bitmap_file.IsEmpty() && m_dim_conv.NeedConversion())
+		paint_expand = MAX(paint_expand, element->expand * m_dim_conv.GetDstDPI() / m_dim_conv.GetSrcDPI());
+
+	TBSkinElementStateList *lists[4] = { &element->m_override_elements, &element->m_strong_override_elements,
+										 &element->m_child_elements, &element->m_overlay_elements };
+	for (int i = 0; i < 4; i++)
+		for (const TBSkinElementState *state = lists[i]->GetFirstElement(); state; state = state->GetNext())
+			if (TBSkinElement *state_element = m_elements.Get(state->element_id))
+				paint_expand = MAX(paint_expand, CalculatePaintExpand(state_element));
+
+	element->is_getting = false;
+	return paint_expand;
+}
+
+void TBSkin::UpdatePaintExpand()
+{
+	TBHashTableIteratorOf<TBSkinElement> it(&m_elements);
+	while (TBSkinElement *element = it.GetNextContent())
+		element->paint_expand = CalculatePaintExpand(element);
+}
+
+int TBSkin::GetPaintExpand(const TBID &skin_id) const
+{
+	TBSkinElement *element = skin_id ? m_elements.Get(skin_id) : nullptr;
+	return element ? element->paint_expand : 0;
+}
+
+bool TBSkin::PrefetchBitmaps(const TBID *skin_ids, int num_skin_ids)
+{
+	TBListOf<TBSkinElement> elements;
+	for (int i = 0; i < num_skin_ids; i++)
+		if (!AddPrefetchElement(elements, skin_ids[i]))
+			return false;
+	return LoadElementBitmaps(elements);
+}
+
+/** Return a hash of the contents of the file, or 0 if it can't be read. */
+static uint32_t GetFileHash(const char *filename)
+{
+	TBTempBuffer file;
+	if (!file.AppendFile(filename))
+		return 0;
+	uint32_t hash = basis;
+	for (int i = 0; i < file.GetAppendPos(); i++)
+		hash = (hash ^ (uint8_t) file.GetData()[i]) * prime;
+	return hash;
+}
+
+uint32_t TBSkin::GetBitmapCacheKey()
+{
+	// The key identifies the DPI, and each image file (by name and contents) and how
+	// it's loaded. Both the file in the destination DPI and the default file are
+	// included, since either may be loaded.
+	uint32_t key = basis;
+	key = (key ^ m_dim_conv.GetSrcDPI()) * prime;
+	key = (key ^ m_dim_conv.GetDstDPI()) * prime;
+	TBTempBuffer filename_dst_DPI;
+	uint32_t elements_key = 0;
+	TBHashTableIteratorOf<TBSkinElement> it(&m_elements);
+	while (TBSkinElement *element = it.GetNextContent())
+	{
+		if (element->bitmap_file.IsEmpty())
+			continue;
+		uint32_t element_key = basis;
+		element_key = (element_key ^ TBID(element->bitmap_file)) * prime;
+		element_key = (element_key ^ (element->type == SKIN_ELEMENT_TYPE_TILE)) * prime;
+		element_key = (element_key ^ GetFileHash(element->bitmap_file.CStr())) * prime;
+		if (m_dim_conv.NeedConversion())
+		{
+			m_dim_conv.GetDstDPIFilename(element->bitmap_file.CStr(), &filename_dst_DPI);
+			element_key = (element_key ^ GetFileHash(filename_dst_DPI.GetData())) * prime;
+		}
+		// Add the elements, so the key doesn't depend on their order.
+		elements_key += element_key;
+	}
+	key = (key ^ elements_key) * prime;
+	return key ? key : 1;
+}
+
 TBSkin::~TBSkin()
 {
 	g_renderer->RemoveListener(this);
 }
 
-TBSkinElement *TBSkin::GetSkinElement(const TBID &skin_id) const
+TBSkinElement *TBSkin::GetSkinElement(const TBID &skin_id, bool load_bitmap)
 {
 	if (!skin_id)
 		return nullptr;
-	return m_elements.Get(skin_id);
+	TBSkinElement *element = m_elements.Get(skin_id);
+	if (element && load_bitmap && m_lazy_bitmap_loading && !element->is_bitmap_loaded && !element->bitmap_file.IsEmpty())
+	{
+		TBListOf<TBSkinElement> elements;
+		if (elements.Add(element))
+			LoadElementBitmaps(elements);
+	}
+	return element;
 }
 
 TBSkinElement *TBSkin::GetSkinElementStrongOverride(const TBID &skin_id, SKIN_STATE state,
-													TBSkinConditionContext &context) const
+													TBSkinConditionContext &context, bool load_bitmap)
 {
-	if (TBSkinElement *skin_element = GetSkinElement(skin_id))
+	if (TBSkinElement *skin_element = GetSkinElement(skin_id, load_bitmap))
 	{
 		// Avoid eternal recursion when overrides refer to elements referring back.
 		if (skin_element->is_getting)
@@ -375,7 +553,7 @@ TBSkinElement *TBSkin::GetSkinElementStrongOverride(const TBID &skin_id, SKIN_ST
 		TBSkinElementState *override_state = skin_element->m_strong_override_elements.GetStateElement(state, context);
 		if (override_state)
 		{
-			if (TBSkinElement *override_element = GetSkinElementStrongOverride(override_state->element_id, state, context))
+			if (TBSkinElement *override_element = GetSkinElementStrongOverride(override_state->element_id, state, context, load_bitmap))
 			{
 				skin_element->is_getting = false;
 				return override_element;
@@ -659,8 +837,8 @@ int TBSkin::GetPxFromNode(TBNode *node, int def_value) const
 // == TBSkinElement =========================================================
 
 TBSkinElement::TBSkinElement()
-	: bitmap(nullptr), cut(0), expand(0), type(SKIN_ELEMENT_TYPE_STRETCH_BOX)
-	, is_painting(false), is_getting(false)
+	: bitmap(nullptr), cut(0), expand(0), paint_expand(0), type(SKIN_ELEMENT_TYPE_STRETCH_BOX)
+	, is_painting(false), is_getting(false), is_bitmap_loaded(false)
 	, padding_left(0), padding_top(0), padding_right(0), padding_bottom(0)
 	, width(SKIN_VALUE_NOT_SPECIFIED), height(SKIN_VALUE_NOT_SPECIFIED)
 	, pref_width(SKIN_VALUE_NOT_SPECIFIED), pref_height(SKIN_VALUE_NOT_SPECIFIED)
@@ -178,9 +178,11 @@ public:
 	TBBitmapFragment *bitmap;///< Bitmap fragment containing the graphics, or nullptr.
 	uint8_t cut;			///< How the bitmap should be sliced using StretchBox.
 	int16_t expand;		///< How much the skin should expand outside the widgets rect.
+	int16_t paint_expand;	///< The largest expand of this and the elements it refers to (See TBSkin::GetPaintExpand).
 	SKIN_ELEMENT_TYPE type;///< Skin element type
 	bool is_painting;	///< If the skin is being painted (avoiding eternal recursing)
 	bool is_getting;	///< If the skin is being got (avoiding eternal recursion)
+	bool is_bitmap_loaded;	///< If the bitmap has been loaded, or failed to load.
 	int16_t padding_left;		///< Left padding for any content in the element
 	int16_t padding_top;		///< Top padding for any content in the element
 	int16_t padding_right;	///< Right padding for any content in the element
@@ -314,20 +316,51 @@ public:
 		are loaded before loading new ones. */
 	bool ReloadBitmaps();
 
+	/** Set a file to cache the packed bitmaps of this skin in. When the bitmaps are loaded
+		(by Load and ReloadBitmaps), they are created from the file if it was saved from the
+		same image files in the same DPI, instead of loading each image. Otherwise the images
+		are loaded and the file is saved again. */
+	void SetBitmapCacheFile(const TBStr &filename) { m_bitmap_cache_file.Set(filename); }
+
+	/** Set to true to load the bitmap of each element when the element is first used
+		(by GetSkinElement, which also gives the painting and layout of widgets their
+		elements), instead of loading all bitmaps when the skin is loaded. Only the
+		bitmaps used are then decoded and kept in memory. Use PrefetchBitmaps to load
+		many elements at once. The bitmap cache file is not used in this mode.
+		This must be set before the skin is loaded. Default is false. */
+	void SetLazyBitmapLoading(bool lazy) { m_lazy_bitmap_loading = lazy; }
+	bool GetLazyBitmapLoading() const { return m_lazy_bitmap_loading; }
+
+	/** Load the bitmaps of the elements with the given ids, and of all elements they
+		refer to (override, strong override, child and overlay elements), that aren't
+		loaded yet. They are decoded in parallel, so this is faster than loading them
+		one by one when first used. See SetLazyBitmapLoading and TBWidget::PrefetchSkinBitmaps.
+		Returns false if any bitmap failed to load. */
+	bool PrefetchBitmaps(const TBID *skin_ids, int num_skin_ids);
+
 	/** Get the dimension converter used for the current skin. This dimension converter
 		converts to px by the same factor as the skin (based on the skin DPI settings). */
 	const TBDimensionConverter *GetDimensionConverter() const { return &m_dim_conv; }
 
-	/** Get the skin element with the given id.
+	/** Get the skin element with the given id. If bitmaps are loaded lazily, this
+		loads its bitmap if it's not loaded yet (see SetLazyBitmapLoading), unless
+		load_bitmap is false. Geometry queries that don't need the bitmap (like
+		offsets and padding) should pass false, so they don't load bitmaps one by one.
 		Returns nullptr if there's no match. */
-	TBSkinElement *GetSkinElement(const TBID &skin_id) const;
+	TBSkinElement *GetSkinElement(const TBID &skin_id, bool load_bitmap = true);
 
 	/** Get the skin element with the given id and state.
 		This is like calling GetSkinElement and also following any strong overrides that
 		match the current state (if any). See details about strong overrides in PaintSkin.
 		Returns nullptr if there's no match. */
 	TBSkinElement *GetSkinElementStrongOverride(const TBID &skin_id, SKIN_STATE state,
-												TBSkinConditionContext &context) const;
+												TBSkinConditionContext &context, bool load_bitmap = true);
+
+	/** Return how far painting the element with the given id may reach outside the rect
+		it's painted at. This is the largest expand of the element and all elements it
+		refers to (override, strong override, child and overlay elements) in any state.
+		It doesn't load any bitmap, and is 0 if there's no element. */
+	int GetPaintExpand(const TBID &skin_id) const;
 
 	/** Get the default text color for all skin elements */
 	TBColor GetDefaultTextColor() const { return m_default_text_color; }
@@ -411,8 +444,15 @@ private:
 	float m_default_disabled_opacity;					///< Disabled opacity
 	float m_default_placeholder_opacity;				///< Placeholder opacity
 	int16_t m_default_spacing;							///< Default layout spacing
+	TBStr m_bitmap_cache_file;							///< See SetBitmapCacheFile.
+	bool m_lazy_bitmap_loading;							///< See SetLazyBitmapLoading.
 	bool LoadInternal(const TBStr & skin_file);
 	bool ReloadBitmapsInternal();
+	bool LoadElementBitmaps(TBListOf<TBSkinElement> &elements);
+	bool AddPrefetchElement(TBListOf<TBSkinElement> &elements, const TBID &skin_id);
+	int CalculatePaintExpand(TBSkinElement *element);
+	void UpdatePaintExpand();
+	uint32_t GetBitmapCacheKey();
 	void PaintElement(const TBRect &dst_rect, TBSkinElement *element);
 	void PaintElementBGColor(const TBRect &dst_rect, TBSkinElement *element);
 	void PaintElementImage(const TBRect &dst_rect, TBSkinElement *element);
@@ -32,6 +32,93 @@ bool TBWidget::cancel_click = false;
 bool TBWidget::update_widget_states = true;
 bool TBWidget::update_skin_states = true;
 bool TBWidget::show_focus_state = false;
+bool TBWidget::display_lists_enabled = true;
+
+/** The max number of rects in the damage region of a damage root. If it grows
+	beyond this, it's merged into one rect to keep the number of paint passes low. */
+static const int MAX_DAMAGE_RECTS = 8;
+
+// == TBWidgetLayer =====================================================================
+
+/** The render target a widget is painted into, if it's a layer (See TBWidget::SetIsLayer). */
+class TBWidgetLayer : public TBRendererListener
+{
+public:
+	TBWidgetLayer() : bitmap(nullptr), is_valid(false) { g_renderer->AddListener(this); }
+	~TBWidgetLayer()
+	{
+		g_renderer->RemoveListener(this);
+		delete bitmap;
+	}
+	virtual void OnContextLost()
+	{
+		delete bitmap;
+		bitmap = nullptr;
+		is_valid = false;
+	}
+	virtual void OnContextRestored() {}
+
+	TBBitmap *bitmap;
+	bool is_valid;	///< false if the bitmap has to be repainted.
+};
+
+// == TBWidgetDisplayList ===============================================================
+
+/** The display list a widget is recorded into (See TBWidget::SetUseDisplayList). */
+class TBWidgetDisplayList : public TBRendererListener
+{
+public:
+	TBWidgetDisplayList() : display_list(nullptr), is_valid(false) { g_renderer->AddListener(this); }
+	~TBWidgetDisplayList()
+	{
+		g_renderer->RemoveListener(this);
+		delete display_list;
+	}
+	virtual void OnContextLost() { is_valid = false; }
+	virtual void OnContextRestored() {}
+
+	TBDisplayList *display_list;
+	TBColor text_color;	///< The inherited text color it was recorded with.
+	bool is_valid;		///< false if it has to be recorded again.
+};
+
+// == TBWidgetsWaitingForGlyphs =========================================================
+
+/** Widgets that painted text while some of its glyphs were still being rendered in the
+	background (See TBFontGlyphCache::SetRenderInBackground). They are invalidated when
+	the glyphs are ready, and so is their layout since new glyphs had no advance before. */
+class TBWidgetsWaitingForGlyphs : public TBFontGlyphListener
+{
+public:
+	void Add(TBWidget *widget)
+	{
+		if (m_widgets.Find(widget) != -1)
+			return;
+		if (!IsInList())
+			g_font_manager->GetGlyphCache()->AddListener(this);
+		m_widgets.Add(widget);
+	}
+	void Remove(TBWidget *widget)
+	{
+		int index = m_widgets.Find(widget);
+		if (index != -1)
+			m_widgets.RemoveFast(index);
+	}
+	virtual void OnGlyphsRendered()
+	{
+		g_font_manager->GetGlyphCache()->RemoveListener(this);
+		for (int i = 0; i < m_widgets.GetNumItems(); i++)
+		{
+			m_widgets[i]->Invalidate();
+			m_widgets[i]->InvalidateLayout(TBWidget::INVALIDATE_LAYOUT_RECURSIVE);
+		}
+		m_widgets.RemoveAll();
+	}
+private:
+	TBListOf<TBWidget> m_widgets;
+};
+
+static TBWidgetsWaitingForGlyphs widgets_waiting_for_glyphs;
 
 // == TBLongClickTimer ==================================================================
 
@@ -72,6 +159,9 @@ TBWidget::TBWidget(TBValue::TYPE sync_type)
 	, m_layout_params(nullptr)
 	, m_scroller(nullptr)
 	, m_long_click_timer(nullptr)
+	, m_damage(nullptr)
+	, m_layer(nullptr)
+	, m_display_list(nullptr)
 	, m_packed_init(0)
 	, m_sync_type(sync_type)
 {
@@ -92,12 +182,16 @@ TBWidget::~TBWidget()
 		captured_widget = nullptr;
 	if (this == focused_widget)
 		focused_widget = nullptr;
+	widgets_waiting_for_glyphs.Remove(this);
 
 	TBWidgetListener::InvokeWidgetDelete(this);
 	DeleteAllChildren();
 
 	delete m_scroller;
 	delete m_layout_params;
+	delete m_damage;
+	delete m_layer;
+	delete m_display_list;
 
 	StopLongClickTimer();
 
@@ -109,13 +203,19 @@ void TBWidget::SetRect(const TBRect &rect)
 	if (m_rect.Equals(rect))
 		return;
 
+	// Invalidate the area we're leaving. Our own layer and display list don't
+	// have to be repainted if we're only moving.
+	bool resized = rect.w != m_rect.w || rect.h != m_rect.h;
+	if (!m_rect.IsEmpty())
+		InvalidateInternal(GetPaintRect().Offset(-m_rect.x, -m_rect.y), resized);
+
 	TBRect old_rect = m_rect;
 	m_rect = rect;
 
-	if (old_rect.w != m_rect.w || old_rect.h != m_rect.h)
+	if (resized)
 		OnResized(old_rect.w, old_rect.h);
 
-	Invalidate();
+	InvalidateInternal(GetPaintRect().Offset(-m_rect.x, -m_rect.y), resized);
 }
 
 void TBWidget::SetSize(int width, int height)
@@ -132,17 +232,143 @@ void TBWidget::SetSize(int width, int height)
 }
 
 void TBWidget::Invalidate()
+{
+	InvalidateInternal(GetPaintRect().Offset(-m_rect.x, -m_rect.y), true);
+}
+
+void TBWidget::Invalidate(const TBRect &rect)
+{
+	InvalidateInternal(rect, true);
+}
+
+void TBWidget::InvalidateInternal(const TBRect &rect, bool invalidate_own_cache)
 {
 	if (!GetVisibilityCombined() && !m_rect.IsEmpty())
 		return;
+
+	// Find the damage root, if there is one, so we know if the rect
+	// has to be converted while walking up the parents.
+	TBWidget *damage_root = this;
+	while (damage_root && !damage_root->m_damage)
+		damage_root = damage_root->m_parent;
+
+	TBRect damage_rect = rect;
 	TBWidget *tmp = this;
 	while (tmp)
 	{
 		tmp->OnInvalid();
+		if (tmp != this || invalidate_own_cache)
+		{
+			if (tmp->m_layer)
+				tmp->m_layer->is_valid = false;
+			if (tmp->m_display_list)
+				tmp->m_display_list->is_valid = false;
+		}
+		if (tmp == damage_root)
+			tmp->AddDamage(damage_rect);
+		else if (damage_root && tmp->m_parent)
+		{
+			// Convert to the coordinates of the parent, the same way it translates
+			// when painting its children (See InvokePaint and OnPaintChildren).
+			int child_translation_x, child_translation_y;
+			tmp->m_parent->GetChildTranslation(child_translation_x, child_translation_y);
+			damage_rect.x += tmp->m_rect.x + child_translation_x;
+			damage_rect.y += tmp->m_rect.y + child_translation_y;
+			if (TBSkinElement *skin_element = tmp->m_parent->GetSkinBgElement(false))
+			{
+				damage_rect.x += skin_element->content_ofs_x;
+				damage_rect.y += skin_element->content_ofs_y;
+			}
+		}
 		tmp = tmp->m_parent;
 	}
 }
 
+TBRect TBWidget::GetPaintRect() const
+{
+	if (m_rect.IsEmpty())
+		return m_rect;
+	// The parent paints the focus skin around the widget (See OnPaintChildren).
+	int expand = g_tb_skin->GetPaintExpand(m_skin_bg);
+	if (GetIsFocusable())
+		expand = MAX(expand, g_tb_skin->GetPaintExpand(TBIDC("generic_focus")));
+	// The content may be painted anywhere in the widget rect, even if the skin is inset.
+	if (expand > 0)
+		return m_rect.Expand(expand, expand);
+	return m_rect;
+}
+
+void TBWidget::AddDamage(const TBRect &rect)
+{
+	TBRect damage_rect = rect.Clip(TBRect(0, 0, m_rect.w, m_rect.h));
+	if (damage_rect.IsEmpty())
+		return;
+	if (m_damage->GetNumRects() >= MAX_DAMAGE_RECTS)
+	{
+		// Too fragmented, so merge it all into one rect.
+		for (int i = 0; i < m_damage->GetNumRects(); i++)
+			damage_rect = damage_rect.Union(m_damage->GetRect(i));
+		m_damage->Set(damage_rect);
+	}
+	else if (!m_damage->IncludeRect(damage_rect))
+		m_damage->Set(TBRect(0, 0, m_rect.w, m_rect.h));
+}
+
+void TBWidget::SetIsLayer(bool is_layer)
+{
+	if (is_layer == GetIsLayer())
+		return;
+	if (is_layer)
+		m_layer = new TBWidgetLayer;
+	else
+	{
+		delete m_layer;
+		m_layer = nullptr;
+	}
+	Invalidate();
+}
+
+void TBWidget::SetUseDisplayList(bool use_display_list)
+{
+	if (use_display_list == GetUseDisplayList())
+		return;
+	if (use_display_list)
+		m_display_list = new TBWidgetDisplayList;
+	else
+	{
+		delete m_display_list;
+		m_display_list = nullptr;
+	}
+	Invalidate();
+}
+
+void TBWidget::SetIsDamageRoot(bool damage_root)
+{
+	if (damage_root == GetIsDamageRoot())
+		return;
+	if (damage_root)
+	{
+		m_damage = new TBRegion;
+		m_damage->Set(TBRect(0, 0, m_rect.w, m_rect.h));
+	}
+	else
+	{
+		delete m_damage;
+		m_damage = nullptr;
+	}
+}
+
+bool TBWidget::TakeDamage(TBRegion &region)
+{
+	region.RemoveAll(false);
+	if (!m_damage || m_damage->IsEmpty())
+		return false;
+	for (int i = 0; i < m_damage->GetNumRects(); i++)
+		region.AddRect(m_damage->GetRect(i), false);
+	m_damage->RemoveAll(false);
+	return true;
+}
+
 void TBWidget::InvalidateStates()
 {
 	update_widget_states = true;
@@ -246,10 +472,11 @@ void TBWidget::SetOpacity(float opacity)
 	opacity = Clamp(opacity, 0.f, 1.f);
 	if (m_opacity == opacity)
 		return;
+	// The opacity is applied when painting our layer or display list, so they don't have to be repainted.
 	if (opacity == 0) // Invalidate after setting opacity 0 will do nothing.
-		Invalidate();
+		InvalidateInternal(GetPaintRect().Offset(-m_rect.x, -m_rect.y), false);
 	m_opacity = opacity;
-	Invalidate();
+	InvalidateInternal(GetPaintRect().Offset(-m_rect.x, -m_rect.y), false);
 }
 
 void TBWidget::SetVisibility(WIDGET_VISIBILITY vis)
@@ -414,11 +641,34 @@ void TBWidget::SetSkinBg(const TBID &skin_bg, WIDGET_INVOKE_INFO info)
 		OnSkinChanged();
 }
 
-TBSkinElement *TBWidget::GetSkinBgElement()
+TBSkinElement *TBWidget::GetSkinBgElement(bool load_bitmap)
 {
 	TBWidgetSkinConditionContext context(this);
 	WIDGET_STATE state = GetAutoState();
-	return g_tb_skin->GetSkinElementStrongOverride(m_skin_bg, static_cast<SKIN_STATE>(state), context);
+	return g_tb_skin->GetSkinElementStrongOverride(m_skin_bg, static_cast<SKIN_STATE>(state), context, load_bitmap);
+}
+
+/** Set the skin background ids of the widget and all its children in skin_ids,
+	unless it's nullptr. Return the number of widgets. */
+static int GetSkinBgIds(TBWidget *widget, TBID *skin_ids)
+{
+	if (skin_ids)
+		skin_ids[0] = widget->GetSkinBg();
+	int num_widgets = 1;
+	for (TBWidget *child = widget->GetFirstChild(); child; child = child->GetNext())
+		num_widgets += GetSkinBgIds(child, skin_ids ? skin_ids + num_widgets : nullptr);
+	return num_widgets;
+}
+
+void TBWidget::PrefetchSkinBitmaps()
+{
+	const int num_widgets = GetSkinBgIds(this, nullptr);
+	if (TBID *skin_ids = new TBID[num_widgets])
+	{
+		GetSkinBgIds(this, skin_ids);
+		g_tb_skin->PrefetchBitmaps(skin_ids, num_widgets);
+		delete [] skin_ids;
+	}
 }
 
 TBWidget *TBWidget::FindScrollableWidget(bool scroll_x, bool scroll_y)
@@ -801,14 +1051,14 @@ void TBWidget::OnPaintChildren(const PaintProps &paint_props)
 	// Invoke paint on all children that are in the current visible rect.
 	for (TBWidget *child = GetFirstChild(); child; child = child->GetNext())
 	{
-		if (clip_rect.Intersects(child->m_rect))
+		if (clip_rect.Intersects(child->GetPaintRect()))
 			child->InvokePaint(paint_props);
 	}
 
 	// Invoke paint of overlay elements on all children that are in the current visible rect.
 	for (TBWidget *child = GetFirstChild(); child; child = child->GetNext())
 	{
-		if (clip_rect.Intersects(child->m_rect) && child->GetVisibility() == WIDGET_VISIBILITY_VISIBLE)
+		if (clip_rect.Intersects(child->GetPaintRect()) && child->GetVisibility() == WIDGET_VISIBILITY_VISIBLE)
 		{
 			TBSkinElement *skin_element = child->GetSkinBgElement();
 			if (skin_element && skin_element->HasOverlayElements())
@@ -902,7 +1152,7 @@ void TBWidget::OnInflateChild(TBWidget *child)
 TBRect TBWidget::GetPaddingRect()
 {
 	TBRect padding_rect(0, 0, m_rect.w, m_rect.h);
-	if (TBSkinElement *e = GetSkinBgElement())
+	if (TBSkinElement *e = GetSkinBgElement(false))
 	{
 		padding_rect.x += e->padding_left;
 		padding_rect.y += e->padding_top;
@@ -925,7 +1175,7 @@ PreferredSize TBWidget::OnCalculatePreferredContentSize(const SizeConstraints &c
 	bool has_layouting_children = false;
 	PreferredSize ps;
 
-	TBSkinElement *bg_skin = GetSkinBgElement();
+	TBSkinElement *bg_skin = GetSkinBgElement(false);
 	int horizontal_padding = bg_skin ? bg_skin->padding_left + bg_skin->padding_right : 0;
 	int vertical_padding = bg_skin ? bg_skin->padding_top + bg_skin->padding_bottom : 0;
 	SizeConstraints inner_sc = constraints.ConstrainByPadding(horizontal_padding, vertical_padding);
@@ -1107,7 +1357,7 @@ void TBWidget::InvokeSkinUpdatesInternal(bool force_update)
 	// if the skin has some strong override dependant a condition that has changed.
 	// If that happens, call OnSkinChanged so the widget can react to that, and
 	// invalidate layout to apply new skin properties.
-	if (TBSkinElement *skin_elm = GetSkinBgElement())
+	if (TBSkinElement *skin_elm = GetSkinBgElement(false))
 	{
 		if (skin_elm->id != m_skin_bg_expected)
 		{
@@ -1169,12 +1419,119 @@ void TBWidget::InvokePaint(const PaintProps &parent_paint_props)
 	if (opacity == 0)
 		return;
 
-	// FIX: This does not give the correct result! Must use a new render target!
+	// A layer applies the opacity when drawing it, which gives the correct result for
+	// overlapping children. Otherwise everything painted gets the opacity separately.
+	if (m_layer && InvokePaintLayer(parent_paint_props, state, skin_element, opacity))
+		return;
+
 	g_renderer->SetOpacity(opacity);
+	InvokePaintInternal(parent_paint_props, state, skin_element);
+	g_renderer->SetOpacity(old_opacity);
+}
+
+bool TBWidget::InvokePaintLayer(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element, float opacity)
+{
+	TBRect paint_rect = GetPaintRect();
+	TBBitmap *&bitmap = m_layer->bitmap;
+	if (bitmap && (bitmap->Width() != paint_rect.w || bitmap->Height() != paint_rect.h))
+	{
+		delete bitmap;
+		bitmap = nullptr;
+	}
+	if (!bitmap)
+	{
+		m_layer->is_valid = false;
+		bitmap = g_renderer->CreateRenderTarget(paint_rect.w, paint_rect.h);
+		if (!bitmap)
+			return false;
+	}
+
+	if (!m_layer->is_valid)
+	{
+		if (!g_renderer->BeginRenderTarget(bitmap))
+			return false;
+		// Set valid first, so anything invalidated while painting is repainted next time.
+		m_layer->is_valid = true;
+		g_renderer->Translate(-paint_rect.x, -paint_rect.y);
+		InvokePaintInternal(parent_paint_props, state, skin_element);
+		g_renderer->EndRenderTarget();
+	}
 
+	float old_opacity = g_renderer->GetOpacity();
+	g_renderer->SetOpacity(opacity);
+	g_renderer->DrawRenderTarget(paint_rect, TBRect(0, 0, paint_rect.w, paint_rect.h), bitmap);
+	g_renderer->SetOpacity(old_opacity);
+	return true;
+}
+
+/** Return the union of the paint rects of the visible children of the widget, and of
+	their children, relative to the widget and translated the same way as when painting. */
+static TBRect GetChildrenPaintRect(TBWidget *widget)
+{
+	TBRect rect;
+	for (TBWidget *child = widget->GetFirstChild(); child; child = child->GetNext())
+	{
+		if (child->GetVisibility() != WIDGET_VISIBILITY_VISIBLE)
+			continue;
+		rect = rect.Union(child->GetPaintRect());
+		rect = rect.Union(GetChildrenPaintRect(child).Offset(child->GetRect().x, child->GetRect().y));
+	}
+	if (rect.IsEmpty())
+		return rect;
+	int child_translation_x, child_translation_y;
+	widget->GetChildTranslation(child_translation_x, child_translation_y);
+	if (TBSkinElement *skin_element = widget->GetSkinBgElement(false))
+	{
+		child_translation_x += skin_element->content_ofs_x;
+		child_translation_y += skin_element->content_ofs_y;
+	}
+	return rect.Offset(child_translation_x, child_translation_y);
+}
+
+bool TBWidget::InvokePaintDisplayList(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element)
+{
+	TBWidgetDisplayList *dl = m_display_list;
+	if (!dl->display_list)
+	{
+		dl->is_valid = false;
+		if (!(dl->display_list = g_renderer->CreateDisplayList()))
+			return false;
+	}
+
+	// The text color is inherited from the parent, which may change without invalidating us.
+	if (!dl->is_valid || (uint32_t) dl->text_color != (uint32_t) parent_paint_props.text_color)
+	{
+		// Children and their focus skin may paint outside this widget, and they aren't clipped to it otherwise.
+		TBRect clip_rect = GetPaintRect().Offset(-m_rect.x, -m_rect.y).Union(GetChildrenPaintRect(this));
+		if (!g_renderer->BeginRecording(dl->display_list, clip_rect))
+			return false;
+		// Set valid first, so anything invalidated while painting is recorded again next time.
+		dl->is_valid = true;
+		dl->text_color = parent_paint_props.text_color;
+		InvokePaintContent(parent_paint_props, state, skin_element);
+		g_renderer->EndRecording();
+	}
+
+	if (g_renderer->PaintDisplayList(dl->display_list))
+		return true;
+	// It can't be used anymore, so paint normally and record it again next time.
+	dl->is_valid = false;
+	return false;
+}
+
+void TBWidget::InvokePaintInternal(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element)
+{
 	int trns_x = m_rect.x, trns_y = m_rect.y;
 	g_renderer->Translate(trns_x, trns_y);
 
+	if (!m_display_list || !display_lists_enabled || !InvokePaintDisplayList(parent_paint_props, state, skin_element))
+		InvokePaintContent(parent_paint_props, state, skin_element);
+
+	g_renderer->Translate(-trns_x, -trns_y);
+}
+
+void TBWidget::InvokePaintContent(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element)
+{
 	// Paint background skin
 	TBRect local_rect(0, 0, m_rect.w, m_rect.h);
 	TBWidgetSkinConditionContext context(this);
@@ -1189,8 +1546,13 @@ void TBWidget::InvokePaint(const PaintProps &parent_paint_props)
 		paint_props.text_color = used_element->text_color;
 
 	// Paint content
+	const int num_skipped_glyphs = g_font_manager->GetGlyphCache()->GetNumSkippedGlyphs();
 	OnPaint(paint_props);
 
+	// Paint it again when the glyphs it skipped are rendered in the background.
+	if (g_font_manager->GetGlyphCache()->GetNumSkippedGlyphs() != num_skipped_glyphs)
+		widgets_waiting_for_glyphs.Add(this);
+
 	if (used_element)
 		g_renderer->Translate(used_element->content_ofs_x, used_element->content_ofs_y);
 
@@ -1220,9 +1582,19 @@ void TBWidget::InvokePaint(const PaintProps &parent_paint_props)
 
 	if (used_element)
 		g_renderer->Translate(-used_element->content_ofs_x, -used_element->content_ofs_y);
+}
 
-	g_renderer->Translate(-trns_x, -trns_y);
-	g_renderer->SetOpacity(old_opacity);
+void TBWidget::InvokePaint(const PaintProps &parent_paint_props, const TBRegion &region)
+{
+	// Paint once for each rect, with the clip rect set to it. The region
+	// is relative to this widget while the clip rect is relative to the parent.
+	for (int i = 0; i < region.GetNumRects(); i++)
+	{
+		TBRect rect = region.GetRect(i).Offset(m_rect.x, m_rect.y);
+		TBRect old_clip_rect = g_renderer->SetClipRect(rect, true);
+		InvokePaint(parent_paint_props);
+		g_renderer->SetClipRect(old_clip_rect, false);
+	}
 }
 
 bool TBWidget::InvokeEvent(TBWidgetEvent &ev)
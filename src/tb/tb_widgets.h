@@ -22,6 +22,8 @@ class TBFontFace;
 class TBScroller;
 class TBWidgetListener;
 class TBLongClickTimer;
+class TBWidgetLayer;
+class TBWidgetDisplayList;
 struct INFLATE_INFO;
 struct DEFLATE_INFO;
 
@@ -443,6 +445,17 @@ public:
 		to make sure the renderer repaints it and its children next frame. */
 	void Invalidate();
 
+	/** Invalidate only the given rect (relative to this widget), to make sure it's
+		repainted next frame. The rect is added to the damage region of the nearest
+		damage root (See SetIsDamageRoot). */
+	void Invalidate(const TBRect &rect);
+
+	/** Get the rect that may be painted by this widget, relative to its parent.
+		This is the widget rect expanded by anything its skin may paint outside it
+		(See TBSkin::GetPaintExpand), including the "generic_focus" element if the
+		widget is focusable. */
+	TBRect GetPaintRect() const;
+
 	/** Call if something changes that might need other widgets to
 		update their state.  F.ex if a action availability changes,
 		some widget might have to become enabled/disabled.  Calling
@@ -597,8 +610,15 @@ public:
 	/** Return the current skin background, as set by SetSkinBg. */
 	TBID GetSkinBg() const { return m_skin_bg; }
 
-	/** Return the skin background element, or nullptr. */
-	TBSkinElement *GetSkinBgElement();
+	/** Return the skin background element, or nullptr. If load_bitmap is false, it
+		doesn't load the bitmap if the skin loads bitmaps lazily (See TBSkin::GetSkinElement). */
+	TBSkinElement *GetSkinBgElement(bool load_bitmap = true);
+
+	/** Load the bitmaps of the skin backgrounds of this widget and all its children, if
+		the skin loads bitmaps lazily (See TBSkin::SetLazyBitmapLoading). Call this f.ex
+		after creating a window, so its bitmaps are decoded in parallel and not one by one
+		when the widgets are first laid out and painted. */
+	void PrefetchSkinBitmaps();
 
 	/** Set if this widget is a group root. Grouped widgets (such as TBRadioButton) will toggle all other
 		widgets with the same group_id under the nearest parent group root. TBWindow is a group root by default. */
@@ -606,6 +626,41 @@ public:
 	/** See TBWidget::SetIsGroupRoot */
 	bool GetIsGroupRoot() const { return m_packed.is_group_root; }
 
+	/** Set if this widget should collect the areas invalidated by itself and its
+		children into a damage region, so it can be painted partially.
+		See TakeDamage and InvokePaint. Initially the whole widget is damaged. */
+	void SetIsDamageRoot(bool damage_root);
+
+	/** Set if this widget should be painted through a layer. A layer paints the widget
+		and its children once into a render target, and then reuses it until something
+		inside it is invalidated. Changing the opacity or position of the widget doesn't
+		repaint the layer, and the opacity applies to the layer as a whole.
+		If the renderer doesn't support render targets, the widget is painted normally. */
+	void SetIsLayer(bool is_layer);
+
+	/** Return true if this widget is painted through a layer. See SetIsLayer. */
+	bool GetIsLayer() const { return m_layer != nullptr; }
+
+	/** Set if this widget should record what it and its children paint into a display
+		list. The display list is then painted instead of painting the widgets, until
+		something inside it is invalidated. Moving the widget or changing its opacity
+		doesn't require recording it again.
+		Anything painted outside GetPaintRect is clipped away.
+		This is ignored if display_lists_enabled is false, or the renderer doesn't
+		support display lists. */
+	void SetUseDisplayList(bool use_display_list);
+
+	/** Return true if this widget uses a display list. See SetUseDisplayList. */
+	bool GetUseDisplayList() const { return m_display_list != nullptr; }
+
+	/** Return true if this widget collects damage. See SetIsDamageRoot. */
+	bool GetIsDamageRoot() const { return m_damage != nullptr; }
+
+	/** Move the region that has been invalidated since the last call into region
+		(relative to this widget), and reset it. Returns false if nothing has
+		been invalidated, or if this isn't a damage root. */
+	bool TakeDamage(TBRegion &region);
+
 	/** Set if this widget should be able to receive focus or not. */
 	void SetIsFocusable(bool focusable) { m_packed.is_focusable = focusable; }
 	/** See TBWidget::SetIsFocusable */
@@ -1035,6 +1090,12 @@ public:
 	/** Invoke paint on this widget and all its children */
 	void InvokePaint(const PaintProps &parent_paint_props);
 
+	/** Invoke paint on this widget and all its children, but only inside the rects
+		of region (relative to this widget). The clip rect is set to each rect in turn,
+		so children outside of it are skipped. Normally used on a damage root with the
+		region from TakeDamage. */
+	void InvokePaint(const PaintProps &parent_paint_props, const TBRegion &region);
+
 	/** Invoke OnFontChanged on this widget and recursively on any
 		children that inherit the font. */
 	void InvokeFontChanged();
@@ -1140,6 +1201,9 @@ private:
 	LayoutParams *m_layout_params;	///< Layout params, or nullptr.
 	TBScroller *m_scroller;			///< Current scroller
 	TBLongClickTimer *m_long_click_timer;///< Active long-click timer
+	TBRegion *m_damage;				///< Invalidated region if this is a damage root, or nullptr.
+	TBWidgetLayer *m_layer;			///< Layer if painted through a layer, or nullptr.
+	TBWidgetDisplayList *m_display_list;///< Display list if using one, or nullptr.
 	union {
 		struct {
 			uint16_t is_group_root : 1;
@@ -1185,6 +1249,7 @@ public:
 	static bool update_widget_states;	///< true if something has called InvalidateStates() and it still hasn't been updated.
 	static bool update_skin_states;		///< true if something has called InvalidateSkinStates() and skin still hasn't been updated.
 	static bool show_focus_state;		///< true if the focused state should be painted automatically.
+	static bool display_lists_enabled;	///< true if widgets may use display lists (See SetUseDisplayList).
 
 	void StopLongClickTimer();
 private:
@@ -1195,6 +1260,12 @@ private:
 	TBScroller *GetReadyScroller(bool scroll_x, bool scroll_y);
 	TBWidget *GetWidgetByIDInternal(const TBID &id, const TB_TYPE_ID type_id = nullptr) const;
 	void InvokeSkinUpdatesInternal(bool force_update);
+	void AddDamage(const TBRect &rect);
+	void InvalidateInternal(const TBRect &rect, bool invalidate_own_cache);
+	void InvokePaintInternal(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element);
+	void InvokePaintContent(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element);
+	bool InvokePaintLayer(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element, float opacity);
+	bool InvokePaintDisplayList(const PaintProps &parent_paint_props, WIDGET_STATE state, TBSkinElement *skin_element);
 	void InvokeProcessInternal();
 	static void SetHoveredWidget(TBWidget *widget, bool touch);
 	static void SetCapturedWidget(TBWidget *widget);
@@ -748,7 +748,12 @@ TB_WIDGET_FACTORY(TBImageWidget, TBValue::TYPE_NULL, WIDGET_Z_TOP) {}
 void TBImageWidget::OnInflate(const INFLATE_INFO &info)
 {
 	if (TBStr filename = info.node->GetValueString("filename", nullptr))
-		SetImage(filename.CStr());
+	{
+		if (info.node->GetValueInt("async", false))
+			SetImageAsync(filename.CStr());
+		else
+			SetImage(filename.CStr());
+	}
 	SetAdaptTextColor(info.node->GetValueInt("adapt-text-color", false) ? true : false);
 	TBWidget::OnInflate(info);
 }
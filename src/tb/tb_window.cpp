@@ -201,7 +201,7 @@ PreferredSize TBWindow::OnCalculatePreferredSize(const SizeConstraints &constrai
 	PreferredSize ps = OnCalculatePreferredContentSize(constraints);
 
 	// Add window skin padding
-	if (TBSkinElement *e = GetSkinBgElement())
+	if (TBSkinElement *e = GetSkinBgElement(false))
 	{
 		ps.min_w += e->padding_left + e->padding_right;
 		ps.pref_w += e->padding_left + e->padding_right;
@@ -5,6 +5,7 @@
 
 #include "tb_test.h"
 #include "tb_system.h"
+#include <stdio.h>
 
 #ifdef TB_UNIT_TESTING
 // Reference at least one group in each test file, to force
@@ -12,17 +13,29 @@
 // as an library.
 TB_FORCE_LINK_TEST_GROUP(tb_color);
 TB_FORCE_LINK_TEST_GROUP(tb_dimension_converter);
+TB_FORCE_LINK_TEST_GROUP(tb_font_glyph_cache);
 TB_FORCE_LINK_TEST_GROUP(tb_geometry);
+#ifdef TB_IMAGE
+TB_FORCE_LINK_TEST_GROUP(tb_image_manager);
+#endif
 TB_FORCE_LINK_TEST_GROUP(tb_linklist);
 TB_FORCE_LINK_TEST_GROUP(tb_node_ref_tree);
 TB_FORCE_LINK_TEST_GROUP(tb_object);
 TB_FORCE_LINK_TEST_GROUP(tb_parser);
+#ifdef TB_RENDERER_BATCHER
+TB_FORCE_LINK_TEST_GROUP(tb_renderer_batcher);
+#endif
+#ifdef TB_RENDERER_SOFTWARE
+TB_FORCE_LINK_TEST_GROUP(tb_renderer_software);
+#endif
+TB_FORCE_LINK_TEST_GROUP(tb_skin);
 TB_FORCE_LINK_TEST_GROUP(tb_space_allocator);
 TB_FORCE_LINK_TEST_GROUP(tb_editfield);
 TB_FORCE_LINK_TEST_GROUP(tb_tempbuffer);
 TB_FORCE_LINK_TEST_GROUP(tb_test);
 TB_FORCE_LINK_TEST_GROUP(tb_value);
 TB_FORCE_LINK_TEST_GROUP(tb_widget_value_text);
+TB_FORCE_LINK_TEST_GROUP(tb_widgets_damage);
 #endif
 
 namespace tb {
@@ -58,6 +71,19 @@ TBStr tb_get_test_file_name(const char *testpath, const char *filename)
 	return str;
 }
 
+bool tb_write_test_image_file(const TBStr &filename, int w, int h, uint8_t r, uint8_t g, uint8_t b)
+{
+	FILE *f = fopen(filename.CStr(), "wb");
+	if (!f)
+		return false;
+	fprintf(f, "P6\n%d %d\n255\n", w, h);
+	const uint8_t rgb[3] = { r, g, b };
+	for (int i = 0; i < w * h; i++)
+		fwrite(rgb, 1, 3, f);
+	fclose(f);
+	return true;
+}
+
 // == TBRegisterCall ==========================================================
 
 TBRegisterCall::TBRegisterCall(TBTestGroup *test, TBCall *call)
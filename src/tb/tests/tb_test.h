@@ -192,6 +192,10 @@ private:
 
 TBStr tb_get_test_file_name(const char *testpath, const char *filename);
 
+/** Write a w * h image file (binary PPM) with all pixels in the given color.
+	Return false if it can't be written. */
+bool tb_write_test_image_file(const TBStr &filename, int w, int h, uint8_t r, uint8_t g, uint8_t b);
+
 // Internal globals
 extern uint32_t test_settings;	///< Settings, as sent to TBRunTests
 extern int fail_line_nr;		///< Fail line number
@@ -0,0 +1,404 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "tb_test.h"
+#include "tb_font_renderer.h"
+#include <math.h>
+#include <stdio.h>
+#include <thread>
+
+#ifdef TB_UNIT_TESTING
+
+using namespace tb;
+
+TB_TEST_GROUP(tb_font_glyph_cache)
+{
+	// Four glyphs of this size fill a page.
+	static const int GLYPH_W = TB_GLYPH_CACHE_WIDTH / 2;
+	static const int GLYPH_H = TB_GLYPH_CACHE_HEIGHT / 2;
+	static const int PAGE_BYTES = TB_GLYPH_CACHE_WIDTH * TB_GLYPH_CACHE_HEIGHT * 4;
+
+	TBFontGlyphCache *cache;
+	uint32_t *data;
+	TBFontGlyph *glyphs[9];
+
+	/** Renders all glyphs with the glyph size above, and advance 10. */
+	class TestFontRenderer : public TBFontRenderer
+	{
+	public:
+		TestFontRenderer(uint8_t *data) : num_rendered(0), num_metrics(0), num_calls_on_thread(0), data(data) {}
+		virtual TBFontFace *Create(TBFontManager *font_manager, const TBStr &filename,
+									const TBFontDescription &font_desc);
+		virtual bool RenderGlyph(TBFontGlyphData *glyph_data, UCS4 /*cp*/)
+		{
+			glyph_data->data8 = data;
+			glyph_data->w = glyph_data->stride = GLYPH_W;
+			glyph_data->h = GLYPH_H;
+			num_rendered++;
+			CountCallOnThread();
+			return true;
+		}
+		virtual void GetGlyphMetrics(TBGlyphMetrics *metrics, UCS4 /*cp*/)
+		{
+			metrics->advance = 10;
+			num_metrics++;
+			CountCallOnThread();
+		}
+		virtual TBFontMetrics GetMetrics() { return TBFontMetrics(); }
+		void CountCallOnThread()
+		{
+			if (std::this_thread::get_id() == thread)
+				num_calls_on_thread++;
+		}
+		int num_rendered;
+		int num_metrics;
+		int num_calls_on_thread;	///< Glyphs rendered or measured on thread.
+		std::thread::id thread;
+	private:
+		uint8_t *data;
+	};
+
+	TestFontRenderer *font_renderer;
+
+	TBFontFace *TestFontRenderer::Create(TBFontManager *font_manager, const TBStr & /*filename*/,
+										const TBFontDescription &font_desc)
+	{
+		font_renderer = new TestFontRenderer(data);
+		return new TBFontFace(font_manager->GetGlyphCache(), font_renderer, font_desc);
+	}
+
+	TBFontFace *CreateTestFontFace()
+	{
+		font_renderer = new TestFontRenderer((uint8_t *) data);
+		return new TBFontFace(cache, font_renderer, TBFontDescription());
+	}
+
+	TBFontGlyph *Render(int index)
+	{
+		TBFontGlyph *glyph = cache->CreateAndCacheGlyph(TBID(index + 1), index);
+		cache->CreateFragment(glyph, GLYPH_W, GLYPH_H, GLYPH_W, TB_BITMAP_FORMAT_RGBA32, data);
+		return glyph;
+	}
+
+	TB_TEST(Init)
+	{
+		data = new uint32_t[GLYPH_W * GLYPH_H];
+		memset(data, 0, GLYPH_W * GLYPH_H * sizeof(uint32_t));
+	}
+	TB_TEST(Shutdown)
+	{
+		delete [] data;
+	}
+	TB_TEST(Setup)
+	{
+		cache = new TBFontGlyphCache;
+		cache->SetMemoryBudget(PAGE_BYTES * 2);
+	}
+	TB_TEST(Cleanup)
+	{
+		delete cache;
+	}
+
+	TB_TEST(grow_within_budget)
+	{
+		for (int i = 0; i < 8; i++)
+			TB_VERIFY((glyphs[i] = Render(i))->frag);
+		TB_VERIFY(cache->GetNumPages() == 2);
+		TB_VERIFY(cache->GetMemoryUsage() == PAGE_BYTES * 2);
+		TB_VERIFY(cache->GetStats().misses == 8);
+		TB_VERIFY(cache->GetStats().evicted_pages == 0);
+	}
+
+	TB_TEST(evict_least_recently_used_page)
+	{
+		for (int i = 0; i < 8; i++)
+			glyphs[i] = Render(i);
+
+		// Use the glyphs in the first page, so the second page is the oldest.
+		for (int i = 0; i < 4; i++)
+			TB_VERIFY(cache->GetGlyph(glyphs[i]->hash_id, glyphs[i]->cp) == glyphs[i]);
+		TB_VERIFY(cache->GetStats().hits == 4);
+
+		glyphs[8] = Render(8);
+		TB_VERIFY(glyphs[8]->frag);
+		TB_VERIFY(cache->GetNumPages() == 2);
+		for (int i = 0; i < 4; i++)
+			TB_VERIFY(glyphs[i]->frag);
+		for (int i = 4; i < 8; i++)
+			TB_VERIFY(!glyphs[i]->frag);
+		TB_VERIFY(cache->GetStats().evicted_pages == 1);
+		TB_VERIFY(cache->GetStats().evicted_glyphs == 4);
+	}
+
+	TB_TEST(max_pages)
+	{
+		cache->SetMaxPages(1);
+		for (int i = 0; i < 5; i++)
+			glyphs[i] = Render(i);
+		TB_VERIFY(cache->GetNumPages() == 1);
+		TB_VERIFY(glyphs[4]->frag);
+		TB_VERIFY(cache->GetStats().evicted_glyphs == 4);
+	}
+
+	TB_TEST(glyph_run_cached)
+	{
+		TBFontFace *font = CreateTestFontFace();
+		font->DrawString(0, 0, TBColor(), "abcab");
+		TB_VERIFY(cache->GetStats().misses == 3);
+
+		// Drawing and measuring the same string again doesn't look up any glyphs.
+		// Drawn glyphs are still marked as used.
+		cache->ResetStats();
+		font->DrawString(0, 0, TBColor(), "abcab");
+		TB_VERIFY(font->GetStringWidth("abcab") == 50);
+		TB_VERIFY(font->GetStringWidth("abcabc", 5) == 50);
+		TB_VERIFY(cache->GetStats().hits == 5);
+		TB_VERIFY(cache->GetStats().misses == 0);
+		delete font;
+	}
+
+	TB_TEST(glyph_run_marks_glyphs_used)
+	{
+		TBFontFace *font = CreateTestFontFace();
+		font->DrawString(0, 0, TBColor(), "abcd");
+		font->DrawString(0, 0, TBColor(), "efgh");
+
+		// Drawing the first string from its run makes its page the most recently used,
+		// so the second page is dropped to make room.
+		font->DrawString(0, 0, TBColor(), "abcd");
+		font->DrawString(0, 0, TBColor(), "i");
+		TB_VERIFY(cache->GetStats().evicted_glyphs == 4);
+		cache->ResetStats();
+		font->DrawString(0, 0, TBColor(), "abcd");
+		TB_VERIFY(cache->GetStats().misses == 0);
+		delete font;
+	}
+
+	TB_TEST(glyph_table)
+	{
+		TBFontFace *font = CreateTestFontFace();
+		// Code points below and above TB_FONT_GLYPH_TABLE_SIZE, each measured in a new run.
+		TB_VERIFY(font->GetStringWidth("a") == 10);
+		TB_VERIFY(font->GetStringWidth("ab") == 20);
+		TB_VERIFY(font->GetStringWidth("\xF0\x9F\x98\x80") == 10);
+		TB_VERIFY(font->GetStringWidth("\xF0\x9F\x98\x80" "a") == 20);
+		TB_VERIFY(font->GetStringWidth("\xC3\xA5" "a") == 20);
+		font->DrawString(0, 0, TBColor(), "ab");
+
+		// Glyphs found in the table are marked as used in the glyph cache too.
+		cache->ResetStats();
+		font->DrawString(0, 0, TBColor(), "ba");
+		TB_VERIFY(cache->GetStats().hits == 2);
+		delete font;
+	}
+
+	TB_TEST(effect_glyphs_cached_separately)
+	{
+		TBFontFace *font = CreateTestFontFace();
+		font->DrawString(0, 0, TBColor(), "a");
+		font->GetEffect()->SetBlurRadius(2);
+		font->DrawString(0, 0, TBColor(), "a");
+		TB_VERIFY(font_renderer->num_rendered == 2);
+
+		// Both are still cached.
+		font->GetEffect()->SetBlurRadius(0);
+		font->DrawString(0, 0, TBColor(), "a");
+		font->GetEffect()->SetBlurRadius(2);
+		font->DrawString(0, 0, TBColor(), "a");
+		TB_VERIFY(font_renderer->num_rendered == 2);
+		delete font;
+	}
+
+	TB_TEST(glyph_run_invalidated_by_eviction)
+	{
+		cache->SetMaxPages(1);
+		TBFontFace *font = CreateTestFontFace();
+		font->DrawString(0, 0, TBColor(), "abcd");
+		font->DrawString(0, 0, TBColor(), "e");
+		TB_VERIFY(cache->GetStats().evicted_glyphs == 4);
+
+		// The glyphs of the cached run were dropped, so they are rendered again.
+		cache->ResetStats();
+		font->DrawString(0, 0, TBColor(), "abcd");
+		TB_VERIFY(cache->GetStats().misses == 4);
+		delete font;
+	}
+
+	class TestGlyphListener : public TBFontGlyphListener
+	{
+	public:
+		TestGlyphListener() : num_calls(0) {}
+		virtual void OnGlyphsRendered() { num_calls++; }
+		int num_calls;
+	};
+
+	TB_TEST(render_in_background)
+	{
+		cache->SetRenderInBackground(true);
+		if (!cache->GetRenderInBackground())
+			return; // There are no threads.
+		TestGlyphListener listener;
+		cache->AddListener(&listener);
+		TBFontFace *font = CreateTestFontFace();
+
+		// Glyphs are queued by prefetching and drawing, and skipped until they are rendered.
+		// They have no advance until their metrics are rendered too.
+		TB_VERIFY(font->RenderGlyphs("ab"));
+		font->DrawString(0, 0, TBColor(), "abc");
+		TB_VERIFY(font->GetStringWidth("abc") == 0);
+		TB_VERIFY(cache->GetNumSkippedGlyphs() == 3);
+		TB_VERIFY(cache->GetStats().misses == 0);
+
+		cache->ProcessRenderedGlyphs(true);
+		TB_VERIFY(font->GetStringWidth("abc") == 30);
+		TB_VERIFY(font_renderer->num_rendered == 3);
+		TB_VERIFY(cache->GetStats().misses == 3);
+		TB_VERIFY(listener.num_calls == 1);
+
+		// They are drawn from the cached run now, and not queued again.
+		font->DrawString(0, 0, TBColor(), "abc");
+		TB_VERIFY(font->RenderGlyphs("abc"));
+		cache->ProcessRenderedGlyphs(true);
+		TB_VERIFY(cache->GetNumSkippedGlyphs() == 3);
+		TB_VERIFY(font_renderer->num_rendered == 3);
+		TB_VERIFY(listener.num_calls == 1);
+
+		cache->RemoveListener(&listener);
+		delete font;
+		cache->SetRenderInBackground(false);
+	}
+
+	TB_TEST(render_in_background_not_on_calling_thread)
+	{
+		cache->SetRenderInBackground(true);
+		if (!cache->GetRenderInBackground())
+			return; // There are no threads.
+		TBFontFace *font = CreateTestFontFace();
+		font_renderer->thread = std::this_thread::get_id();
+
+		// Neither drawing nor measuring new glyphs calls the font renderer on this thread.
+		font->DrawString(0, 0, TBColor(), "ab");
+		TB_VERIFY(font->GetStringWidth("abc") == 0);
+		cache->ProcessRenderedGlyphs(true);
+		TB_VERIFY(font->GetStringWidth("abc") == 30);
+		TB_VERIFY(font_renderer->num_metrics == 3);
+		TB_VERIFY(font_renderer->num_calls_on_thread == 0);
+
+		delete font;
+		cache->SetRenderInBackground(false);
+	}
+
+	TB_TEST(render_in_background_delete_font)
+	{
+		cache->SetRenderInBackground(true);
+		if (!cache->GetRenderInBackground())
+			return; // There are no threads.
+		TestGlyphListener listener;
+		cache->AddListener(&listener);
+
+		// The glyphs still queued for the font are dropped with it.
+		TBFontFace *font = CreateTestFontFace();
+		font->RenderGlyphs("abcdefgh");
+		delete font;
+		cache->ProcessRenderedGlyphs(true);
+		TB_VERIFY(listener.num_calls == 0);
+		TB_VERIFY(cache->GetStats().misses == 0);
+
+		cache->RemoveListener(&listener);
+		cache->SetRenderInBackground(false);
+	}
+
+	TB_TEST(save_glyph_cache)
+	{
+		const TBStr filename = TB_TEST_FILE("test_tb_font_glyph_cache.tmp");
+		TBFontDescription font_desc;
+		font_desc.SetID(TBIDC("test_font"));
+		font_desc.SetSize(16);
+		for (int i = 0; i < 2; i++)
+		{
+			TBFontManager *font_manager = new TBFontManager;
+			font_manager->AddRenderer(new TestFontRenderer((uint8_t *) data));
+			font_manager->AddFontInfo(TB_TEST_FILE("test_tb_parser.tb.txt").CStr(), "test_font");
+			TB_VERIFY(font_manager->LoadGlyphCache(filename) == (i == 1));
+			TBFontFace *font = font_manager->CreateFontFace(font_desc);
+			TB_VERIFY(font->RenderGlyphs("ab"));
+			TB_VERIFY(font->GetStringWidth("ab") == 20);
+			TB_VERIFY(font_manager->GetGlyphCache()->GetStats().misses == 2);
+
+			// The second time, the saved glyphs are used without the font renderer.
+			TB_VERIFY(font_renderer->num_rendered == (i == 0 ? 2 : 0));
+			TB_VERIFY(font_renderer->num_metrics == (i == 0 ? 2 : 0));
+			TB_VERIFY(font_manager->SaveGlyphCache(filename));
+			delete font_manager;
+		}
+		remove(filename.CStr());
+	}
+}
+
+TB_TEST_GROUP(tb_font_effect)
+{
+	/** The straightforward two pass blur, to compare with. */
+	void ReferenceBlur(const uint8_t *src, int srcw, int srch, uint8_t *dst, const float *kernel, int radius)
+	{
+		const int dstw = srcw + radius * 2, dsth = srch + radius * 2;
+		float *temp = new float[dstw * srch];
+		for (int y = 0; y < srch; y++)
+			for (int x = 0; x < dstw; x++)
+			{
+				float val = 0;
+				for (int k = -radius; k <= radius; k++)
+					if (x - radius + k >= 0 && x - radius + k < srcw)
+						val += src[y * srcw + x - radius + k] * kernel[k + radius];
+				temp[y * dstw + x] = val;
+			}
+		for (int y = 0; y < dsth; y++)
+			for (int x = 0; x < dstw; x++)
+			{
+				float val = 0;
+				for (int k = -radius; k <= radius; k++)
+					if (y - radius + k >= 0 && y - radius + k < srch)
+						val += temp[(y - radius + k) * dstw + x] * kernel[k + radius];
+				dst[y * dstw + x] = (uint8_t)(val + 0.5f);
+			}
+		delete [] temp;
+	}
+
+	TB_TEST(blur)
+	{
+		const int radius = 3, srcw = 9, srch = 5;
+		uint8_t src[srcw * srch];
+		for (int i = 0; i < srcw * srch; i++)
+			src[i] = (uint8_t) (i * 37);
+
+		TBFontEffect effect;
+		effect.SetBlurRadius(radius);
+		TBFontGlyphData glyph_data;
+		glyph_data.data8 = src;
+		glyph_data.w = glyph_data.stride = srcw;
+		glyph_data.h = srch;
+		TBGlyphMetrics metrics;
+		TBFontGlyphData *result = effect.Render(&metrics, &glyph_data);
+		TB_VERIFY(result && result->w == srcw + radius * 2 && result->h == srch + radius * 2);
+		TB_VERIFY(metrics.x == -radius && metrics.y == -radius);
+
+		// The kernel is the same as in TBFontEffect::SetBlurRadius.
+		float kernel[radius * 2 + 1], sum = 0;
+		const float std_dev_sq2 = 2.f * (radius / 2.f) * (radius / 2.f);
+		for (int k = 0; k < radius * 2 + 1; k++)
+			sum += (kernel[k] = 1.f / sqrtf(3.1415f * std_dev_sq2) * expf(-((k - radius) * (k - radius) / std_dev_sq2)));
+		for (int k = 0; k < radius * 2 + 1; k++)
+			kernel[k] /= sum;
+		uint8_t expected[(srcw + radius * 2) * (srch + radius * 2)];
+		ReferenceBlur(src, srcw, srch, expected, kernel, radius);
+		for (int i = 0; i < result->w * result->h; i++)
+		{
+			const int diff = (int) result->data8[i] - (int) expected[i];
+			TB_VERIFY(diff >= -1 && diff <= 1);
+		}
+		delete result;
+	}
+}
+
+#endif // TB_UNIT_TESTING
@@ -0,0 +1,98 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "tb_test.h"
+#include "image/tb_image_manager.h"
+#include "image/tb_image_widget.h"
+#include <stdio.h>
+
+#if defined(TB_UNIT_TESTING) && defined(TB_IMAGE)
+
+using namespace tb;
+
+TB_TEST_GROUP(tb_image_manager)
+{
+	class ImageListener : public TBImageListener
+	{
+	public:
+		ImageListener() : num_calls(0) { g_image_manager->AddListener(this); }
+		~ImageListener() { g_image_manager->RemoveListener(this); }
+		virtual void OnImagesLoaded() { num_calls++; }
+		int num_calls;
+	};
+
+	TBStr image_files[2];
+
+	TB_TEST(Init)
+	{
+		image_files[0] = TB_TEST_FILE("test_tb_image_manager_a.ppm");
+		image_files[1] = TB_TEST_FILE("test_tb_image_manager_b.ppm");
+		TB_VERIFY(tb_write_test_image_file(image_files[0], 8, 6, 255, 255, 255));
+		TB_VERIFY(tb_write_test_image_file(image_files[1], 4, 4, 255, 255, 255));
+	}
+
+	TB_TEST(load_async)
+	{
+		ImageListener listener;
+		TBImage image = g_image_manager->GetImageAsync(image_files[0]);
+		TB_VERIFY(image.IsPending() && image.IsEmpty());
+
+		g_image_manager->ProcessLoadedImages(true);
+		TB_VERIFY(!image.IsPending() && !image.IsEmpty());
+		TB_VERIFY(image.Width() == 8 && image.Height() == 6);
+		TB_VERIFY(listener.num_calls == 1);
+
+		// It's not pending if it's loaded already.
+		TB_VERIFY(!g_image_manager->GetImageAsync(image_files[0]).IsPending());
+	}
+
+	TB_TEST(load_missing)
+	{
+		TBImage image = g_image_manager->GetImageAsync(TB_TEST_FILE("test_tb_image_manager_missing.ppm"));
+		TB_VERIFY(image.IsPending());
+		g_image_manager->ProcessLoadedImages(true);
+		TB_VERIFY(!image.IsPending() && image.IsEmpty());
+	}
+
+	TB_TEST(get_pending)
+	{
+		// Getting a pending image loads it right away.
+		TBImage image = g_image_manager->GetImageAsync(image_files[1]);
+		TBImage image_sync = g_image_manager->GetImage(image_files[1]);
+		TB_VERIFY(!image.IsPending() && image.Width() == 4);
+		TB_VERIFY(image_sync.GetBitmap() == image.GetBitmap());
+
+		g_image_manager->ProcessLoadedImages(true);
+		TB_VERIFY(image.GetBitmap() == image_sync.GetBitmap());
+	}
+
+	TB_TEST(release_pending)
+	{
+		g_image_manager->GetImageAsync(image_files[1]);
+		g_image_manager->ProcessLoadedImages(true);
+		TB_VERIFY(g_image_manager->GetImageAsync(image_files[1]).IsPending());
+		g_image_manager->ProcessLoadedImages(true);
+	}
+
+	TB_TEST(widget)
+	{
+		TBImageWidget widget;
+		widget.SetImageAsync(image_files[0]);
+		TB_VERIFY(widget.GetImage().IsPending());
+
+		g_image_manager->ProcessLoadedImages(true);
+		TB_VERIFY(!widget.GetImage().IsPending());
+		PreferredSize ps = widget.GetPreferredSize();
+		TB_VERIFY(ps.pref_w == 8 && ps.pref_h == 6);
+	}
+
+	TB_TEST(Shutdown)
+	{
+		for (int i = 0; i < 2; i++)
+			remove(image_files[i].CStr());
+	}
+}
+
+#endif // TB_UNIT_TESTING
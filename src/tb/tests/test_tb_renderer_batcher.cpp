@@ -0,0 +1,347 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "tb_test.h"
+#include "renderers/tb_renderer_batcher.h"
+#include "tb_bitmap_fragment.h"
+
+#if defined(TB_UNIT_TESTING) && defined(TB_RENDERER_BATCHER)
+
+using namespace tb;
+
+TB_TEST_GROUP(tb_renderer_batcher)
+{
+	/** Bitmap that doesn't hold any data. */
+	class TestBitmap : public TBBitmap
+	{
+	public:
+		virtual int Width() { return 64; }
+		virtual int Height() { return 64; }
+		virtual void SetData(uint32_t * /*data*/) {}
+	};
+
+	/** Renderer that logs the batches it's asked to render. */
+	class TestRenderer : public TBRendererBatcher
+	{
+	public:
+		struct Entry
+		{
+			TBBitmap *bitmap;
+			int vertex_count;
+			int index_count;
+			int instance_count;
+			float first_x;
+			Vertex first_vertex[4];
+			Instance first_instance;
+		};
+		Entry log[32];
+		int log_count = 0;
+
+		virtual TBBitmap *CreateBitmap(int /*width*/, int /*height*/, uint32_t * /*data*/) { return nullptr; }
+		virtual void RenderBatch(Batch *b)
+		{
+			Entry &e = log[log_count++];
+			e.bitmap = b->bitmap;
+			e.vertex_count = b->vertex_count;
+			e.index_count = b->GetIndexCount();
+			e.instance_count = b->instance_count;
+			e.first_instance = b->instance[0];
+			e.first_x = b->vertex[0].x;
+			for (int i = 0; i < 4; i++)
+				e.first_vertex[i] = b->vertex[i];
+		}
+		virtual int MapBatch(Batch *b, int quad_count)
+		{
+			int count = TBRendererBatcher::MapBatch(b, quad_count);
+			return map_limit ? MIN(count, map_limit) : count;
+		}
+		int map_limit = 0;
+		virtual void SetRenderTarget(TBBitmap *render_target, bool clear)
+		{
+			render_target_set = render_target;
+			render_target_cleared = clear;
+			render_target_set_at_log_count = log_count;
+		}
+		TBBitmap *render_target_set = nullptr;
+		bool render_target_cleared = false;
+		int render_target_set_at_log_count = -1;
+		void SetInstanced(bool instanced) { m_instanced_batches = instanced; }
+	};
+
+	TestRenderer *renderer;
+	TestBitmap bitmap_a;
+	TestBitmap bitmap_b;
+
+	TB_TEST(Setup)
+	{
+		renderer = new TestRenderer;
+		renderer->BeginPaint(1000, 1000);
+	}
+	TB_TEST(Cleanup)
+	{
+		delete renderer;
+	}
+
+	TB_TEST(sort_non_overlapping)
+	{
+		// Alternate between two bitmaps without any overlap.
+		for (int i = 0; i < 10; i++)
+			renderer->DrawBitmap(TBRect(i * 20, 0, 10, 10), TBRect(0, 0, 10, 10), i & 1 ? &bitmap_b : &bitmap_a);
+		TB_VERIFY(renderer->log_count == 0);
+		renderer->EndPaint();
+
+		TB_VERIFY(renderer->log_count == 2);
+		TB_VERIFY(renderer->log[0].bitmap == &bitmap_a);
+		TB_VERIFY(renderer->log[0].vertex_count == 5 * 4);
+		TB_VERIFY(renderer->log[1].bitmap == &bitmap_b);
+		TB_VERIFY(renderer->log[1].vertex_count == 5 * 4);
+	}
+
+	TB_TEST(keep_order_of_overlapping)
+	{
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->DrawBitmap(TBRect(5, 5, 10, 10), TBRect(0, 0, 10, 10), &bitmap_b);
+		renderer->DrawBitmap(TBRect(10, 10, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		// Doesn't overlap anything so it can join the first batch.
+		renderer->DrawBitmap(TBRect(100, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_b);
+		renderer->EndPaint();
+
+		TB_VERIFY(renderer->log_count == 3);
+		TB_VERIFY(renderer->log[0].bitmap == &bitmap_a);
+		TB_VERIFY(renderer->log[1].bitmap == &bitmap_b);
+		TB_VERIFY(renderer->log[1].vertex_count == 2 * 4);
+		TB_VERIFY(renderer->log[2].bitmap == &bitmap_a);
+		TB_VERIFY(renderer->log[2].first_x == 10);
+	}
+
+	TB_TEST(clip_rect)
+	{
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		TBRect old_clip = renderer->SetClipRect(TBRect(50, 0, 50, 50), true);
+		renderer->DrawBitmap(TBRect(60, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		// Completely clipped away
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_b);
+		renderer->SetClipRect(old_clip, false);
+		renderer->DrawBitmap(TBRect(20, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		TB_VERIFY(renderer->log_count == 0);
+		renderer->EndPaint();
+
+		// Changing the clip rect doesn't break the batch.
+		TB_VERIFY(renderer->log_count == 1);
+		TB_VERIFY(renderer->log[0].vertex_count == 3 * 4);
+	}
+
+	TB_TEST(clip_rect_clamp)
+	{
+		renderer->SetClipRect(TBRect(50, 0, 50, 50), true);
+		renderer->DrawBitmap(TBRect(40, 40, 20, 20), TBRect(0, 0, 64, 64), &bitmap_a);
+		renderer->EndPaint();
+
+		TB_VERIFY(renderer->log_count == 1);
+		const TBRendererBatcher::Vertex *ver = renderer->log[0].first_vertex;
+		// Bottom left
+		TB_VERIFY_FLOAT(ver[0].x, 50);
+		TB_VERIFY_FLOAT(ver[0].y, 50);
+		TB_VERIFY_FLOAT(ver[0].u, 0.5f);
+		TB_VERIFY_FLOAT(ver[0].v, 0.5f);
+		// Top right
+		TB_VERIFY_FLOAT(ver[3].x, 60);
+		TB_VERIFY_FLOAT(ver[3].y, 40);
+		TB_VERIFY_FLOAT(ver[3].u, 1.f);
+		TB_VERIFY_FLOAT(ver[3].v, 0.f);
+	}
+
+	TB_TEST(clip_rect_clamp_flipped)
+	{
+		renderer->SetClipRect(TBRect(50, 0, 50, 50), true);
+		renderer->DrawBitmap(TBRect(60, 0, -20, 10), TBRect(0, 0, 64, 64), &bitmap_a);
+		renderer->EndPaint();
+
+		TB_VERIFY(renderer->log_count == 1);
+		const TBRendererBatcher::Vertex *ver = renderer->log[0].first_vertex;
+		TB_VERIFY_FLOAT(ver[0].x, 60);
+		TB_VERIFY_FLOAT(ver[0].u, 0.f);
+		TB_VERIFY_FLOAT(ver[1].x, 50);
+		TB_VERIFY_FLOAT(ver[1].u, 0.5f);
+	}
+
+	TB_TEST(quad_indices)
+	{
+		const uint16_t *indices = TBRendererBatcher::GetQuadIndices();
+		TB_VERIFY(indices[0] == 0 && indices[1] == 1 && indices[2] == 2);
+		TB_VERIFY(indices[3] == 2 && indices[4] == 1 && indices[5] == 3);
+		TB_VERIFY(indices[INDEX_BATCH_SIZE - 1] == VERTEX_BATCH_SIZE - 1);
+
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->DrawBitmap(TBRect(20, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 1);
+		TB_VERIFY(renderer->log[0].vertex_count == 8);
+		TB_VERIFY(renderer->log[0].index_count == 12);
+	}
+
+	TB_TEST(instances)
+	{
+		renderer->SetInstanced(true);
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 32, 64), &bitmap_a);
+		renderer->DrawBitmap(TBRect(20, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 1);
+		TB_VERIFY(renderer->log[0].vertex_count == 0);
+		TB_VERIFY(renderer->log[0].instance_count == 2);
+		const TBRendererBatcher::Instance &inst = renderer->log[0].first_instance;
+		TB_VERIFY(inst.x == 0 && inst.y == 0 && inst.w == 10 && inst.h == 10);
+		TB_VERIFY_FLOAT(inst.uu, 0.5f);
+		TB_VERIFY_FLOAT(inst.vv, 1.f);
+	}
+
+	TB_TEST(instances_clamp_huge)
+	{
+		// A quad that doesn't fit in the 16bit instance coordinates is
+		// clamped to the clip rect.
+		renderer->SetInstanced(true);
+		renderer->DrawBitmap(TBRect(-100000, 0, 200000, 10), TBRect(0, 0, 64, 64), &bitmap_a);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 1);
+		const TBRendererBatcher::Instance &inst = renderer->log[0].first_instance;
+		TB_VERIFY(inst.x == 0 && inst.w == 1000);
+		TB_VERIFY_FLOAT(inst.u, 0.5f);
+		TB_VERIFY_FLOAT(inst.uu, 0.505f);
+	}
+
+	TB_TEST(map_batch_limit)
+	{
+		// If MapBatch can't fit all quads, the batch is split.
+		renderer->map_limit = 2;
+		for (int i = 0; i < 5; i++)
+			renderer->DrawBitmap(TBRect(i * 20, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 3);
+		TB_VERIFY(renderer->log[0].vertex_count == 2 * 4);
+		TB_VERIFY(renderer->log[1].vertex_count == 2 * 4);
+		TB_VERIFY(renderer->log[2].vertex_count == 4);
+		TB_VERIFY(renderer->log[2].first_x == 80);
+	}
+
+	TB_TEST(flush_bitmap)
+	{
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->DrawBitmap(TBRect(20, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_b);
+		renderer->FlushBitmap(&bitmap_b);
+		TB_VERIFY(renderer->log_count == 2);
+		renderer->DrawBitmap(TBRect(40, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 3);
+	}
+
+	TB_TEST(render_target)
+	{
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->Translate(100, 100);
+		renderer->SetClipRect(TBRect(0, 0, 50, 50), false);
+		renderer->SetOpacity(0.5f);
+		float opacity = renderer->GetOpacity();
+
+		// Begin flushes what's been drawn so far, and resets the state.
+		TB_VERIFY(renderer->BeginRenderTarget(&bitmap_b));
+		TB_VERIFY(renderer->render_target_set == &bitmap_b);
+		TB_VERIFY(renderer->render_target_cleared);
+		TB_VERIFY(renderer->render_target_set_at_log_count == 1);
+		TB_VERIFY(renderer->GetClipRect().Equals(TBRect(0, 0, 64, 64)));
+		TB_VERIFY_FLOAT(renderer->GetOpacity(), 1.f);
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndRenderTarget();
+
+		// End flushes what was drawn to the render target, and restores the state.
+		TB_VERIFY(renderer->render_target_set == nullptr);
+		TB_VERIFY(!renderer->render_target_cleared);
+		TB_VERIFY(renderer->render_target_set_at_log_count == 2);
+		TB_VERIFY_FLOAT(renderer->log[1].first_vertex[0].x, 0);
+		TB_VERIFY(renderer->GetClipRect().Equals(TBRect(0, 0, 50, 50)));
+		TB_VERIFY(renderer->GetOpacity() == opacity);
+
+		// The render target has premultiplied alpha, so the opacity applies to all channels.
+		renderer->DrawRenderTarget(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_b);
+		renderer->Translate(-100, -100);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 3);
+		TB_VERIFY(renderer->log[2].bitmap == &bitmap_b);
+		const TBRendererBatcher::Vertex &ver = renderer->log[2].first_vertex[0];
+		TB_VERIFY_FLOAT(ver.x, 100);
+		TB_VERIFY(ver.r == ver.a && ver.g == ver.a && ver.b == ver.a);
+		TB_VERIFY(ver.a == (unsigned char)(0.5f * 255));
+	}
+
+	TB_TEST(display_list)
+	{
+		TBDisplayList *display_list = renderer->CreateDisplayList();
+		renderer->Translate(100, 0);
+		renderer->SetOpacity(0.5f);
+		TB_VERIFY(renderer->BeginRecording(display_list, TBRect(0, 0, 50, 50)));
+		TB_VERIFY_FLOAT(renderer->GetOpacity(), 1.f);
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		// Clamped to the clip rect given to BeginRecording.
+		renderer->DrawBitmap(TBRect(40, 0, 20, 10), TBRect(0, 0, 64, 64), &bitmap_b);
+		renderer->EndRecording();
+		renderer->Translate(-100, 0);
+
+		// Nothing is painted while recording.
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 0);
+
+		// Painted at the current translation and opacity.
+		renderer->BeginPaint(1000, 1000);
+		renderer->Translate(200, 0);
+		renderer->SetOpacity(0.5f);
+		TB_VERIFY(renderer->PaintDisplayList(display_list));
+		renderer->Translate(-200, 0);
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 2);
+		TB_VERIFY_FLOAT(renderer->log[0].first_vertex[0].x, 200);
+		TB_VERIFY(renderer->log[0].first_vertex[0].a == 127);
+		TB_VERIFY(renderer->log[1].bitmap == &bitmap_b);
+		TB_VERIFY_FLOAT(renderer->log[1].first_vertex[1].x, 250);
+		TB_VERIFY_FLOAT(renderer->log[1].first_vertex[1].u, 0.5f);
+
+		delete display_list;
+	}
+
+	TB_TEST(display_list_stale)
+	{
+		TBDisplayList *display_list = renderer->CreateDisplayList();
+		TB_VERIFY(renderer->BeginRecording(display_list, TBRect(0, 0, 50, 50)));
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndRecording();
+
+		// The data of a bitmap changing doesn't affect what's recorded.
+		renderer->FlushBitmap(&bitmap_a);
+		TB_VERIFY(renderer->PaintDisplayList(display_list));
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 1);
+
+		// A bitmap fragment being freed or moved might affect any display list.
+		renderer->BeginPaint(1000, 1000);
+		TBBitmapFragment fragment;
+		fragment.m_batch_id = 0xffffffff;
+		renderer->FlushBitmapFragment(&fragment);
+		TB_VERIFY(!renderer->PaintDisplayList(display_list));
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 1);
+
+		// So might a bitmap being deleted.
+		renderer->BeginPaint(1000, 1000);
+		TB_VERIFY(renderer->BeginRecording(display_list, TBRect(0, 0, 50, 50)));
+		renderer->DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 10, 10), &bitmap_a);
+		renderer->EndRecording();
+		renderer->FlushDeletedBitmap(&bitmap_b);
+		TB_VERIFY(!renderer->PaintDisplayList(display_list));
+		renderer->EndPaint();
+		TB_VERIFY(renderer->log_count == 1);
+
+		delete display_list;
+	}
+}
+
+#endif // TB_UNIT_TESTING && TB_RENDERER_BATCHER
@@ -0,0 +1,347 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "tb_test.h"
+#include "renderers/tb_renderer_software.h"
+#include "renderers/tb_renderer_software_tiled.h"
+#include "tb_bitmap_fragment.h"
+
+#if defined(TB_UNIT_TESTING) && defined(TB_RENDERER_SOFTWARE)
+
+using namespace tb;
+
+TB_TEST_GROUP(tb_renderer_software)
+{
+	/** Return true if each channel of the pixels differ by at most 1. */
+	bool PixelNear(uint32_t a, uint32_t b)
+	{
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			int diff = (int) ((a >> shift) & 0xff) - (int) ((b >> shift) & 0xff);
+			if (diff < -1 || diff > 1)
+				return false;
+		}
+		return true;
+	}
+
+	TBRendererSoftware *renderer;
+	uint32_t framebuffer[64 * 64];
+
+	uint32_t Pixel(int x, int y) { return framebuffer[y * 64 + x]; }
+
+	TB_TEST(Setup)
+	{
+		for (int i = 0; i < 64 * 64; i++)
+			framebuffer[i] = 0xff000000;
+		renderer = new TBRendererSoftware;
+		renderer->SetFramebuffer(framebuffer, 64, 64, 64);
+		renderer->BeginPaint(64, 64);
+	}
+	TB_TEST(Cleanup)
+	{
+		delete renderer;
+	}
+
+	TB_TEST(copy)
+	{
+		uint32_t data[4] = { 0xff0000ff, 0xff00ff00, 0xffff0000, 0xffffffff };
+		TBBitmap *bitmap = renderer->CreateBitmap(2, 2, data);
+		renderer->DrawBitmap(TBRect(10, 20, 2, 2), TBRect(0, 0, 2, 2), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(Pixel(10, 20) == data[0]);
+		TB_VERIFY(Pixel(11, 20) == data[1]);
+		TB_VERIFY(Pixel(10, 21) == data[2]);
+		TB_VERIFY(Pixel(11, 21) == data[3]);
+		TB_VERIFY(Pixel(12, 20) == 0xff000000);
+		delete bitmap;
+	}
+
+	TB_TEST(blend)
+	{
+		uint32_t data = 0x800000ff; // Red with half alpha.
+		TBBitmap *bitmap = renderer->CreateBitmap(1, 1, &data);
+		renderer->DrawBitmap(TBRect(0, 0, 4, 4), TBRect(0, 0, 1, 1), bitmap);
+		renderer->DrawBitmapColored(TBRect(4, 0, 4, 4), TBRect(0, 0, 1, 1), TBColor(0, 255, 0, 255), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(PixelNear(Pixel(1, 1), 0xff000080));
+		// The color is multiplied with the bitmap.
+		TB_VERIFY(PixelNear(Pixel(5, 1), 0xff000000));
+		delete bitmap;
+	}
+
+	TB_TEST(bilinear)
+	{
+		uint32_t data[2] = { 0xff000000, 0xffffffff };
+		TBBitmap *bitmap = renderer->CreateBitmap(2, 1, data);
+		renderer->DrawBitmap(TBRect(0, 0, 4, 1), TBRect(0, 0, 2, 1), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(PixelNear(Pixel(1, 0), 0xff404040));
+		TB_VERIFY(PixelNear(Pixel(2, 0), 0xffbfbfbf));
+		delete bitmap;
+	}
+
+	TB_TEST(flip_and_tile)
+	{
+		uint32_t data[2] = { 0xff0000ff, 0xff00ff00 };
+		TBBitmap *bitmap = renderer->CreateBitmap(2, 1, data);
+		renderer->DrawBitmap(TBRect(2, 0, -2, 1), TBRect(0, 0, 2, 1), bitmap);
+		renderer->DrawBitmapTile(TBRect(0, 1, 5, 1), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(Pixel(0, 0) == data[1]);
+		TB_VERIFY(Pixel(1, 0) == data[0]);
+		TB_VERIFY(Pixel(2, 1) == data[0]);
+		TB_VERIFY(Pixel(3, 1) == data[1]);
+		TB_VERIFY(Pixel(4, 1) == data[0]);
+		delete bitmap;
+	}
+
+	TB_TEST(clip_rect)
+	{
+		uint32_t data = 0xffffffff;
+		TBBitmap *bitmap = renderer->CreateBitmap(1, 1, &data);
+		renderer->SetClipRect(TBRect(2, 2, 2, 2), false);
+		renderer->DrawBitmap(TBRect(0, 0, 8, 8), TBRect(0, 0, 1, 1), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(Pixel(1, 2) == 0xff000000);
+		TB_VERIFY(Pixel(2, 2) == 0xffffffff);
+		TB_VERIFY(Pixel(3, 3) == 0xffffffff);
+		TB_VERIFY(Pixel(4, 3) == 0xff000000);
+		delete bitmap;
+	}
+
+	TB_TEST(render_target)
+	{
+		uint32_t data = 0xff0000ff;
+		TBBitmap *bitmap = renderer->CreateBitmap(1, 1, &data);
+		TBBitmap *render_target = renderer->CreateRenderTarget(8, 8);
+		TB_VERIFY(renderer->BeginRenderTarget(render_target));
+		renderer->DrawBitmap(TBRect(0, 0, 4, 4), TBRect(0, 0, 1, 1), bitmap);
+		renderer->EndRenderTarget();
+		renderer->SetOpacity(0.5f);
+		renderer->DrawRenderTarget(TBRect(10, 10, 8, 8), TBRect(0, 0, 8, 8), render_target);
+		renderer->SetOpacity(1.f);
+		renderer->EndPaint();
+		TB_VERIFY(PixelNear(Pixel(11, 11), 0xff00007f));
+		// Transparent in the render target.
+		TB_VERIFY(Pixel(16, 16) == 0xff000000);
+		delete render_target;
+		delete bitmap;
+	}
+
+	TB_TEST(set_data_rect)
+	{
+		uint32_t data[4] = { 0xff000000, 0xff000000, 0xff000000, 0xff000000 };
+		TBBitmapSoftware *bitmap = static_cast<TBBitmapSoftware *>(renderer->CreateBitmap(2, 2, data));
+		uint32_t new_data[4] = { 0xffffffff, 0, 0xff0000ff, 0 };
+		TB_VERIFY(bitmap->SetDataRect(TBRect(1, 0, 1, 2), new_data, 2));
+		TB_VERIFY(bitmap->m_data[0] == 0xff000000);
+		TB_VERIFY(bitmap->m_data[1] == 0xffffffff);
+		TB_VERIFY(bitmap->m_data[2] == 0xff000000);
+		TB_VERIFY(bitmap->m_data[3] == 0xff0000ff);
+		delete bitmap;
+	}
+
+	TB_TEST(fragment_map_partial_update)
+	{
+		// Fragment maps create their bitmaps with g_renderer.
+		TBRenderer *old_renderer = g_renderer;
+		g_renderer = renderer;
+
+		TBBitmapFragmentManager manager;
+		manager.SetDefaultMapSize(64, 64);
+		uint32_t data_a[4] = { 0xff0000ff, 0xff0000ff, 0xff0000ff, 0xff0000ff };
+		TBBitmapFragment *frag_a = manager.CreateNewFragment(TBIDC("a"), false, 2, 2, 2, data_a);
+		TBBitmapSoftware *bitmap = static_cast<TBBitmapSoftware *>(frag_a->GetBitmap());
+
+		// Only the area of the new fragment should be updated, so
+		// a pixel changed elsewhere in the bitmap is left alone.
+		bitmap->m_data[63 * 64 + 63] = 0x12345678;
+		uint32_t data_b[4] = { 0xff00ff00, 0xff00ff00, 0xff00ff00, 0xff00ff00 };
+		TBBitmapFragment *frag_b = manager.CreateNewFragment(TBIDC("b"), false, 2, 2, 2, data_b);
+		TB_VERIFY(frag_b->GetBitmap() == bitmap);
+		TB_VERIFY(bitmap->m_data[63 * 64 + 63] == 0x12345678);
+		TB_VERIFY(bitmap->m_data[frag_a->m_rect.y * 64 + frag_a->m_rect.x] == 0xff0000ff);
+		TB_VERIFY(bitmap->m_data[frag_b->m_rect.y * 64 + frag_b->m_rect.x] == 0xff00ff00);
+
+		manager.Clear();
+		g_renderer = old_renderer;
+	}
+
+	TB_TEST(alpha_bitmap)
+	{
+		uint8_t data[2] = { 0xff, 0x80 };
+		TBBitmap *bitmap = renderer->CreateBitmapFormat(2, 1, TB_BITMAP_FORMAT_A8, data);
+		TB_VERIFY(bitmap->GetFormat() == TB_BITMAP_FORMAT_A8);
+		// Painted as white with the alpha, multiplied with the color.
+		renderer->DrawBitmapColored(TBRect(0, 0, 2, 1), TBRect(0, 0, 2, 1), TBColor(255, 0, 0, 255), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(Pixel(0, 0) == 0xff0000ff);
+		TB_VERIFY(PixelNear(Pixel(1, 0), 0xff000080));
+		delete bitmap;
+	}
+
+	TB_TEST(sdf_bitmap)
+	{
+		uint8_t data[4] = { 0, TB_SDF8_EDGE, TB_SDF8_EDGE + TB_SDF8_STEPS_PER_TEXEL / 2, 255 };
+		TBBitmap *bitmap = renderer->CreateBitmapFormat(4, 1, TB_BITMAP_FORMAT_SDF8, data);
+		TB_VERIFY(bitmap->GetFormat() == TB_BITMAP_FORMAT_SDF8);
+		// Drawn 1:1, the alpha ramps from 0 to 255 over the texel around the edge.
+		renderer->DrawBitmapColored(TBRect(0, 0, 4, 1), TBRect(0, 0, 4, 1), TBColor(255, 0, 0, 255), bitmap);
+		renderer->EndPaint();
+		TB_VERIFY(Pixel(0, 0) == 0xff000000);
+		TB_VERIFY(PixelNear(Pixel(1, 0), 0xff000080));
+		TB_VERIFY(Pixel(2, 0) == 0xff0000ff);
+		TB_VERIFY(Pixel(3, 0) == 0xff0000ff);
+		delete bitmap;
+	}
+
+	TB_TEST(fragment_map_alpha)
+	{
+		TBRenderer *old_renderer = g_renderer;
+		g_renderer = renderer;
+
+		TBBitmapFragmentManager manager;
+		manager.SetFormat(TB_BITMAP_FORMAT_A8);
+		manager.SetDefaultMapSize(64, 64);
+		manager.SetAddBorder(true);
+		uint8_t data[6] = { 1, 2, 3, 4, 5, 6 };
+		TBBitmapFragment *frag = manager.CreateNewFragment(TBIDC("a"), false, 2, 2, 3, data);
+		TBBitmapSoftware *bitmap = static_cast<TBBitmapSoftware *>(frag->GetBitmap());
+		TB_VERIFY(frag->GetFormat() == TB_BITMAP_FORMAT_A8);
+		TB_VERIFY(bitmap->m_data8 && !bitmap->m_data);
+		const uint8_t *p = bitmap->m_data8 + frag->m_rect.y * 64 + frag->m_rect.x;
+		TB_VERIFY(p[0] == 1 && p[1] == 2 && p[64] == 4 && p[65] == 5);
+		// The border is transparent.
+		TB_VERIFY(p[-1] == 0 && p[2] == 0 && p[-64] == 0 && p[128] == 0);
+
+		manager.Clear();
+		g_renderer = old_renderer;
+	}
+}
+
+TB_TEST_GROUP(tb_renderer_software_tiled)
+{
+	static const int W = 200;
+	static const int H = 150;
+
+	uint32_t expected[W * H];
+	uint32_t framebuffer[W * H];
+
+	/** Paint overlapping, blended, flipped and clipped quads across many tiles. */
+	void PaintScene(TBRendererSoftware *renderer, uint32_t *pixels)
+	{
+		for (int i = 0; i < W * H; i++)
+			pixels[i] = 0xff000000;
+		renderer->SetFramebuffer(pixels, W, H, W);
+		renderer->BeginPaint(W, H);
+
+		uint32_t data[4] = { 0x800000ff, 0xff00ff00, 0x40ff0000, 0xffffffff };
+		TBBitmap *bitmap = renderer->CreateBitmap(2, 2, data);
+		uint32_t solid_data = 0xc0ffffff;
+		TBBitmap *solid = renderer->CreateBitmap(1, 1, &solid_data);
+		for (int i = 0; i < 40; i++)
+		{
+			TBRect dst(i * 7 - 20, i * 5 - 10, 30 + i * 3, 20 + i * 2);
+			if (i & 1)
+				dst = TBRect(dst.x + dst.w, dst.y, -dst.w, dst.h);
+			renderer->DrawBitmapColored(dst, TBRect(0, 0, 2, 2), TBColor(255, i * 6, 255 - i * 6, 200), bitmap);
+			renderer->DrawBitmapColored(dst.Shrink(4, 4), TBRect(0, 0, 1, 1), TBColor(i * 6, 255, 0, 128), solid);
+		}
+
+		TBRect old_clip_rect = renderer->SetClipRect(TBRect(30, 40, 100, 70), false);
+		renderer->DrawBitmapTile(TBRect(0, 0, W, H), bitmap);
+		renderer->SetClipRect(old_clip_rect, false);
+
+		TBBitmap *render_target = renderer->CreateRenderTarget(70, 70);
+		renderer->BeginRenderTarget(render_target);
+		renderer->DrawBitmap(TBRect(5, 5, 60, 60), TBRect(0, 0, 2, 2), bitmap);
+		renderer->EndRenderTarget();
+		renderer->SetOpacity(0.5f);
+		renderer->DrawRenderTarget(TBRect(100, 60, 70, 70), TBRect(0, 0, 70, 70), render_target);
+		renderer->SetOpacity(1.f);
+
+		// A render target wider than the framebuffer.
+		TBBitmap *wide_render_target = renderer->CreateRenderTarget(W + 60, 20);
+		renderer->BeginRenderTarget(wide_render_target);
+		renderer->DrawBitmap(TBRect(0, 0, W + 60, 20), TBRect(0, 0, 2, 2), bitmap);
+		renderer->EndRenderTarget();
+		renderer->DrawRenderTarget(TBRect(10, 120, W - 20, 20), TBRect(40, 0, W - 20, 20), wide_render_target);
+
+		// Changing the bitmap must not affect what is already drawn.
+		uint32_t new_data[4] = { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff };
+		bitmap->SetData(new_data);
+		renderer->DrawBitmap(TBRect(150, 10, 20, 20), TBRect(0, 0, 2, 2), bitmap);
+
+		renderer->EndPaint();
+		delete wide_render_target;
+		delete render_target;
+		delete solid;
+		delete bitmap;
+	}
+
+	bool PaintTiled(int num_threads)
+	{
+		TBRendererSoftwareTiled renderer;
+		renderer.SetNumThreads(num_threads);
+		PaintScene(&renderer, framebuffer);
+		return memcmp(expected, framebuffer, sizeof(framebuffer)) == 0;
+	}
+
+	TB_TEST(Init)
+	{
+		TBRendererSoftware renderer;
+		PaintScene(&renderer, expected);
+	}
+
+	TB_TEST(single_thread)
+	{
+		TB_VERIFY(PaintTiled(1));
+	}
+
+	TB_TEST(multiple_threads)
+	{
+		TB_VERIFY(PaintTiled(2));
+		TB_VERIFY(PaintTiled(5));
+	}
+
+	TB_TEST(flush_bitmap)
+	{
+		TBRendererSoftwareTiled renderer;
+		renderer.SetNumThreads(2);
+		for (int i = 0; i < W * H; i++)
+			framebuffer[i] = 0xff000000;
+		renderer.SetFramebuffer(framebuffer, W, H, W);
+		renderer.BeginPaint(W, H);
+		uint32_t data = 0xffffffff;
+		TBBitmap *used = renderer.CreateBitmap(1, 1, &data);
+		TBBitmap *unused = renderer.CreateBitmap(1, 1, &data);
+		renderer.DrawBitmap(TBRect(0, 0, 10, 10), TBRect(0, 0, 1, 1), used);
+		renderer.FlushBitmap(used);
+		TB_VERIFY(framebuffer[0] == 0xffffffff);
+
+		// Changing a bitmap that isn't used by any binned quad doesn't paint them.
+		renderer.DrawBitmap(TBRect(10, 0, 10, 10), TBRect(0, 0, 1, 1), used);
+		unused->SetData(&data);
+		TB_VERIFY(framebuffer[10] == 0xff000000);
+
+		renderer.EndPaint();
+		TB_VERIFY(framebuffer[10] == 0xffffffff);
+		delete unused;
+		delete used;
+	}
+
+	TB_TEST(many_frames)
+	{
+		TBRendererSoftwareTiled renderer;
+		renderer.SetNumThreads(4);
+		for (int i = 0; i < 10; i++)
+		{
+			PaintScene(&renderer, framebuffer);
+			TB_VERIFY(memcmp(expected, framebuffer, sizeof(framebuffer)) == 0);
+		}
+	}
+}
+
+#endif // TB_UNIT_TESTING && TB_RENDERER_SOFTWARE
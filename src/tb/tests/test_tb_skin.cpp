@@ -0,0 +1,163 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "tb_test.h"
+#include "tb_skin.h"
+#include "tb_renderer.h"
+#include "tb_tempbuffer.h"
+#include <stdio.h>
+
+#ifdef TB_UNIT_TESTING
+
+using namespace tb;
+
+TB_TEST_GROUP(tb_skin)
+{
+	TBStr skin_file;
+	const char *image_files[3] = { "test_tb_skin_a.ppm", "test_tb_skin_b.ppm", "test_tb_skin_c.ppm" };
+
+	/** Return true if the skin has loaded the image file with the given index. */
+	bool IsLoaded(TBSkin &skin, int index)
+	{
+		TBTempBuffer filename;
+		filename.AppendPath(skin_file.CStr());
+		filename.AppendString(image_files[index]);
+		return skin.GetFragmentManager()->GetFragment(TBID(filename.GetData())) != nullptr;
+	}
+
+	TB_TEST(Init)
+	{
+		skin_file = TB_TEST_FILE("test_tb_skin.tmp.tb.txt");
+		TBTempBuffer path;
+		path.AppendPath(skin_file.CStr());
+		for (int i = 0; i < 3; i++)
+		{
+			TBStr filename;
+			filename.SetFormatted("%s%s", path.GetData(), image_files[i]);
+			TB_VERIFY(tb_write_test_image_file(filename, 8 + i, 8, 255, 255, 255));
+		}
+		FILE *f = fopen(skin_file.CStr(), "wb");
+		TB_VERIFY(f);
+		fputs("elements\n"
+			  "\tLazy\n"
+			  "\t\tbitmap test_tb_skin_a.ppm\n"
+			  "\t\tchildren\n"
+			  "\t\t\telement Lazy.child\n"
+			  "\tLazy.child\n"
+			  "\t\tbitmap test_tb_skin_b.ppm\n"
+			  "\tUnused\n"
+			  "\t\tbitmap test_tb_skin_c.ppm\n"
+			  "\tMissing\n"
+			  "\t\tbitmap test_tb_skin_missing.ppm\n"
+			  "\tExpand\n"
+			  "\t\texpand -1\n"
+			  "\t\toverlays\n"
+			  "\t\t\telement Expand.overlay\n"
+			  "\t\t\t\tstate all\n"
+			  "\tExpand.overlay\n"
+			  "\t\texpand 3\n", f);
+		fclose(f);
+	}
+
+	TB_TEST(load_all)
+	{
+		TBSkin skin;
+		TB_VERIFY(!skin.Load(skin_file)); // Missing a bitmap
+		for (int i = 0; i < 3; i++)
+			TB_VERIFY(IsLoaded(skin, i));
+	}
+
+	TB_TEST(load_lazy)
+	{
+		TBSkin skin;
+		skin.SetLazyBitmapLoading(true);
+		TB_VERIFY(skin.Load(skin_file));
+		for (int i = 0; i < 3; i++)
+			TB_VERIFY(!IsLoaded(skin, i));
+
+		// Getting an element without loading its bitmap is for geometry queries.
+		TB_VERIFY(skin.GetSkinElement(TBIDC("Lazy"), false));
+		TB_VERIFY(!IsLoaded(skin, 0));
+
+		// Getting an element loads only its own bitmap.
+		TBSkinElement *element = skin.GetSkinElement(TBIDC("Lazy"));
+		TB_VERIFY(element && element->bitmap && element->bitmap->Width() == 8);
+		TB_VERIFY(element->GetIntrinsicWidth() == 8);
+		TB_VERIFY(IsLoaded(skin, 0) && !IsLoaded(skin, 1) && !IsLoaded(skin, 2));
+
+		TB_VERIFY(!skin.GetSkinElement(TBIDC("Missing"))->bitmap);
+
+		// Reloading unloads them until they're used again.
+		TB_VERIFY(skin.ReloadBitmaps());
+		TB_VERIFY(!IsLoaded(skin, 0));
+		TB_VERIFY(skin.GetSkinElement(TBIDC("Lazy"))->bitmap);
+	}
+
+	TB_TEST(prefetch)
+	{
+		TBSkin skin;
+		skin.SetLazyBitmapLoading(true);
+		TB_VERIFY(skin.Load(skin_file));
+
+		// Prefetching an element loads the elements it refers to as well.
+		TBID skin_ids[2] = { TBIDC("Lazy"), TBIDC("NotInSkin") };
+		TB_VERIFY(skin.PrefetchBitmaps(skin_ids, 2));
+		TB_VERIFY(IsLoaded(skin, 0) && IsLoaded(skin, 1) && !IsLoaded(skin, 2));
+
+		skin_ids[0] = TBIDC("Missing");
+		TB_VERIFY(!skin.PrefetchBitmaps(skin_ids, 1));
+	}
+
+	TB_TEST(reload_display_list)
+	{
+		TBDisplayList *display_list = g_renderer->CreateDisplayList();
+		if (!display_list)
+			return; // The renderer doesn't support display lists.
+		TBSkin skin;
+		skin.SetLazyBitmapLoading(true);
+		TB_VERIFY(skin.Load(skin_file));
+		TBSkinElement *element = skin.GetSkinElement(TBIDC("Lazy"));
+		TB_VERIFY(element && element->bitmap);
+
+		g_renderer->BeginPaint(100, 100);
+		TB_VERIFY(g_renderer->BeginRecording(display_list, TBRect(0, 0, 100, 100)));
+		g_renderer->DrawBitmap(TBRect(0, 0, 8, 8), TBRect(0, 0, 8, 8), element->bitmap);
+		g_renderer->EndRecording();
+
+		// Reloading deletes the bitmaps and fragments the list refers to, so it can't be used.
+		TB_VERIFY(skin.ReloadBitmaps());
+		TB_VERIFY(!g_renderer->PaintDisplayList(display_list));
+		g_renderer->EndPaint();
+		delete display_list;
+	}
+
+	TB_TEST(paint_expand)
+	{
+		TBSkin skin;
+		skin.SetLazyBitmapLoading(true);
+		TB_VERIFY(skin.Load(skin_file));
+
+		// The overlay paints further outside than the element itself.
+		TB_VERIFY(skin.GetPaintExpand(TBIDC("Expand")) == 3);
+		TB_VERIFY(skin.GetPaintExpand(TBIDC("Lazy")) == 0);
+		TB_VERIFY(skin.GetPaintExpand(TBIDC("NotInSkin")) == 0);
+		TB_VERIFY(!IsLoaded(skin, 0));
+	}
+
+	TB_TEST(Shutdown)
+	{
+		TBTempBuffer path;
+		path.AppendPath(skin_file.CStr());
+		for (int i = 0; i < 3; i++)
+		{
+			TBStr filename;
+			filename.SetFormatted("%s%s", path.GetData(), image_files[i]);
+			remove(filename.CStr());
+		}
+		remove(skin_file.CStr());
+	}
+}
+
+#endif // TB_UNIT_TESTING
@@ -5,6 +5,7 @@
 
 #include "tb_test.h"
 #include "tb_bitmap_fragment.h"
+#include <stdio.h>
 
 #ifdef TB_UNIT_TESTING
 
@@ -125,6 +126,243 @@ TB_TEST_GROUP(tb_space_allocator)
 		s5 = spa.AllocSpace(10);
 		TB_VERIFY(s1 && s3 && s5); // We should have 3 * 10 spaces though.
 	}
+
+	/** Return true if the live fragments are inside the map and don't overlap. */
+	bool FragmentsAreValid(TBBitmapFragment *frags, int num_frags, int map_w, int map_h)
+	{
+		for (int i = 0; i < num_frags; i++)
+		{
+			const TBRect &rect = frags[i].m_alloc_rect;
+			if (rect.IsEmpty())
+				continue;
+			if (rect.x < 0 || rect.y < 0 || rect.x + rect.w > map_w || rect.y + rect.h > map_h)
+				return false;
+			for (int j = i + 1; j < num_frags; j++)
+				if (rect.Intersects(frags[j].m_alloc_rect))
+					return false;
+		}
+		return true;
+	}
+
+	TB_TEST(skyline_fill_and_free)
+	{
+		TBFragmentPackerSkyline packer(64, 64);
+		TB_VERIFY(packer.Init());
+		TBBitmapFragment frags[16];
+		for (int i = 0; i < 16; i++)
+			TB_VERIFY(packer.AllocSpace(&frags[i], 16, 16));
+		TBBitmapFragment frag;
+		TB_VERIFY(!packer.AllocSpace(&frag, 1, 1));
+		TB_VERIFY(FragmentsAreValid(frags, 16, 64, 64));
+
+		// Free all but the last (bottom right), in an order that leaves freed
+		// space both on and below the skyline. All of it should be usable.
+		for (int i = 0; i < 15; i++)
+			packer.FreeSpace(&frags[(i * 7) % 15]);
+		TB_VERIFY(packer.AllocSpace(&frag, 48, 64));
+		TB_VERIFY(packer.AllocSpace(&frags[0], 16, 48));
+		TB_VERIFY(!packer.AllocSpace(&frags[1], 1, 1));
+	}
+	TB_TEST(skyline_use_waste)
+	{
+		TBFragmentPackerSkyline packer(64, 64);
+		TB_VERIFY(packer.Init());
+		TBBitmapFragment a, b, c, d;
+		TB_VERIFY(packer.AllocSpace(&a, 32, 10));
+		TB_VERIFY(packer.AllocSpace(&b, 32, 30));
+		// c is placed below b, which leaves the space below a unused.
+		TB_VERIFY(packer.AllocSpace(&c, 64, 10));
+		TB_VERIFY(c.m_alloc_rect.Equals(TBRect(0, 30, 64, 10)));
+		TB_VERIFY(packer.AllocSpace(&d, 30, 20));
+		TB_VERIFY(d.m_alloc_rect.Equals(TBRect(0, 10, 30, 20)));
+
+		// Freeing c and d should give back all space below a and b.
+		packer.FreeSpace(&d);
+		packer.FreeSpace(&c);
+		packer.FreeSpace(&a);
+		TB_VERIFY(packer.AllocSpace(&a, 32, 64));
+		TB_VERIFY(packer.AllocSpace(&c, 32, 34));
+	}
+	void TestPackerChurn(TB_FRAGMENT_PACKER type)
+	{
+		const int num_frags = 200;
+		TBFragmentPacker *packer = TBFragmentPacker::Create(type, 256, 256);
+		TB_VERIFY(packer);
+		TBBitmapFragment frags[num_frags];
+		uint32_t seed = 1;
+		for (int i = 0; i < 2000; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			TBBitmapFragment &frag = frags[(seed >> 8) % num_frags];
+			if (frag.m_alloc_rect.IsEmpty())
+			{
+				if (!packer->AllocSpace(&frag, 4 + (seed >> 12) % 40, 4 + (seed >> 20) % 40))
+					frag.m_alloc_rect = TBRect();
+			}
+			else
+			{
+				packer->FreeSpace(&frag);
+				frag.m_alloc_rect = TBRect();
+			}
+		}
+		TB_VERIFY(FragmentsAreValid(frags, num_frags, 256, 256));
+		for (int i = 0; i < num_frags; i++)
+			if (!frags[i].m_alloc_rect.IsEmpty())
+				packer->FreeSpace(&frags[i]);
+		TBBitmapFragment frag;
+		TB_VERIFY(packer->AllocSpace(&frag, 256, 256));
+		delete packer;
+	}
+	TB_TEST(rows_churn) { TestPackerChurn(TB_FRAGMENT_PACKER_ROWS); }
+	TB_TEST(skyline_churn) { TestPackerChurn(TB_FRAGMENT_PACKER_SKYLINE); }
+
+	void TestMapCompact(TB_FRAGMENT_PACKER type)
+	{
+		TBBitmapFragmentMap map;
+		TB_VERIFY(map.Init(64, 64, TB_BITMAP_FORMAT_RGBA32, type));
+
+		// Fill the map with 16x16 fragments of different colors, and free every other.
+		// The data is large enough for the 64x32 fragments created later too.
+		uint32_t data[64 * 32];
+		TBBitmapFragment *frags[16];
+		for (int i = 0; i < 16; i++)
+		{
+			for (int j = 0; j < 16 * 16; j++)
+				data[j] = i * 0x01010101;
+			frags[i] = map.CreateNewFragment(16, 16, 16, data, false);
+			TB_VERIFY(frags[i]);
+		}
+		TBListOf<TBBitmapFragment> live_frags;
+		for (int i = 0; i < 16; i++)
+		{
+			if ((i + i / 4) % 2)
+			{
+				map.FreeFragmentSpace(frags[i]);
+				delete frags[i];
+				frags[i] = nullptr;
+			}
+			else
+				live_frags.Add(frags[i]);
+		}
+		TB_VERIFY(!map.CreateNewFragment(64, 32, 64, data, false));
+
+		TB_VERIFY(map.Compact(live_frags));
+		for (int i = 0; i < 16; i++)
+		{
+			if (!frags[i])
+				continue;
+			// The fragment moved with its data.
+			frags[i]->CopyData(data);
+			TB_VERIFY(data[0] == i * 0x01010101u && data[16 * 16 - 1] == i * 0x01010101u);
+			TB_VERIFY(frags[i]->m_rect.Equals(frags[i]->m_alloc_rect));
+			for (int j = i + 1; j < 16; j++)
+				TB_VERIFY(!frags[j] || !frags[i]->m_rect.Intersects(frags[j]->m_rect));
+		}
+		TB_VERIFY(map.GetAllocatedPixels() == 8 * 16 * 16);
+
+		// All the free space is gathered now.
+		TBBitmapFragment *frag = map.CreateNewFragment(64, 32, 64, data, false);
+		TB_VERIFY(frag);
+		map.FreeFragmentSpace(frag);
+		delete frag;
+		for (int i = 0; i < 16; i++)
+			if (frags[i])
+			{
+				map.FreeFragmentSpace(frags[i]);
+				delete frags[i];
+			}
+	}
+	TB_TEST(rows_compact) { TestMapCompact(TB_FRAGMENT_PACKER_ROWS); }
+	TB_TEST(skyline_compact) { TestMapCompact(TB_FRAGMENT_PACKER_SKYLINE); }
+
+	TB_TEST(save_maps)
+	{
+		const TBStr filename = TB_TEST_FILE("test_tb_space_allocator.tmp");
+		uint32_t data[20 * 10];
+		{
+			TBBitmapFragmentManager frag_manager;
+			frag_manager.SetAddBorder(true);
+			for (int i = 0; i < 20; i++)
+			{
+				for (int j = 0; j < 20 * 10; j++)
+					data[j] = i * 0x01010101;
+				TB_VERIFY(frag_manager.CreateNewFragment(i + 1, false, 10 + i % 10, 10, 20, data));
+			}
+			TB_VERIFY(frag_manager.CreateNewFragment(100, true, 20, 10, 20, data));
+			TB_VERIFY(frag_manager.GetNumMaps() == 2);
+			TB_VERIFY(frag_manager.SaveMaps(filename, 123));
+		}
+
+		TBBitmapFragmentManager frag_manager;
+		TB_VERIFY(!frag_manager.LoadSavedMaps(filename, 124));
+		TB_VERIFY(!frag_manager.LoadSavedMaps(filename, 123)); // Without border
+		frag_manager.SetAddBorder(true);
+		TB_VERIFY(frag_manager.LoadSavedMaps(filename, 123));
+		TB_VERIFY(frag_manager.GetNumMaps() == 2);
+		for (int i = 0; i < 20; i++)
+		{
+			TBBitmapFragment *frag = frag_manager.GetFragment(i + 1);
+			TB_VERIFY(frag && frag->Width() == 10 + i % 10 && frag->Height() == 10);
+			frag->CopyData(data);
+			TB_VERIFY(data[0] == i * 0x01010101u && data[frag->Width() * 10 - 1] == i * 0x01010101u);
+		}
+		TB_VERIFY(frag_manager.GetFragment(100)->Width() == 20);
+
+		// New fragments get space next to the loaded ones.
+		TB_VERIFY(frag_manager.CreateNewFragment(101, false, 20, 10, 20, data));
+		TB_VERIFY(frag_manager.GetNumMaps() == 2);
+		remove(filename.CStr());
+	}
+
+	TB_TEST(fragments_from_files)
+	{
+		const int num_images = 8;
+		TBStr filenames[num_images];
+		for (int i = 0; i < num_images; i++)
+		{
+			filenames[i].SetFormatted("%s%d.ppm", TB_TEST_FILE("test_tb_space_allocator").CStr(), i);
+			TB_VERIFY(tb_write_test_image_file(filenames[i], 4 + i, 3, (uint8_t) (i * 10), 1, 2));
+		}
+		// All images, one of them twice, and one that doesn't exist.
+		TBBitmapFragmentFile files[num_images + 2];
+		for (int i = 0; i < num_images; i++)
+			files[i].filename.Set(filenames[i]);
+		files[num_images].filename.Set(filenames[0]);
+		files[num_images + 1].filename.Set(TB_TEST_FILE("test_tb_space_allocator_missing.ppm"));
+
+		TBBitmapFragmentManager frag_manager;
+		frag_manager.SetNumDecodeThreads(4);
+		TB_VERIFY(!frag_manager.GetFragmentsFromFiles(files, num_images + 2));
+		TB_VERIFY(!files[num_images + 1].fragment);
+		TB_VERIFY(files[num_images].fragment == files[0].fragment);
+		uint32_t data[11 * 3];
+		for (int i = 0; i < num_images; i++)
+		{
+			TBBitmapFragment *frag = files[i].fragment;
+			TB_VERIFY(frag && frag == frag_manager.GetFragment(TBID(filenames[i])));
+			TB_VERIFY(frag->Width() == 4 + i && frag->Height() == 3);
+			frag->CopyData(data);
+			TB_VERIFY(data[0] == (0xff020100u | (i * 10)) && data[frag->Width() * 3 - 1] == data[0]);
+		}
+
+		// Fragments are placed in the given order, not the order the files were decoded in.
+		TBBitmapFragmentManager frag_manager_single;
+		frag_manager_single.SetNumDecodeThreads(1);
+		TBBitmapFragmentFile single_files[num_images];
+		for (int i = 0; i < num_images; i++)
+			single_files[i].filename.Set(filenames[i]);
+		TB_VERIFY(frag_manager_single.GetFragmentsFromFiles(single_files, num_images));
+		for (int i = 0; i < num_images; i++)
+			TB_VERIFY(single_files[i].fragment->m_rect.Equals(files[i].fragment->m_rect));
+
+		// Loaded files are not loaded again.
+		TB_VERIFY(frag_manager.GetFragmentsFromFiles(files, num_images));
+		for (int i = 0; i < num_images; i++)
+			TB_VERIFY(files[i].fragment == frag_manager.GetFragment(TBID(filenames[i])));
+
+		for (int i = 0; i < num_images; i++)
+			remove(filenames[i].CStr());
+	}
 }
 
 #endif // TB_UNIT_TESTING
@@ -0,0 +1,211 @@
+// ================================================================================
+// ==      This file is a part of Turbo Badger. (C) 2011-2014, Emil Segerås      ==
+// ==                     See tb_core.h for more information.                    ==
+// ================================================================================
+
+#include "tb_test.h"
+#include "tb_widgets.h"
+#include "tb_renderer.h"
+
+#ifdef TB_UNIT_TESTING
+
+using namespace tb;
+
+TB_TEST_GROUP(tb_widgets_damage)
+{
+	/** Widget that scrolls its children by a fixed offset. */
+	class ScrollingWidget : public TBWidget
+	{
+	public:
+		virtual void GetChildTranslation(int &x, int &y) const { x = -100; y = 0; }
+	};
+
+	TBWidget *root;
+	TBWidget *parent;
+	TBWidget *child;
+	TBRegion damage;
+
+	TB_TEST(Setup)
+	{
+		root = new TBWidget;
+		root->SetIsDamageRoot(true);
+		root->SetRect(TBRect(0, 0, 1000, 1000));
+		parent = new ScrollingWidget;
+		parent->SetRect(TBRect(100, 100, 500, 500));
+		root->AddChild(parent);
+		child = new TBWidget;
+		child->SetRect(TBRect(200, 10, 50, 50));
+		parent->AddChild(child);
+		root->TakeDamage(damage);
+	}
+	TB_TEST(Cleanup)
+	{
+		delete root;
+	}
+
+	TB_TEST(initial_damage)
+	{
+		TBWidget widget;
+		widget.SetRect(TBRect(10, 10, 100, 100));
+		widget.SetIsDamageRoot(true);
+		TB_VERIFY(widget.TakeDamage(damage));
+		TB_VERIFY(damage.GetNumRects() == 1);
+		TB_VERIFY(damage.GetRect(0).Equals(TBRect(0, 0, 100, 100)));
+		TB_VERIFY(!widget.TakeDamage(damage));
+		TB_VERIFY(damage.IsEmpty());
+	}
+
+	TB_TEST(invalidate_child)
+	{
+		child->Invalidate();
+		TB_VERIFY(root->TakeDamage(damage));
+		TB_VERIFY(damage.GetNumRects() == 1);
+		// Offset by the parent position and child translation.
+		TB_VERIFY(damage.GetRect(0).Equals(TBRect(200, 110, 50, 50)));
+	}
+
+	TB_TEST(invalidate_rect)
+	{
+		child->Invalidate(TBRect(5, 5, 10, 10));
+		child->Invalidate(TBRect(5, 5, 5, 5));
+		TB_VERIFY(root->TakeDamage(damage));
+		TB_VERIFY(damage.GetNumRects() == 1);
+		TB_VERIFY(damage.GetRect(0).Equals(TBRect(205, 115, 10, 10)));
+	}
+
+	TB_TEST(clipped_to_root)
+	{
+		root->Invalidate(TBRect(900, -100, 200, 200));
+		TB_VERIFY(root->TakeDamage(damage));
+		TB_VERIFY(damage.GetRect(0).Equals(TBRect(900, 0, 100, 100)));
+
+		root->Invalidate(TBRect(-100, 0, 50, 50));
+		TB_VERIFY(!root->TakeDamage(damage));
+	}
+
+	TB_TEST(invisible)
+	{
+		child->SetVisibility(WIDGET_VISIBILITY_INVISIBLE);
+		root->TakeDamage(damage);
+		child->Invalidate();
+		TB_VERIFY(!root->TakeDamage(damage));
+		child->SetVisibility(WIDGET_VISIBILITY_VISIBLE);
+	}
+
+	TB_TEST(move)
+	{
+		// Both the old and the new area is damaged.
+		child->SetRect(TBRect(300, 10, 50, 50));
+		TB_VERIFY(root->TakeDamage(damage));
+		TB_VERIFY(damage.GetNumRects() == 2);
+		TB_VERIFY(damage.GetRect(0).Equals(TBRect(200, 110, 50, 50)));
+		TB_VERIFY(damage.GetRect(1).Equals(TBRect(300, 110, 50, 50)));
+	}
+
+	TB_TEST(merge_fragmented)
+	{
+		for (int i = 0; i < 20; i++)
+			root->Invalidate(TBRect(i * 20, 0, 10, 10));
+		TB_VERIFY(root->TakeDamage(damage));
+		TB_VERIFY(damage.GetNumRects() < 20);
+		TBRect bounds;
+		for (int i = 0; i < damage.GetNumRects(); i++)
+			bounds = bounds.Union(damage.GetRect(i));
+		TB_VERIFY(bounds.Equals(TBRect(0, 0, 390, 10)));
+	}
+}
+
+TB_TEST_GROUP(tb_widgets_display_list)
+{
+	/** Widget that counts how many times it's painted. */
+	class PaintCountWidget : public TBWidget
+	{
+	public:
+		virtual void OnPaint(const PaintProps & /*paint_props*/) { paint_count++; }
+		int paint_count = 0;
+	};
+
+	TBWidget *root;
+	PaintCountWidget *parent;
+	PaintCountWidget *child;
+
+	void Paint()
+	{
+		g_renderer->BeginPaint(root->GetRect().w, root->GetRect().h);
+		root->InvokePaint(TBWidget::PaintProps());
+		g_renderer->EndPaint();
+	}
+
+	TB_TEST(Setup)
+	{
+		root = new TBWidget;
+		root->SetRect(TBRect(0, 0, 1000, 1000));
+		parent = new PaintCountWidget;
+		parent->SetRect(TBRect(100, 100, 500, 500));
+		parent->SetUseDisplayList(true);
+		root->AddChild(parent);
+		child = new PaintCountWidget;
+		child->SetRect(TBRect(10, 10, 50, 50));
+		parent->AddChild(child);
+	}
+	TB_TEST(Cleanup)
+	{
+		delete root;
+		TBWidget::display_lists_enabled = true;
+	}
+
+	TB_TEST(replay)
+	{
+		TBDisplayList *display_list = g_renderer->CreateDisplayList();
+		if (!display_list)
+			return; // The renderer doesn't support display lists.
+		delete display_list;
+
+		Paint();
+		Paint();
+		TB_VERIFY(parent->paint_count == 1);
+		TB_VERIFY(child->paint_count == 1);
+
+		// Invalidating a child records the list again.
+		child->Invalidate();
+		Paint();
+		TB_VERIFY(parent->paint_count == 2);
+		TB_VERIFY(child->paint_count == 2);
+
+		// Moving or fading the widget with the list doesn't.
+		parent->SetRect(TBRect(200, 100, 500, 500));
+		parent->SetOpacity(0.5f);
+		Paint();
+		TB_VERIFY(parent->paint_count == 2);
+
+		// Resizing it does.
+		parent->SetRect(TBRect(200, 100, 400, 500));
+		Paint();
+		TB_VERIFY(parent->paint_count == 3);
+	}
+
+	TB_TEST(child_outside)
+	{
+		TBDisplayList *display_list = g_renderer->CreateDisplayList();
+		if (!display_list)
+			return; // The renderer doesn't support display lists.
+		delete display_list;
+
+		// A child outside the widget with the list is still painted, as without a list.
+		child->SetRect(TBRect(-60, -60, 50, 50));
+		Paint();
+		TB_VERIFY(parent->paint_count == 1);
+		TB_VERIFY(child->paint_count == 1);
+	}
+
+	TB_TEST(disabled)
+	{
+		TBWidget::display_lists_enabled = false;
+		Paint();
+		Paint();
+		TB_VERIFY(parent->paint_count == 2);
+		TB_VERIFY(parent->GetUseDisplayList());
+	}
+}
+
+#endif // TB_UNIT_TESTING